@@ -13,11 +13,13 @@
 #include <stdlib.h>
 #include <sys/time.h>
 #include <string.h>
+#include <pthread.h>
 
 // Project includes
 #include <cmpsc311_log.h>
 #include <cmpsc311_util.h>
 #include <raid_cache.h>
+#include <raid_pool.h>
 
 
 //Global Variables
@@ -32,22 +34,35 @@ int hit = 0, miss = 0, insert = 0, get = 0;
 uint64_t timea = 0;
 uint64_t oldestTime = 0;
 
+//The application fills the cache, the references it was handed may be
+//released from any thread
+pthread_mutex_t cacheLock = PTHREAD_MUTEX_INITIALIZER;
+
 
 //Structures
 
-//Cache structure
+//Cache structure. A slot referenced by the application (pinned) is never
+//reused or written; if its block changes it stops being valid and the block
+//goes to another slot.
 struct cache
 {
 	char *data;
 	uint64_t timestamp;
 	RAIDDiskID disk;
 	RAIDBlockID block;
+	int valid;
+	int pins;
 };
 
 //Global Pointer for cacheArray
 struct cache *cacheArray;
 
 
+//Functions Prototypes
+int find_raid_cache_slot(RAIDDiskID, RAIDBlockID);
+int lookup_raid_cache_slot(RAIDDiskID, RAIDBlockID);
+
+
 // TAGLINE Cache interface
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -71,14 +86,16 @@ int init_raid_cache(uint32_t max_items) {
 		return (-1);
 
 	for (i=0; i<glob_max_items; i++){
-		//Allocate for each block
-		cacheArray[i].data = (char *) malloc(RAID_BLOCK_SIZE);
+		//Take a block buffer from the pool for each slot
+		cacheArray[i].data = (char *) raid_pool_get(1);
 		if (cacheArray[i].data == NULL)
 			return (-1);
 
 		//Set and invalid value to unused blocks
 		cacheArray[i].disk = -1;
 		cacheArray[i].block = -1;
+		cacheArray[i].valid = 0;
+		cacheArray[i].pins = 0;
 	}
 
 
@@ -100,9 +117,9 @@ int close_raid_cache(void) {
 
 	efficiency = ((double)hit/((double)hit+(double)miss))*100;
 
-	//Deallocate
+	//Give the slots back to the pool
 	for (i = 0; i<glob_max_items; i++){
-		free(cacheArray[i].data);
+		raid_pool_put(cacheArray[i].data);
 		cacheArray[i].data = NULL;
 	}
 
@@ -134,103 +151,204 @@ int close_raid_cache(void) {
 // Outputs      : 0 if successful, -1 if failure
 int put_raid_cache(RAIDDiskID dsk, RAIDBlockID blk, void *buf)  {
 
-	int i;
-	int found = 0;//Bool
-	int oldestPosition;//use to find position of oldest block
+	int slot;
 
-	//Keep track of time
-	timea++;
+	//Find where the block goes and copy it there
+	pthread_mutex_lock(&cacheLock);
+	slot = find_raid_cache_slot(dsk, blk);
+	if (slot != -1)
+		memcpy(cacheArray[slot].data, buf, RAID_BLOCK_SIZE);
+	pthread_mutex_unlock(&cacheLock);
 
-	//Insert new blocks into the cache
-	if(objectCount<glob_max_items){
+	// Return successfully
+	return(slot == -1 ? -1 : 0);
+}
 
-		for(i=0; i<objectCount; i++){
-			if(cacheArray[i].disk == dsk && cacheArray[i].block == blk){
-				
-				//is a hit!
-				hit++;
-				found = 1;
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : reserve_raid_cache
+// Description  : Take the slot for a block so its data can be received
+//                straight into the cache (no copy on insert). If filling the
+//                slot fails the caller must drop it with invalidate_raid_cache.
+//
+// Inputs       : dsk - this is the disk number of the block to cache
+//                blk - this is the block number of the block to cache
+// Outputs      : pointer to the data of the slot, NULL if every slot is pinned
+void * reserve_raid_cache(RAIDDiskID dsk, RAIDBlockID blk) {
 
-				//replace the data that is already there with the new info
-				memcpy(cacheArray[i].data, buf, RAID_BLOCK_SIZE);
-				
-				//Count an insert
-				insert++;
+	int slot;
 
-				//Update time
-				cacheArray[i].timestamp = timea;
+	pthread_mutex_lock(&cacheLock);
+	slot = find_raid_cache_slot(dsk, blk);
+	pthread_mutex_unlock(&cacheLock);
 
-				//Break the loop
-				break;
-			}
+	return (slot == -1 ? NULL : cacheArray[slot].data);
+}
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : pin_raid_cache
+// Description  : Keep a cached block where it is, with the data it has, until
+//                it is unpinned (as many times as it was pinned)
+//
+// Inputs       : data - the data of the block, as the cache returned it
+// Outputs      : 0 if successful, -1 if failure
+int pin_raid_cache(const void *data) {
+
+	int i, failed = -1;
+
+	pthread_mutex_lock(&cacheLock);
+	for (i=0; i<objectCount; i++){
+		if (cacheArray[i].data == data){
+			cacheArray[i].pins++;
+			failed = 0;
+			break;
 		}
-		//if it was not in the cache, is a new block
-		if (!found){
-			memcpy(cacheArray[objectCount].data, buf, RAID_BLOCK_SIZE);
-			cacheArray[objectCount].disk = dsk;
-			cacheArray[objectCount].block = blk;
-			cacheArray[objectCount].timestamp = timea;
-			objectCount++;
-			
-			//Count an insert
-			insert++;
+	}
+	pthread_mutex_unlock(&cacheLock);
+
+	return (failed);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : unpin_raid_cache
+// Description  : Release a pin of a cached block, the last one lets its slot
+//                be reused again
+//
+// Inputs       : data - the data of the block, as the cache returned it
+// Outputs      : 0 if successful, -1 if failure (it was not pinned)
+int unpin_raid_cache(const void *data) {
+
+	int i, failed = -1;
+
+	pthread_mutex_lock(&cacheLock);
+	for (i=0; i<objectCount; i++){
+		if (cacheArray[i].data == data && cacheArray[i].pins > 0){
+			cacheArray[i].pins--;
+			failed = 0;
+			break;
 		}
 	}
+	pthread_mutex_unlock(&cacheLock);
 
-	//Cache is full, update with new blocks
-	else{
+	return (failed);
+}
 
-		for (i=0; i<glob_max_items; i++){
-			//Check if the item is alreay on the cache
-			if(cacheArray[i].disk == dsk && cacheArray[i].block == blk){
-				//is a hit!
-				hit++;
-				found = 1;
-				//replace the data that is already there with the new info
-				memcpy(cacheArray[i].data, buf, RAID_BLOCK_SIZE);
-				cacheArray[i].timestamp = timea;
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : invalidate_raid_cache
+// Description  : Drop a block from the cache, its slot is the first one to be
+//                reused
+//
+// Inputs       : dsk - this is the disk number of the block to drop
+//                blk - this is the block number of the block to drop
+// Outputs      : 0 if successful, -1 if failure
+int invalidate_raid_cache(RAIDDiskID dsk, RAIDBlockID blk) {
 
-				//Count an insert
-				insert++;
+	int i;
 
-				//Break the loop
-				break;
+	pthread_mutex_lock(&cacheLock);
+	i = lookup_raid_cache_slot(dsk, blk);
+	if (i != -1){
+		cacheArray[i].valid = 0;
+		cacheArray[i].timestamp = 0;
+	}
+	pthread_mutex_unlock(&cacheLock);
 
-			}
+	// Return successfully
+	return(0);
+}
 
-		}
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : find_raid_cache_slot
+// Description  : Find the slot for a block being inserted: the slot already
+//                holding it, the next unused slot or the least recently used
+//                one not pinned, and mark it as holding the block. Called with
+//                cacheLock held.
+//
+// Inputs       : dsk - this is the disk number of the block to cache
+//                blk - this is the block number of the block to cache
+// Outputs      : the slot in cacheArray, -1 if every slot is pinned
+int find_raid_cache_slot(RAIDDiskID dsk, RAIDBlockID blk) {
+
+	int i;
+	int oldestPosition;//use to find position of oldest block
 
-		//if it went though the whole array and the block is not found is a miss
-		if (!found){
-			//is a miss
-			miss++;
+	//Keep track of time
+	timea++;
 
-			//find the oldest block
-			oldestTime = cacheArray[0].timestamp;
-			oldestPosition = 0;
+	//Count an insert
+	insert++;
 
-			for(i=0; i<glob_max_items; i++){
-				if(cacheArray[i].timestamp < oldestTime){
-					oldestPosition = i;
-					oldestTime = cacheArray[i].timestamp;
-				}
+	//Check if the item is alreay on the cache
+	i = lookup_raid_cache_slot(dsk, blk);
+	if (i != -1){
 
-			}
+		//is a hit!
+		hit++;
+
+		//Update time
+		cacheArray[i].timestamp = timea;
+		if (cacheArray[i].pins == 0)
+			return (i);
+
+		//Referenced as it is, the new data goes elsewhere
+		cacheArray[i].valid = 0;
+		cacheArray[i].timestamp = 0;
+	}
+
+	//Insert new blocks into the cache while there is space
+	if(objectCount<glob_max_items){
+		i = objectCount++;
+	}
+
+	//Cache is full, replace the oldest block
+	else{
+		//is a miss
+		miss++;
+
+		oldestPosition = -1;
 
-			//replaced the block that is oldestTime
-			memcpy(cacheArray[oldestPosition].data, buf, RAID_BLOCK_SIZE);
-			cacheArray[oldestPosition].disk = dsk;
-			cacheArray[oldestPosition].block = blk;
-			cacheArray[oldestPosition].timestamp = timea;
+		for(i=0; i<glob_max_items; i++){
+			if(cacheArray[i].pins == 0 && (oldestPosition == -1 || cacheArray[i].timestamp < oldestTime)){
+				oldestPosition = i;
+				oldestTime = cacheArray[i].timestamp;
+			}
 
-			//Count an insert
-			insert++;
 		}
+		i = oldestPosition;
+		if (i == -1)
+			return (-1);
 	}
 
-	// Return successfully
-	return(0);
+	cacheArray[i].disk = dsk;
+	cacheArray[i].block = blk;
+	cacheArray[i].timestamp = timea;
+	cacheArray[i].valid = 1;
+
+	return (i);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lookup_raid_cache_slot
+// Description  : Find the valid slot holding a block. Called with cacheLock
+//                held.
+//
+// Inputs       : dsk - this is the disk number of the block
+//                blk - this is the block number of the block
+// Outputs      : the slot in cacheArray, -1 if the block is not cached
+int lookup_raid_cache_slot(RAIDDiskID dsk, RAIDBlockID blk) {
+
+	int i;
+
+	for (i=0; i<objectCount; i++)
+		if (cacheArray[i].valid && cacheArray[i].disk == dsk && cacheArray[i].block == blk)
+			return (i);
+
+	return (-1);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -245,25 +363,28 @@ void * get_raid_cache(RAIDDiskID dsk, RAIDBlockID blk) {
 
 	int i;
 
+	pthread_mutex_lock(&cacheLock);
+
 	//Keep track of time
 	timea++;
 
 	//Count a get
 	get++;
 
-	for (i=0; i <glob_max_items; i++){
-		//If found, return pointer to object
-		if(cacheArray[i].disk == dsk && cacheArray[i].block == blk){
-			//Hit!!!
-			hit++;
-			//Update time
-			cacheArray[i].timestamp = timea;
-			return cacheArray[i].data;
-		}
-
+	//If found, return pointer to object
+	i = lookup_raid_cache_slot(dsk, blk);
+	if (i != -1){
+		//Hit!!!
+		hit++;
+		//Update time
+		cacheArray[i].timestamp = timea;
+		pthread_mutex_unlock(&cacheLock);
+		return cacheArray[i].data;
 	}
+
 	//Miss!!!
 	miss++;
+	pthread_mutex_unlock(&cacheLock);
 	//Not found so return NULL
 	return (NULL);
 
@@ -8,12 +8,20 @@
 //
 
 // Include Files
+#define _GNU_SOURCE
 #include <signal.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/time.h>
+#include <time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <errno.h>
+#include <poll.h>
 #include <string.h>
+#include <stdlib.h>
 #include <unistd.h>
 #include <assert.h>
 #include <stdint.h>
@@ -22,18 +30,69 @@
 #include <raid_network.h>
 #include <cmpsc311_log.h>
 #include <cmpsc311_util.h>
+#include <raid_pool.h>
+#include <raid_ext.h>
+
+// Defines
+#define RAID_CHANNELS          20   // Connections the client can keep open
+#define RAID_HEDGE_CHANNEL     1    // First connection used for hedged reads
+#define RAID_HEDGE_CHANNELS    2    // Connections used for hedged reads
+#define RAID_LATENCY_BUCKETS   32   // Read latency histogram, bucket i < 2^i usec
+#define RAID_HEDGE_MIN_SAMPLES 64   // Reads measured before hedging starts
+#define RAID_PIPELINE_WINDOW   8    // Requests in flight on a pipelined channel
 
 // Global data
 unsigned char *raid_network_address = NULL; // Address of CRUD server
 unsigned short raid_network_port = 0; // Port of CRUD server
 int sockfd = -1;
 
+//Every channel is a connection to the server, channel 0 is sockfd (the one
+//opened by RAID_INIT), the others are opened the first time they are used
+int channels[RAID_CHANNELS] = { [0 ... RAID_CHANNELS-1] = -1 };
+
+//Channels given an endpoint of their own (client_raid_channel_endpoint) talk
+//to another server, they do not need RAID_INIT on channel 0 first
+char *channelAddress[RAID_CHANNELS];
+unsigned short channelPort[RAID_CHANNELS];
+
+//A channel that still owes the response of a request nobody waits for anymore
+//(the loser of a hedged read), it is drained before the channel is used again
+RAIDOpCode pendingOp[RAID_CHANNELS];
+int pending[RAID_CHANNELS];
+
+//Hedged reads: percentile of the read latency after which the backup copy is
+//asked too, 0 means hedging is off
+int raid_hedge_percentile = 0;
+uint64_t readLatency[RAID_LATENCY_BUCKETS];
+uint64_t readSamples = 0;
+uint64_t hedgedReads = 0;
+
 //Global struct
 struct network
 {
 	uint64_t opcode;
 	uint64_t length;
-} remoteRaid;
+};
+
+
+//Functions Prototypes
+RAIDOpCode client_raid_bus_request_channel(int, RAIDOpCode, void *);
+RAIDOpCode client_raid_hedged_read(RAIDOpCode, RAIDOpCode, void *, RAIDOpCode *);
+int client_raid_bus_pipeline(int, int, RAIDOpCode *, void **, RAIDOpCode *);
+int raid_connect(const char *, unsigned short);
+int client_raid_channel_endpoint(int, const char *, unsigned short);
+void client_raid_channel_reset(int);
+int raid_recv_full(int, void *, size_t);
+int raid_send_request(int, RAIDOpCode, void *);
+RAIDOpCode raid_recv_response(int, RAIDOpCode, void *);
+int raid_channel_fd(int);
+uint64_t raid_hedge_delay(void);
+int raid_hedge_channel(void);
+void raid_record_latency(uint64_t);
+uint64_t raid_now(void);
+uint64_t raid_request_length(RAIDOpCode);
+int raid_request_iov(RAIDOpCode, void *, struct network *, struct iovec *);
+void raid_iov_advance(struct iovec *, int *, size_t);
 
 
 // Functions
@@ -54,98 +113,714 @@ struct network
 
 RAIDOpCode client_raid_bus_request(RAIDOpCode op, void *buf) {
 
-	
-	struct sockaddr_in caddr;//structure for network
 	uint8_t type; //type of request
-	uint64_t length; //lenth of data to be sent
-	uint64_t blocks;//number of blocks to be written or read
 	RAIDOpCode response = 0; //the response opcode from the server
-	remoteRaid.length = 0; //length of data to be sent
-	
+	int i;
 
 	//Get the type of request:
 	type = (op>>56);
 
-	//Get the length of data (only needed for reads and writes)
-	blocks = (op<<8)>>56;
-	length = blocks*RAID_BLOCK_SIZE;
+	//Make a connection to the server
+	if (type == RAID_INIT){
+		sockfd = raid_connect(NULL, 0);
+		if (sockfd == -1)
+			return (-1);
+		channels[0] = sockfd;
+	}
 
-	//Change opcode to network byte order
-	remoteRaid.opcode = htonll64(op);
+	response = client_raid_bus_request_channel(0, op, buf);
 
-	
-	//Change length of data to network byte order
-	if(type == RAID_READ || type == RAID_WRITE){
-		remoteRaid.length = htonll64(length);
+	///////////////////////////
+	//Close server connection/
+	/////////////////////////
+
+	if (type == RAID_CLOSE){
+		for (i = 0; i < RAID_CHANNELS; i++){
+			if (channels[i] != -1)
+				close(channels[i]);
+			channels[i] = -1;
+			pending[i] = 0;
+		}
+		sockfd = -1;
 	}
 
-	
-	//Make a connection to the server
-	if (type == RAID_INIT){
+	return (response);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : client_raid_bus_request_channel
+// Description  : Sends a request on one of the connections to the server and
+//                waits for its response. Each channel must only be used by
+//                one thread at a time.
+//
+// Inputs       : channel - the connection to use (0 is the RAID_INIT one)
+//                op - the request opcode for the command
+//                buf - the block to be read/written from (READ/WRITE)
+// Outputs      : the response structure encoded as needed, -1 if failure
 
-		//Setup the address and port in proper form
-		caddr.sin_family = AF_INET;
-		caddr.sin_port = htons(RAID_DEFAULT_PORT);
+RAIDOpCode client_raid_bus_request_channel(int channel, RAIDOpCode op, void *buf) {
 
-		if(inet_aton(RAID_DEFAULT_IP, &caddr.sin_addr) == 0 ){
-    		return(-1);
-    	}
+	int fd;
 
-    	//Create the socket
-    	sockfd = socket(AF_INET, SOCK_STREAM, 0);
-    	if (sockfd == -1)
-    		return (-1);
+	fd = raid_channel_fd(channel);
+	if (fd == -1)
+		return (-1);
 
-    	//Now Connect
-    	if(connect(sockfd, (const struct sockaddr *)&caddr, sizeof(caddr)) == -1){
-    		return(-1);
-    	}
+	if (raid_send_request(fd, op, buf))
+		return (-1);
+
+	return (raid_recv_response(fd, op, buf));
+}
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : client_raid_bus_pipeline
+// Description  : Sends a batch of requests on one channel keeping up to
+//                RAID_PIPELINE_WINDOW of them in flight, so the server never
+//                waits for the next request and the link stays busy. Sending
+//                and receiving are interleaved with poll, so large requests
+//                and large answers can not block each other.
+//
+// Inputs       : channel - the connection to use
+//                count - the number of requests
+//                ops - the request opcodes
+//                bufs - the blocks of each request (READ/WRITE)
+//                responses - returns the response opcode of each request
+// Outputs      : 0 if successful (check each response), -1 if failure
+
+int client_raid_bus_pipeline(int channel, int count, RAIDOpCode *ops, void **bufs, RAIDOpCode *responses) {
+
+	struct network header, answer;
+	struct pollfd pfd;
+	struct iovec iov[3];
+	struct msghdr msg;
+	char *scratch, *dest;
+	size_t sendOff = 0, recvOff = 0, total, length = 0;
+	uint64_t blocks;
+	uint8_t type;
+	int sent = 0, received = 0, iovs;
+	ssize_t n;
+
+	pfd.fd = raid_channel_fd(channel);
+	if (pfd.fd == -1)
+		return (-1);
+
+	//Echoes of written blocks (and anything unexpected) are received here
+	scratch = raid_pool_get(RAID_POOL_MULTI_BLOCKS);
+	if (scratch == NULL)
+		return (-1);
+
+	while (received < count){
+
+		pfd.events = 0;
+		if (sent < count && sent - received < RAID_PIPELINE_WINDOW)
+			pfd.events |= POLLOUT;
+		if (received < sent)
+			pfd.events |= POLLIN;
+
+		if (poll(&pfd, 1, -1) == -1){
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		if ((pfd.revents & (POLLERR | POLLHUP | POLLNVAL)) && !(pfd.revents & POLLIN))
+			break;
+
+		//Push out more of the next request
+		if (pfd.revents & POLLOUT){
+
+			iovs = raid_request_iov(ops[sent], bufs[sent], &header, iov);
+			total = sizeof(header) + raid_request_length(ops[sent]);
+
+			//Skip what already went out
+			raid_iov_advance(iov, &iovs, sendOff);
+
+			memset(&msg, 0, sizeof(msg));
+			msg.msg_iov = iov;
+			msg.msg_iovlen = iovs;
+			n = sendmsg(pfd.fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+			if (n == -1 && errno != EAGAIN && errno != EINTR)
+				break;
+			if (n > 0){
+				sendOff += n;
+				if (sendOff == total){
+					sent++;
+					sendOff = 0;
+				}
+			}
+		}
+
+		//Pull in more of the oldest answer
+		if (pfd.revents & POLLIN){
+
+			if (recvOff < sizeof(answer))
+				n = recv(pfd.fd, (char *)&answer + recvOff, sizeof(answer) - recvOff, MSG_DONTWAIT);
+			else{
+				type = ops[received] >> 56;
+				blocks = (ops[received] << 8) >> 56;
+				dest = (type == RAID_READ && length <= blocks * RAID_BLOCK_SIZE) ? (char *)bufs[received] : scratch;
+				n = recv(pfd.fd, dest + (recvOff - sizeof(answer)), length - (recvOff - sizeof(answer)), MSG_DONTWAIT);
+			}
+
+			if (n == 0 || (n == -1 && errno != EAGAIN && errno != EINTR))
+				break;
+			if (n > 0){
+				recvOff += n;
+
+				//Header complete, now we know how much data follows
+				if (recvOff == sizeof(answer)){
+					length = ntohll64(answer.length);
+					if (length > (size_t)RAID_POOL_MULTI_BLOCKS * RAID_BLOCK_SIZE)
+						break;
+				}
+
+				if (recvOff >= sizeof(answer) && recvOff == sizeof(answer) + length){
+					responses[received++] = ntohll64(answer.opcode);
+					recvOff = 0;
+				}
+			}
+		}
 	}
 
-	////////////////////
-    //Write to server//
-    //////////////////
+	raid_pool_put(scratch);
 
-    //Send opcode (64 bits = 8 bytes)
-    write(sockfd, &remoteRaid.opcode, 8);
+	//The stream is out of step if we stopped halfway, nothing else can use it
+	if (received < count){
+		close(pfd.fd);
+		channels[channel] = -1;
+		if (channel == 0)
+			sockfd = -1;
+		return (-1);
+	}
 
-    //Send length (64 bits == 8 bytes)
-    write(sockfd, &remoteRaid.length, 8);
+	return (0);
+}
 
-	//Send buffer
-	if(type == RAID_READ || type == RAID_WRITE){
-    	write(sockfd, buf, RAID_BLOCK_SIZE*blocks);
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : client_raid_hedged_read
+// Description  : Reads from the primary copy and, if it has not answered
+//                after the configured latency percentile, asks the backup
+//                copy too and keeps whichever answers first. The other answer
+//                is thrown away when its channel is used again.
+//
+// Inputs       : op - the RAID_READ of the primary copy
+//                backupOp - the RAID_READ of the backup copy
+//                buf - where the blocks are read
+//                answered - returns the request that was answered
+// Outputs      : the response structure encoded as needed, -1 if failure
+
+RAIDOpCode client_raid_hedged_read(RAIDOpCode op, RAIDOpCode backupOp, void *buf, RAIDOpCode *answered) {
+
+	struct pollfd fds[2];
+	struct timespec wait;
+	uint64_t start, delay;
+	RAIDOpCode response;
+	int ready, hedge, fd;
+
+	*answered = op;
+
+	//Not enough history yet, hedging is off or every hedge channel is still busy
+	delay = raid_hedge_delay();
+	hedge = (delay != 0) ? raid_hedge_channel() : -1;
+	if (hedge == -1){
+		start = raid_now();
+		response = client_raid_bus_request_channel(0, op, buf);
+		raid_record_latency(raid_now() - start);
+		return (response);
 	}
 
-    /////////////////////////
-    //Read from the server//
-	///////////////////////
+	fds[0].fd = raid_channel_fd(0);
+	fds[1].fd = raid_channel_fd(hedge);
+	if (fds[0].fd == -1 || fds[1].fd == -1)
+		return (-1);
+	fds[0].events = fds[1].events = POLLIN;
+
+	start = raid_now();
+	if (raid_send_request(fds[0].fd, op, buf))
+		return (-1);
+
+	//Give the primary its usual time
+	wait.tv_sec = delay / 1000000;
+	wait.tv_nsec = (delay % 1000000) * 1000;
+	do {
+		ready = ppoll(fds, 1, &wait, NULL);
+	} while (ready == -1 && errno == EINTR);
+
+	if (ready == 0){
+
+		//Slow primary, ask the backup too and take the first answer
+		hedgedReads++;
+		if (raid_send_request(fds[1].fd, backupOp, buf))
+			return (-1);
+
+		do {
+			ready = poll(fds, 2, -1);
+		} while (ready == -1 && errno == EINTR);
+
+		if (!(fds[0].revents & POLLIN) && (fds[1].revents & POLLIN)){
+
+			//The stalled connection becomes a hedge channel and the one that
+			//answered takes its place, so the next request does not wait for it
+			fd = channels[0];
+			channels[0] = sockfd = channels[hedge];
+			channels[hedge] = fd;
+			pending[hedge] = 1;
+			pendingOp[hedge] = op;
+
+			*answered = backupOp;
+			raid_record_latency(raid_now() - start);
+			return (raid_recv_response(fds[1].fd, backupOp, buf));
+		}
+
+		pending[hedge] = 1;
+		pendingOp[hedge] = backupOp;
+	}
 
-    //read response
-    read(sockfd, &response, 8);
+	response = raid_recv_response(fds[0].fd, op, buf);
+	raid_record_latency(raid_now() - start);
+	return (response);
+}
 
-    //Read length
-    read(sockfd, &remoteRaid.length, 8);
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : raid_connect
+// Description  : Opens a new connection to the server
+//
+// Inputs       : address - the server, NULL for the one of the array
+//                port - its port, 0 for the one of the array
+// Outputs      : the socket, -1 if failure
 
-    //Read buffer
-    if(type == RAID_READ || type == RAID_WRITE){
-    	read(sockfd, buf, RAID_BLOCK_SIZE*blocks);
-    }
+int raid_connect(const char *address, unsigned short port) {
 
+	struct sockaddr_in caddr;//structure for network
+	int fd, one = 1;
 
-	//Turn response back to client byte order
-	response = ntohll64(response);
+	if (address == NULL)
+		address = raid_network_address ? (char *)raid_network_address : RAID_DEFAULT_IP;
+	if (port == 0)
+		port = raid_network_port ? raid_network_port : RAID_DEFAULT_PORT;
 
+	//Setup the address and port in proper form
+	caddr.sin_family = AF_INET;
+	caddr.sin_port = htons(port);
+
+	if(inet_aton(address, &caddr.sin_addr) == 0 ){
+		return(-1);
+	}
+
+	//Create the socket
+	fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd == -1)
+		return (-1);
+
+	//Requests are small and strictly request/response, do not let Nagle hold them
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+	//Now Connect
+	if(connect(fd, (const struct sockaddr *)&caddr, sizeof(caddr)) == -1){
+		close(fd);
+		return(-1);
+	}
+
+	return (fd);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : raid_channel_fd
+// Description  : Gets the socket of a channel, opening it the first time and
+//                draining any response it still owes
+//
+// Inputs       : channel - the channel
+// Outputs      : the socket, -1 if failure
+
+int raid_channel_fd(int channel) {
+
+	if (channel < 0 || channel >= RAID_CHANNELS)
+		return (-1);
+
+	//Extra channels are only opened once the array is initialized, unless
+	//they go somewhere else
+	if (channels[channel] == -1){
+		if (channel == 0 || (sockfd == -1 && channelPort[channel] == 0))
+			return (-1);
+		channels[channel] = raid_connect(channelAddress[channel], channelPort[channel]);
+		if (channels[channel] == -1)
+			return (-1);
+	}
+
+	//Throw away the answer of a request that was given up on
+	if (pending[channel]){
+		pending[channel] = 0;
+		if (raid_recv_response(channels[channel], pendingOp[channel], NULL) == (RAIDOpCode)-1)
+			return (-1);
+	}
+
+	return (channels[channel]);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : client_raid_channel_endpoint
+// Description  : Makes a channel talk to another RAID server (a second array),
+//                from the next time it is opened
+//
+// Inputs       : channel - the channel, not 0
+//                address - the server, NULL to go back to the array's one
+//                port - its port
+// Outputs      : 0 if successful, -1 if failure
+
+int client_raid_channel_endpoint(int channel, const char *address, unsigned short port) {
+
+	struct in_addr check;
+
+	if (channel <= 0 || channel >= RAID_CHANNELS || (address != NULL && inet_aton(address, &check) == 0))
+		return (-1);
+
+	free(channelAddress[channel]);
+	channelAddress[channel] = NULL;
+	channelPort[channel] = 0;
+
+	if (address != NULL){
+		channelAddress[channel] = strdup(address);
+		if (channelAddress[channel] == NULL)
+			return (-1);
+		channelPort[channel] = port;
+	}
+
+	client_raid_channel_reset(channel);
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : client_raid_channel_reset
+// Description  : Closes a channel after an error, it is opened again the next
+//                time it is used
+//
+// Inputs       : channel - the channel, not 0
+// Outputs      : none
+
+void client_raid_channel_reset(int channel) {
+
+	if (channel <= 0 || channel >= RAID_CHANNELS)
+		return;
+
+	if (channels[channel] != -1)
+		close(channels[channel]);
+	channels[channel] = -1;
+	pending[channel] = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : raid_hedge_channel
+// Description  : Finds a hedge channel that can take a request right away, one
+//                that owes nothing or whose old answer has already arrived
+//
+// Inputs       : none
+// Outputs      : the channel, -1 if all of them are still waiting
+
+int raid_hedge_channel(void) {
+
+	struct pollfd fd;
+	int channel;
+
+	for (channel = RAID_HEDGE_CHANNEL; channel < RAID_HEDGE_CHANNEL + RAID_HEDGE_CHANNELS; channel++){
+		if (channels[channel] == -1 || !pending[channel])
+			return (channel);
+
+		fd.fd = channels[channel];
+		fd.events = POLLIN;
+		if (poll(&fd, 1, 0) == 1)
+			return (channel);
+	}
+
+	return (-1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : raid_send_request
+// Description  : Writes a request (opcode, length and blocks) to a socket
+//
+// Inputs       : fd - the socket
+//                op - the request opcode for the command
+//                buf - the blocks to send (READ/WRITE)
+// Outputs      : 0 if successful, -1 if failure
+
+int raid_send_request(int fd, RAIDOpCode op, void *buf) {
+
+	struct network remoteRaid;
+	struct iovec iov[3];
+	size_t total, sent = 0;
+	ssize_t n;
+	int count;
+
+	//The opcode, length and data go out in a single write
+	count = raid_request_iov(op, buf, &remoteRaid, iov);
+	total = sizeof(remoteRaid) + raid_request_length(op);
+
+	while (sent < total){
+		n = writev(fd, iov, count);
+		if (n == -1 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return (-1);
+		sent += n;
+
+		//Skip what already went out
+		raid_iov_advance(iov, &count, n);
+	}
+
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : raid_recv_full
+// Description  : Reads exactly len bytes from a socket
+//
+// Inputs       : fd - the socket
+//                buf - where to read
+//                len - bytes to read
+// Outputs      : 0 if successful, -1 if failure
+
+int raid_recv_full(int fd, void *buf, size_t len) {
+
+	size_t got = 0;
+	ssize_t n;
+
+	while (got < len){
+		n = read(fd, (char *)buf + got, len - got);
+		if (n == -1 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return (-1);
+		got += n;
+	}
+
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : raid_recv_response
+// Description  : Reads the response to a request from a socket
+//
+// Inputs       : fd - the socket
+//                op - the request the response belongs to
+//                buf - where read blocks go, NULL to throw them away
+// Outputs      : the response opcode, -1 if failure
+
+RAIDOpCode raid_recv_response(int fd, RAIDOpCode op, void *buf) {
+
+	struct network remoteRaid;
+	uint8_t type; //type of request
+	uint64_t blocks;//number of blocks to be written or read
+	char *echo = NULL; //where the echo of a write is received
+
+	type = (op>>56);
+	blocks = (op<<8)>>56;
 
-	///////////////////////////
-	//Close server connection/
 	/////////////////////////
+	//Read from the server//
+	///////////////////////
 
-	if (type == RAID_CLOSE){
-		close(sockfd);
-		sockfd = -1;
+	//read response and length
+	if (raid_recv_full(fd, &remoteRaid, sizeof(remoteRaid)))
+		return (-1);
+
+	//Read buffer
+	if(type == RAID_READ && buf != NULL){
+		if (raid_recv_full(fd, buf, RAID_BLOCK_SIZE*blocks))
+			return (-1);
 	}
 
-	return (response);
+	//The server echoes written blocks, drain them into a pool buffer so the
+	//caller's data is left untouched (also where unwanted reads go)
+	else if((type == RAID_READ || type == RAID_WRITE) && blocks > 0){
+		echo = raid_pool_get(blocks);
+		if (echo == NULL)
+			return (-1);
+		if (raid_recv_full(fd, echo, RAID_BLOCK_SIZE*blocks)){
+			raid_pool_put(echo);
+			return (-1);
+		}
+		raid_pool_put(echo);
+	}
+
+	//Turn response back to client byte order
+	return (ntohll64(remoteRaid.opcode));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : raid_hedge_delay
+// Description  : Time to wait for the primary copy before hedging, the upper
+//                bound of the latency bucket holding raid_hedge_percentile
+//
+// Inputs       : none
+// Outputs      : the delay in microseconds, 0 if reads are not hedged
+
+uint64_t raid_hedge_delay(void) {
+
+	uint64_t seen = 0, wanted;
+	int i;
+
+	if (raid_hedge_percentile <= 0 || raid_hedge_percentile >= 100)
+		return (0);
+	if (readSamples < RAID_HEDGE_MIN_SAMPLES || sockfd == -1)
+		return (0);
+
+	wanted = (readSamples * raid_hedge_percentile + 99) / 100;
+	for (i = 0; i < RAID_LATENCY_BUCKETS; i++){
+		seen += readLatency[i];
+		if (seen >= wanted)
+			break;
+	}
+
+	return ((uint64_t)1 << (i < RAID_LATENCY_BUCKETS ? i : RAID_LATENCY_BUCKETS-1));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : raid_record_latency
+// Description  : Adds a read latency to the histogram, old samples are halved
+//                now and then so the threshold follows the current load
+//
+// Inputs       : usec - latency of the read in microseconds
+// Outputs      : none
+
+void raid_record_latency(uint64_t usec) {
+
+	int i = 0;
+
+	while (i < RAID_LATENCY_BUCKETS-1 && ((uint64_t)1 << i) <= usec)
+		i++;
+
+	readLatency[i]++;
+	readSamples++;
+
+	if (readSamples >= 64 * 1024){
+		readSamples = 0;
+		for (i = 0; i < RAID_LATENCY_BUCKETS; i++){
+			readLatency[i] /= 2;
+			readSamples += readLatency[i];
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : raid_request_length
+// Description  : Bytes of data sent after the header of a request
+//
+// Inputs       : op - the request opcode
+// Outputs      : the length
+
+uint64_t raid_request_length(RAIDOpCode op) {
+
+	uint8_t type = RAID_OP_TYPE(op);
+
+	if (type == RAID_READ || type == RAID_WRITE)
+		return ((uint64_t)RAID_OP_BLOCKS(op) * RAID_BLOCK_SIZE);
+
+	if (type == RAID_COPY)
+		return (RAID_COPY_PAYLOAD);
+
+	if (type == RAID_MIRROR_WRITE)
+		return ((uint64_t)RAID_OP_BLOCKS(op) * RAID_BLOCK_SIZE + RAID_OP_TARGETS(op) * sizeof(uint64_t));
+
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : raid_request_iov
+// Description  : Lays out a request for writev: the header (in network order)
+//                and the pieces of its data
+//
+// Inputs       : op - the request opcode
+//                buf - the data of the request
+//                header - where the header is built
+//                iov - returns the pieces, room for three
+// Outputs      : the number of pieces
+
+int raid_request_iov(RAIDOpCode op, void *buf, struct network *header, struct iovec *iov) {
+
+	struct raid_mirror_payload *mirror;
+	uint64_t length;
+	int count = 1;
+
+	length = raid_request_length(op);
+	header->opcode = htonll64(op);
+	header->length = htonll64(length);
+	iov[0].iov_base = header;
+	iov[0].iov_len = sizeof(*header);
+
+	//A mirrored write carries its extra targets ahead of the blocks
+	if (RAID_OP_TYPE(op) == RAID_MIRROR_WRITE){
+		mirror = (struct raid_mirror_payload *)buf;
+		if (RAID_OP_TARGETS(op) > 0){
+			iov[count].iov_base = mirror->targets;
+			iov[count++].iov_len = RAID_OP_TARGETS(op) * sizeof(uint64_t);
+		}
+		if (RAID_OP_BLOCKS(op) > 0){
+			iov[count].iov_base = mirror->blocks;
+			iov[count++].iov_len = (size_t)RAID_OP_BLOCKS(op) * RAID_BLOCK_SIZE;
+		}
+	}
+	else if (length > 0){
+		iov[count].iov_base = buf;
+		iov[count++].iov_len = length;
+	}
+
+	return (count);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : raid_iov_advance
+// Description  : Drops the bytes that were already sent from the front of a
+//                list of pieces
+//
+// Inputs       : iov - the pieces
+//                count - the number of pieces, updated
+//                n - the bytes sent
+// Outputs      : none
+
+void raid_iov_advance(struct iovec *iov, int *count, size_t n) {
+
+	int i;
+
+	while (*count > 0 && n >= iov[0].iov_len){
+		n -= iov[0].iov_len;
+		for (i = 1; i < *count; i++)
+			iov[i-1] = iov[i];
+		(*count)--;
+	}
+
+	if (*count > 0){
+		iov[0].iov_base = (char *)iov[0].iov_base + n;
+		iov[0].iov_len -= n;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : raid_now
+// Description  : Current time in microseconds
+//
+// Inputs       : none
+// Outputs      : the time
+
+uint64_t raid_now(void) {
+
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return ((uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000);
 }
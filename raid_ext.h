@@ -0,0 +1,72 @@
+#ifndef RAID_EXT_INCLUDED
+#define RAID_EXT_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : raid_ext.h
+//  Description    : This is the interface of the extensions to the RAID
+//                   protocol understood by the local stand-in server. A stock
+//                   server does not know them, the driver only uses them after
+//                   a successful capability probe.
+//
+//  Author         : agent
+//  Last Modified  : 10/18/2026
+//
+
+// Include Files
+#include <stdint.h>
+
+// Project Include Files
+#include <raid_bus.h>
+
+// Defines
+
+//Extension request types, far from the ones of RAID_REQUEST_TYPES
+#define RAID_COPY                0x40  // Server side copy of blocks between disks
+#define RAID_MIRROR_WRITE        0x41  // One write fanned out to several disks
+
+//RAID_COPY: blockQuantity, diskNumber and id are the source range, the
+//payload is one 64 bit word (network order) with the destination disk in
+//the upper 32 bits and the destination block in the lower 32 bits. The
+//response carries no data.
+#define RAID_COPY_PAYLOAD        8
+#define RAID_COPY_TARGET(dsk, blk)  (((uint64_t)(dsk) << 32) | (uint32_t)(blk))
+
+//RAID_MIRROR_WRITE: blockQuantity, diskNumber and id are the first target,
+//the unused bits 33-39 hold the number of extra targets. The payload is the
+//extra targets (RAID_COPY_TARGET words, network order) followed by the
+//blocks. The response carries no data.
+#define RAID_MIRROR_TARGETS      4     // Most copies one frame may write
+#define RAID_OP_TARGETS(op)      ((uint32_t)(((op) >> 33) & 0x7F))
+#define RAID_OP_WITH_TARGETS(op, n)  ((op) | ((RAIDOpCode)(n) << 33))
+
+//What the client is given as the buffer of a RAID_MIRROR_WRITE
+struct raid_mirror_payload
+{
+	void *blocks;
+	uint64_t targets[RAID_MIRROR_TARGETS-1];
+};
+
+//Fields of an opcode
+#define RAID_OP_TYPE(op)         ((uint8_t)((op) >> 56))
+#define RAID_OP_BLOCKS(op)       ((uint32_t)(((op) << 8) >> 56))
+#define RAID_OP_DISK(op)         ((uint8_t)(((op) << 16) >> 56))
+#define RAID_OP_STATUS(op)       ((int)(((op) << 31) >> 63))
+#define RAID_OP_ID(op)           ((uint32_t)(op))
+
+//
+// Interface
+
+int raid_local_server_start(unsigned short port);
+	// Start the stand-in RAID server on 127.0.0.1:port, 0 if successful
+
+int raid_local_server_stop(void);
+	// Stop the stand-in server and drop its disks, 0 if successful
+
+int raid_local_server_fail(uint8_t disk, int permanent);
+	// Fail a disk of the stand-in server until it is formatted (never if permanent), 0 if successful
+
+int raid_local_server_stall(uint8_t disk, uint32_t usec, uint32_t every);
+	// Answer one in every `every` READ or WRITE requests to disk usec microseconds late, 0 usec turns it off
+
+#endif
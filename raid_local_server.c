@@ -0,0 +1,570 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : raid_local_server.c
+//  Description    : This is a local stand-in for the RAID server, the disks
+//                   live in memory. It speaks the RAID protocol plus the
+//                   extensions of raid_ext.h, so the driver can be run and
+//                   measured against it on one machine.
+//
+//  Author         : agent
+//  Last Modified  : 10/18/2026
+//
+
+// Includes
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+// Project includes
+#include <cmpsc311_log.h>
+#include <cmpsc311_util.h>
+#include <raid_ext.h>
+
+
+//Definitions
+
+//Connections served at once (the client opens one per channel)
+#define SERVER_CONNECTIONS   64
+
+//Largest payload of a request: a full RAID_MIRROR_WRITE
+#define SERVER_PAYLOAD       ((size_t)255 * RAID_BLOCK_SIZE + (RAID_MIRROR_TARGETS-1) * sizeof(uint64_t))
+
+
+//Structures
+
+//Header of every request and response
+struct serverframe
+{
+	uint64_t opcode;
+	uint64_t length;
+};
+
+//A disk of the array
+struct serverdisk
+{
+	char *blocks;
+	int status;
+	int dead;              //Formatting fails too, the disk has to be replaced
+	uint32_t stallUsec;    //Delay of a stalled request, 0 if the disk never stalls
+	uint32_t stallEvery;   //One in every stallEvery READs and WRITEs of the disk stalls
+	uint32_t stallCount;   //READs and WRITEs since the last stall
+};
+
+
+//Global Variables
+
+struct serverdisk serverDisks[RAID_DISKS];
+pthread_mutex_t serverLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t serverIdle = PTHREAD_COND_INITIALIZER;
+pthread_t serverThread;
+int serverRunning = 0;
+int listenfd = -1;
+
+//Open connections, so stopping the server can close them
+int serverConnections[SERVER_CONNECTIONS];
+int connectionCount = 0;
+
+
+//Functions Prototypes
+void *server_accept(void *);
+void *server_connection(void *);
+RAIDOpCode server_execute(RAIDOpCode, char *, uint64_t, uint64_t *);
+void server_stall(uint32_t);
+int server_range(RAIDOpCode, uint8_t, uint32_t);
+int server_recv(int, void *, size_t);
+int server_send(int, const void *, size_t);
+
+
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : raid_local_server_start
+// Description  : Creates the disks in memory and starts accepting connections
+//                on the loopback interface
+//
+// Inputs       : port - the port to listen on
+// Outputs      : 0 if successful, -1 if failure
+
+int raid_local_server_start(unsigned short port) {
+
+	struct sockaddr_in saddr;
+	int i, one = 1;
+
+	if (serverRunning)
+		return (-1);
+
+	for (i = 0; i < RAID_DISKS; i++){
+		serverDisks[i].blocks = calloc(RAID_DISKBLOCKS, RAID_BLOCK_SIZE);
+		serverDisks[i].status = RAID_DISK_UNINITIALIZED;
+		serverDisks[i].dead = 0;
+		serverDisks[i].stallUsec = 0;
+		serverDisks[i].stallEvery = 0;
+		serverDisks[i].stallCount = 0;
+		if (serverDisks[i].blocks == NULL){
+			raid_local_server_stop();
+			return (-1);
+		}
+	}
+
+	listenfd = socket(AF_INET, SOCK_STREAM, 0);
+	if (listenfd == -1){
+		raid_local_server_stop();
+		return (-1);
+	}
+	setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+	memset(&saddr, 0, sizeof(saddr));
+	saddr.sin_family = AF_INET;
+	saddr.sin_port = htons(port);
+	saddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	if (bind(listenfd, (struct sockaddr *)&saddr, sizeof(saddr)) == -1
+			|| listen(listenfd, SERVER_CONNECTIONS) == -1){
+		logMessage(LOG_ERROR_LEVEL, "RAID local server: unable to listen on port %u", port);
+		raid_local_server_stop();
+		return (-1);
+	}
+
+	serverRunning = 1;
+	if (pthread_create(&serverThread, NULL, server_accept, NULL)){
+		serverRunning = 0;
+		raid_local_server_stop();
+		return (-1);
+	}
+
+	logMessage(LOG_INFO_LEVEL, "RAID local server: listening on port %u", port);
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : raid_local_server_stop
+// Description  : Stops accepting, closes every connection, waits for them to
+//                finish and frees the disks
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int raid_local_server_stop(void) {
+
+	int i;
+
+	if (listenfd != -1)
+		shutdown(listenfd, SHUT_RDWR);
+
+	if (serverRunning){
+		pthread_join(serverThread, NULL);
+		serverRunning = 0;
+	}
+
+	if (listenfd != -1){
+		close(listenfd);
+		listenfd = -1;
+	}
+
+	//Wake up the connections and wait until all of them are gone
+	pthread_mutex_lock(&serverLock);
+	for (i = 0; i < connectionCount; i++)
+		shutdown(serverConnections[i], SHUT_RDWR);
+	while (connectionCount > 0)
+		pthread_cond_wait(&serverIdle, &serverLock);
+	pthread_mutex_unlock(&serverLock);
+
+	for (i = 0; i < RAID_DISKS; i++){
+		free(serverDisks[i].blocks);
+		serverDisks[i].blocks = NULL;
+	}
+
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : raid_local_server_fail
+// Description  : Fails a disk the way a real one fails: its status reads
+//                RAID_DISK_FAILED and its requests fail until it is formatted,
+//                which also loses its blocks. A permanent failure makes the
+//                format fail too, until the disk is failed again without it
+//                (replaced).
+//
+// Inputs       : disk - the disk
+//                permanent - 1 if formatting the disk fails as well
+// Outputs      : 0 if successful, -1 if failure
+
+int raid_local_server_fail(uint8_t disk, int permanent) {
+
+	if (disk >= RAID_DISKS || serverDisks[disk].blocks == NULL)
+		return (-1);
+
+	pthread_mutex_lock(&serverLock);
+	serverDisks[disk].status = RAID_DISK_FAILED;
+	serverDisks[disk].dead = permanent;
+	pthread_mutex_unlock(&serverLock);
+
+	logMessage(LOG_INFO_LEVEL, "RAID local server: disk %u failed%s", disk, permanent ? " for good" : "");
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : raid_local_server_stall
+// Description  : Answers one in every `every` READ or WRITE requests to a
+//                disk usec microseconds late. Only the connection of that
+//                request waits, the others are served meanwhile, like a
+//                disk that is slow for a moment.
+//
+// Inputs       : disk - the disk
+//                usec - the delay, 0 stops stalling
+//                every - stall one request in every
+// Outputs      : 0 if successful, -1 if failure
+
+int raid_local_server_stall(uint8_t disk, uint32_t usec, uint32_t every) {
+
+	if (disk >= RAID_DISKS || (usec && !every))
+		return (-1);
+
+	pthread_mutex_lock(&serverLock);
+	serverDisks[disk].stallUsec = usec;
+	serverDisks[disk].stallEvery = every;
+	serverDisks[disk].stallCount = 0;
+	pthread_mutex_unlock(&serverLock);
+
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : server_accept
+// Description  : Accepts connections, each one is served by its own thread
+//
+// Inputs       : arg - unused
+// Outputs      : NULL
+
+void *server_accept(void *arg) {
+
+	pthread_t thread;
+	intptr_t fd;
+	int one = 1;
+
+	while (1){
+		fd = accept(listenfd, NULL, NULL);
+		if (fd == -1){
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			break;
+		}
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+		pthread_mutex_lock(&serverLock);
+		if (connectionCount == SERVER_CONNECTIONS){
+			pthread_mutex_unlock(&serverLock);
+			close(fd);
+			continue;
+		}
+		serverConnections[connectionCount++] = fd;
+		pthread_mutex_unlock(&serverLock);
+
+		if (pthread_create(&thread, NULL, server_connection, (void *)fd)){
+			pthread_mutex_lock(&serverLock);
+			serverConnections[--connectionCount] = -1;
+			pthread_mutex_unlock(&serverLock);
+			close(fd);
+			continue;
+		}
+		pthread_detach(thread);
+	}
+
+	return (NULL);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : server_connection
+// Description  : Serves the requests of one connection until it is closed
+//
+// Inputs       : arg - the socket
+// Outputs      : NULL
+
+void *server_connection(void *arg) {
+
+	struct serverframe frame;
+	RAIDOpCode op, response;
+	uint64_t length, answerLength;
+	char *payload;
+	int fd = (int)(intptr_t)arg;
+	int i;
+
+	payload = malloc(SERVER_PAYLOAD);
+
+	while (payload != NULL){
+
+		if (server_recv(fd, &frame, sizeof(frame)))
+			break;
+		op = ntohll64(frame.opcode);
+		length = ntohll64(frame.length);
+
+		if (length > SERVER_PAYLOAD || server_recv(fd, payload, length))
+			break;
+
+		response = server_execute(op, payload, length, &answerLength);
+
+		frame.opcode = htonll64(response);
+		frame.length = htonll64(answerLength);
+		if (server_send(fd, &frame, sizeof(frame)) || server_send(fd, payload, answerLength))
+			break;
+	}
+
+	free(payload);
+
+	//Forget the socket before closing it, its number may be reused right away
+	pthread_mutex_lock(&serverLock);
+	for (i = 0; i < connectionCount; i++){
+		if (serverConnections[i] == fd){
+			serverConnections[i] = serverConnections[--connectionCount];
+			break;
+		}
+	}
+	close(fd);
+	pthread_cond_broadcast(&serverIdle);
+	pthread_mutex_unlock(&serverLock);
+
+	return (NULL);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : server_execute
+// Description  : Runs one request against the disks. READ and WRITE answer
+//                with as many blocks as they asked for, even on failure, as
+//                the stock server does.
+//
+// Inputs       : op - the request
+//                payload - the data of the request, the data of the answer
+//                          is left here
+//                length - bytes of data in the request
+//                answerLength - returns the bytes of data of the answer
+// Outputs      : the response opcode
+
+RAIDOpCode server_execute(RAIDOpCode op, char *payload, uint64_t length, uint64_t *answerLength) {
+
+	uint8_t type = RAID_OP_TYPE(op), disk = RAID_OP_DISK(op), target;
+	uint32_t blocks = RAID_OP_BLOCKS(op), id = RAID_OP_ID(op), targetId;
+	uint64_t word, targets[RAID_MIRROR_TARGETS];
+	uint32_t stall = 0;
+	int failed = 0, i, extra;
+
+	*answerLength = 0;
+	if (type == RAID_READ || type == RAID_WRITE)
+		*answerLength = (uint64_t)blocks * RAID_BLOCK_SIZE;
+
+	pthread_mutex_lock(&serverLock);
+
+	//Pick the requests to stall while the lock is held, sleep once it is not
+	if ((type == RAID_READ || type == RAID_WRITE) && disk < RAID_DISKS && serverDisks[disk].stallUsec){
+		if (++serverDisks[disk].stallCount >= serverDisks[disk].stallEvery){
+			serverDisks[disk].stallCount = 0;
+			stall = serverDisks[disk].stallUsec;
+		}
+	}
+
+	switch (type){
+
+	case RAID_INIT:
+		for (i = 0; i < RAID_DISKS; i++)
+			if (!serverDisks[i].dead)
+				serverDisks[i].status = RAID_DISK_READY;
+		break;
+
+	case RAID_FORMAT:
+		if (disk >= RAID_DISKS || serverDisks[disk].dead){
+			failed = 1;
+			break;
+		}
+		memset(serverDisks[disk].blocks, 0, (size_t)RAID_DISKBLOCKS * RAID_BLOCK_SIZE);
+		serverDisks[disk].status = RAID_DISK_READY;
+		break;
+
+	case RAID_READ:
+		failed = server_range(op, disk, id);
+		if (length < *answerLength)
+			memset(payload, 0, *answerLength);
+		if (!failed)
+			memcpy(payload, serverDisks[disk].blocks + (size_t)id * RAID_BLOCK_SIZE, *answerLength);
+		break;
+
+	case RAID_WRITE:
+		failed = server_range(op, disk, id) || length != *answerLength;
+		if (!failed)
+			memcpy(serverDisks[disk].blocks + (size_t)id * RAID_BLOCK_SIZE, payload, *answerLength);
+		break;
+
+	case RAID_CLOSE:
+		break;
+
+	case RAID_STATUS:
+		if (disk >= RAID_DISKS){
+			failed = 1;
+			break;
+		}
+		op = (op & ~(RAIDOpCode)0xFFFFFFFF) | (uint32_t)serverDisks[disk].status;
+		break;
+
+	case RAID_COPY:
+		if (length != RAID_COPY_PAYLOAD){
+			failed = 1;
+			break;
+		}
+		memcpy(&word, payload, sizeof(word));
+		word = ntohll64(word);
+		target = word >> 32;
+		targetId = (uint32_t)word;
+
+		failed = server_range(op, disk, id) || server_range(op, target, targetId);
+		if (!failed)
+			memmove(serverDisks[target].blocks + (size_t)targetId * RAID_BLOCK_SIZE,
+					serverDisks[disk].blocks + (size_t)id * RAID_BLOCK_SIZE, (size_t)blocks * RAID_BLOCK_SIZE);
+		break;
+
+	case RAID_MIRROR_WRITE:
+		extra = RAID_OP_TARGETS(op);
+		if (extra > RAID_MIRROR_TARGETS-1 || length != extra * sizeof(uint64_t) + (uint64_t)blocks * RAID_BLOCK_SIZE){
+			failed = 1;
+			break;
+		}
+
+		//Every target is checked before any of them is written
+		targets[0] = RAID_COPY_TARGET(disk, id);
+		for (i = 1; i <= extra; i++){
+			memcpy(&word, payload + (i-1) * sizeof(uint64_t), sizeof(word));
+			targets[i] = ntohll64(word);
+			failed |= server_range(op, targets[i] >> 32, (uint32_t)targets[i]);
+		}
+		failed |= server_range(op, disk, id);
+		if (failed)
+			break;
+
+		for (i = 0; i <= extra; i++)
+			memcpy(serverDisks[targets[i] >> 32].blocks + (size_t)(uint32_t)targets[i] * RAID_BLOCK_SIZE,
+					payload + extra * sizeof(uint64_t), (size_t)blocks * RAID_BLOCK_SIZE);
+		break;
+
+	//Unknown requests fail, that is how a client probes for extensions
+	default:
+		failed = 1;
+		break;
+	}
+
+	pthread_mutex_unlock(&serverLock);
+
+	if (stall)
+		server_stall(stall);
+
+	//Set the status bit of a failed request
+	if (failed)
+		op |= (RAIDOpCode)1 << 32;
+
+	return (op);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : server_stall
+// Description  : Holds the answer of a request back, signals do not cut the
+//                delay short
+//
+// Inputs       : usec - the delay
+// Outputs      : none
+
+void server_stall(uint32_t usec) {
+
+	struct timespec delay;
+
+	delay.tv_sec = usec / 1000000;
+	delay.tv_nsec = (long)(usec % 1000000) * 1000;
+	while (nanosleep(&delay, &delay) == -1 && errno == EINTR)
+		;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : server_range
+// Description  : Checks that the blocks of a request exist on a ready disk
+//
+// Inputs       : op - the request
+//                disk - the disk
+//                id - the first block
+// Outputs      : 0 if valid, 1 if not
+
+int server_range(RAIDOpCode op, uint8_t disk, uint32_t id) {
+
+	if (disk >= RAID_DISKS || serverDisks[disk].status != RAID_DISK_READY)
+		return (1);
+
+	if ((uint64_t)id + RAID_OP_BLOCKS(op) > RAID_DISKBLOCKS)
+		return (1);
+
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : server_recv
+// Description  : Reads exactly len bytes from a socket
+//
+// Inputs       : fd - the socket
+//                buf - where to read
+//                len - bytes to read
+// Outputs      : 0 if successful, -1 if failure
+
+int server_recv(int fd, void *buf, size_t len) {
+
+	size_t got = 0;
+	ssize_t n;
+
+	while (got < len){
+		n = read(fd, (char *)buf + got, len - got);
+		if (n == -1 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return (-1);
+		got += n;
+	}
+
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : server_send
+// Description  : Writes exactly len bytes to a socket
+//
+// Inputs       : fd - the socket
+//                buf - what to write
+//                len - bytes to write
+// Outputs      : 0 if successful, -1 if failure
+
+int server_send(int fd, const void *buf, size_t len) {
+
+	size_t sent = 0;
+	ssize_t n;
+
+	while (sent < len){
+		n = send(fd, (const char *)buf + sent, len - sent, MSG_NOSIGNAL);
+		if (n == -1 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return (-1);
+		sent += n;
+	}
+
+	return (0);
+}
@@ -0,0 +1,357 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : raid_pool.c
+//  Description    : This is the implementation of the pool of block buffers
+//                   used by the TAGLINE driver, the cache and the RAID client.
+//                   Buffers are created on first use and never freed until
+//                   raid_pool_close, so steady-state I/O does no malloc/free.
+//
+//  Author         : agent
+//  Last Modified  : 10/18/2026
+//
+
+// Includes
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+// Project includes
+#include <cmpsc311_log.h>
+#include <raid_pool.h>
+
+
+//Definitions
+
+//Two classes of buffers: single blocks and multi-block buffers
+#define POOL_CLASSES         2
+#define POOL_BLOCK_CLASS     0
+#define POOL_MULTI_CLASS     1
+
+//Maximum number of pooled buffers of each class, past that buffers are plain allocations
+#define POOL_BLOCK_BUFFERS   8192
+#define POOL_MULTI_BUFFERS   64
+
+//Buffers each thread keeps for itself before touching the shared lists
+#define POOL_THREAD_CACHE    16
+
+//Every buffer is preceded by a header (one cache line, so data stays aligned)
+#define POOL_HEADER          RAID_POOL_ALIGNMENT
+#define POOL_UNPOOLED        0xFFFFFFFFu
+
+
+//Structures
+
+//Header in front of the data of each buffer
+struct poolheader
+{
+	uint32_t poolClass;
+	uint32_t index; //Slot in the class, POOL_UNPOOLED if not part of the pool
+};
+
+//Free list of a class, a lock-free stack of slot indexes. The head packs a
+//version counter (upper 32 bits) with index+1 (lower 32 bits, 0 is empty)
+//so a pop can never succeed on a head that was popped and pushed back (ABA).
+struct poolclass
+{
+	uint32_t capacity;
+	size_t size;
+	_Atomic uint64_t head;
+	_Atomic uint32_t created;
+	_Atomic uint32_t *next;
+	void **buffers;
+};
+
+//Per thread cache of free buffers, only valid while generation is the one
+//of the pool (raid_pool_close frees every buffer and starts a new one)
+struct poolcache
+{
+	uint32_t generation;
+	int count[POOL_CLASSES];
+	void *buffers[POOL_CLASSES][POOL_THREAD_CACHE];
+};
+
+
+//Global Variables
+
+_Atomic uint32_t blockNext[POOL_BLOCK_BUFFERS];
+_Atomic uint32_t multiNext[POOL_MULTI_BUFFERS];
+void *blockBuffers[POOL_BLOCK_BUFFERS];
+void *multiBuffers[POOL_MULTI_BUFFERS];
+
+struct poolclass pools[POOL_CLASSES] = {
+	{ POOL_BLOCK_BUFFERS, RAID_BLOCK_SIZE, 0, 0, blockNext, blockBuffers },
+	{ POOL_MULTI_BUFFERS, (size_t)RAID_BLOCK_SIZE * RAID_POOL_MULTI_BLOCKS, 0, 0, multiNext, multiBuffers }
+};
+
+//Buffers handed out and not given back yet, and the generation of the pool
+_Atomic uint32_t poolOutstanding = 0;
+_Atomic uint32_t poolGeneration = 1;
+
+__thread struct poolcache threadCache;
+pthread_key_t threadKey;
+pthread_once_t threadKeyOnce = PTHREAD_ONCE_INIT;
+
+
+//Functions Prototypes
+void pool_push(struct poolclass *, uint32_t);
+uint32_t pool_pop(struct poolclass *);
+void pool_flush_thread(void *);
+void pool_check_cache(void);
+void pool_make_key(void);
+
+
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : raid_pool_get
+// Description  : Get a buffer from the pool, first from the thread cache, then
+//                from the shared free list and only if both are empty create
+//                a new one
+//
+// Inputs       : blocks - the number of blocks the buffer has to hold
+// Outputs      : pointer to the buffer, NULL if failure
+void * raid_pool_get(uint32_t blocks) {
+
+	struct poolclass *pool;
+	struct poolheader *header;
+	uint32_t index;
+	int poolClass;
+	void *base;
+
+	if (blocks == 0 || blocks > RAID_POOL_MULTI_BLOCKS)
+		return (NULL);
+
+	poolClass = (blocks == 1) ? POOL_BLOCK_CLASS : POOL_MULTI_CLASS;
+	pool = &pools[poolClass];
+	pool_check_cache();
+
+	//Fast path, nobody else touches the thread cache
+	if (threadCache.count[poolClass] > 0){
+		atomic_fetch_add_explicit(&poolOutstanding, 1, memory_order_relaxed);
+		return (threadCache.buffers[poolClass][--threadCache.count[poolClass]]);
+	}
+
+	//Shared free list
+	index = pool_pop(pool);
+	if (index != POOL_UNPOOLED){
+		atomic_fetch_add_explicit(&poolOutstanding, 1, memory_order_relaxed);
+		return ((char *)pool->buffers[index] + POOL_HEADER);
+	}
+
+	//Create a new buffer, claiming a slot if there is one left
+	index = atomic_fetch_add(&pool->created, 1);
+	if (index >= pool->capacity){
+		atomic_fetch_sub(&pool->created, 1);
+		index = POOL_UNPOOLED;
+	}
+
+	if (posix_memalign(&base, RAID_POOL_ALIGNMENT, POOL_HEADER + pool->size)){
+		if (index != POOL_UNPOOLED)
+			atomic_fetch_sub(&pool->created, 1);
+		return (NULL);
+	}
+
+	header = (struct poolheader *)base;
+	header->poolClass = poolClass;
+	header->index = index;
+	if (index != POOL_UNPOOLED)
+		pool->buffers[index] = base;
+
+	atomic_fetch_add_explicit(&poolOutstanding, 1, memory_order_relaxed);
+	return ((char *)base + POOL_HEADER);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : raid_pool_put
+// Description  : Give a buffer back, it goes to the thread cache and when that
+//                is full half of the cache moves to the shared free list
+//
+// Inputs       : buf - the buffer obtained with raid_pool_get
+// Outputs      : none
+void raid_pool_put(void *buf) {
+
+	struct poolheader *header;
+	struct poolclass *pool;
+	int poolClass, i;
+
+	if (buf == NULL)
+		return;
+
+	header = (struct poolheader *)((char *)buf - POOL_HEADER);
+	poolClass = header->poolClass;
+	pool = &pools[poolClass];
+	pool_check_cache();
+	atomic_fetch_sub_explicit(&poolOutstanding, 1, memory_order_relaxed);
+
+	//Buffers past the capacity of the pool are just freed
+	if (header->index == POOL_UNPOOLED){
+		free(header);
+		return;
+	}
+
+	//Make sure the cache goes back to the pool when the thread exits
+	if (threadCache.count[POOL_BLOCK_CLASS] + threadCache.count[POOL_MULTI_CLASS] == 0){
+		pthread_once(&threadKeyOnce, pool_make_key);
+		pthread_setspecific(threadKey, &threadCache);
+	}
+
+	if (threadCache.count[poolClass] == POOL_THREAD_CACHE){
+		for (i = 0; i < POOL_THREAD_CACHE/2; i++){
+			header = (struct poolheader *)((char *)threadCache.buffers[poolClass][--threadCache.count[poolClass]] - POOL_HEADER);
+			pool_push(pool, header->index);
+		}
+	}
+
+	threadCache.buffers[poolClass][threadCache.count[poolClass]++] = buf;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : raid_pool_close
+// Description  : Free every buffer created by the pool. Every buffer has to be
+//                back and every other thread that used the pool joined; the
+//                caches such threads left behind are dropped, not reused,
+//                since the pool starts a new generation.
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+int raid_pool_close(void) {
+
+	struct poolclass *pool;
+	uint32_t i, created, outstanding;
+	int poolClass;
+
+	//Freeing a buffer still in use would hand it out twice later
+	outstanding = atomic_load(&poolOutstanding);
+	if (outstanding != 0){
+		logMessage(LOG_ERROR_LEVEL, "RAID pool: %u buffers were not given back, not closing", outstanding);
+		return (-1);
+	}
+
+	//The buffers cached by this thread are free too
+	pool_flush_thread(&threadCache);
+
+	for (poolClass = 0; poolClass < POOL_CLASSES; poolClass++){
+		pool = &pools[poolClass];
+		created = atomic_load(&pool->created);
+
+		for (i = 0; i < created; i++){
+			free(pool->buffers[i]);
+			pool->buffers[i] = NULL;
+		}
+
+		atomic_store(&pool->created, 0);
+		atomic_store(&pool->head, 0);
+	}
+
+	//Buffers still in the caches of other threads are gone now
+	atomic_fetch_add(&poolGeneration, 1);
+
+	// Return successfully
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : pool_push
+// Description  : Push a slot on the free list of a class
+//
+// Inputs       : pool - the class
+//                index - the slot to push
+// Outputs      : none
+void pool_push(struct poolclass *pool, uint32_t index) {
+
+	uint64_t head, newHead;
+
+	head = atomic_load(&pool->head);
+	do {
+		atomic_store(&pool->next[index], (uint32_t)head);
+		newHead = ((head >> 32) + 1) << 32 | (index + 1);
+	} while (!atomic_compare_exchange_weak(&pool->head, &head, newHead));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : pool_pop
+// Description  : Pop a slot from the free list of a class
+//
+// Inputs       : pool - the class
+// Outputs      : the slot, POOL_UNPOOLED if the list is empty
+uint32_t pool_pop(struct poolclass *pool) {
+
+	uint64_t head, newHead;
+	uint32_t index;
+
+	head = atomic_load(&pool->head);
+	do {
+		if ((uint32_t)head == 0)
+			return (POOL_UNPOOLED);
+		index = (uint32_t)head - 1;
+		newHead = ((head >> 32) + 1) << 32 | atomic_load(&pool->next[index]);
+	} while (!atomic_compare_exchange_weak(&pool->head, &head, newHead));
+
+	return (index);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : pool_flush_thread
+// Description  : Move all the buffers cached by a thread to the free lists,
+//                runs when a thread that used the pool exits
+//
+// Inputs       : cache - the thread cache
+// Outputs      : none
+void pool_flush_thread(void *cache) {
+
+	struct poolcache *threadBuffers = (struct poolcache *)cache;
+	struct poolheader *header;
+	int poolClass;
+
+	//A cache from before the last raid_pool_close holds freed buffers
+	if (threadBuffers->generation != atomic_load(&poolGeneration)){
+		for (poolClass = 0; poolClass < POOL_CLASSES; poolClass++)
+			threadBuffers->count[poolClass] = 0;
+		return;
+	}
+
+	for (poolClass = 0; poolClass < POOL_CLASSES; poolClass++){
+		while (threadBuffers->count[poolClass] > 0){
+			header = (struct poolheader *)((char *)threadBuffers->buffers[poolClass][--threadBuffers->count[poolClass]] - POOL_HEADER);
+			pool_push(&pools[poolClass], header->index);
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : pool_check_cache
+// Description  : Drop the cache of this thread if the pool was closed since it
+//                was filled, its buffers were freed with the pool
+//
+// Inputs       : none
+// Outputs      : none
+void pool_check_cache(void) {
+
+	uint32_t generation = atomic_load(&poolGeneration);
+
+	if (threadCache.generation != generation){
+		threadCache.count[POOL_BLOCK_CLASS] = 0;
+		threadCache.count[POOL_MULTI_CLASS] = 0;
+		threadCache.generation = generation;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : pool_make_key
+// Description  : Create the key that flushes thread caches on thread exit
+//
+// Inputs       : none
+// Outputs      : none
+void pool_make_key(void) {
+
+	if (pthread_key_create(&threadKey, pool_flush_thread))
+		logMessage(LOG_ERROR_LEVEL, "RAID pool: unable to register thread caches");
+}
@@ -0,0 +1,37 @@
+#ifndef RAID_POOL_INCLUDED
+#define RAID_POOL_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : raid_pool.h
+//  Description    : This is the interface of the pool of block buffers shared
+//                   by the TAGLINE driver, the cache and the RAID client.
+//
+//  Author         : agent
+//  Last Modified  : 10/18/2026
+//
+
+// Include Files
+#include <stdint.h>
+
+// Project Include Files
+#include <raid_bus.h>
+
+// Defines
+#define RAID_POOL_MULTI_BLOCKS   255   // Blocks in a multi-block buffer (largest RAID op)
+#define RAID_POOL_ALIGNMENT      64    // Alignment of every buffer (one cache line)
+
+//
+// Interface
+
+void * raid_pool_get(uint32_t blocks);
+	// Get a buffer of at least blocks * RAID_BLOCK_SIZE bytes, NULL if failure
+
+void raid_pool_put(void *buf);
+	// Give a buffer obtained with raid_pool_get back to the pool
+
+int raid_pool_close(void);
+	// Free every buffer of the pool, 0 if successful, -1 (nothing freed) if
+	// some are still out. Other threads that used the pool must be joined.
+
+#endif
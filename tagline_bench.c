@@ -0,0 +1,226 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : tagline_bench.c
+//  Description    : This is the benchmark of hedged reads. Taglines are
+//                   appended and then read one block at a time in a random
+//                   order while the local stand-in server answers some of the
+//                   requests of every disk late. The same reads are run with
+//                   hedging off and at the given percentile, each in a
+//                   process of its own, and their total time and latencies
+//                   are printed. It is linked with the driver sources in
+//                   place of the simulator:
+//
+//                   cc -O2 -o tagline_bench tagline_bench.c tagline_driver.c
+//                      tagline_map.c tagline_mirror.c tagline_workers.c
+//                      tagline_rebuild.c tagline_monitor.c tagline_defrag.c
+//                      tagline_rebalance.c tagline_digest.c tagline_stream.c
+//                      tagline_replica.c raid_client.c raid_local_server.c
+//                      raid_pool.c raid_cache.c -lpthread
+//
+//                   tagline_bench [usec [every [reads [percentile]]]]
+//
+//  Author         : agent
+//  Last Modified  : 10/18/2026
+//
+
+// Includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/wait.h>
+
+// Project includes
+#include <raid_network.h>
+#include <raid_ext.h>
+#include <tagline_ext.h>
+
+
+//Definitions
+
+//The array and the taglines read, twice the blocks the cache holds
+#define BENCH_DISKS          4
+#define BENCH_TAGLINES       8
+#define BENCH_BLOCKS         MAX_TAGLINE_BLOCK_NUMBER
+
+//Port of the server of the first run, the second one uses the next one
+#define BENCH_PORT           19900
+
+//Defaults: 5% of the requests of every disk answer 10 ms late
+#define BENCH_STALL_USEC     10000
+#define BENCH_STALL_EVERY    20
+#define BENCH_READS          20000
+#define BENCH_PERCENTILE     90
+
+
+//Global Variables
+
+uint32_t stallUsec = BENCH_STALL_USEC;
+uint32_t stallEvery = BENCH_STALL_EVERY;
+uint32_t benchReads = BENCH_READS;
+int benchPercentile = BENCH_PERCENTILE;
+
+//Latency of every read of a run
+uint64_t *latencies = NULL;
+
+
+//Functions Prototypes
+int bench_run(int, unsigned short);
+int bench_order(const void *, const void *);
+uint64_t bench_now(void);
+
+
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : main
+// Description  : Runs the reads without hedging and with it
+//
+// Inputs       : argc - the number of arguments
+//                argv - stall delay, one request in every stalled, reads and
+//                       hedging percentile, all optional
+// Outputs      : 0 if successful, 1 if failure
+
+int main(int argc, char *argv[]) {
+
+	int run, status, failed = 0;
+	pid_t pid;
+
+	if (argc > 1)
+		stallUsec = atoi(argv[1]);
+	if (argc > 2)
+		stallEvery = atoi(argv[2]);
+	if (argc > 3)
+		benchReads = atoi(argv[3]);
+	if (argc > 4)
+		benchPercentile = atoi(argv[4]);
+	if (stallEvery == 0 || benchReads == 0 || benchPercentile < 1 || benchPercentile > 99){
+		fprintf(stderr, "usage: %s [usec [every [reads [percentile]]]]\n", argv[0]);
+		return (1);
+	}
+
+	printf("%u reads, one request of every disk in %u answered %u usec late\n",
+			benchReads, stallEvery, stallUsec);
+	printf("%-10s %10s %10s %10s %10s %10s\n", "hedging", "total ms", "p50 usec", "p99 usec", "p99.9 usec", "max usec");
+
+	for (run = 0; run < 2; run++){
+
+		fflush(stdout);
+		pid = fork();
+		if (pid == -1)
+			return (1);
+
+		if (pid == 0){
+			status = bench_run(run ? benchPercentile : 0, BENCH_PORT + run);
+			fflush(stdout);
+			_exit(status);
+		}
+
+		waitpid(pid, &status, 0);
+		if (!WIFEXITED(status) || WEXITSTATUS(status))
+			failed = 1;
+	}
+
+	return (failed);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_run
+// Description  : Appends the taglines, reads them once to give the client
+//                its latency history, then times the stalled reads
+//
+// Inputs       : percentile - the hedging percentile, 0 for none
+//                port - the port of the server
+// Outputs      : 0 if successful, 1 if failure
+
+int bench_run(int percentile, unsigned short port) {
+
+	char buf[TAGLINE_BLOCK_SIZE], label[16];
+	uint64_t start, total;
+	TagLineNumber tag;
+	TagLineBlockNumber bnum;
+	uint32_t i;
+	uint8_t disk;
+
+	latencies = (uint64_t *) malloc(benchReads * sizeof(uint64_t));
+	raid_network_port = port;
+	if (latencies == NULL || raid_local_server_start(port)
+			|| tagline_set_disks(BENCH_DISKS) || tagline_driver_init(BENCH_TAGLINES)){
+		printf("unable to start the driver\n");
+		return (1);
+	}
+
+	for (tag = 0; tag < BENCH_TAGLINES; tag++){
+		for (bnum = 0; bnum < BENCH_BLOCKS; bnum++){
+			memset(buf, tag + bnum, TAGLINE_BLOCK_SIZE);
+			if (tagline_write(tag, bnum, 1, buf) || tagline_read(tag, bnum, 1, buf))
+				return (1);
+		}
+	}
+
+	for (disk = 0; disk < BENCH_DISKS; disk++)
+		raid_local_server_stall(disk, stallUsec, stallEvery);
+	tagline_set_hedging(percentile);
+
+	//Both runs read the same blocks in the same order
+	srand(1);
+	start = bench_now();
+	for (i = 0; i < benchReads; i++){
+		tag = rand() % BENCH_TAGLINES;
+		bnum = rand() % BENCH_BLOCKS;
+		latencies[i] = bench_now();
+		if (tagline_read(tag, bnum, 1, buf))
+			return (1);
+		latencies[i] = bench_now() - latencies[i];
+	}
+	total = bench_now() - start;
+
+	qsort(latencies, benchReads, sizeof(uint64_t), bench_order);
+	if (percentile)
+		snprintf(label, sizeof(label), "p%d", percentile);
+	else
+		snprintf(label, sizeof(label), "off");
+	printf("%-10s %10lu %10lu %10lu %10lu %10lu\n", label, (unsigned long)(total / 1000),
+			(unsigned long)latencies[benchReads / 2], (unsigned long)latencies[(uint64_t)benchReads * 99 / 100],
+			(unsigned long)latencies[(uint64_t)benchReads * 999 / 1000], (unsigned long)latencies[benchReads - 1]);
+
+	tagline_close();
+	raid_local_server_stop();
+	free(latencies);
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_order
+// Description  : Orders two latencies for qsort
+//
+// Inputs       : a - the first latency
+//                b - the second latency
+// Outputs      : -1, 0 or 1
+
+int bench_order(const void *a, const void *b) {
+
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return ((x > y) - (x < y));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_now
+// Description  : The monotonic clock in microseconds
+//
+// Inputs       : none
+// Outputs      : the time
+
+uint64_t bench_now(void) {
+
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return ((uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000);
+}
@@ -0,0 +1,687 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : tagline_daemon.c
+//  Description    : This is the implementation of the TAGLINE daemon. One
+//                   thread owns the driver and serves every client: it waits
+//                   for requests on all the connections, takes everything
+//                   that arrived as one batch, runs it sorted by tagline and
+//                   block, merging requests that continue each other into one
+//                   driver call, and then answers the whole batch. Blocks are
+//                   exchanged through a buffer shared with each client.
+//
+//  Author         : agent
+//  Last Modified  : 10/18/2026
+//
+
+#define _GNU_SOURCE
+
+// Includes
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+
+// Project includes
+#include <cmpsc311_log.h>
+#include <raid_pool.h>
+#include <tagline_daemon.h>
+
+
+//Definitions
+
+//Bytes of the buffer shared with a client
+#define DAEMON_BUFFER_SIZE   ((size_t)TAGLINE_DAEMON_BLOCKS * TAGLINE_BLOCK_SIZE)
+
+
+//Structures
+
+//A connected client
+struct daemonclient
+{
+	int fd;
+	char *buffer;
+	int status; //Answer to the request of the current batch
+	struct tagline_daemon_request request;
+	size_t received; //Bytes of the request read so far
+};
+
+
+//Global Variables
+
+//Daemon side
+struct daemonclient daemonClients[TAGLINE_DAEMON_CLIENTS];
+int daemonClientCount = 0;
+int daemonListen = -1;
+int daemonWake[2] = { -1, -1 };
+int daemonRunning = 0;
+pthread_t daemonThread;
+uint32_t daemonLines = 0;
+char *daemonPath = NULL;
+char *daemonStage = NULL;
+
+//Requests served and driver calls made for them
+uint64_t daemonRequests = 0, daemonCalls = 0, daemonBatches = 0;
+
+//Client side
+int daemonSocket = -1;
+char *daemonBuffer = NULL;
+pthread_mutex_t daemonClientLock = PTHREAD_MUTEX_INITIALIZER;
+
+
+//Functions Prototypes
+void *daemon_schedule(void *);
+void daemon_accept(void);
+int daemon_receive(struct daemonclient *);
+void daemon_execute(int *, int);
+int daemon_order(const void *, const void *);
+void daemon_drop(struct daemonclient *);
+int daemon_request(uint32_t, TagLineNumber, TagLineBlockNumber, uint8_t);
+
+
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_daemon_start
+// Description  : Initializes the driver and starts serving it on a Unix
+//                socket, from then on only the daemon thread uses the driver
+//
+// Inputs       : path - the path of the socket, replaced if it exists
+//                maxlines - the number of taglines, as tagline_driver_init
+// Outputs      : 0 if successful, -1 if failure
+
+int tagline_daemon_start(const char *path, uint32_t maxlines) {
+
+	struct sockaddr_un saddr;
+
+	if (daemonRunning || strlen(path) >= sizeof(saddr.sun_path))
+		return (-1);
+
+	if (tagline_driver_init(maxlines))
+		return (-1);
+	daemonLines = maxlines;
+
+	daemonPath = strdup(path);
+	daemonStage = (char *) raid_pool_get(TAGLINE_DAEMON_BLOCKS);
+	if (daemonPath == NULL || daemonStage == NULL || pipe(daemonWake) == -1){
+		tagline_daemon_stop();
+		return (-1);
+	}
+
+	daemonListen = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (daemonListen == -1){
+		tagline_daemon_stop();
+		return (-1);
+	}
+
+	memset(&saddr, 0, sizeof(saddr));
+	saddr.sun_family = AF_UNIX;
+	strcpy(saddr.sun_path, path);
+	unlink(path);
+
+	if (bind(daemonListen, (struct sockaddr *)&saddr, sizeof(saddr)) == -1
+			|| listen(daemonListen, TAGLINE_DAEMON_CLIENTS) == -1){
+		logMessage(LOG_ERROR_LEVEL, "TAGLINE daemon: unable to listen on %s", path);
+		tagline_daemon_stop();
+		return (-1);
+	}
+
+	daemonRunning = 1;
+	if (pthread_create(&daemonThread, NULL, daemon_schedule, NULL)){
+		daemonRunning = 0;
+		tagline_daemon_stop();
+		return (-1);
+	}
+
+	logMessage(LOG_INFO_LEVEL, "TAGLINE daemon: serving %u taglines on %s", maxlines, path);
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_daemon_stop
+// Description  : Stops the daemon thread, disconnects every client and closes
+//                the driver
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int tagline_daemon_stop(void) {
+
+	int ret = 0;
+
+	if (daemonRunning){
+		if (write(daemonWake[1], "", 1) != 1)
+			ret = -1;
+		pthread_join(daemonThread, NULL);
+		daemonRunning = 0;
+	}
+
+	while (daemonClientCount > 0)
+		daemon_drop(&daemonClients[0]);
+
+	if (daemonListen != -1){
+		close(daemonListen);
+		daemonListen = -1;
+		unlink(daemonPath);
+	}
+
+	if (daemonWake[0] != -1){
+		close(daemonWake[0]);
+		close(daemonWake[1]);
+		daemonWake[0] = daemonWake[1] = -1;
+	}
+
+	if (daemonRequests > 0)
+		logMessage(LOG_OUTPUT_LEVEL, "TAGLINE daemon: %lu requests in %lu batches, %lu driver calls",
+				(unsigned long)daemonRequests, (unsigned long)daemonBatches, (unsigned long)daemonCalls);
+
+	raid_pool_put(daemonStage);
+	daemonStage = NULL;
+	free(daemonPath);
+	daemonPath = NULL;
+
+	if (tagline_close())
+		ret = -1;
+
+	return (ret);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : daemon_schedule
+// Description  : The daemon thread. Waits on every connection, the requests
+//                that arrived together are run as one batch.
+//
+// Inputs       : arg - unused
+// Outputs      : NULL
+
+void *daemon_schedule(void *arg) {
+
+	struct pollfd fds[TAGLINE_DAEMON_CLIENTS + 2];
+	int batch[TAGLINE_DAEMON_CLIENTS];
+	int i, count, polled;
+
+	while (1){
+
+		fds[0].fd = daemonWake[0];
+		fds[0].events = POLLIN;
+		fds[1].fd = daemonListen;
+		fds[1].events = POLLIN;
+		for (i = 0; i < daemonClientCount; i++){
+			fds[i+2].fd = daemonClients[i].fd;
+			fds[i+2].events = POLLIN;
+		}
+		polled = daemonClientCount;
+
+		if (poll(fds, polled + 2, -1) == -1){
+			if (errno == EINTR)
+				continue;
+			logMessage(LOG_ERROR_LEVEL, "TAGLINE daemon: poll failed");
+			break;
+		}
+
+		//Stopping
+		if (fds[0].revents)
+			break;
+
+		//Every whole request that is ready goes in the batch, closed clients
+		//are left with no socket and dropped once the batch is answered
+		count = 0;
+		for (i = 0; i < polled; i++){
+			if (fds[i+2].revents == 0)
+				continue;
+			switch (daemon_receive(&daemonClients[i])){
+			case 0:
+				batch[count++] = i;
+				break;
+			case -1:
+				close(daemonClients[i].fd);
+				daemonClients[i].fd = -1;
+				break;
+			}
+		}
+
+		if (count > 0)
+			daemon_execute(batch, count);
+
+		for (i = daemonClientCount - 1; i >= 0; i--){
+			if (daemonClients[i].fd == -1)
+				daemon_drop(&daemonClients[i]);
+		}
+
+		if (fds[1].revents & POLLIN)
+			daemon_accept();
+	}
+
+	return (NULL);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : daemon_accept
+// Description  : Takes a new client, creates the buffer it shares with the
+//                daemon and hands it over with the socket (SCM_RIGHTS)
+//
+// Inputs       : none
+// Outputs      : none
+
+void daemon_accept(void) {
+
+	struct daemonclient *client;
+	char control[CMSG_SPACE(sizeof(int))];
+	struct cmsghdr *cmsg;
+	struct msghdr msg;
+	struct iovec iov;
+	int fd, memfd;
+	char hello = 0;
+
+	fd = accept4(daemonListen, NULL, NULL, SOCK_CLOEXEC);
+	if (fd == -1)
+		return;
+
+	if (daemonClientCount == TAGLINE_DAEMON_CLIENTS){
+		logMessage(LOG_WARNING_LEVEL, "TAGLINE daemon: too many clients, connection refused");
+		close(fd);
+		return;
+	}
+
+	//The buffer is created by the daemon and sealed at its size, a client can
+	//not shrink it under the daemon (which would fault on the mapping)
+	memfd = memfd_create("tagline", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (memfd == -1 || ftruncate(memfd, DAEMON_BUFFER_SIZE) == -1
+			|| fcntl(memfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) == -1){
+		if (memfd != -1)
+			close(memfd);
+		close(fd);
+		return;
+	}
+
+	client = &daemonClients[daemonClientCount];
+	client->buffer = mmap(NULL, DAEMON_BUFFER_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+	if (client->buffer == MAP_FAILED){
+		close(memfd);
+		close(fd);
+		return;
+	}
+
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base = &hello;
+	iov.iov_len = 1;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg), &memfd, sizeof(int));
+
+	if (sendmsg(fd, &msg, MSG_NOSIGNAL) != 1){
+		munmap(client->buffer, DAEMON_BUFFER_SIZE);
+		close(memfd);
+		close(fd);
+		return;
+	}
+	close(memfd);
+
+	client->fd = fd;
+	client->received = 0;
+	daemonClientCount++;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : daemon_receive
+// Description  : Reads what arrived of the request of a client whose socket
+//                is ready, without waiting for the rest: a client that sends
+//                part of a request does not hold up the others
+//
+// Inputs       : client - the client
+// Outputs      : 0 if the request is whole, 1 if not yet, -1 if the client
+//                is gone
+
+int daemon_receive(struct daemonclient *client) {
+
+	ssize_t n;
+
+	do {
+		n = recv(client->fd, (char *)&client->request + client->received,
+				sizeof(client->request) - client->received, MSG_DONTWAIT);
+	} while (n == -1 && errno == EINTR);
+
+	if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+		return (1);
+	if (n <= 0)
+		return (-1);
+
+	client->received += n;
+	if (client->received < sizeof(client->request))
+		return (1);
+	client->received = 0;
+
+	//Bad requests are answered with a failure without going to the driver
+	client->status = client->request.blocks == 0 || client->request.blocks > TAGLINE_DAEMON_BLOCKS
+			|| client->request.tag >= daemonLines
+			|| (client->request.type != TAGLINE_DAEMON_READ && client->request.type != TAGLINE_DAEMON_WRITE);
+
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : daemon_execute
+// Description  : Runs a batch of requests and answers them. Sorting by
+//                tagline and block puts appends from different clients in
+//                order and next to each other, so requests of the same type
+//                that continue each other become one driver call through the
+//                staging buffer.
+//
+// Inputs       : batch - the clients with a request
+//                count - the number of clients in the batch
+// Outputs      : none
+
+void daemon_execute(int *batch, int count) {
+
+	struct tagline_daemon_request *first, *next;
+	struct daemonclient *client;
+	uint32_t blocks, offset;
+	int i, j, k, valid, status;
+	int32_t answer;
+
+	daemonBatches++;
+	daemonRequests += count;
+
+	//Bad requests go last and are not run
+	qsort(batch, count, sizeof(int), daemon_order);
+	for (valid = 0; valid < count && daemonClients[batch[valid]].status == 0; valid++)
+		;
+
+	for (i = 0; i < valid; i = j){
+
+		first = &daemonClients[batch[i]].request;
+		blocks = first->blocks;
+		for (j = i + 1; j < valid; j++){
+			next = &daemonClients[batch[j]].request;
+			if (next->type != first->type || next->tag != first->tag || next->bnum != first->bnum + blocks
+					|| blocks + next->blocks > TAGLINE_DAEMON_BLOCKS)
+				break;
+			blocks += next->blocks;
+		}
+
+		daemonCalls++;
+
+		//A request on its own works on the buffer of its client
+		if (j == i + 1){
+			client = &daemonClients[batch[i]];
+			if (first->type == TAGLINE_DAEMON_READ)
+				client->status = tagline_read(first->tag, first->bnum, blocks, client->buffer);
+			else
+				client->status = tagline_write(first->tag, first->bnum, blocks, client->buffer);
+			continue;
+		}
+
+		if (first->type == TAGLINE_DAEMON_WRITE){
+			for (k = i, offset = 0; k < j; offset += daemonClients[batch[k]].request.blocks, k++)
+				memcpy(&daemonStage[offset * TAGLINE_BLOCK_SIZE], daemonClients[batch[k]].buffer,
+						daemonClients[batch[k]].request.blocks * TAGLINE_BLOCK_SIZE);
+			status = tagline_write(first->tag, first->bnum, blocks, daemonStage);
+		}
+		else
+			status = tagline_read(first->tag, first->bnum, blocks, daemonStage);
+
+		for (k = i, offset = 0; k < j; offset += daemonClients[batch[k]].request.blocks, k++){
+			client = &daemonClients[batch[k]];
+			client->status = status;
+			if (first->type == TAGLINE_DAEMON_READ && status == 0)
+				memcpy(client->buffer, &daemonStage[offset * TAGLINE_BLOCK_SIZE],
+						client->request.blocks * TAGLINE_BLOCK_SIZE);
+		}
+	}
+
+	for (i = 0; i < count; i++){
+		client = &daemonClients[batch[i]];
+		answer = client->status;
+		if (send(client->fd, &answer, sizeof(answer), MSG_NOSIGNAL) != sizeof(answer)){
+			close(client->fd);
+			client->fd = -1;
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : daemon_order
+// Description  : Order of the requests of a batch: bad ones last, then by
+//                tagline, block and client
+//
+// Inputs       : a, b - the clients to compare
+// Outputs      : <0, 0 or >0 as qsort expects
+
+int daemon_order(const void *a, const void *b) {
+
+	struct daemonclient *x = &daemonClients[*(const int *)a];
+	struct daemonclient *y = &daemonClients[*(const int *)b];
+
+	if (x->status != y->status)
+		return (x->status - y->status);
+	if (x->request.tag != y->request.tag)
+		return (x->request.tag < y->request.tag ? -1 : 1);
+	if (x->request.bnum != y->request.bnum)
+		return (x->request.bnum < y->request.bnum ? -1 : 1);
+
+	return (*(const int *)a - *(const int *)b);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : daemon_drop
+// Description  : Forgets a client, the last one takes its place
+//
+// Inputs       : client - the client
+// Outputs      : none
+
+void daemon_drop(struct daemonclient *client) {
+
+	if (client->fd != -1)
+		close(client->fd);
+	munmap(client->buffer, DAEMON_BUFFER_SIZE);
+
+	*client = daemonClients[--daemonClientCount];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_daemon_connect
+// Description  : Connects this process to the daemon and maps the buffer it
+//                shares with it
+//
+// Inputs       : path - the path of the socket of the daemon
+// Outputs      : 0 if successful, -1 if failure
+
+int tagline_daemon_connect(const char *path) {
+
+	struct sockaddr_un saddr;
+	char control[CMSG_SPACE(sizeof(int))];
+	struct cmsghdr *cmsg;
+	struct msghdr msg;
+	struct iovec iov;
+	int memfd = -1;
+	char hello;
+
+	if (daemonSocket != -1 || strlen(path) >= sizeof(saddr.sun_path))
+		return (-1);
+
+	daemonSocket = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (daemonSocket == -1)
+		return (-1);
+
+	memset(&saddr, 0, sizeof(saddr));
+	saddr.sun_family = AF_UNIX;
+	strcpy(saddr.sun_path, path);
+
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base = &hello;
+	iov.iov_len = 1;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+
+	//The daemon answers the connection with the buffer
+	if (connect(daemonSocket, (struct sockaddr *)&saddr, sizeof(saddr)) == -1
+			|| recvmsg(daemonSocket, &msg, MSG_CMSG_CLOEXEC) != 1){
+		logMessage(LOG_ERROR_LEVEL, "TAGLINE daemon: unable to connect to %s", path);
+		tagline_daemon_disconnect();
+		return (-1);
+	}
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	if (cmsg != NULL && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+		memcpy(&memfd, CMSG_DATA(cmsg), sizeof(int));
+	if (memfd == -1){
+		tagline_daemon_disconnect();
+		return (-1);
+	}
+
+	daemonBuffer = mmap(NULL, DAEMON_BUFFER_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+	close(memfd);
+	if (daemonBuffer == MAP_FAILED){
+		daemonBuffer = NULL;
+		tagline_daemon_disconnect();
+		return (-1);
+	}
+
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_daemon_buffer
+// Description  : The buffer shared with the daemon. Requests given this buffer
+//                are not copied, the daemon reads and writes it directly.
+//
+// Inputs       : none
+// Outputs      : pointer to TAGLINE_DAEMON_BLOCKS blocks, NULL if not connected
+
+char * tagline_daemon_buffer(void) {
+
+	return (daemonBuffer);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_daemon_read
+// Description  : Read a number of blocks of a tagline through the daemon
+//
+// Inputs       : tag - the number of the tagline to read from
+//                bnum - the starting block to read from
+//                blks - the number of blocks to read
+//                buf - memory block to read the blocks into
+// Outputs      : 0 if successful, 1 if failure
+
+int tagline_daemon_read(TagLineNumber tag, TagLineBlockNumber bnum, uint8_t blks, char *buf) {
+
+	int ret;
+
+	pthread_mutex_lock(&daemonClientLock);
+	ret = daemon_request(TAGLINE_DAEMON_READ, tag, bnum, blks);
+	if (ret == 0 && buf != daemonBuffer)
+		memcpy(buf, daemonBuffer, (size_t)blks * TAGLINE_BLOCK_SIZE);
+	pthread_mutex_unlock(&daemonClientLock);
+
+	return (ret);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_daemon_write
+// Description  : Write a number of blocks of a tagline through the daemon
+//
+// Inputs       : tag - the number of the tagline to write to
+//                bnum - the starting block to write to
+//                blks - the number of blocks to write
+//                buf - the blocks to write
+// Outputs      : 0 if successful, 1 if failure
+
+int tagline_daemon_write(TagLineNumber tag, TagLineBlockNumber bnum, uint8_t blks, char *buf) {
+
+	int ret = 1;
+
+	pthread_mutex_lock(&daemonClientLock);
+	if (daemonBuffer != NULL){
+		if (buf != daemonBuffer)
+			memcpy(daemonBuffer, buf, (size_t)blks * TAGLINE_BLOCK_SIZE);
+		ret = daemon_request(TAGLINE_DAEMON_WRITE, tag, bnum, blks);
+	}
+	pthread_mutex_unlock(&daemonClientLock);
+
+	return (ret);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : daemon_request
+// Description  : Sends a request to the daemon and waits for its answer,
+//                called with daemonClientLock held
+//
+// Inputs       : type - TAGLINE_DAEMON_READ or TAGLINE_DAEMON_WRITE
+//                tag, bnum, blks - the blocks of the request
+// Outputs      : 0 if successful, 1 if failure
+
+int daemon_request(uint32_t type, TagLineNumber tag, TagLineBlockNumber bnum, uint8_t blks) {
+
+	struct tagline_daemon_request request;
+	int32_t answer;
+
+	if (daemonSocket == -1 || daemonBuffer == NULL)
+		return (1);
+
+	request.type = type;
+	request.tag = tag;
+	request.bnum = bnum;
+	request.blocks = blks;
+
+	if (send(daemonSocket, &request, sizeof(request), MSG_NOSIGNAL) != sizeof(request)
+			|| recv(daemonSocket, &answer, sizeof(answer), MSG_WAITALL) != sizeof(answer)){
+		logMessage(LOG_ERROR_LEVEL, "TAGLINE daemon: lost the connection to the daemon");
+		return (1);
+	}
+
+	return (answer != 0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_daemon_disconnect
+// Description  : Closes the connection to the daemon and unmaps the buffer
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int tagline_daemon_disconnect(void) {
+
+	pthread_mutex_lock(&daemonClientLock);
+
+	if (daemonBuffer != NULL){
+		munmap(daemonBuffer, DAEMON_BUFFER_SIZE);
+		daemonBuffer = NULL;
+	}
+
+	if (daemonSocket != -1){
+		close(daemonSocket);
+		daemonSocket = -1;
+	}
+
+	pthread_mutex_unlock(&daemonClientLock);
+
+	return (0);
+}
@@ -0,0 +1,64 @@
+#ifndef TAGLINE_DAEMON_INCLUDED
+#define TAGLINE_DAEMON_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : tagline_daemon.h
+//  Description    : This is the interface of the TAGLINE daemon, one process
+//                   that owns the array and serves the tagline API to other
+//                   local processes over a Unix socket. Block data does not go
+//                   through the socket, every client shares a buffer with the
+//                   daemon.
+//
+//  Author         : agent
+//  Last Modified  : 10/18/2026
+//
+
+// Include Files
+#include <stdint.h>
+
+// Project Include Files
+#include <tagline_driver.h>
+
+// Defines
+#define TAGLINE_DAEMON_CLIENTS   64    // Clients served at once
+#define TAGLINE_DAEMON_BLOCKS    255   // Blocks of the buffer shared with a client
+
+//Requests from a client
+#define TAGLINE_DAEMON_READ      1
+#define TAGLINE_DAEMON_WRITE     2
+
+//A request, its blocks are at the start of the shared buffer
+struct tagline_daemon_request
+{
+	uint32_t type;
+	uint32_t tag;
+	uint32_t bnum;
+	uint32_t blocks;
+};
+
+//
+// Interface
+
+int tagline_daemon_start(const char *path, uint32_t maxlines);
+	// Initialize the driver and serve it on the Unix socket path, 0 if successful
+
+int tagline_daemon_stop(void);
+	// Disconnect every client and close the driver, 0 if successful
+
+int tagline_daemon_connect(const char *path);
+	// Connect this process to the daemon listening on path, 0 if successful
+
+char * tagline_daemon_buffer(void);
+	// The buffer shared with the daemon, passing it to read/write avoids a copy
+
+int tagline_daemon_read(TagLineNumber tag, TagLineBlockNumber bnum, uint8_t blks, char *buf);
+	// tagline_read through the daemon, 0 if successful
+
+int tagline_daemon_write(TagLineNumber tag, TagLineBlockNumber bnum, uint8_t blks, char *buf);
+	// tagline_write through the daemon, 0 if successful
+
+int tagline_daemon_disconnect(void);
+	// Close the connection to the daemon, 0 if successful
+
+#endif
@@ -0,0 +1,342 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : tagline_defrag.c
+//  Description    : This is the online defragmenter of the TAGLINE driver,
+//                   it moves the extents of a tagline that are not contiguous
+//                   on disk to a contiguous place, a few blocks at a time.
+//
+//  Author         : agent
+//  Last Modified  : 10/18/2026
+//
+
+// Includes
+
+// Project includes
+#include <cmpsc311_log.h>
+#include "raid_pool.h"
+#include "tagline_internal.h"
+
+
+//Definitions
+
+//Online defragmentation: taglines are checked in extents of
+//TAGLINE_DEFRAG_EXTENT blocks, an extent that is not contiguous on both copies
+//(or, in computed placement, has relocated blocks) is moved to a contiguous
+//place. Every TAGLINE_DEFRAG_INTERVAL writes at most defragBudget blocks move.
+#define TAGLINE_DEFRAG_EXTENT    64
+
+
+//Global Variables
+
+uint32_t defragBudget = 0;
+uint32_t defragWrites = 0;
+TagLineNumber defragTag = 0;
+TagLineBlockNumber defragBnum = 0;
+uint64_t defragMoved = 0;
+
+
+//Functions Prototypes
+int defrag_fragmented(TagLineNumber, TagLineBlockNumber, int);
+int defrag_ready(TagLineNumber, TagLineBlockNumber, int, struct tagline *);
+int defrag_extent(TagLineNumber, TagLineBlockNumber, int, struct tagline *);
+int defrag_move(TagLineNumber, TagLineBlockNumber, int, struct tagline *);
+
+
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_set_defrag
+// Description  : turns on the online defragmenter. Every TAGLINE_DEFRAG_INTERVAL
+//				  writes it moves at most budget blocks (rounded up to whole
+//				  extents) to contiguous places, so it never takes over the link.
+//
+// Inputs       : budget - blocks moved per step, 0 turns it off
+// Outputs      : 0 if successful, 1 if failure
+
+int tagline_set_defrag(uint32_t budget){
+
+	defragBudget = budget;
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_defrag_step
+// Description  : one step of the defragmenter. Carries on from where the last
+//				  step stopped, skipping extents that are already contiguous,
+//				  and moves fragmented extents until budget blocks have moved
+//				  or every tagline has been looked at once. While a disk is
+//				  rebuilt the step moves nothing, extents with a copy to read
+//				  or write on a disk that is not ready are passed over.
+//
+// Inputs       : budget - the number of blocks that may move
+// Outputs      : the number of blocks moved, -1 if failure
+
+int tagline_defrag_step(uint32_t budget){
+
+	struct tagline dest[TAGLINE_DEFRAG_EXTENT];
+	uint32_t moved = 0;
+	int scanned = 0, n;
+
+	//Nothing to move before tagline_driver_init, nor while a disk is rebuilt
+	pthread_mutex_lock(&writeLock);
+	if (tagcounter == NULL || pthread_mutex_trylock(&recoverLock)){
+		pthread_mutex_unlock(&writeLock);
+		return (0);
+	}
+
+	while (moved < budget && scanned <= maxtaglines){
+
+		//Next tagline
+		if (defragTag >= maxtaglines || defragBnum >= tagcounter[defragTag]){
+			defragTag = (defragTag + 1 < maxtaglines) ? defragTag + 1 : 0;
+			defragBnum = 0;
+			scanned++;
+			continue;
+		}
+
+		n = tagcounter[defragTag] - defragBnum;
+		if (n > TAGLINE_DEFRAG_EXTENT)
+			n = TAGLINE_DEFRAG_EXTENT;
+
+		if (defrag_fragmented(defragTag, defragBnum, n) && defrag_ready(defragTag, defragBnum, n, NULL)){
+
+			//No room for a new extent, try again later
+			if (defrag_extent(defragTag, defragBnum, n, dest))
+				break;
+
+			//The computed places may be on a failed disk
+			if (defrag_ready(defragTag, defragBnum, n, dest)){
+				if (defrag_move(defragTag, defragBnum, n, dest)){
+					pthread_mutex_unlock(&recoverLock);
+					pthread_mutex_unlock(&writeLock);
+					return (-1);
+				}
+
+				moved += n;
+			}
+		}
+
+		defragBnum += n;
+	}
+
+	defragMoved += moved;
+	pthread_mutex_unlock(&recoverLock);
+	pthread_mutex_unlock(&writeLock);
+	return (moved);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : defrag_fragmented
+// Description  : tells if an extent of a tagline is worth moving
+//
+// Inputs       : tag - the tagline
+//				  bnum - the first block of the extent
+//				  n - the number of blocks
+// Outputs      : 1 if fragmented, 0 if not
+
+int defrag_fragmented(TagLineNumber tag, TagLineBlockNumber bnum, int n){
+
+	struct tagline first, loc, home;
+	int i;
+
+	first = tagline_locate(tag, bnum);
+
+	for (i = 0; i < n; i++){
+		loc = tagline_locate(tag, bnum + i);
+
+		//Computed placement is contiguous by itself, only relocated blocks count
+		if (placementMode == TAGLINE_PLACEMENT_COMPUTED){
+			home = computed_location(tag, bnum + i);
+			if (loc.primary != home.primary || loc.backup != home.backup)
+				return (1);
+		}
+		else if (loc.primary != first.primary + i || loc.backup != first.backup + i)
+			return (1);
+	}
+
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : defrag_ready
+// Description  : tells if the disks a move of an extent uses are ready: the
+//				  ones of the primary copies it reads or, given the new places,
+//				  the ones it writes. Called with recoverLock held.
+//
+// Inputs       : tag - the tagline
+//				  bnum - the first block of the extent
+//				  n - the number of blocks
+//				  dest - the new locations, NULL to look at the current ones
+// Outputs      : 1 if every disk is ready, 0 if not
+
+int defrag_ready(TagLineNumber tag, TagLineBlockNumber bnum, int n, struct tagline *dest){
+
+	struct tagline loc;
+	int i;
+
+	for (i = 0; i < n; i++){
+		if (dest == NULL){
+			loc = tagline_locate(tag, bnum + i);
+			if (loc.primary == TAGLINE_NO_LOC || array[LOC_DISK(loc.primary)].status != RAID_DISK_READY)
+				return (0);
+		}
+		else if (array[LOC_DISK(dest[i].primary)].status != RAID_DISK_READY
+				|| array[LOC_DISK(dest[i].backup)].status != RAID_DISK_READY)
+			return (0);
+	}
+
+	return (1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : defrag_extent
+// Description  : finds the new places of an extent: its computed places, or in
+//				  the table placement a fresh contiguous extent at the end of the
+//				  two ready disks with the most room
+//
+// Inputs       : tag - the tagline
+//				  bnum - the first block of the extent
+//				  n - the number of blocks
+//				  dest - returns the new locations of every block
+// Outputs      : 0 if successful, 1 if there is no room
+
+int defrag_extent(TagLineNumber tag, TagLineBlockNumber bnum, int n, struct tagline *dest){
+
+	int i, disk, backupDisk;
+
+	if (placementMode == TAGLINE_PLACEMENT_COMPUTED){
+		for (i = 0; i < n; i++)
+			dest[i] = computed_location(tag, bnum + i);
+		return (0);
+	}
+
+	if (choose_extent(n, &disk, &backupDisk))
+		return (1);
+
+	for (i = 0; i < n; i++){
+		array[disk].blocks++;
+		array[backupDisk].blocks++;
+		dest[i].primary = MAKE_LOC(disk, array[disk].blocks);
+		dest[i].backup = MAKE_LOC(backupDisk, array[backupDisk].blocks);
+	}
+
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : defrag_move
+// Description  : moves an extent of a tagline. The blocks are read from the
+//				  primary copy straight from the disks (the cache is neither
+//				  used nor filled), both copies are written at the new places
+//				  and only then the map switches over, so a failure leaves the
+//				  tagline as it was.
+//
+// Inputs       : tag - the tagline
+//				  bnum - the first block of the extent
+//				  n - the number of blocks (up to 255)
+//				  dest - the new locations of every block
+// Outputs      : 0 if successful, 1 if failure
+
+int defrag_move(TagLineNumber tag, TagLineBlockNumber bnum, int n, struct tagline *dest){
+
+	RAIDOpCode ops[TAGLINE_PIPELINE_BATCH];
+	void *bufs[TAGLINE_PIPELINE_BATCH];
+	struct raid_mirror_payload mirrors[TAGLINE_PIPELINE_BATCH];
+	struct tagline loc;
+	uint32_t start;
+	char *data;
+	int i, run, count = 0, failed = 0, mirrored;
+
+	//Queued backups of the extent must not land after it has moved
+	if (tagdurability[tag] == TAGLINE_DURABLE_ONE)
+		mirror_drain();
+
+	data = raid_pool_get(n);
+	if (data == NULL)
+		return (1);
+
+	//Read the primary copy, one request per contiguous run
+	i = 0;
+	while (i < n && !failed){
+		start = tagline_locate(tag, bnum + i).primary;
+		for (run = 1; i + run < n; run++)
+			if (tagline_locate(tag, bnum + i + run).primary != start + run)
+				break;
+
+		ops[count] = create_raid_request(RAID_READ, run, LOC_DISK(start), LOC_POSITION(start));
+		bufs[count++] = &data[i*RAID_BLOCK_SIZE];
+		if (count == TAGLINE_PIPELINE_BATCH){
+			failed = pipeline_flush(count, ops, bufs);
+			count = 0;
+		}
+		i += run;
+	}
+	if (!failed)
+		failed = pipeline_flush(count, ops, bufs);
+	count = 0;
+
+	//Write both copies at the new place
+	mirrored = offload_ready(&mirrorOffload, RAID_MIRROR_WRITE);
+	i = 0;
+	while (i < n && !failed){
+		for (run = 1; i + run < n; run++)
+			if (dest[i+run].primary != dest[i].primary + run || dest[i+run].backup != dest[i].backup + run)
+				break;
+
+		if (mirrored){
+			ops[count] = mirror_write_request(dest[i].primary, dest[i].backup, run, &data[i*RAID_BLOCK_SIZE], &mirrors[count]);
+			bufs[count] = &mirrors[count];
+			count++;
+		}
+		else{
+			ops[count] = create_raid_request(RAID_WRITE, run, LOC_DISK(dest[i].primary), LOC_POSITION(dest[i].primary));
+			bufs[count++] = &data[i*RAID_BLOCK_SIZE];
+			ops[count] = create_raid_request(RAID_WRITE, run, LOC_DISK(dest[i].backup), LOC_POSITION(dest[i].backup));
+			bufs[count++] = &data[i*RAID_BLOCK_SIZE];
+		}
+		if (count > TAGLINE_PIPELINE_BATCH - 2){
+			failed = pipeline_flush(count, ops, bufs);
+			count = 0;
+		}
+		i += run;
+	}
+	if (!failed)
+		failed = pipeline_flush(count, ops, bufs);
+
+	raid_pool_put(data);
+	if (failed)
+		return (1);
+
+	//Switch the map over, the old places are never read again
+	for (i = 0; i < n; i++){
+		loc = tagline_locate(tag, bnum + i);
+		if (loc.primary != TAGLINE_NO_LOC)
+			invalidate_raid_cache(LOC_DISK(loc.primary), LOC_POSITION(loc.primary));
+		if (map_update(tag, bnum + i, dest[i]))
+			return (1);
+
+		//Keep the counts of a rebalancing in progress right
+		if (rebalanceTarget > 0){
+			if (loc.primary != TAGLINE_NO_LOC)
+				rebalanceLive[LOC_DISK(loc.primary)]--;
+			if (loc.backup != TAGLINE_NO_LOC)
+				rebalanceLive[LOC_DISK(loc.backup)]--;
+			if (dest[i].primary != TAGLINE_NO_LOC)
+				rebalanceLive[LOC_DISK(dest[i].primary)]++;
+			if (dest[i].backup != TAGLINE_NO_LOC)
+				rebalanceLive[LOC_DISK(dest[i].backup)]++;
+		}
+	}
+
+	//Both copies were written from the primary one
+	if (digestsEnabled)
+		digest_copied(tag, bnum, n, 0);
+
+	return (0);
+}
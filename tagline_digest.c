@@ -0,0 +1,446 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : tagline_digest.c
+//  Description    : These are the mirror digests of the TAGLINE driver,
+//                   Merkle trees over the blocks of both copies of every
+//                   tagline, used to find and rewrite the copies that differ.
+//
+//  Author         : agent
+//  Last Modified  : 10/18/2026
+//
+
+// Includes
+#include <stdlib.h>
+#include <string.h>
+
+// Project includes
+#include "raid_network.h"
+#include "raid_pool.h"
+#include "tagline_internal.h"
+
+
+//Definitions
+
+//Mirror digests (tagline_set_digests): every tagline has a Merkle tree per
+//copy over the checksums of its blocks, as known to be on that copy. A leaf
+//is the checksum of the block, or the STALE value of its copy when a write
+//of it failed or was lost (the two differ so stale leaves never match).
+//Equal subtrees are skipped when the copies are compared.
+#define TAGLINE_DIGEST_STALE     0     // Leaf of a primary copy in doubt, +1 for a backup
+
+
+//Global Variables
+
+int digestsEnabled = 0;
+uint32_t digestLeaves = 0;
+struct tagdigest *digests = NULL;
+pthread_mutex_t digestLock = PTHREAD_MUTEX_INITIALIZER;
+
+
+//Functions Prototypes
+uint64_t digest_block(const char *);
+uint64_t digest_combine(uint64_t, uint64_t);
+struct tagdigest *digest_tree(TagLineNumber);
+int digest_diff(struct tagdigest *, uint32_t, uint32_t, TagLineBlockNumber *);
+int resync_run(TagLineNumber, TagLineBlockNumber, uint32_t, int);
+
+
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_set_digests
+// Description  : keeps a Merkle tree of block checksums per copy of every
+//				  tagline, so the copies can be compared and resynced without
+//				  reading what they have in common. Has to be called before
+//				  tagline_driver_init.
+//
+// Inputs       : enable - 1 to keep the digests, 0 not to
+// Outputs      : 0 if successful, 1 if failure
+
+int tagline_set_digests(int enable){
+
+	if ((enable != 0 && enable != 1) || tagcounter != NULL)
+		return (1);
+
+	digestsEnabled = enable;
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : digest_block
+// Description  : checksum of a block, never one of the STALE values
+//
+// Inputs       : block - the block
+// Outputs      : the checksum
+
+uint64_t digest_block(const char *block){
+
+	uint64_t hash = 0x9E3779B97F4A7C15ull, word;
+	int i;
+
+	for (i = 0; i < RAID_BLOCK_SIZE; i += sizeof(word)){
+		memcpy(&word, &block[i], sizeof(word));
+		hash ^= word;
+		hash = (hash ^ (hash >> 30)) * 0xBF58476D1CE4E5B9ull;
+		hash = (hash ^ (hash >> 27)) * 0x94D049BB133111EBull;
+	}
+	hash ^= hash >> 31;
+
+	return (hash > TAGLINE_DIGEST_STALE + 1 ? hash : hash + 2);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : digest_combine
+// Description  : digest of a node of the tree from the ones of its children,
+//				  empty subtrees stay 0
+//
+// Inputs       : left, right - the digests of the children
+// Outputs      : the digest
+
+uint64_t digest_combine(uint64_t left, uint64_t right){
+
+	uint64_t hash;
+
+	if (left == 0 && right == 0)
+		return (0);
+
+	hash = left + 0x9E3779B97F4A7C15ull * (right | 1) + (right >> 1);
+	hash = (hash ^ (hash >> 30)) * 0xBF58476D1CE4E5B9ull;
+	hash = (hash ^ (hash >> 27)) * 0x94D049BB133111EBull;
+	return (hash ^ (hash >> 31));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : digest_tree
+// Description  : the digests of a tagline, made the first time. Called with
+//				  digestLock held.
+//
+// Inputs       : tag - the tagline
+// Outputs      : the digests, NULL if failure
+
+struct tagdigest *digest_tree(TagLineNumber tag){
+
+	struct tagdigest *tree = &digests[tag];
+
+	if (tree->nodes[0] == NULL){
+		tree->nodes[0] = (uint64_t *) calloc(2 * (size_t)digestLeaves, sizeof(uint64_t));
+		tree->nodes[1] = (uint64_t *) calloc(2 * (size_t)digestLeaves, sizeof(uint64_t));
+		if (tree->nodes[0] == NULL || tree->nodes[1] == NULL){
+			free(tree->nodes[0]);
+			free(tree->nodes[1]);
+			tree->nodes[0] = tree->nodes[1] = NULL;
+			return (NULL);
+		}
+	}
+
+	return (tree);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : digest_set
+// Description  : sets leaves of one copy and the nodes above them, a level at
+//				  a time. Called with digestLock held.
+//
+// Inputs       : tree - the digests of the tagline
+//				  bnum - the first block
+//				  n - the number of blocks
+//				  copy - 0 for the primary copy, 1 for the backup
+//				  leaves - the new leaves
+// Outputs      : none
+
+void digest_set(struct tagdigest *tree, TagLineBlockNumber bnum, uint32_t n, int copy, const uint64_t *leaves){
+
+	uint64_t *nodes = tree->nodes[copy];
+	uint32_t lo, hi, k;
+
+	if (n == 0)
+		return;
+
+	lo = digestLeaves + bnum;
+	hi = lo + n - 1;
+	for (k = lo; k <= hi; k++)
+		nodes[k] = leaves[k - lo];
+
+	while (lo > 1){
+		lo >>= 1;
+		hi >>= 1;
+		for (k = lo; k <= hi; k++)
+			nodes[k] = digest_combine(nodes[2*k], nodes[2*k+1]);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : digest_write
+// Description  : records a write of a tagline: both copies hold the blocks,
+//				  or after a failure neither is known to
+//
+// Inputs       : tag - the tagline
+//				  bnum - the first block written
+//				  blks - the number of blocks
+//				  buf - the blocks
+//				  failed - 1 if the write failed
+// Outputs      : none
+
+void digest_write(TagLineNumber tag, TagLineBlockNumber bnum, uint32_t blks, char *buf, int failed){
+
+	uint64_t leaves[MAX_TAGLINE_BLOCK_NUMBER];
+	struct tagdigest *tree;
+	uint32_t i;
+
+	if (tag >= maxtaglines || blks > MAX_TAGLINE_BLOCK_NUMBER || bnum > MAX_TAGLINE_BLOCK_NUMBER - blks)
+		return;
+
+	if (failed){
+		digest_stale(tag, bnum, blks, 0);
+		digest_stale(tag, bnum, blks, 1);
+		return;
+	}
+
+	for (i = 0; i < blks; i++)
+		leaves[i] = digest_block(&buf[i*RAID_BLOCK_SIZE]);
+
+	pthread_mutex_lock(&digestLock);
+	tree = digest_tree(tag);
+	if (tree != NULL){
+		digest_set(tree, bnum, blks, 0, leaves);
+		digest_set(tree, bnum, blks, 1, leaves);
+	}
+	pthread_mutex_unlock(&digestLock);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : digest_stale
+// Description  : marks blocks of one copy as not known to be right
+//
+// Inputs       : tag - the tagline
+//				  bnum - the first block
+//				  n - the number of blocks
+//				  copy - 0 for the primary copy, 1 for the backup
+// Outputs      : none
+
+void digest_stale(TagLineNumber tag, TagLineBlockNumber bnum, uint32_t n, int copy){
+
+	uint64_t leaves[MAX_TAGLINE_BLOCK_NUMBER];
+	struct tagdigest *tree;
+	uint32_t i;
+
+	if (n > MAX_TAGLINE_BLOCK_NUMBER || bnum > MAX_TAGLINE_BLOCK_NUMBER - n)
+		return;
+
+	for (i = 0; i < n; i++)
+		leaves[i] = TAGLINE_DIGEST_STALE + copy;
+
+	pthread_mutex_lock(&digestLock);
+	tree = digest_tree(tag);
+	if (tree != NULL)
+		digest_set(tree, bnum, n, copy, leaves);
+	pthread_mutex_unlock(&digestLock);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : digest_copied
+// Description  : records that blocks of one copy were written from the other
+//
+// Inputs       : tag - the tagline
+//				  bnum - the first block
+//				  n - the number of blocks
+//				  from - the copy they were read from, 0 primary or 1 backup
+// Outputs      : none
+
+void digest_copied(TagLineNumber tag, TagLineBlockNumber bnum, uint32_t n, int from){
+
+	struct tagdigest *tree;
+
+	pthread_mutex_lock(&digestLock);
+	tree = digest_tree(tag);
+	if (tree != NULL)
+		digest_set(tree, bnum, n, !from, &tree->nodes[from][digestLeaves + bnum]);
+	pthread_mutex_unlock(&digestLock);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : digest_diff
+// Description  : walks down the two trees of a tagline from a node, into the
+//				  subtrees that differ only. Called with digestLock held.
+//
+// Inputs       : tree - the digests of the tagline
+//				  node - where to start, 1 for the whole tagline
+//				  max - room left in blocks
+//				  blocks - returns the blocks that differ, NULL to only count
+// Outputs      : the number of blocks that differ
+
+int digest_diff(struct tagdigest *tree, uint32_t node, uint32_t max, TagLineBlockNumber *blocks){
+
+	int found;
+
+	if (tree->nodes[0][node] == tree->nodes[1][node] || max == 0)
+		return (0);
+
+	if (node >= digestLeaves){
+		if (blocks != NULL)
+			blocks[0] = node - digestLeaves;
+		return (1);
+	}
+
+	found = digest_diff(tree, 2*node, max, blocks);
+	return (found + digest_diff(tree, 2*node+1, max - found, blocks ? blocks + found : NULL));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_mirror_verify
+// Description  : compares the two copies of a tagline by their digests, the
+//				  cost grows with how much they differ and not with the size of
+//				  the tagline. Nothing is read from the disks.
+//
+// Inputs       : tag - the tagline
+// Outputs      : the number of blocks whose copies differ or are in doubt,
+//				  -1 if failure
+
+int tagline_mirror_verify(TagLineNumber tag){
+
+	int found = 0;
+
+	if (digests == NULL || tag >= maxtaglines)
+		return (-1);
+
+	//Backups still queued are not on their disk yet
+	if (tagdurability[tag] == TAGLINE_DURABLE_ONE)
+		mirror_drain();
+
+	pthread_mutex_lock(&digestLock);
+	if (digests[tag].nodes[0] != NULL)
+		found = digest_diff(&digests[tag], 1, MAX_TAGLINE_BLOCK_NUMBER, NULL);
+	pthread_mutex_unlock(&digestLock);
+
+	return (found);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_mirror_resync
+// Description  : makes the two copies of a tagline agree again, reading and
+//				  writing only the blocks whose digests differ. A copy in doubt
+//				  is written from the other one; if both are, the primary copy
+//				  (the one reads return) wins.
+//
+// Inputs       : tag - the tagline
+// Outputs      : the number of blocks written, -1 if failure
+
+int tagline_mirror_resync(TagLineNumber tag){
+
+	TagLineBlockNumber blocks[MAX_TAGLINE_BLOCK_NUMBER];
+	uint8_t from[MAX_TAGLINE_BLOCK_NUMBER];
+	struct tagline loc, next;
+	int found = 0, i, n;
+
+	pthread_mutex_lock(&writeLock);
+
+	if (digests == NULL || tag >= maxtaglines){
+		pthread_mutex_unlock(&writeLock);
+		return (-1);
+	}
+
+	if (tagdurability[tag] == TAGLINE_DURABLE_ONE)
+		mirror_drain();
+
+	//The backup is the source only where the primary is in doubt and it is not
+	pthread_mutex_lock(&digestLock);
+	if (digests[tag].nodes[0] != NULL)
+		found = digest_diff(&digests[tag], 1, MAX_TAGLINE_BLOCK_NUMBER, blocks);
+	for (i = 0; i < found; i++)
+		from[i] = (digests[tag].nodes[0][digestLeaves + blocks[i]] == TAGLINE_DIGEST_STALE
+				&& digests[tag].nodes[1][digestLeaves + blocks[i]] != TAGLINE_DIGEST_STALE + 1);
+	pthread_mutex_unlock(&digestLock);
+
+	//The blocks come in order, copy them in runs contiguous on both copies
+	for (i = 0; i < found; i += n){
+		loc = tagline_locate(tag, blocks[i]);
+		for (n = 1; i + n < found && n < 255 && blocks[i+n] == blocks[i] + n && from[i+n] == from[i]; n++){
+			next = tagline_locate(tag, blocks[i+n]);
+			if (next.primary != loc.primary + n || next.backup != loc.backup + n)
+				break;
+		}
+
+		if (resync_run(tag, blocks[i], n, from[i])){
+			pthread_mutex_unlock(&writeLock);
+			return (-1);
+		}
+	}
+
+	pthread_mutex_unlock(&writeLock);
+	return (found);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : resync_run
+// Description  : copies a run of blocks of a tagline from one copy to the
+//				  other and sets the digests of both to what was copied
+//
+// Inputs       : tag - the tagline
+//				  bnum - the first block
+//				  n - the number of blocks, contiguous on both copies
+//				  from - the copy to read, 0 primary or 1 backup
+// Outputs      : 0 if successful, 1 if failure
+
+int resync_run(TagLineNumber tag, TagLineBlockNumber bnum, uint32_t n, int from){
+
+	uint64_t leaves[MAX_TAGLINE_BLOCK_NUMBER];
+	RAIDOpCode operation = 0;
+	RAIDOpCode response = 0;
+	struct tagline loc;
+	uint32_t source, target, i;
+	char *data;
+
+	loc = tagline_locate(tag, bnum);
+	source = from ? loc.backup : loc.primary;
+	target = from ? loc.primary : loc.backup;
+
+	//A copy on a disk that is not there is left to the rebuild
+	if (source == TAGLINE_NO_LOC || target == TAGLINE_NO_LOC
+			|| array[LOC_DISK(source)].status != RAID_DISK_READY || array[LOC_DISK(target)].status != RAID_DISK_READY)
+		return (1);
+
+	data = raid_pool_get(n);
+	if (data == NULL)
+		return (1);
+
+	operation = create_raid_request(RAID_READ, n, LOC_DISK(source), LOC_POSITION(source));
+	response = client_raid_bus_request(operation, data);
+	if (extract_raid_response(response, operation, NULL)){
+		raid_pool_put(data);
+		return (1);
+	}
+
+	operation = create_raid_request(RAID_WRITE, n, LOC_DISK(target), LOC_POSITION(target));
+	response = client_raid_bus_request(operation, data);
+	if (extract_raid_response(response, operation, NULL)){
+		raid_pool_put(data);
+		return (1);
+	}
+
+	//The cache holds primary blocks, drop what was there before
+	for (i = 0; i < n; i++){
+		leaves[i] = digest_block(&data[i*RAID_BLOCK_SIZE]);
+		if (from)
+			invalidate_raid_cache(LOC_DISK(target), LOC_POSITION(target) + i);
+	}
+	raid_pool_put(data);
+
+	pthread_mutex_lock(&digestLock);
+	digest_set(&digests[tag], bnum, n, 0, leaves);
+	digest_set(&digests[tag], bnum, n, 1, leaves);
+	pthread_mutex_unlock(&digestLock);
+
+	return (0);
+}
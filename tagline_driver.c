@@ -12,63 +12,113 @@
 #include <stdlib.h>
 #include <time.h>
 #include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <cmpsc311_log.h>
+#include <cmpsc311_util.h>
 
 // Project Includes
-#include "raid_bus.h"
-#include "tagline_driver.h"
 #include "raid_cache.h"
 #include "raid_network.h"
+#include "raid_pool.h"
+#include "tagline_internal.h"
 
 //Definitions
 #define false 0
 #define true  1
 typedef int bool;
 
+//Large I/O: the longest run of a large read still worth keeping in the cache
+//(longer ones are streaming)
+#define TAGLINE_CACHE_RUN        16
+
+//The largest RAID_READ or RAID_WRITE, and the pieces a whole tagline is
+//written in
+#define TAGLINE_MAX_RUN          255
+#define TAGLINE_MAX_PIECES       ((MAX_TAGLINE_BLOCK_NUMBER + TAGLINE_MAX_RUN - 1) / TAGLINE_MAX_RUN)
+
+//Writes between two steps of the defragmenter, and of the rebalancing
+#define TAGLINE_DEFRAG_INTERVAL  64
+
+//Protocol extensions (RAID_COPY, RAID_MIRROR_WRITE): off until asked for, then
+//probed on a channel of its own the first time they are needed, since a stock
+//server may not take an unknown request gracefully
+#define TAGLINE_OFFLOAD_OFF      0
+#define TAGLINE_OFFLOAD_PROBE    1
+#define TAGLINE_OFFLOAD_ON       2
+
 
 //Global Variables and Structures
 
 int maxtaglines = 1;
 int *tagcounter = NULL;
 
-struct disks
+struct disks array[RAID_DISKS] = { [0 ... RAID_DISKS-1].status = RAID_DISK_UNINITIALIZED};
+
+//Times each disk was formatted by a rebuild, counted before the format is
+//sent. Reads take no lock: one that found a disk ready notes this first and
+//looks again once it is answered, a change means the answer may come from the
+//formatted disk and the block is read again.
+_Atomic uint32_t diskFormats[RAID_DISKS];
+
+//Disks in use, the first arrayDisks of the bus. The RAID server is given
+//all RAID_DISKS at RAID_INIT, so that is as far as tagline_add_disks can grow.
+uint32_t arrayDisks = RAID_DISKS;
+
+//Striped table placement: blocks per stripe unit, 0 keeps each write on one
+//random disk pair. Stripe unit s of tagline t goes to disk (t+s) % arrayDisks
+//with its mirror on the next disk.
+uint32_t stripeUnit = 0;
+
+//A stripe unit (or the part of it) of one striped write and its places
+struct stripewrite
 {
-	int status;
-	//Blocks in the disk are filled linearly, the number store in 'int block'
-	//denotes that until that block disk is filled (0 based), -1 means is empty
+	int first;  //First block of the unit in the write
 	int blocks;
-} array[RAID_DISKS] = { [0 ... RAID_DISKS-1].status = RAID_DISK_UNINITIALIZED};
-
+	uint32_t primary;
+	uint32_t backup;
+};
 
-//Each Block of the tagline have 4 properties, the disk, the backup disk and the diskblock 
-//in which it was written to.
-struct tagline
+//Space reserved for the appends of each tagline (tagline_reserve): the next
+//free location of each copy and how many blocks are left
+struct reservation
 {
-	int disk;
-	int diskPosition;
-	int backupDisk;
-	int backupDiskPosition;
+	uint32_t primary;
+	uint32_t backup;
+	uint32_t blocks;
 };
+struct reservation *reserved = NULL;
 
-//Global Pointer to the tag structure table
-//Array tag[maxlines][MAX_TAGLINE_BLOCK_NUMBER] created in tagline_driver_init
-struct tagline **Globtag = NULL;
+int copyOffload = TAGLINE_OFFLOAD_OFF;
+int mirrorOffload = TAGLINE_OFFLOAD_OFF;
 
-struct RAIDresponse
-{
-	uint8_t status; //status bit of response (only 1 bit)
-	uint8_t type;
-	uint8_t blockQuantity;
-	uint8_t diskNumber;
-	uint32_t id;
-} GlobResponse;
+//The application calls the driver from one thread at a time (the ring poller
+//or the daemon standing in for it), the background services and the recovery
+//of a disk run beside it. writeLock is held by the calls that change the map,
+//the tagline lengths or the copies (writes, reservations, the defragmenter,
+//rebalancing, resyncs, imports) and by a recovery while it formats and scans
+//the disk and while it finishes, so a rebuild never sees a write half done.
+//Reads, settings and the copying of a rebuild take no lock. Taken after
+//recoverLock; whoever holds writeLock only ever tries recoverLock.
+pthread_mutex_t writeLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_mutex_t recoverLock = PTHREAD_MUTEX_INITIALIZER; //One rebuild at a time
+
+//Probes of the protocol extensions, a recovery may probe RAID_COPY while a
+//write probes RAID_MIRROR_WRITE
+pthread_mutex_t probeLock = PTHREAD_MUTEX_INITIALIZER;
 
 
 //Functions Prototypes
-RAIDOpCode create_raid_request(uint8_t, uint8_t, uint8_t, uint32_t);
-int extract_raid_response(RAIDOpCode, RAIDOpCode);
-int raid_disk_recover(uint8_t);
 int chooseDisk(int*, int*, int);
+int write_located(TagLineNumber, TagLineBlockNumber, uint32_t, char *);
+int stripe_disks(TagLineNumber, uint32_t, int *, int *);
+int write_striped(TagLineNumber, TagLineBlockNumber, int, char *);
+int write_tagline(TagLineNumber, TagLineBlockNumber, uint32_t, char *);
+int write_blocks(TagLineNumber, TagLineBlockNumber, uint32_t, char *);
+void cache_fill(int, int, char *);
+int write_extent(TagLineNumber, TagLineBlockNumber, int, char *, uint32_t, uint32_t);
+int read_block(TagLineNumber, TagLineBlockNumber, struct tagline, char *);
+
 
 // Functions
 
@@ -85,7 +135,8 @@ int tagline_driver_init(uint32_t maxlines) {
 	RAIDOpCode operation = 0;
 	RAIDOpCode response  = 0;
 
-	int i, j, currentDisk;
+	int i, currentDisk;
+	uint64_t groups;
 
 	//Global variable to keep reference to maxlines
 	maxtaglines = maxlines;
@@ -98,28 +149,53 @@ int tagline_driver_init(uint32_t maxlines) {
 	time_t t;
 	srand((unsigned) time(&t));
 
-	//Create table to keep track of tagline
-	//Equivalent to:
-	//tagline Globtag[maxlines][MAX_TAGLINE_BLOCK_NUMBER];
-	//Freeing memory at tagline_close()
-	Globtag = (struct tagline**) malloc(maxlines * sizeof(struct tagline*));
-	if (Globtag == NULL)
-		return (1);
+	if (placementMode == TAGLINE_PLACEMENT_COMPUTED){
+
+		//The hash spreads over every disk, the array can not grow
+		arrayDisks = RAID_DISKS;
+
+		//Each disk holds one primary region and one backup region, a placement group
+		//takes TAGLINE_PG_BLOCKS in one of them. Everything after both regions is
+		//left to the linear allocator for relocated blocks.
+		groups = ((uint64_t)maxlines * MAX_TAGLINE_BLOCK_NUMBER + TAGLINE_PG_BLOCKS - 1) / TAGLINE_PG_BLOCKS;
+		placementRegion = ((groups + RAID_DISKS - 1) / RAID_DISKS) * TAGLINE_PG_BLOCKS;
 
-	for (i = 0; i < maxlines; i++){
-		Globtag[i] = (struct tagline*) malloc(MAX_TAGLINE_BLOCK_NUMBER * sizeof(struct tagline));
-		if (Globtag[i] == NULL)
+		if (2 * (uint64_t)placementRegion > RAID_DISKBLOCKS){
+			logMessage(LOG_ERROR_LEVEL, "TAGLINE: %u taglines do not fit computed placement", maxlines);
+			return (1);
+		}
+
+		//Only relocated blocks are stored, freeing memory at tagline_close()
+		exceptions = (struct tagexception**) calloc(TAGLINE_EXCEPTION_BUCKETS, sizeof(struct tagexception*));
+		if (exceptions == NULL)
+			return (1);
+	}
+	//The table is paged in from a file
+	else if (metaPath != NULL){
+		if (meta_init(maxlines))
 			return (1);
 	}
+	else{
+
+		//Create table to keep track of tagline
+		//Equivalent to:
+		//tagline Globtag[maxlines][MAX_TAGLINE_BLOCK_NUMBER];
+		//Freeing memory at tagline_close()
+		Globtag = (struct tagline**) malloc(maxlines * sizeof(struct tagline*));
+		if (Globtag == NULL)
+			return (1);
 
-	//Initialize disks and position to -1 (invalid block), 
-	for (i = 0; i < maxlines; i++){
-		for(j = 0; j < MAX_TAGLINE_BLOCK_NUMBER; j++){
-			Globtag[i][j].disk = -1;
-			Globtag[i][j].diskPosition = -1;
-			Globtag[i][j].backupDisk = -1;
-			Globtag[i][j].backupDiskPosition = -1;
-		}
+		//All the rows live in a single allocation, so walking a tagline (or the whole
+		//table during a recovery) is a linear scan through memory
+		if (posix_memalign((void **)&Globmap, TAGLINE_LINE_SIZE,
+				(size_t)maxlines * MAX_TAGLINE_BLOCK_NUMBER * sizeof(struct tagline)))
+			return (1);
+
+		for (i = 0; i < maxlines; i++)
+			Globtag[i] = &Globmap[(size_t)i * MAX_TAGLINE_BLOCK_NUMBER];
+
+		//Initialize every location to TAGLINE_NO_LOC (invalid block)
+		memset(Globmap, 0xFF, (size_t)maxlines * MAX_TAGLINE_BLOCK_NUMBER * sizeof(struct tagline));
 	}
 
 	//Create an array to count the number of blocks of each tagline, freeing memory at tag_close()
@@ -127,6 +203,43 @@ int tagline_driver_init(uint32_t maxlines) {
 	if (tagcounter == NULL)
 		return (1);
 
+	//Every tagline starts with both copies written before returning
+	tagdurability = (uint8_t*) calloc(maxlines, sizeof(uint8_t));
+	if (tagdurability == NULL)
+		return (1);
+
+	//And no backup copy behind its primary
+	backupStale = (uint8_t*) calloc(((size_t)maxlines * MAX_TAGLINE_BLOCK_NUMBER + 7) / 8, sizeof(uint8_t));
+	if (backupStale == NULL)
+		return (1);
+	atomic_store(&backupStaleCount, 0);
+
+	//No tagline has space reserved
+	reserved = (struct reservation*) calloc(maxlines, sizeof(struct reservation));
+	if (reserved == NULL)
+		return (1);
+
+	//Taglines the second array has to get again whole
+	if (replicaPort != 0){
+		replicaDirty = (uint8_t*) calloc(maxlines, sizeof(uint8_t));
+		if (replicaDirty == NULL)
+			return (1);
+	}
+
+	//Trees of the mirror digests, made at the first write of each tagline
+	if (digestsEnabled){
+		for (digestLeaves = 1; digestLeaves < MAX_TAGLINE_BLOCK_NUMBER; digestLeaves <<= 1);
+		digests = (struct tagdigest*) calloc(maxlines, sizeof(struct tagdigest));
+		if (digests == NULL)
+			return (1);
+	}
+
+	//Nothing read yet, every tagline has the same rebuild priority
+	tagheat = (uint32_t*) calloc(maxlines, sizeof(uint32_t));
+	tagpriority = (uint8_t*) calloc(maxlines, sizeof(uint8_t));
+	if (tagheat == NULL || tagpriority == NULL)
+		return (1);
+
 	//RAID_INIT
 	//Create OPcode for RAID_INIT
 	operation = create_raid_request(RAID_INIT, RAID_DISKBLOCKS/RAID_TRACK_BLOCKS+3, RAID_DISKS, 0);
@@ -136,12 +249,12 @@ int tagline_driver_init(uint32_t maxlines) {
 
 
 	//extract raid response for RAID_INIT
-	if (extract_raid_response(response, operation))
+	if (extract_raid_response(response, operation, NULL))
 		return (1);
 
 	//RAID_FORMAT
-	//Format all disks
-	for (currentDisk = 0; currentDisk < RAID_DISKS; currentDisk++){
+	//Format the disks in use, the others wait for tagline_add_disks
+	for (currentDisk = 0; currentDisk < arrayDisks; currentDisk++){
 		
 		if (array[currentDisk].status == RAID_DISK_UNINITIALIZED){
 
@@ -152,21 +265,36 @@ int tagline_driver_init(uint32_t maxlines) {
 			response = client_raid_bus_request(operation, NULL);
 
 			//extract the raid response for RAID_FORMAT
-			if(extract_raid_response(response, operation))
+			if(extract_raid_response(response, operation, NULL))
 				return(1);
 
 			//Set Status to Ready
 			array[currentDisk].status = RAID_DISK_READY;
+			atomic_store(&diskHealth[currentDisk], TAGLINE_DISK_HEALTHY);
 
 			//All Blocks are initially unused, -1 is an invalid position meaning that there's nothing
 			//in the current disk
 			for(i = 0; i < RAID_DISKBLOCKS; i++)
 				array[currentDisk].blocks = -1;
 
+			//With computed placement the copy regions are already taken
+			if (placementMode == TAGLINE_PLACEMENT_COMPUTED)
+				array[currentDisk].blocks = 2 * placementRegion - 1;
+
 		}
 
 	}
 
+	//The workers open their connections now that the array is up
+	if (workersEnabled && workers_start())
+		return (1);
+
+	if (monitorInterval > 0 && monitor_start())
+		return (1);
+
+	if (replicaPort != 0 && replica_start())
+		return (1);
+
 	// Return successfully
 	logMessage(LOG_INFO_LEVEL, "TAGLINE: initialized storage (maxline=%u)", maxlines);
 	return(0);
@@ -185,36 +313,47 @@ int tagline_driver_init(uint32_t maxlines) {
 
 int tagline_read(TagLineNumber tag, TagLineBlockNumber bnum, uint8_t blks, char *buf) {
 
-	RAIDOpCode operation = 0;
-	RAIDOpCode response = 0;
-
 	int i;
+	struct tagline loc;
 
 	//Temporal buffer for the cache
 	char *tempbuf;
 
+	//The misses go to the disk workers all at once
+	if (workersRunning)
+		return (tagline_read_large(tag, bnum, blks, buf));
+
+	tagline_heat(tag, blks);
+
 	//Read all the blocks, 1 by 1, and keep adding data to the reading buffer
 	for (i=0; i< blks; i++){
 
+		loc = tagline_locate(tag, bnum+i);
+
 		//But first check if data is in the cache
-		tempbuf = get_raid_cache(Globtag[tag][bnum+i].disk, Globtag[tag][bnum+i].diskPosition);
+		tempbuf = get_raid_cache(LOC_DISK(loc.primary), LOC_POSITION(loc.primary));
 
-		if (tempbuf != NULL){
-			memcpy(&buf[i*RAID_BLOCK_SIZE], tempbuf, RAID_BLOCK_SIZE);
-		}
-		else{
-			operation = create_raid_request(RAID_READ, 1, Globtag[tag][bnum+i].disk, Globtag[tag][bnum+i].diskPosition);
-			response = client_raid_bus_request(operation, &buf[TAGLINE_BLOCK_SIZE*i]);
+		//On a miss the block is received straight into a cache slot
+		if (tempbuf == NULL){
+			tempbuf = reserve_raid_cache(LOC_DISK(loc.primary), LOC_POSITION(loc.primary));
 
-			//Put the block into the cache
-			put_raid_cache(Globtag[tag][bnum+i].disk, Globtag[tag][bnum+i].diskPosition, &buf[RAID_BLOCK_SIZE*i]);
+			//Every slot is referenced by the application, it is not cached
+			if (tempbuf == NULL){
+				if (read_block(tag, bnum+i, loc, &buf[i*RAID_BLOCK_SIZE]))
+					return (1);
+				continue;
+			}
 
+			//Check Response, a failed read must not stay in the cache
+			if(read_block(tag, bnum+i, loc, tempbuf)){
+				invalidate_raid_cache(LOC_DISK(loc.primary), LOC_POSITION(loc.primary));
+				return (1);
+			}
 		}
-	}
 
-	//Check Response:
-	if(extract_raid_response(response, operation))
-		return (1);
+		//The only copy into the reading buffer
+		memcpy(&buf[i*RAID_BLOCK_SIZE], tempbuf, RAID_BLOCK_SIZE);
+	}
 
 
 	//Return successfully
@@ -225,290 +364,430 @@ int tagline_read(TagLineNumber tag, TagLineBlockNumber bnum, uint8_t blks, char
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : tagline_write
-// Description  : Write a number of blocks from the tagline driver
+// Function     : tagline_read_ref
+// Description  : Read one block of a tagline without copying it, the caller
+//                gets a reference to the cached block. The block stays in its
+//                slot with the data it has until tagline_read_release, later
+//                writes of it go to another slot.
 //
-// Inputs       : tag - the number of the tagline to write from
-//                bnum - the starting block to write from
-//                blks - the number of blocks to write
-//                buf - the place to write the blocks into
+// Inputs       : tag - the number of the tagline to read from
+//                bnum - the block to read
+//                ref - where the reference to the block is returned
 // Outputs      : 0 if successful, 1 if failure
 
-int tagline_write(TagLineNumber tag, TagLineBlockNumber bnum, uint8_t blks, char *buf) {
+int tagline_read_ref(TagLineNumber tag, TagLineBlockNumber bnum, const char **ref) {
 
+	struct tagline loc;
+	char *block;
 
-	RAIDOpCode operation = 0;
-	RAIDOpCode operation2 =0;
-	RAIDOpCode response  = 0;
-	RAIDOpCode response2  = 0;
-	TagLineBlockNumber localBnum = bnum;
-	int disk, backupDisk, i;
+	tagline_heat(tag, 1);
+	loc = tagline_locate(tag, bnum);
 
-	//Blocks available before overlapping with another tagline
-	int blocksAvailable = 1;
-	int blocksAvailable2 = 1;
-	//Rewriting tagline?
-	bool rewritting;
+	block = get_raid_cache(LOC_DISK(loc.primary), LOC_POSITION(loc.primary));
+	if (block == NULL){
+		block = reserve_raid_cache(LOC_DISK(loc.primary), LOC_POSITION(loc.primary));
 
+		//Every slot is referenced already
+		if (block == NULL)
+			return (1);
 
-	//Check if tagline is going to be overwritten
-	if(bnum < tagcounter[tag])
-		rewritting = true;
-	else
-		rewritting = false;
+		if(read_block(tag, bnum, loc, block)){
+			invalidate_raid_cache(LOC_DISK(loc.primary), LOC_POSITION(loc.primary));
+			return (1);
+		}
+	}
 
-	//Choose two random disk number (from 0 to RAID_DISKS-1) to write to:
-	disk = rand() % RAID_DISKS;
-	backupDisk = rand() % RAID_DISKS;
+	if (pin_raid_cache(block))
+		return (1);
 
-	//Make sure the disks are not the same and are not full
-	chooseDisk(&disk,&backupDisk,blks);
+	*ref = block;
+	return (0);
+}
 
-	//Check how many blocks are available before overlapping with another tag
-	if (rewritting && blks != 1){
-		for(i = 0; i<blks; i++){
-			//If next block of the tagline is in the next position of the disk
-			if(Globtag[tag][localBnum+1].disk == Globtag[tag][bnum].disk && Globtag[tag][localBnum+1].diskPosition == Globtag[tag][localBnum].diskPosition+1
-			   && Globtag[tag][localBnum+1].disk != -1 && Globtag[tag][bnum+i].diskPosition == Globtag[tag][localBnum].diskPosition+i){
-				blocksAvailable++;
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_read_release
+// Description  : Gives back a reference of tagline_read_ref, its cache slot
+//                may be reused once every reference to it is given back. May
+//                be called from any thread.
+//
+// Inputs       : ref - the reference
+// Outputs      : 0 if successful, 1 if failure
+
+int tagline_read_release(const char *ref) {
+
+	return (unpin_raid_cache(ref) ? 1 : 0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_read_large
+// Description  : Read any number of blocks of a tagline with one call. Blocks
+//                missing from the cache are grouped in runs that are contiguous
+//                on a disk (up to 255 blocks, the largest RAID_READ), received
+//                straight into buf and sent pipelined. Long runs are not cached
+//                so a bulk read does not flush the working set.
+//
+// Inputs       : tag - the number of the tagline to read from
+//                bnum - the starting block to read from
+//                blks - the number of blocks to read
+//                buf - memory block to read the blocks into
+// Outputs      : 0 if successful, 1 if failure
+
+int tagline_read_large(TagLineNumber tag, TagLineBlockNumber bnum, uint32_t blks, char *buf) {
+
+	RAIDOpCode ops[TAGLINE_PIPELINE_BATCH];
+	void *bufs[TAGLINE_PIPELINE_BATCH];
+	uint32_t runs[TAGLINE_PIPELINE_BATCH];
+	uint32_t firsts[TAGLINE_PIPELINE_BATCH];
+	uint32_t formats[TAGLINE_PIPELINE_BATCH];
+	struct tagline loc;
+	uint32_t i, j, run, start, format;
+	char *block;
+	int count = 0, k;
+
+	//A tagline has MAX_TAGLINE_BLOCK_NUMBER blocks, none can be past it
+	if (tag >= maxtaglines || blks > MAX_TAGLINE_BLOCK_NUMBER || bnum > MAX_TAGLINE_BLOCK_NUMBER - blks)
+		return (1);
+
+	//Streamed blocks do not count as the working set
+	if (!cacheBypass)
+		tagline_heat(tag, blks);
+
+	i = 0;
+	while (i < blks || count > 0){
+
+		//Send a full batch, or what is left at the end
+		if (count == TAGLINE_PIPELINE_BATCH || (i == blks && count > 0)){
+			if (pipeline_flush(count, ops, bufs))
+				return (1);
+
+			//Short runs are likely to be read again, keep them
+			for (k = 0; k < count; k++){
+				run = (ops[k] << 8) >> 56;
+
+				//The disk was formatted by a rebuild while the run was read
+				if (atomic_load(&diskFormats[LOC_DISK(runs[k])]) != formats[k]){
+					for (j = 0; j < run; j++){
+						if (read_block(tag, bnum + firsts[k] + j, tagline_locate(tag, bnum + firsts[k] + j), (char *)bufs[k] + j*RAID_BLOCK_SIZE))
+							return (1);
+					}
+					continue;
 				}
-			if(Globtag[tag][localBnum+1].backupDisk == Globtag[tag][bnum].backupDisk 
-			   && Globtag[tag][localBnum+1].backupDiskPosition == Globtag[tag][localBnum].backupDiskPosition+1
-			   && Globtag[tag][localBnum+1].backupDisk != -1 && Globtag[tag][bnum+i].backupDiskPosition == Globtag[tag][localBnum].backupDiskPosition+i){
-				blocksAvailable2++;
+
+				if (run <= TAGLINE_CACHE_RUN && !cacheBypass){
+					for (j = 0; j < run; j++)
+						put_raid_cache(LOC_DISK(runs[k]), LOC_POSITION(runs[k]) + j, (char *)bufs[k] + j*RAID_BLOCK_SIZE);
 				}
-			localBnum++;
+			}
+			count = 0;
+			continue;
 		}
-	}
 
+		loc = tagline_locate(tag, bnum + i);
+		if (loc.primary == TAGLINE_NO_LOC)
+			return (1);
 
-	if(rewritting){
-		//If there is enough space and we are rewriting:
-		if (blocksAvailable >= blks){
+		block = get_raid_cache(LOC_DISK(loc.primary), LOC_POSITION(loc.primary));
+		if (block != NULL){
+			memcpy(&buf[i*RAID_BLOCK_SIZE], block, RAID_BLOCK_SIZE);
+			i++;
+			continue;
+		}
 
-			//Write to the cache
-			for(i=0; i<blks; i++){
-				put_raid_cache(Globtag[tag][bnum+i].disk, Globtag[tag][bnum+i].diskPosition, &buf[i*RAID_BLOCK_SIZE]);
-			}
+		//Blocks of a failed disk are read one by one from their backup
+		format = atomic_load(&diskFormats[LOC_DISK(loc.primary)]);
+		if (array[LOC_DISK(loc.primary)].status != RAID_DISK_READY){
+			if (read_block(tag, bnum + i, loc, &buf[i*RAID_BLOCK_SIZE]))
+				return (1);
+			i++;
+			continue;
+		}
 
+		//Grow the run while the next block follows on the same disk
+		start = loc.primary;
+		for (run = 1; i + run < blks && run < 255; run++){
+			loc = tagline_locate(tag, bnum + i + run);
+			if (loc.primary != start + run
+					|| get_raid_cache(LOC_DISK(loc.primary), LOC_POSITION(loc.primary)) != NULL)
+				break;
+		}
 
-			operation = create_raid_request(RAID_WRITE, blks, Globtag[tag][bnum].disk, Globtag[tag][bnum].diskPosition);
-			response = client_raid_bus_request(operation, buf);
-			//No need to save information as we are just rewriting.
+		ops[count] = create_raid_request(RAID_READ, run, LOC_DISK(start), LOC_POSITION(start));
+		bufs[count] = &buf[i*RAID_BLOCK_SIZE];
+		runs[count] = start;
+		firsts[count] = i;
+		formats[count] = format;
+		count++;
+		i += run;
+	}
 
-			//Check Response:
-			if(extract_raid_response(response, operation))
-				return(1);			
-		}
+	logMessage(LOG_INFO_LEVEL, "TAGLINE : read %u blocks from tagline %u, starting block %u.",
+			blks, tag, bnum);
+	return (0);
+}
 
-		//Same thing for the backup disk:
-		if (blocksAvailable2 >= blks){
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_write_large
+// Description  : Write any number of blocks of a tagline with one call. The
+//                blocks are split in the largest writes the RAID accepts and
+//                all of them are sent pipelined, new blocks as one extent on
+//                each copy.
+//
+// Inputs       : tag - the number of the tagline to write to
+//                bnum - the starting block to write
+//                blks - the number of blocks to write
+//                buf - the blocks to write
+// Outputs      : 0 if successful, 1 if failure
 
-			//Write to cache
-			for(i=0; i<blks; i++){
-				put_raid_cache(Globtag[tag][bnum+i].backupDisk, Globtag[tag][bnum+i].backupDiskPosition, &buf[i*RAID_BLOCK_SIZE]);
-			}
+int tagline_write_large(TagLineNumber tag, TagLineBlockNumber bnum, uint32_t blks, char *buf) {
 
-			operation2 = create_raid_request(RAID_WRITE, blks, Globtag[tag][bnum].backupDisk, Globtag[tag][bnum].backupDiskPosition);
-			response2 = client_raid_bus_request(operation2, buf);
-			
-			if(extract_raid_response(response2, operation2))
-				return(1);
+	//A tagline has MAX_TAGLINE_BLOCK_NUMBER blocks, none can be past it
+	if (tag >= maxtaglines || blks > MAX_TAGLINE_BLOCK_NUMBER || bnum > MAX_TAGLINE_BLOCK_NUMBER - blks)
+		return (1);
 
-		}
+	return (write_tagline(tag, bnum, blks, buf));
+}
 
-		//Rewriting but not enough blocks before overlapping:
-		if(blocksAvailable < blks){
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : pipeline_flush
+// Description  : Sends a batch of RAID operations pipelined on the main
+//                connection and checks every answer
+//
+// Inputs       : count - the number of operations
+//                ops - the operations
+//                bufs - the blocks of each operation
+// Outputs      : 0 if successful, 1 if failure
 
-			//Write to the Cache
-			for(i=0; i<blocksAvailable; i++){
-				put_raid_cache(Globtag[tag][bnum+i].disk, Globtag[tag][bnum+i].diskPosition, &buf[i*RAID_BLOCK_SIZE]);
-			}
+int pipeline_flush(int count, RAIDOpCode *ops, void **bufs) {
 
-			//Write the blocks available
-			operation = create_raid_request(RAID_WRITE, blocksAvailable, Globtag[tag][bnum].disk, Globtag[tag][bnum].diskPosition);
-			response = client_raid_bus_request(operation, buf);
-			//No need to save new information
+	RAIDOpCode responses[TAGLINE_PIPELINE_BATCH];
+	int i;
 
-			//Check Response
-			if(extract_raid_response(response, operation))
-				return(1);
+	if (count == 0)
+		return (0);
 
-			//Write the rest one by one
-			localBnum = bnum + blocksAvailable;
+	if (workersRunning)
+		return (workers_flush(count, ops, bufs));
 
-			for(i=0; i < blks - blocksAvailable; i++){
+	if (client_raid_bus_pipeline(0, count, ops, bufs, responses))
+		return (1);
 
-				//Make sure that the backup disk and and the regular disk are not the same and that there is enough space
-				while(Globtag[tag][localBnum].backupDisk == disk || Globtag[tag][bnum].backupDisk == disk){
-					chooseDisk(&disk,NULL,1);
-				}
+	for (i = 0; i < count; i++){
+		if (extract_raid_response(responses[i], ops[i], NULL))
+			return (1);
+	}
 
+	return (0);
+}
 
-				//If map has invalid position, it means that the block is new, write to the end of disk
-				if (Globtag[tag][localBnum].diskPosition == -1){
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : read_block
+// Description  : Reads one block from its primary copy. With hedging on, the
+//                backup copy is asked too when the primary is slower than
+//                usual and the first answer wins.
+//
+// Inputs       : tag - the tagline the block belongs to
+//                bnum - the block of the tagline
+//                loc - the locations of the block
+//                buf - where the block is read
+// Outputs      : 0 if successful, 1 if failure
 
-					//Write to cache
-					put_raid_cache(disk, array[disk].blocks+1, &buf[TAGLINE_BLOCK_SIZE*(blocksAvailable+i)]);
+int read_block(TagLineNumber tag, TagLineBlockNumber bnum, struct tagline loc, char *buf) {
 
+	RAIDOpCode operation = 0;
+	RAIDOpCode operation2 = 0;
+	RAIDOpCode response = 0;
+	uint32_t formats[2] = { 0, 0 };
+	int disk, backupDisk, hedged, failed;
 
-					operation = create_raid_request(RAID_WRITE, 1, disk, array[disk].blocks+1);
-					response = client_raid_bus_request(operation, &buf[TAGLINE_BLOCK_SIZE*(blocksAvailable+i)]);
+	if (loc.primary == TAGLINE_NO_LOC)
+		return (1);
+	disk = LOC_DISK(loc.primary);
+	backupDisk = LOC_DISK(loc.backup);
 
-					//Check Response
-					if(extract_raid_response(response, operation))
-						return(1);
-					
-					//Save information of the current operation:
-					Globtag[tag][localBnum].disk = disk;
-					array[disk].blocks++;
-					Globtag[tag][localBnum].diskPosition = array[disk].blocks;
-					tagcounter[tag]++;
+	formats[0] = atomic_load(&diskFormats[disk]);
+	if (array[disk].status != RAID_DISK_READY)
+		return (read_degraded(tag, bnum, loc, buf));
 
-				}
+	operation = create_raid_request(RAID_READ, 1, disk, LOC_POSITION(loc.primary));
 
-				//If position is valid, is an old block: overwrite
-				else{
+	//Only hedge when there is a healthy backup to ask, and never on relaxed
+	//taglines, their backup copy may still be sitting in the mirror queue
+	hedged = (raid_hedge_percentile > 0 && backupDisk != -1 && tagdurability[tag] == TAGLINE_DURABLE_BOTH);
+	if (hedged){
+		formats[1] = atomic_load(&diskFormats[backupDisk]);
+		hedged = (array[backupDisk].status == RAID_DISK_READY);
+	}
 
+	if (hedged){
+		operation2 = create_raid_request(RAID_READ, 1, backupDisk, LOC_POSITION(loc.backup));
+		response = client_raid_hedged_read(operation, operation2, buf, &operation);
+	}
+	else
+		response = client_raid_bus_request(operation, buf);
 
-					//Put in cache
-					put_raid_cache(Globtag[tag][localBnum].disk, Globtag[tag][localBnum].diskPosition, &buf[TAGLINE_BLOCK_SIZE*(blocksAvailable+i)]);
+	failed = extract_raid_response(response, operation, NULL);
 
-					operation = create_raid_request(RAID_WRITE, 1, Globtag[tag][localBnum].disk, Globtag[tag][localBnum].diskPosition);
-					response = client_raid_bus_request(operation, &buf[TAGLINE_BLOCK_SIZE*(blocksAvailable+i)]);
-					//No need to save new information
+	//A rebuild formatted a disk meanwhile, the disk is not ready anymore
+	if (atomic_load(&diskFormats[disk]) != formats[0] || (hedged && atomic_load(&diskFormats[backupDisk]) != formats[1]))
+		return (read_block(tag, bnum, loc, buf));
 
-					//Check Response
-					if(extract_raid_response(response, operation))
-						return(1);
-				}
+	return (failed);
+}
 
-				//move in the map
-				localBnum++;
-			}
-		}
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_write
+// Description  : Write a number of blocks from the tagline driver
+//
+// Inputs       : tag - the number of the tagline to write from
+//                bnum - the starting block to write from
+//                blks - the number of blocks to write
+//                buf - the place to write the blocks into
+// Outputs      : 0 if successful, 1 if failure
 
-		//Same thing for the backup disk:
-		if(blocksAvailable2 < blks){
+int tagline_write(TagLineNumber tag, TagLineBlockNumber bnum, uint8_t blks, char *buf) {
 
-			//Write to the Cache
-			for(i=0; i<blocksAvailable; i++){
-				put_raid_cache(Globtag[tag][bnum+i].backupDisk, Globtag[tag][bnum+i].backupDiskPosition, &buf[i*RAID_BLOCK_SIZE]);
-			}
+	return (write_tagline(tag, bnum, blks, buf));
+}
 
-			//Write the blocks available
-			operation2 = create_raid_request(RAID_WRITE, blocksAvailable2, Globtag[tag][bnum].backupDisk, Globtag[tag][bnum].backupDiskPosition);
-			response2 = client_raid_bus_request(operation2, buf);
-			//No need to save new information
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : write_tagline
+// Description  : writes blocks of a tagline and keeps the digests, the backup
+//				  state and the replica log up to date, then lets the
+//				  defragmenter and the rebalancing take a step
+//
+// Inputs       : tag - the number of the tagline to write to
+//                bnum - the starting block to write
+//                blks - the number of blocks to write
+//                buf - the blocks to write
+// Outputs      : 0 if successful, 1 if failure
 
-			//Check Response
-			if(extract_raid_response(response2, operation2))
-				return(1);
+int write_tagline(TagLineNumber tag, TagLineBlockNumber bnum, uint32_t blks, char *buf) {
 
-			//Write the rest one by one
-			localBnum = bnum + blocksAvailable2;
-			for(i=0; i < blks - blocksAvailable2; i++){
+	int failed;
 
-				//Make sure that the backup disk and and the regular disk are not the same
-				while(Globtag[tag][localBnum].disk == backupDisk || Globtag[tag][bnum].disk == backupDisk){
-					chooseDisk(NULL, &backupDisk, 1);
-				}
+	pthread_mutex_lock(&writeLock);
 
-				//if map has invalid position, it means that the block is new, write to the end of disk
-				if (Globtag[tag][localBnum].backupDiskPosition == -1){
+	//What both copies hold now. It is recorded before the backups are queued,
+	//the mirror thread may fail a relaxed one before write_blocks returns and
+	//that must not be covered up.
+	if (digestsEnabled)
+		digest_write(tag, bnum, blks, buf, 0);
 
-					//Write to cache
-					put_raid_cache(backupDisk, array[backupDisk].blocks+1, &buf[TAGLINE_BLOCK_SIZE*(blocksAvailable+i)]);
+	failed = write_blocks(tag, bnum, blks, buf);
 
+	//Or that they are in doubt
+	if (failed && digestsEnabled)
+		digest_write(tag, bnum, blks, buf, 1);
 
-					operation2 = create_raid_request(RAID_WRITE, 1, backupDisk, array[backupDisk].blocks+1);
-					response2 = client_raid_bus_request(operation2, &buf[TAGLINE_BLOCK_SIZE*(blocksAvailable2+i)]);
+	//The backup is current again (a relaxed one once the mirror thread wrote it)
+	if (!failed && tagdurability[tag] == TAGLINE_DURABLE_BOTH)
+		backup_mark(tag, bnum, blks, 0);
 
-					//Check Response
-					if(extract_raid_response(response2, operation2))
-						return(1);
+	if (replicaRunning)
+		replica_log(tag, bnum, blks, buf, failed);
 
-					//Save information of the current operation:
-					Globtag[tag][localBnum].backupDisk = backupDisk;
-					array[backupDisk].blocks++;
-					Globtag[tag][localBnum].backupDiskPosition = array[backupDisk].blocks;
+	pthread_mutex_unlock(&writeLock);
 
-				}
-				//overwrite in the position of the disk
-				else{
+	//Let the defragmenter move a few blocks now and then, they take writeLock
+	//themselves
+	if (defragBudget > 0 && ++defragWrites % TAGLINE_DEFRAG_INTERVAL == 0)
+		if (tagline_defrag_step(defragBudget) < 0)
+			logMessage(LOG_ERROR_LEVEL, "TAGLINE : defragmentation step failed.");
 
-					//Put in cache
-					put_raid_cache(Globtag[tag][localBnum].backupDisk, Globtag[tag][localBnum].backupDiskPosition, &buf[TAGLINE_BLOCK_SIZE*(blocksAvailable+i)]);
+	//Same for the rebalancing after the array grew
+	if (rebalanceBudget > 0 && ++rebalanceWrites % TAGLINE_DEFRAG_INTERVAL == 0)
+		if (tagline_rebalance_step(rebalanceBudget) < 0)
+			logMessage(LOG_ERROR_LEVEL, "TAGLINE : rebalancing step failed.");
 
-					operation2 = create_raid_request(RAID_WRITE, 1, Globtag[tag][localBnum].backupDisk, Globtag[tag][localBnum].backupDiskPosition);
-					response2 = client_raid_bus_request(operation2, &buf[TAGLINE_BLOCK_SIZE*(blocksAvailable2+i)]);
-					//No need to save new information
+	return (failed);
+}
 
-					//Check Response
-					if(extract_raid_response(response2, operation2))
-						return(1);
-				}
-				//move in the map
-				localBnum++;
-			}
-		}
-	}
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : write_blocks
+// Description  : writes a number of blocks of a tagline to both copies
+//
+// Inputs       : tag - the number of the tagline to write from
+//                bnum - the starting block to write from
+//                blks - the number of blocks to write
+//                buf - the place to write the blocks into
+// Outputs      : 0 if successful, 1 if failure
 
-	//If not rewriting blocks just continue to fill disk linearly
-	if (!rewritting){
+int write_blocks(TagLineNumber tag, TagLineBlockNumber bnum, uint32_t blks, char *buf) {
 
-		//Write to cache 
-		for (i=0; i < blks; i++){
-			put_raid_cache(disk, array[disk].blocks+1+i, &buf[i*RAID_BLOCK_SIZE]);
-		}
 
-		operation = create_raid_request(RAID_WRITE, blks, disk, array[disk].blocks+1);
-		response = client_raid_bus_request(operation, buf);
+	int disk, backupDisk;
 
-		//Check Response
-		if(extract_raid_response(response, operation))
-			return(1);
+	//Blocks of the tagline written to places they already have
+	int existing;
 
-		//Same thing for backup disk
 
-		//Write to cache 
-		for (i=0; i < blks; i++){
-			put_raid_cache(backupDisk, array[backupDisk].blocks+1+i, &buf[i*RAID_BLOCK_SIZE]);
-		}
+	//A backup written now must not be overtaken by an older queued one
+	if (tagdurability[tag] == TAGLINE_DURABLE_BOTH)
+		mirror_drain();
 
-		operation2 = create_raid_request(RAID_WRITE, blks, backupDisk, array[backupDisk].blocks+1);
-		response2 = client_raid_bus_request(operation2, buf);
+	//Computed placement already knows where every block goes
+	if (placementMode == TAGLINE_PLACEMENT_COMPUTED)
+		return (write_located(tag, bnum, blks, buf));
 
-		//Check Response
-		if(extract_raid_response(response2, operation2))
-			return(1);
+	//Rewriting: the blocks that exist keep their places, one RAID_WRITE for
+	//every run that is contiguous on each copy
+	if(bnum < tagcounter[tag]){
+		existing = tagcounter[tag] - bnum;
+		if (existing >= blks)
+			return (write_located(tag, bnum, blks, buf));
 
-		//Save information of current operation:
-		tagcounter[tag] += blks;
-		localBnum = bnum;
+		if (write_located(tag, bnum, existing, buf))
+			return (1);
 
-		for(i = 0; i < blks; i++){
-			//In which disk the blocks where stored:
-			Globtag[tag][localBnum].disk = disk;
-			Globtag[tag][localBnum].backupDisk = backupDisk;
-			
-			//Which blocks of each disk were used.
-			array[disk].blocks++;
-			array[backupDisk].blocks++;
+		//The rest extends the tagline like any append
+		bnum += existing;
+		blks -= existing;
+		buf += existing * RAID_BLOCK_SIZE;
+	}
 
-			//Map postion of each Tagline Block to a Disk Block
-			Globtag[tag][localBnum].diskPosition = array[disk].blocks;
-			Globtag[tag][localBnum].backupDiskPosition = array[backupDisk].blocks;
+	//Appends fill the space reserved for the tagline first
+	if (reserved[tag].blocks > 0){
+		existing = (blks < reserved[tag].blocks) ? blks : reserved[tag].blocks;
+		if (write_extent(tag, bnum, existing, buf, reserved[tag].primary, reserved[tag].backup))
+			return (1);
 
-			localBnum++;
-		}
+		reserved[tag].primary += existing;
+		reserved[tag].backup += existing;
+		reserved[tag].blocks -= existing;
 
+		bnum += existing;
+		blks -= existing;
+		buf += existing * RAID_BLOCK_SIZE;
+		if (blks == 0)
+			return (0);
 	}
 
-	
+	//Striped layout, consecutive stripe units go to different disk pairs
+	if (stripeUnit > 0)
+		return (write_striped(tag, bnum, blks, buf));
 
-	logMessage(LOG_INFO_LEVEL, "TAGLINE : wrote %u blocks to tagline %u, starting block %u.",
-			blks, tag, bnum);
+	//Choose two random disk number (from 0 to arrayDisks-1) to write to:
+	disk = rand() % arrayDisks;
+	backupDisk = rand() % arrayDisks;
+
+	//Make sure the disks are not the same and are not full
+	chooseDisk(&disk,&backupDisk,blks);
+
+	//New blocks fill the disks linearly, as one extent on each disk
+	if (write_extent(tag, bnum, blks, buf, MAKE_LOC(disk, array[disk].blocks+1), MAKE_LOC(backupDisk, array[backupDisk].blocks+1)))
+		return (1);
+
+	//Which blocks of each disk were used.
+	array[disk].blocks += blks;
+	array[backupDisk].blocks += blks;
 
 	// Return successfully
 	return(0);
@@ -526,8 +805,27 @@ int tagline_close(void) {
 
 	RAIDOpCode operation = 0;
 	RAIDOpCode response = 0;
-	int i = 0;
+	struct tagexception *next;
+	int i;
+
 
+	//No rebuild may start once the array is going away
+	monitor_stop();
+
+	//Ship what the second array is still missing, it reads from this one
+	replica_stop();
+
+	//Let the queued backup copies reach the disks and stop the mirror thread
+	mirror_drain();
+	if (mirrorRunning){
+		pthread_mutex_lock(&mirrorLock);
+		mirrorRunning = 0;
+		pthread_cond_signal(&mirrorWork);
+		pthread_mutex_unlock(&mirrorLock);
+		pthread_join(mirrorThread, NULL);
+	}
+
+	workers_stop();
 
 	//RAID_CLOSE
 	//Generate opcode for RAID_CLOSE
@@ -537,22 +835,72 @@ int tagline_close(void) {
 	response = client_raid_bus_request(operation, NULL);
 
 	//Check Response:
-	if(extract_raid_response(response, operation))
+	if(extract_raid_response(response, operation, NULL))
 		return (1);
 
-	//Clear the cache
+	//Clear the cache and free the buffers it was using, every thread that
+	//took buffers from the pool was joined above
 	close_raid_cache();
+	if (raid_pool_close())
+		logMessage(LOG_ERROR_LEVEL, "TAGLINE: buffers still in use, the pool was not freed");
 
 	//Free Memory
-	for (i =0; i < maxtaglines; i++)
-		free(Globtag[i]);
-	
+	if (exceptions != NULL){
+		for (i = 0; i < TAGLINE_EXCEPTION_BUCKETS; i++){
+			while (exceptions[i] != NULL){
+				next = exceptions[i]->next;
+				free(exceptions[i]);
+				exceptions[i] = next;
+			}
+		}
+		free(exceptions);
+		exceptions = NULL;
+	}
+
+	//No reader is left, the replaced exception entries can go too (the
+	//reader records stay, threads keep a pointer to their own)
+	pthread_mutex_lock(&mapLock);
+	map_reclaim(1);
+	pthread_mutex_unlock(&mapLock);
+
+	free(Globmap);
+	Globmap = NULL;
+
+	meta_close();
+
 	free(Globtag);
 	Globtag = NULL;
 
 	free(tagcounter);
 	tagcounter = NULL;
 
+	free(tagdurability);
+	tagdurability = NULL;
+
+	free(backupStale);
+	backupStale = NULL;
+
+	free(reserved);
+	reserved = NULL;
+
+	free(tagheat);
+	tagheat = NULL;
+
+	free(tagpriority);
+	tagpriority = NULL;
+
+	free(replicaDirty);
+	replicaDirty = NULL;
+
+	if (digests != NULL){
+		for (i = 0; i < maxtaglines; i++){
+			free(digests[i].nodes[0]);
+			free(digests[i].nodes[1]);
+		}
+		free(digests);
+		digests = NULL;
+	}
+
 
 	// Return successfully
 	logMessage(LOG_INFO_LEVEL, "TAGLINE storage device: closing completed.");
@@ -571,41 +919,44 @@ int raid_disk_signal(void){
 
 	RAIDOpCode operation = 0;
 	RAIDOpCode response = 0;
+	struct RAIDresponse fields;
 	uint8_t disk;
 
 	//RAID_STATUS
 	//Generate opcode for RAID_STATUS
 
 	//Find out which disk Failed
-	for (disk = 0; disk<RAID_DISKS; disk++){
+	for (disk = 0; disk<arrayDisks; disk++){
 		operation = create_raid_request(RAID_STATUS, 0, disk, 0);
 
 		//Check Status
 		response = client_raid_bus_request(operation, NULL);
 
 		//Check Response:
-		if(extract_raid_response(response, operation))
+		if(extract_raid_response(response, operation, &fields))
 			return (1);
 
 		//Now fix the disk that failed
-		if (GlobResponse.id == RAID_DISK_FAILED){
+		if (fields.id == RAID_DISK_FAILED){
 			array[disk].status = RAID_DISK_FAILED;
 			raid_disk_recover(disk);
 		}
 
 	}
 
-
 	//return successfully	
 	return (0);
 }
 
 
-////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : raid_disk_recover
 // Description  : recovers the disk that failed in the raid array, first reformats
-//				  the disk, then finds all the lost blocks and copies them back.
+//				  the disk, then finds all the lost blocks and copies them back
+//				  in parallel (on the server itself when it supports RAID_COPY).
+//				  The application may keep reading and writing meanwhile, a
+//				  read of a block still lost copies it back on the spot.
 //
 // Inputs       : disk - the disk that failed in the raid array
 //				  		       
@@ -613,92 +964,777 @@ int raid_disk_signal(void){
 
 int raid_disk_recover(uint8_t disk){
 
+	int failed;
+
+	pthread_mutex_lock(&recoverLock);
+	failed = recover_disk(disk);
+	pthread_mutex_unlock(&recoverLock);
+
+	return (failed);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : recover_disk
+// Description  : recovers a disk, called with recoverLock held. writeLock is
+//				  held while the lost blocks are gathered and while the rebuilt
+//				  copies are marked current, not while they are copied: writes
+//				  then claim the blocks they overwrite and reads repair the ones
+//				  they need.
+//
+// Inputs       : disk - the disk that failed in the raid array
+// Outputs      : 0 if successful, 1 if failure
+
+int recover_disk(uint8_t disk){
+
 	RAIDOpCode operation = 0;
 	RAIDOpCode response = 0;
 	int i= 0;
 	int j = 0;
-	char *tempbuf;
-	char *tempbufcache;//Temporal buffer for the cache
-
-	//Allocate space for one block
-	tempbuf = (char*)calloc(1, TAGLINE_BLOCK_SIZE);
-
-	//Reformat the disk
+	int failed = 0;
+	uint32_t lost = 0;
+	struct tagline loc;
+
+	//Somebody else rebuilt it while we waited
+	if (array[disk].status == RAID_DISK_READY)
+		return (0);
+
+	pthread_mutex_lock(&writeLock);
+	atomic_store(&diskHealth[disk], TAGLINE_DISK_REBUILDING);
+	atomic_fetch_add(&diskFailures[disk], 1);
+
+	//Backup copies still in the queue have to be on disk before the mirrors are
+	//used as the source of the rebuild
+	mirror_drain();
+
+	//Reformat the disk, on a connection of the rebuild since this may not be
+	//the thread of the application. Reads that found the disk ready before it
+	//failed see the count change and read their block again.
+	atomic_fetch_add(&diskFormats[disk], 1);
 	operation = create_raid_request(RAID_FORMAT, 0, disk, 0);
-	response = client_raid_bus_request(operation, NULL);
+	response = client_raid_bus_request_channel(TAGLINE_REBUILD_CHANNEL, operation, NULL);
 
 	//Check Response:
-	if(extract_raid_response(response, operation))
+	if (response == (RAIDOpCode)-1 || RAID_OP_STATUS(response) || rebuild_begin(disk)){
+		atomic_store(&diskHealth[disk], TAGLINE_DISK_FAILED);
+		pthread_mutex_unlock(&writeLock);
+		return (1);
+	}
+
+	//Now scan for lost blocks, every block is copied back from its other copy
+	for(i = 0; i < maxtaglines && !failed; i++){
+		for(j = 0; j < tagcounter[i] && !failed; j++){
+
+			loc = tagline_locate(i, j);
+
+			//If the block was in the disk that failed, a backup that missed a
+			//write (or no backup) can not give the primary back
+			if(LOC_DISK(loc.primary) == disk && (loc.backup == TAGLINE_NO_LOC || backup_stale(i, j))){
+				lost++;
+				continue;
+			}
+			else if(LOC_DISK(loc.primary) == disk)
+				failed = rebuild_add(loc.backup, loc.primary, i);
+			else if (LOC_DISK(loc.backup) == disk && loc.primary != TAGLINE_NO_LOC){
+
+				//Current once copied from its primary, a write that misses it
+				//meanwhile marks it again
+				backup_mark(i, j, 1, 0);
+				failed = rebuild_add(loc.primary, loc.backup, i);
+			}
+			else
+				continue;
+
+			//The copy is gone until it is rebuilt
+			if (digestsEnabled)
+				digest_stale(i, j, 1, LOC_DISK(loc.backup) == disk);
+		}
+	}
+
+	//The copying goes on with the driver open to reads and writes, in the
+	//order of the runs: the taglines ranked highest are back first
+	pthread_mutex_unlock(&writeLock);
+	if (!failed)
+		failed = rebuild_run();
+	pthread_mutex_lock(&writeLock);
+
+	//The rebuilt copies are the other ones again. Backups of relaxed taglines
+	//written meanwhile have to be on the disk first.
+	mirror_drain();
+	if (!failed && digestsEnabled){
+		for(i = 0; i < maxtaglines; i++){
+			for(j = 0; j < tagcounter[i]; j++){
+				loc = tagline_locate(i, j);
+				if (LOC_DISK(loc.primary) == disk || LOC_DISK(loc.backup) == disk)
+					digest_copied(i, j, 1, LOC_DISK(loc.primary) == disk);
+			}
+		}
+	}
+
+	//The disk stays failed rather than serve blocks that were not restored
+	if (lost > 0){
+		logMessage(LOG_ERROR_LEVEL, "TAGLINE : %u blocks of disk %u have no current copy left.", lost, disk);
+		failed = 1;
+	}
+
+	//Other backups that missed a write are brought up to date while at it
+	if (!failed)
+		backup_repair(TAGLINE_REBUILD_CHANNEL);
+
+	//Disk Recovered! Reads and writes waiting for a block go back to the disk
+	rebuild_end(disk, failed);
+	atomic_store(&diskHealth[disk], failed ? TAGLINE_DISK_FAILED : TAGLINE_DISK_HEALTHY);
+
+	pthread_mutex_unlock(&writeLock);
+	return (failed);
+}
+
+
+////////
+//
+// Function     : tagline_set_hedging
+// Description  : turns hedged reads on or off. A read that has not been
+//				  answered after the given percentile of recent read latencies
+//				  is also sent to the backup copy.
+//
+// Inputs       : percentile - latency percentile (1-99), 0 turns hedging off
+// Outputs      : 0 if successful, 1 if failure
+
+int tagline_set_hedging(int percentile){
+
+	if (percentile < 0 || percentile > 99)
+		return (1);
+
+	raid_hedge_percentile = percentile;
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_set_stripe_unit
+// Description  : selects the striped mirror layout (RAID-10) for blocks
+//				  appended from now on: every stripe unit of a tagline lands on
+//				  the next disk pair, so long taglines are spread over the
+//				  whole array. Blocks already written stay where they are.
+//
+// Inputs       : blocks - blocks per stripe unit (1-255), 0 turns striping off
+// Outputs      : 0 if successful, 1 if failure
+
+int tagline_set_stripe_unit(uint32_t blocks){
+
+	//One stripe unit is written with one RAID operation
+	if (blocks > 255)
 		return (1);
 
-	//Now scan for lost blocks
-	for(i = 0; i < maxtaglines; i++){
-		for(j = 0; j < tagcounter[i]; j++){
+	stripeUnit = blocks;
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_set_copy_offload
+// Description  : lets the driver copy blocks between disks on the server
+//				  (RAID_COPY) instead of reading and writing them back. The
+//				  server is probed the first time a copy is needed.
+//
+// Inputs       : enable - 1 to use server side copies if available, 0 not to
+// Outputs      : 0 if successful, 1 if failure
+
+int tagline_set_copy_offload(int enable){
 
-			//If the block was in the disk that failed:
-			if(Globtag[i][j].disk == disk){
+	if (enable != 0 && enable != 1)
+		return (1);
+
+	copyOffload = enable ? TAGLINE_OFFLOAD_PROBE : TAGLINE_OFFLOAD_OFF;
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_set_mirror_offload
+// Description  : lets the driver send both copies of a write in one frame
+//				  (RAID_MIRROR_WRITE) that the server writes to both disks, so
+//				  the blocks cross the network once. The server is probed the
+//				  first time it is needed. Only fully durable taglines use it.
+//
+// Inputs       : enable - 1 to use mirrored writes if available, 0 not to
+// Outputs      : 0 if successful, 1 if failure
+
+int tagline_set_mirror_offload(int enable){
+
+	if (enable != 0 && enable != 1)
+		return (1);
+
+	mirrorOffload = enable ? TAGLINE_OFFLOAD_PROBE : TAGLINE_OFFLOAD_OFF;
+	return (0);
+}
 
-				//But first check if data is in the cache
-				tempbufcache = get_raid_cache(Globtag[i][j].disk, Globtag[i][j].diskPosition);
-				
-				if (tempbufcache != NULL){
-					memcpy(tempbuf, tempbufcache, RAID_BLOCK_SIZE);
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : write_located
+// Description  : writes blocks of a tagline to the locations they already have,
+//				  one RAID_WRITE for every run of blocks that is contiguous on a
+//				  disk, sent pipelined. Used by computed placement, where every
+//				  block has a place before it is written for the first time,
+//				  and by rewrites in the table placement.
+//
+// Inputs       : tag - the tagline
+//				  bnum - the first block to write
+//				  blks - the number of blocks
+//				  buf - the data of the blocks
+// Outputs      : 0 if successful, 1 if failure
+
+int write_located(TagLineNumber tag, TagLineBlockNumber bnum, uint32_t blks, char *buf){
+
+	RAIDOpCode ops[TAGLINE_PIPELINE_BATCH];
+	void *bufs[TAGLINE_PIPELINE_BATCH];
+	struct raid_mirror_payload mirrors[TAGLINE_PIPELINE_BATCH];
+	RAIDOpCode operation = 0;
+	struct tagline loc;
+	uint32_t start, backupStart = 0, current, i, run;
+	int copy, copies, count = 0, mirrored;
+
+	//New blocks exist from now on, tagline_locate needs it to place them
+	if (bnum + blks > tagcounter[tag])
+		tagcounter[tag] = bnum + blks;
+
+	//What is written on the disk being rebuilt must not be copied over
+	if (atomic_load(&rebuildDisk) != -1){
+		for (i = 0; i < blks; i++){
+			loc = tagline_locate(tag, bnum + i);
+			rebuild_claim(loc.primary);
+			rebuild_claim(loc.backup);
+		}
+	}
+
+	//With mirrored writes one pass writes both copies of each run
+	mirrored = (tagdurability[tag] == TAGLINE_DURABLE_BOTH && offload_ready(&mirrorOffload, RAID_MIRROR_WRITE));
+	copies = mirrored ? 1 : 2;
+
+	//First the primary copy, then the backup copy
+	for (copy = 0; copy < copies; copy++){
+
+		i = 0;
+		while (i < blks){
+
+			loc = tagline_locate(tag, bnum + i);
+			start = copy ? loc.backup : loc.primary;
+			backupStart = loc.backup;
+
+			//Grow the run while the next block follows on the same disk
+			for (run = 1; i + run < blks && run < 255; run++){
+				loc = tagline_locate(tag, bnum + i + run);
+				current = copy ? loc.backup : loc.primary;
+				if (current != start + run || (mirrored && loc.backup != backupStart + run))
+					break;
+			}
+
+			//Only the primary copy is read back, keep that one in the cache
+			if (!copy){
+				for (current = 0; current < run; current++)
+					cache_fill(LOC_DISK(start), LOC_POSITION(start) + current, &buf[(i+current)*RAID_BLOCK_SIZE]);
+			}
+
+			operation = create_raid_request(RAID_WRITE, run, LOC_DISK(start), LOC_POSITION(start));
+
+			//Relaxed backups go to the mirror queue, the rest is pipelined
+			if (copy && tagdurability[tag] != TAGLINE_DURABLE_BOTH){
+				if (write_backup(tag, bnum + i, operation, &buf[i*RAID_BLOCK_SIZE]))
+					return (1);
+			}
+			else{
+				ops[count] = operation;
+				bufs[count] = &buf[i*RAID_BLOCK_SIZE];
+				if (mirrored){
+					ops[count] = mirror_write_request(start, backupStart, run, &buf[i*RAID_BLOCK_SIZE], &mirrors[count]);
+					bufs[count] = &mirrors[count];
 				}
-				else{
-					//Read from backup
-					operation = create_raid_request(RAID_READ, 1, Globtag[i][j].backupDisk, Globtag[i][j].backupDiskPosition);
-					response = client_raid_bus_request(operation,tempbuf);
-
-					//And put the block in the cache
-					//Put the block into the cache
-					put_raid_cache(Globtag[i][j].disk, Globtag[i][j].diskPosition, tempbuf);
+				if (++count == TAGLINE_PIPELINE_BATCH){
+					if (pipeline_flush(count, ops, bufs))
+						return (1);
+					count = 0;
 				}
+			}
 
+			i += run;
+		}
+	}
 
-				//Check Response
-				if(extract_raid_response(response, operation))
-					return (1);
+	if (pipeline_flush(count, ops, bufs))
+		return (1);
 
-				//Now copy back to the disk
-				operation = create_raid_request(RAID_WRITE, 1, Globtag[i][j].disk, Globtag[i][j].diskPosition);
-				response = client_raid_bus_request(operation, tempbuf);
+	logMessage(LOG_INFO_LEVEL, "TAGLINE : wrote %u blocks to tagline %u, starting block %u.",
+			blks, tag, bnum);
+	return (0);
+}
 
-				//Check Response
-				if(extract_raid_response(response, operation))
-					return (1);
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : stripe_disks
+// Description  : the disk pair of a stripe unit of a tagline. Disks that are
+//				  not ready are passed over, the unit goes to the next ready
+//				  disk and its mirror to the ready one after it.
+//
+// Inputs       : tag - the tagline
+//				  unit - the stripe unit of the tagline
+//				  disk - returns the disk of the primary copy
+//				  backupDisk - returns the disk of the backup copy
+// Outputs      : 0 if successful, 1 if there are not two ready disks
+
+int stripe_disks(TagLineNumber tag, uint32_t unit, int *disk, int *backupDisk){
+
+	int i, d;
+
+	*disk = -1;
+	*backupDisk = -1;
+
+	for (i = 0; i < arrayDisks && *backupDisk == -1; i++){
+		d = (tag + unit + i) % arrayDisks;
+		if (array[d].status != RAID_DISK_READY)
+			continue;
+		if (*disk == -1)
+			*disk = d;
+		else
+			*backupDisk = d;
+	}
+
+	return (*backupDisk == -1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : write_striped
+// Description  : appends blocks to a tagline with the striped layout. Each
+//				  piece of a stripe unit is one RAID_WRITE per copy, and all
+//				  of them are sent pipelined so the disk pairs work at once.
+//				  The places are only taken from the disks once everything is
+//				  written; backups of relaxed taglines are queued after that,
+//				  and the ones that can not be are marked stale.
+//
+// Inputs       : tag - the tagline
+//				  bnum - the first block to write, the end of the tagline
+//				  blks - the number of blocks
+//				  buf - the data of the blocks
+// Outputs      : 0 if successful, 1 if failure
+
+int write_striped(TagLineNumber tag, TagLineBlockNumber bnum, int blks, char *buf){
+
+	RAIDOpCode ops[TAGLINE_PIPELINE_BATCH];
+	void *bufs[TAGLINE_PIPELINE_BATCH];
+	struct raid_mirror_payload mirrors[TAGLINE_PIPELINE_BATCH];
+	struct stripewrite units[MAX_TAGLINE_BLOCK_NUMBER];
+	uint32_t next[RAID_DISKS];
+	RAIDOpCode operation = 0;
+	struct tagline loc;
+	int i, j, u, run, disk, backupDisk, unitCount = 0, count = 0;
+	int failed = 0, mirrored;
+
+	mirrored = (tagdurability[tag] == TAGLINE_DURABLE_BOTH && offload_ready(&mirrorOffload, RAID_MIRROR_WRITE));
+
+	//Where each disk would be filled to, nothing is taken yet
+	for (i = 0; i < arrayDisks; i++)
+		next[i] = array[i].blocks + 1;
+
+	//Find a place for every stripe unit first, so a disk that is full or not
+	//ready fails the write before anything is sent
+	for (i = 0; i < blks; i += run){
+
+		//The rest of the stripe unit this block falls in
+		run = stripeUnit - (bnum + i) % stripeUnit;
+		if (run > blks - i)
+			run = blks - i;
+
+		if (stripe_disks(tag, (bnum + i) / stripeUnit, &disk, &backupDisk)){
+			logMessage(LOG_ERROR_LEVEL, "TAGLINE : not enough ready disks to stripe tagline %u.", tag);
+			return (1);
+		}
+
+		if (next[disk] + run >= RAID_DISKBLOCKS || next[backupDisk] + run >= RAID_DISKBLOCKS){
+			logMessage(LOG_ERROR_LEVEL, "TAGLINE : no room to stripe %u blocks of tagline %u.", blks, tag);
+			return (1);
+		}
+
+		units[unitCount].first = i;
+		units[unitCount].blocks = run;
+		units[unitCount].primary = MAKE_LOC(disk, next[disk]);
+		units[unitCount].backup = MAKE_LOC(backupDisk, next[backupDisk]);
+		unitCount++;
+
+		next[disk] += run;
+		next[backupDisk] += run;
+	}
+
+	for (u = 0; u < unitCount && !failed; u++){
+
+		i = units[u].first;
+		run = units[u].blocks;
+
+		//Write to cache
+		for (j = 0; j < run; j++)
+			cache_fill(LOC_DISK(units[u].primary), LOC_POSITION(units[u].primary)+j, &buf[(i+j)*RAID_BLOCK_SIZE]);
 
+		//One frame for both copies if the server can fan it out
+		if (mirrored){
+			ops[count] = mirror_write_request(units[u].primary, units[u].backup, run, &buf[i*RAID_BLOCK_SIZE], &mirrors[count]);
+			bufs[count] = &mirrors[count];
+			count++;
+		}
+		else{
+			ops[count] = create_raid_request(RAID_WRITE, run, LOC_DISK(units[u].primary), LOC_POSITION(units[u].primary));
+			bufs[count++] = &buf[i*RAID_BLOCK_SIZE];
+
+			//Relaxed taglines queue the backup copy once this is done
+			if (tagdurability[tag] == TAGLINE_DURABLE_BOTH){
+				ops[count] = create_raid_request(RAID_WRITE, run, LOC_DISK(units[u].backup), LOC_POSITION(units[u].backup));
+				bufs[count++] = &buf[i*RAID_BLOCK_SIZE];
 			}
-			if (Globtag[i][j].backupDisk == disk){
+		}
 
+		if (count > TAGLINE_PIPELINE_BATCH - 2){
+			failed |= pipeline_flush(count, ops, bufs);
+			count = 0;
+		}
+	}
 
-				//Read from the other disk
-				operation = create_raid_request(RAID_READ, 1, Globtag[i][j].disk, Globtag[i][j].diskPosition);
-				response = client_raid_bus_request(operation,tempbuf);
+	if (!failed)
+		failed = pipeline_flush(count, ops, bufs);
 
-				//Check Response
-				if(extract_raid_response(response, operation))
-					return (1);
+	//Map postion of each Tagline Block to a Disk Block
+	for (u = 0; u < unitCount && !failed; u++){
+		for (j = 0; j < units[u].blocks && !failed; j++){
+			loc.primary = units[u].primary + j;
+			loc.backup = units[u].backup + j;
+			if (map_update(tag, bnum+units[u].first+j, loc))
+				failed = 1;
+		}
+	}
 
-				//Now copy back to the disk
-				operation = create_raid_request(RAID_WRITE, 1, Globtag[i][j].backupDisk, Globtag[i][j].backupDiskPosition);
-				response = client_raid_bus_request(operation, tempbuf);
+	//The blocks were new, forget them again; their places were never taken
+	//and nothing of them is queued, so they can be handed out again
+	if (failed){
+		loc.primary = TAGLINE_NO_LOC;
+		loc.backup = TAGLINE_NO_LOC;
+		for (u = 0; u < unitCount; u++){
+			for (j = 0; j < units[u].blocks; j++){
+				invalidate_raid_cache(LOC_DISK(units[u].primary), LOC_POSITION(units[u].primary)+j);
+				map_update(tag, bnum+units[u].first+j, loc);
+			}
+		}
+		return (1);
+	}
 
-				if(extract_raid_response(response, operation))
-					return (1);
+	//Which blocks of each disk were used.
+	for (i = 0; i < arrayDisks; i++)
+		array[i].blocks = next[i] - 1;
+
+	//The backups of a relaxed tagline go after the primaries are on disk. The
+	//blocks are written and mapped already, so a backup that can not be
+	//queued is only behind, like one the mirror thread failed to write
+	if (tagdurability[tag] != TAGLINE_DURABLE_BOTH){
+		for (u = 0; u < unitCount; u++){
+			operation = create_raid_request(RAID_WRITE, units[u].blocks, LOC_DISK(units[u].backup), LOC_POSITION(units[u].backup));
+			if (failed || write_backup(tag, bnum + units[u].first, operation, &buf[units[u].first*RAID_BLOCK_SIZE])){
+				backup_mark(tag, bnum + units[u].first, units[u].blocks, 1);
+				failed = 1;
 			}
 		}
+		if (failed)
+			logMessage(LOG_ERROR_LEVEL, "TAGLINE : backups of tagline %u from block %u are behind.", tag, bnum);
+	}
+
+	tagcounter[tag] += blks;
+
+	logMessage(LOG_INFO_LEVEL, "TAGLINE : wrote %u blocks to tagline %u, starting block %u.",
+			blks, tag, bnum);
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : offload_ready
+// Description  : tells if a protocol extension can be used, probing the server
+//				  the first time with an empty request of that type. The probe
+//				  goes on a channel of its own, so a server that drops the
+//				  connection does not take the main one with it.
+//
+// Inputs       : state - the state of the extension, updated by the probe
+//				  type - RAID_COPY or RAID_MIRROR_WRITE
+// Outputs      : 1 if the extension can be used, 0 if not
+
+int offload_ready(int *state, uint8_t type){
+
+	RAIDOpCode operation = 0;
+	RAIDOpCode response = 0;
+	struct raid_mirror_payload mirror;
+	uint64_t target;
+	void *payload;
+
+	if (__atomic_load_n(state, __ATOMIC_ACQUIRE) != TAGLINE_OFFLOAD_PROBE)
+		return (__atomic_load_n(state, __ATOMIC_ACQUIRE) == TAGLINE_OFFLOAD_ON);
+
+	//The probe channel is used by one thread at a time
+	pthread_mutex_lock(&probeLock);
+	if (*state != TAGLINE_OFFLOAD_PROBE){
+		pthread_mutex_unlock(&probeLock);
+		return (*state == TAGLINE_OFFLOAD_ON);
+	}
+
+	operation = create_raid_request(type, 0, 0, 0);
+	target = htonll64(RAID_COPY_TARGET(0, 0));
+	mirror.blocks = NULL;
+	payload = (type == RAID_COPY) ? (void *)&target : (void *)&mirror;
+
+	response = client_raid_bus_request_channel(TAGLINE_PROBE_CHANNEL, operation, payload);
+
+	if (extract_raid_response(response, operation, NULL)){
+		logMessage(LOG_INFO_LEVEL, "TAGLINE : server has no extension %u, falling back.", type);
+		__atomic_store_n(state, TAGLINE_OFFLOAD_OFF, __ATOMIC_RELEASE);
+		pthread_mutex_unlock(&probeLock);
+		return (0);
+	}
+
+	__atomic_store_n(state, TAGLINE_OFFLOAD_ON, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&probeLock);
+	return (1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : mirror_write_request
+// Description  : builds the RAID_MIRROR_WRITE of a run of blocks that has both
+//				  copies contiguous
+//
+// Inputs       : primary - location of the first block of the primary copy
+//				  backup - location of the first block of the backup copy
+//				  blks - the number of blocks
+//				  buf - the blocks
+//				  mirror - the payload to fill, handed to the client as buffer
+// Outputs      : the opcode
+
+RAIDOpCode mirror_write_request(uint32_t primary, uint32_t backup, int blks, char *buf, struct raid_mirror_payload *mirror){
+
+	mirror->blocks = buf;
+	mirror->targets[0] = htonll64(RAID_COPY_TARGET(LOC_DISK(backup), LOC_POSITION(backup)));
+
+	return (RAID_OP_WITH_TARGETS(create_raid_request(RAID_MIRROR_WRITE, blks, LOC_DISK(primary), LOC_POSITION(primary)), 1));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cache_fill
+// Description  : puts a block just written in the cache, or when streaming
+//				  only drops the old one
+//
+// Inputs       : disk - the disk of the block
+//				  block - its place on the disk
+//				  buf - the block
+// Outputs      : none
+
+void cache_fill(int disk, int block, char *buf){
+
+	if (cacheBypass)
+		invalidate_raid_cache(disk, block);
+	else
+		put_raid_cache(disk, block, buf);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_reserve
+// Description  : preallocates a contiguous region on each copy for the next
+//				  appends of a tagline, so a tagline that grows a few blocks at
+//				  a time still ends up in one extent per disk. A new reservation
+//				  replaces what was left of the previous one.
+//
+// Inputs       : tag - the tagline
+//				  nblocks - the number of blocks to reserve
+// Outputs      : 0 if successful, 1 if failure
+
+int tagline_reserve(TagLineNumber tag, uint32_t nblocks){
+
+	int disk, backupDisk;
+
+	pthread_mutex_lock(&writeLock);
+
+	if (reserved == NULL || tag >= maxtaglines){
+		pthread_mutex_unlock(&writeLock);
+		return (1);
+	}
+
+	//Computed placement keeps every tagline contiguous already
+	if (placementMode == TAGLINE_PLACEMENT_COMPUTED){
+		pthread_mutex_unlock(&writeLock);
+		return (0);
+	}
+
+	if (nblocks > MAX_TAGLINE_BLOCK_NUMBER - tagcounter[tag]){
+		pthread_mutex_unlock(&writeLock);
+		return (1);
+	}
+
+	if (nblocks == 0){
+		reserved[tag].blocks = 0;
+		pthread_mutex_unlock(&writeLock);
+		return (0);
 	}
 
-	//Disk Recovered!
-	array[disk].status = RAID_DISK_READY;
+	if (choose_extent(nblocks, &disk, &backupDisk)){
+		pthread_mutex_unlock(&writeLock);
+		return (1);
+	}
 
-	//Free memory
-	free(tempbuf);
-	tempbuf = NULL;
+	reserved[tag].primary = MAKE_LOC(disk, array[disk].blocks+1);
+	reserved[tag].backup = MAKE_LOC(backupDisk, array[backupDisk].blocks+1);
+	reserved[tag].blocks = nblocks;
 
+	array[disk].blocks += nblocks;
+	array[backupDisk].blocks += nblocks;
+
+	pthread_mutex_unlock(&writeLock);
 	return (0);
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : choose_extent
+// Description  : picks the two ready disks with the most room for a new
+//				  extent of both copies
+//
+// Inputs       : n - the number of blocks of the extent
+//				  disk - returns the disk of the primary copy
+//				  backupDisk - returns the disk of the backup copy
+// Outputs      : 0 if successful, 1 if there is no room
+
+int choose_extent(int n, int *disk, int *backupDisk){
+
+	int i;
+
+	*disk = -1;
+	*backupDisk = -1;
+
+	for (i = 0; i < arrayDisks; i++){
+		if (array[i].status != RAID_DISK_READY)
+			continue;
+		if (*disk == -1 || array[i].blocks < array[*disk].blocks){
+			*backupDisk = *disk;
+			*disk = i;
+		}
+		else if (*backupDisk == -1 || array[i].blocks < array[*backupDisk].blocks)
+			*backupDisk = i;
+	}
+
+	if (*backupDisk == -1 || array[*backupDisk].blocks + n >= RAID_DISKBLOCKS - 1)
+		return (1);
+
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : write_extent
+// Description  : appends blocks to a tagline at a contiguous place of each
+//				  copy and maps them. An extent longer than a RAID_WRITE is
+//				  written in pieces, all of them sent pipelined.
+//
+// Inputs       : tag - the tagline
+//				  bnum - the first block, the end of the tagline
+//				  blks - the number of blocks
+//				  buf - the data of the blocks
+//				  primary - location of the first block of the primary copy
+//				  backup - location of the first block of the backup copy
+// Outputs      : 0 if successful, 1 if failure
+
+int write_extent(TagLineNumber tag, TagLineBlockNumber bnum, int blks, char *buf, uint32_t primary, uint32_t backup){
+
+	RAIDOpCode ops[2 * TAGLINE_MAX_PIECES];
+	void *bufs[2 * TAGLINE_MAX_PIECES];
+	struct raid_mirror_payload mirrors[TAGLINE_MAX_PIECES];
+	struct tagline loc;
+	int i, piece, mirrored, count = 0;
+
+	//Write to cache 
+	for (i=0; i < blks; i++){
+		cache_fill(LOC_DISK(primary), LOC_POSITION(primary)+i, &buf[i*RAID_BLOCK_SIZE]);
+	}
+
+	//Places appended on the disk being rebuilt are current once written
+	if (atomic_load(&rebuildDisk) != -1){
+		for (i = 0; i < blks; i++){
+			rebuild_claim(primary + i);
+			rebuild_claim(backup + i);
+		}
+	}
+
+	//Both copies in one frame when the server fans it out itself, else both
+	//at the same time (each by the worker of its disk if they run)
+	mirrored = (tagdurability[tag] == TAGLINE_DURABLE_BOTH && offload_ready(&mirrorOffload, RAID_MIRROR_WRITE));
+	for (i = 0; i < blks; i += piece){
+		piece = (blks - i > TAGLINE_MAX_RUN) ? TAGLINE_MAX_RUN : blks - i;
+
+		if (mirrored){
+			ops[count] = mirror_write_request(primary + i, backup + i, piece, &buf[i*RAID_BLOCK_SIZE], &mirrors[count]);
+			bufs[count] = &mirrors[count];
+			count++;
+			continue;
+		}
+
+		ops[count] = create_raid_request(RAID_WRITE, piece, LOC_DISK(primary), LOC_POSITION(primary) + i);
+		bufs[count++] = &buf[i*RAID_BLOCK_SIZE];
+		if (tagdurability[tag] == TAGLINE_DURABLE_BOTH){
+			ops[count] = create_raid_request(RAID_WRITE, piece, LOC_DISK(backup), LOC_POSITION(backup) + i);
+			bufs[count++] = &buf[i*RAID_BLOCK_SIZE];
+		}
+	}
+
+	if (pipeline_flush(count, ops, bufs))
+		return (1);
+
+	//Relaxed taglines queue the backup copy once the primary is on disk, it is
+	//only read back during a recovery so it does not go to the cache
+	if (tagdurability[tag] != TAGLINE_DURABLE_BOTH){
+		for (i = 0; i < blks; i += piece){
+			piece = (blks - i > TAGLINE_MAX_RUN) ? TAGLINE_MAX_RUN : blks - i;
+			if (write_backup(tag, bnum + i, create_raid_request(RAID_WRITE, piece, LOC_DISK(backup), LOC_POSITION(backup) + i), &buf[i*RAID_BLOCK_SIZE])){
+
+				//The places are not taken, a piece queued already must land
+				//before they are handed out again
+				mirror_drain();
+				return (1);
+			}
+		}
+	}
+
+	//Map postion of each Tagline Block to a Disk Block
+	for(i = 0; i < blks; i++){
+		loc.primary = primary + i;
+		loc.backup = backup + i;
+		if (map_update(tag, bnum+i, loc))
+			break;
+	}
+
+	//A block that could not be mapped fails the write, the ones mapped before
+	//it are dropped again and the tagline keeps its length
+	if (i < blks){
+		logMessage(LOG_ERROR_LEVEL, "TAGLINE : unable to map block %u of tagline %u.", bnum+i, tag);
+		loc.primary = loc.backup = TAGLINE_NO_LOC;
+		while (i-- > 0)
+			map_update(tag, bnum+i, loc);
+		for (i = 0; i < blks; i++)
+			invalidate_raid_cache(LOC_DISK(primary), LOC_POSITION(primary)+i);
+
+		//The places are handed out again, a queued backup must land first
+		if (tagdurability[tag] != TAGLINE_DURABLE_BOTH)
+			mirror_drain();
+		return (1);
+	}
+
+	//Save information of current operation:
+	tagcounter[tag] += blks;
+
+	logMessage(LOG_INFO_LEVEL, "TAGLINE : wrote %u blocks to tagline %u, starting block %u.",
+			blks, tag, bnum);
+	return (0);
+}
 
 ////////////////////////////////////////////////////////////////////////////////
 //
@@ -727,21 +1763,21 @@ int chooseDisk(int *disk, int *backupDisk, int blks){
 	//Change disk
 	if(backupDisk == NULL){
 		while(*disk == oldDisk)
-			*disk = rand() % RAID_DISKS;
+			*disk = rand() % arrayDisks;
 	}
 
 	//Change Backup
 	if (disk == NULL){
 		while(*backupDisk == oldBDisk)
-			*backupDisk = rand() % RAID_DISKS;
+			*backupDisk = rand() % arrayDisks;
 	}
 
 	//Changing Both
 	if (disk != NULL && backupDisk != NULL){
 		//Make sure disks are not full and are Different
 		while (*disk == *backupDisk){	
-			*disk = rand() % RAID_DISKS;
-			*backupDisk = rand() % RAID_DISKS;
+			*disk = rand() % arrayDisks;
+			*backupDisk = rand() % arrayDisks;
 		}
 	}
 
@@ -802,14 +1838,15 @@ RAIDOpCode create_raid_request(uint8_t type, uint8_t blockQuantity, uint8_t disk
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : extract_raid_response
-// Description  : Checks every field of the raid response, saves the fields on
-//                Globresponse and compares to the original request returning
-//				  failure if something changed.				  
+// Description  : Checks every field of the raid response, returns the fields
+//                to the caller that wants them and compares to the original
+//				  request returning failure if something changed.
 // Inputs       : resp - response of the raid after applying and operation
-//				  operation - the op code originally sent to the RAID  
+//				  operation - the op code originally sent to the RAID
+//				  fields - where the fields of the response go, NULL for none
 // Outputs      : 1 if failure, 0 if success
 
-int extract_raid_response(RAIDOpCode resp, RAIDOpCode operation) {
+int extract_raid_response(RAIDOpCode resp, RAIDOpCode operation, struct RAIDresponse *fields) {
 
 	//Response fields:
 
@@ -817,54 +1854,56 @@ int extract_raid_response(RAIDOpCode resp, RAIDOpCode operation) {
 	// | type(8bits) | blockQuantity (8bits) | diskNumber (8bits)| 000..(7bits) |status(1bit)| | id (32 bits)
 	//+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-
 
-	//Clear this field
-	GlobResponse.id = 0;
+	//The fields decoded, on the stack of the caller so threads do not share them
+	struct RAIDresponse decoded;
 
 	//temporal variables
 	uint8_t temp = 0;
 	uint32_t tempID = 0;
 
+	if (fields == NULL)
+		fields = &decoded;
 
 	//Get the ID:
 	//shift 32 bits to the left to erase upper bits, then back the right.
-	GlobResponse.id = (resp<<32) >> 32;
+	fields->id = (resp<<32) >> 32;
 	tempID = (operation << 32) >> 32;
 
 	
 	//Check status bit:
 	//Shift 31 bits to erase upper bits, then shift 63 back and check
-	GlobResponse.status = (resp<<31)>>63;
+	fields->status = (resp<<31)>>63;
 
-	if(GlobResponse.status == 1)
+	if(fields->status == 1)
 		return (1);
 
 	//Get Disk Number:
 	// 0xFF0000000000u = 1111 1111 0000 0000 .... 0000 (40 bits of 0s)
 	//Does an AND logical operation to copy bits, then shift to the right
-	GlobResponse.diskNumber = (0xFF0000000000u & resp) >> 40;
+	fields->diskNumber = (0xFF0000000000u & resp) >> 40;
 	temp = (0xFF0000000000u & operation) >> 40;
 
-	if(GlobResponse.diskNumber != temp)
+	if(fields->diskNumber != temp)
 		return (1);
 
 	//Get block Quantity, shift 8 bits to the left to erase upper bits, then shift back
-	GlobResponse.blockQuantity = (resp<<8)>>56;
+	fields->blockQuantity = (resp<<8)>>56;
 	temp = (operation<<8)>>56;
 	
-	if (GlobResponse.blockQuantity != temp)
+	if (fields->blockQuantity != temp)
 		return (1);
 	
 	//Get type:
-	GlobResponse.type = (resp) >> 56;
+	fields->type = (resp) >> 56;
 	temp = (operation) >> 56;
 	
-	if(GlobResponse.type != temp)
+	if(fields->type != temp)
 		return (1);	
 
-	if (GlobResponse.id != tempID && GlobResponse.type != RAID_STATUS)
+	if (fields->id != tempID && fields->type != RAID_STATUS)
 		return (1);
 
 	
 	//return successfully
 	return (0);
-}
\ No newline at end of file
+}
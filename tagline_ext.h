@@ -0,0 +1,138 @@
+#ifndef TAGLINE_EXT_INCLUDED
+#define TAGLINE_EXT_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : tagline_ext.h
+//  Description    : This is the interface of the extensions to the TAGLINE
+//                   driver: large and zero copy I/O, placement and durability
+//                   settings, the background services (defragmenter, disk
+//                   monitor, rebalancing, replication) and streaming. The
+//                   tagline_set_* calls documented as such have to be made
+//                   before tagline_driver_init.
+//
+//  Author         : agent
+//  Last Modified  : 10/18/2026
+//
+
+// Include Files
+#include <stdint.h>
+
+// Project Include Files
+#include <tagline_driver.h>
+
+// Defines
+
+//Placement modes (tagline_set_placement)
+#define TAGLINE_PLACEMENT_TABLE      0     // The location of every block is kept in a table
+#define TAGLINE_PLACEMENT_COMPUTED   1     // Locations are hashed, moved blocks are remembered
+
+//Durability of a tagline (tagline_set_durability)
+#define TAGLINE_DURABLE_BOTH     0     // A write returns once both copies are on disk
+#define TAGLINE_DURABLE_ONE      1     // Once the primary is, the backup follows
+
+//Health of a disk (tagline_disk_health)
+#define TAGLINE_DISK_UNKNOWN     0     // Not formatted yet or the poll failed
+#define TAGLINE_DISK_HEALTHY     1
+#define TAGLINE_DISK_FAILED      2     // Failed and the rebuild did not succeed
+#define TAGLINE_DISK_REBUILDING  3
+
+//
+// Interface
+
+// Settings, before tagline_driver_init
+
+int tagline_set_placement(int mode);
+	// Select TAGLINE_PLACEMENT_TABLE or TAGLINE_PLACEMENT_COMPUTED, 0 if successful
+
+int tagline_set_disks(uint32_t disks);
+	// Start the array with the first disks (2 to RAID_DISKS) of the bus, 0 if successful
+
+int tagline_set_workers(int enable);
+	// Run the I/O of every disk on a worker thread of its own, 0 if successful
+
+int tagline_set_metadata(const char *path, uint32_t pages);
+	// Keep the block table in path with pages pages in memory, 0 if successful
+
+int tagline_set_digests(int enable);
+	// Keep Merkle digests of both copies of every tagline, 0 if successful
+
+int tagline_set_monitor(uint32_t interval);
+	// Poll the disks every interval ms at most and rebuild failed ones, 0 if successful
+
+int tagline_set_replica(const char *address, unsigned short port);
+	// Replicate every write to the array at address:port, 0 if successful
+
+// Settings, any time
+
+int tagline_set_hedging(int percentile);
+	// Hedge reads slower than the percentile (1-99) of recent ones, 0 turns it off
+
+int tagline_set_stripe_unit(uint32_t blocks);
+	// Stripe new blocks over the disk pairs in units of blocks, 0 turns it off
+
+int tagline_set_copy_offload(int enable);
+	// Copy blocks between disks on the server (RAID_COPY) if it can, 0 if successful
+
+int tagline_set_mirror_offload(int enable);
+	// Send both copies of a write in one frame (RAID_MIRROR_WRITE) if it can, 0 if successful
+
+int tagline_set_defrag(uint32_t budget);
+	// Move at most budget fragmented blocks every few writes, 0 turns it off
+
+int tagline_set_durability(TagLineNumber tag, int mode);
+	// Select TAGLINE_DURABLE_BOTH or TAGLINE_DURABLE_ONE for a tagline, 0 if successful
+
+int tagline_set_rebuild_priority(TagLineNumber tag, uint8_t priority);
+	// Rebuild the copies of a tagline before those of lower priority, 0 if successful
+
+// I/O
+
+int tagline_read_large(TagLineNumber tag, TagLineBlockNumber bnum, uint32_t blks, char *buf);
+	// Read any number of blocks with pipelined requests, 0 if successful
+
+int tagline_write_large(TagLineNumber tag, TagLineBlockNumber bnum, uint32_t blks, char *buf);
+	// Write any number of blocks with pipelined requests, 0 if successful
+
+int tagline_read_ref(TagLineNumber tag, TagLineBlockNumber bnum, const char **ref);
+	// Reference a cached block, valid until tagline_read_release, 0 if successful
+
+int tagline_read_release(const char *ref);
+	// Give back a reference of tagline_read_ref, 0 if successful
+
+int tagline_reserve(TagLineNumber tag, uint32_t nblocks);
+	// Preallocate contiguous space for the next appends of a tagline, 0 if successful
+
+int tagline_export(TagLineNumber tag, int fd);
+	// Write every block of a tagline to fd, the blocks exported or -1 if failure
+
+int tagline_import(int fd, TagLineNumber tag);
+	// Replace the blocks of a tagline with those of fd, the blocks imported or -1 if failure
+
+// Maintenance
+
+int tagline_defrag_step(uint32_t budget);
+	// Move at most budget fragmented blocks, the blocks moved or -1 if failure
+
+int tagline_add_disks(uint32_t disks, uint32_t budget);
+	// Grow the array and rebalance onto the new disks, 0 if successful
+
+int tagline_rebalance_step(uint32_t budget);
+	// Move at most budget blocks to emptier disks, the blocks moved or -1 if failure
+
+int tagline_disk_health(uint8_t disk);
+	// The last known TAGLINE_DISK_* health of a disk, -1 if failure
+
+int tagline_mirror_verify(TagLineNumber tag);
+	// Blocks whose two copies differ by their digests, -1 if failure
+
+int tagline_mirror_resync(TagLineNumber tag);
+	// Rewrite the copies that differ, the blocks written or -1 if failure
+
+int tagline_replica_format(void);
+	// Format the second array and send it every tagline again, 0 if successful
+
+uint64_t tagline_replica_lag(uint32_t *writes, uint32_t *blocks, uint32_t *taglines);
+	// Age in usec of the oldest change the replica does not have, 0 if up to date
+
+#endif
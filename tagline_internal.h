@@ -0,0 +1,264 @@
+#ifndef TAGLINE_INTERNAL_INCLUDED
+#define TAGLINE_INTERNAL_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : tagline_internal.h
+//  Description    : This is the interface between the parts of the TAGLINE
+//                   driver: the locations of the blocks, the state of the
+//                   array shared by the I/O paths and the background services,
+//                   and the functions they call in each other. Applications
+//                   use tagline_driver.h and tagline_ext.h instead.
+//
+//  Author         : agent
+//  Last Modified  : 10/18/2026
+//
+
+// Include Files
+#include <stdint.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+// Project Include Files
+#include <raid_bus.h>
+#include <tagline_driver.h>
+#include <raid_ext.h>
+#include <tagline_ext.h>
+
+// Defines
+
+//Each Block of the tagline is kept in two places, the disk and the backup disk.
+//A place is packed in 32 bits: the disk number in the upper 8 bits and the disk
+//block in the lower 24 bits, so a whole entry is 8 bytes and a 64 byte cache line
+//holds 8 consecutive blocks of a tagline. All bits set means the block is unused,
+//so disk 255 is never a place (it would pack to the unused value).
+#define TAGLINE_NO_LOC       0xFFFFFFFFu
+#define TAGLINE_LINE_SIZE    64
+
+#if RAID_DISKBLOCKS > 0xFFFFFF
+#error "RAID_DISKBLOCKS does not fit in the 24 bits of a packed tagline location"
+#endif
+
+#if RAID_DISKS > 255
+#error "RAID_DISKS does not fit in the 8 bits of a packed tagline location (disk 255 is reserved)"
+#endif
+
+//Accessors for the packed locations, an unused location gives -1 for both fields
+#define LOC_DISK(loc)        ((loc) == TAGLINE_NO_LOC ? -1 : (int)((loc) >> 24))
+#define LOC_POSITION(loc)    ((loc) == TAGLINE_NO_LOC ? -1 : (int)((loc) & 0xFFFFFF))
+#define MAKE_LOC(dsk, pos)   (((uint32_t)(dsk) << 24) | ((uint32_t)(pos) & 0xFFFFFF))
+
+//Placement modes: TABLE keeps the location of every block in Globtag, COMPUTED
+//derives the locations of (tag, bnum) from a hash over the array topology and only
+//remembers the blocks that were moved somewhere else (the exception table).
+//The mode has to be chosen with tagline_set_placement() before tagline_driver_init.
+
+//Consecutive blocks of a tagline in the same placement group stay contiguous on disk
+#define TAGLINE_PG_BLOCKS            16
+#define TAGLINE_EXCEPTION_BUCKETS    1024
+
+//Large I/O: RAID operations handed to the client at once
+#define TAGLINE_PIPELINE_BATCH   32
+
+//Threads of the driver with connections (channels) of their own. Channel 0 is
+//the one of the application, 1 and 2 are the hedge channels of the client.
+#define TAGLINE_WORKERS          8
+#define TAGLINE_REBUILD_THREADS  4
+
+#define TAGLINE_MIRROR_CHANNEL   3     // Backup writes of relaxed taglines
+#define TAGLINE_PROBE_CHANNEL    4     // Probes of the protocol extensions
+#define TAGLINE_WORKER_CHANNEL   5     // The disk workers, TAGLINE_WORKERS of them
+#define TAGLINE_REBUILD_CHANNEL  13    // The rebuild, TAGLINE_REBUILD_THREADS of them
+#define TAGLINE_MONITOR_CHANNEL  17    // The health monitor
+#define TAGLINE_REPLICA_CHANNEL  18    // Connection to the second array
+#define TAGLINE_RESEND_CHANNEL   19    // Reads of the taglines sent again whole
+
+// Structures
+
+//Reads look at the status of a disk without any lock, it is atomic
+struct disks
+{
+	_Atomic int status;
+	//Blocks in the disk are filled linearly, the number store in 'int block'
+	//denotes that until that block disk is filled (0 based), -1 means is empty
+	int blocks;
+};
+
+//The two places of a block, TAGLINE_NO_LOC if it has none
+struct tagline
+{
+	uint32_t primary;
+	uint32_t backup;
+};
+
+//Relocated blocks in computed placement, chained by (tag, bnum)
+struct tagexception
+{
+	TagLineNumber tag;
+	TagLineBlockNumber bnum;
+	struct tagline loc;
+	struct tagexception *next;
+	struct tagexception *retired; //Next entry waiting to be freed
+	uint64_t retiredEpoch;
+};
+
+//Mirror digests of a tagline
+struct tagdigest
+{
+	uint64_t *nodes[2]; //Per copy, root at 1 and leaf i at digestLeaves + i
+};
+
+struct RAIDresponse
+{
+	uint8_t status; //status bit of response (only 1 bit)
+	uint8_t type;
+	uint8_t blockQuantity;
+	uint8_t diskNumber;
+	uint32_t id;
+};
+
+// Global Variables
+
+//The array (tagline_driver.c)
+extern int maxtaglines;
+extern int *tagcounter;
+extern struct disks array[RAID_DISKS];
+extern _Atomic uint32_t diskFormats[RAID_DISKS];
+extern uint32_t arrayDisks;
+extern int copyOffload;
+extern int mirrorOffload;
+extern pthread_mutex_t writeLock;
+extern pthread_mutex_t recoverLock;
+
+//Block map (tagline_map.c)
+extern struct tagline **Globtag;
+extern struct tagline *Globmap;
+extern int placementMode;
+extern uint32_t placementRegion;
+extern struct tagexception **exceptions;
+extern char *metaPath;
+extern pthread_mutex_t mapLock;
+
+//Backup copies (tagline_mirror.c)
+extern uint8_t *tagdurability;
+extern int mirrorRunning;
+extern pthread_t mirrorThread;
+extern pthread_mutex_t mirrorLock;
+extern pthread_cond_t mirrorWork;
+extern uint8_t *backupStale;
+extern _Atomic uint32_t backupStaleCount;
+
+//Disk workers (tagline_workers.c)
+extern int workersEnabled;
+extern int workersRunning;
+
+//Rebuild (tagline_rebuild.c)
+extern uint32_t *tagheat;
+extern uint8_t *tagpriority;
+extern _Atomic int rebuildDisk;
+extern _Atomic uint64_t rebuildStolen;
+
+//Health monitor (tagline_monitor.c)
+extern _Atomic int diskHealth[RAID_DISKS];
+extern _Atomic uint32_t diskFailures[RAID_DISKS];
+extern uint32_t monitorInterval;
+
+//Defragmenter (tagline_defrag.c)
+extern uint32_t defragBudget;
+extern uint32_t defragWrites;
+
+//Growth of the array (tagline_rebalance.c)
+extern uint32_t rebalanceBudget;
+extern uint32_t rebalanceWrites;
+extern uint32_t rebalanceTarget;
+extern uint32_t rebalanceLive[RAID_DISKS];
+
+//Mirror digests (tagline_digest.c)
+extern int digestsEnabled;
+extern uint32_t digestLeaves;
+extern struct tagdigest *digests;
+extern pthread_mutex_t digestLock;
+
+//Streaming (tagline_stream.c)
+extern __thread int cacheBypass;
+
+//Replication (tagline_replica.c)
+extern unsigned short replicaPort;
+extern int replicaRunning;
+extern uint8_t *replicaDirty;
+
+//
+// Interface
+
+//The array (tagline_driver.c)
+RAIDOpCode create_raid_request(uint8_t, uint8_t, uint8_t, uint32_t);
+int extract_raid_response(RAIDOpCode, RAIDOpCode, struct RAIDresponse *);
+int raid_disk_recover(uint8_t);
+int recover_disk(uint8_t);
+int pipeline_flush(int, RAIDOpCode *, void **);
+int offload_ready(int *, uint8_t);
+RAIDOpCode mirror_write_request(uint32_t, uint32_t, int, char *, struct raid_mirror_payload *);
+int choose_extent(int, int *, int *);
+
+//Block map (tagline_map.c)
+struct tagline tagline_locate(TagLineNumber, TagLineBlockNumber);
+struct tagline computed_location(TagLineNumber, TagLineBlockNumber);
+int map_update(TagLineNumber, TagLineBlockNumber, struct tagline);
+void map_reclaim(int);
+int meta_init(uint32_t);
+void meta_close(void);
+
+//Backup copies (tagline_mirror.c)
+int write_backup(TagLineNumber, TagLineBlockNumber, RAIDOpCode, char *);
+void mirror_drain(void);
+void backup_mark(TagLineNumber, TagLineBlockNumber, uint32_t, int);
+int backup_stale(TagLineNumber, TagLineBlockNumber);
+int backup_repair(int);
+
+//Disk workers (tagline_workers.c)
+int workers_start(void);
+void workers_stop(void);
+int workers_flush(int, RAIDOpCode *, void **);
+
+//Rebuild (tagline_rebuild.c)
+int rebuild_add(uint32_t, uint32_t, TagLineNumber);
+int rebuild_run(void);
+int rebuild_begin(uint8_t);
+void rebuild_end(uint8_t, int);
+void rebuild_claim(uint32_t);
+int read_degraded(TagLineNumber, TagLineBlockNumber, struct tagline, char *);
+void tagline_heat(TagLineNumber, uint32_t);
+
+//Health monitor (tagline_monitor.c)
+int monitor_start(void);
+void monitor_stop(void);
+
+//Mirror digests (tagline_digest.c)
+void digest_set(struct tagdigest *, TagLineBlockNumber, uint32_t, int, const uint64_t *);
+void digest_write(TagLineNumber, TagLineBlockNumber, uint32_t, char *, int);
+void digest_stale(TagLineNumber, TagLineBlockNumber, uint32_t, int);
+void digest_copied(TagLineNumber, TagLineBlockNumber, uint32_t, int);
+
+//Replication (tagline_replica.c)
+int replica_start(void);
+void replica_stop(void);
+void replica_log(TagLineNumber, TagLineBlockNumber, uint32_t, char *, int);
+uint32_t replica_location(TagLineNumber, TagLineBlockNumber);
+
+
+//Client extensions (raid_client.c)
+extern int raid_hedge_percentile;
+RAIDOpCode client_raid_hedged_read(RAIDOpCode, RAIDOpCode, void *, RAIDOpCode *);
+RAIDOpCode client_raid_bus_request_channel(int, RAIDOpCode, void *);
+int client_raid_bus_pipeline(int, int, RAIDOpCode *, void **, RAIDOpCode *);
+int client_raid_channel_endpoint(int, const char *, unsigned short);
+void client_raid_channel_reset(int);
+uint64_t raid_now(void);
+
+//Cache extensions (raid_cache.c)
+void * reserve_raid_cache(RAIDDiskID, RAIDBlockID);
+int pin_raid_cache(const void *);
+int unpin_raid_cache(const void *);
+int invalidate_raid_cache(RAIDDiskID, RAIDBlockID);
+
+#endif
@@ -0,0 +1,594 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : tagline_map.c
+//  Description    : This is the block map of the TAGLINE driver: where the
+//                   two copies of every block of a tagline are. The map is a
+//                   table in memory, a table paged in from a file, or computed
+//                   from a hash with only the moved blocks remembered. Lookups
+//                   never take a lock.
+//
+//  Author         : agent
+//  Last Modified  : 10/18/2026
+//
+
+// Includes
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// Project includes
+#include <cmpsc311_log.h>
+#include "tagline_internal.h"
+
+
+//Definitions
+
+//Out-of-core table (tagline_set_metadata): the table lives in a file in pages
+//of TAGLINE_META_PAGE entries and only metaPages of them are kept in memory,
+//picked by the CLOCK policy. Pages never written are not in the file.
+#define TAGLINE_META_PAGE        512
+
+
+//Structures
+
+//Readers of the map (tagline_locate) never take a lock. Writers hold mapLock,
+//replace table entries with one 8 byte atomic store and never change an
+//exception entry in place: a new one is linked instead and the old one is
+//freed once every reader that could still see it has left (epochs).
+struct mapreader
+{
+	_Atomic uint64_t epoch; //Epoch the reader entered in, 0 if outside
+	struct mapreader *next;
+};
+
+struct metaframe
+{
+	uint64_t page;
+	int valid;
+	int dirty;
+	int referenced;
+	int next; //Next frame in the same bucket of the index
+	struct tagline *entries;
+};
+
+
+//Global Variables
+
+//Global Pointer to the tag structure table
+//Array tag[maxlines][MAX_TAGLINE_BLOCK_NUMBER] created in tagline_driver_init,
+//every row points into one contiguous, cache line aligned block (Globmap)
+struct tagline **Globtag = NULL;
+struct tagline *Globmap = NULL;
+
+int placementMode = TAGLINE_PLACEMENT_TABLE;
+
+//Blocks at the start of every disk taken by each of the two computed copy regions
+uint32_t placementRegion = 0;
+
+struct tagexception **exceptions = NULL;
+
+char *metaPath = NULL;
+uint32_t metaPages = 0;
+int metaFile = -1;
+struct metaframe *metaFrames = NULL;
+int *metaBuckets = NULL;
+uint8_t *metaWritten = NULL; //One bit per page, set once it is in the file
+uint32_t metaHand = 0;
+uint64_t metaHits = 0, metaMisses = 0;
+pthread_mutex_t metaLock = PTHREAD_MUTEX_INITIALIZER;
+
+pthread_mutex_t mapLock = PTHREAD_MUTEX_INITIALIZER;
+_Atomic uint64_t mapEpoch = 1;
+_Atomic(struct mapreader *) mapReaders = NULL;
+__thread struct mapreader *mapReader = NULL;
+struct tagexception *mapRetired = NULL;
+
+
+//Functions Prototypes
+struct mapreader *map_read_begin(void);
+void map_read_end(struct mapreader *);
+void map_retire(struct tagexception *);
+struct tagline *meta_entry(TagLineNumber, TagLineBlockNumber, int);
+int meta_evict(struct metaframe *);
+
+
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_set_placement
+// Description  : selects how the driver decides where the blocks of a tagline
+//				  live, has to be called before tagline_driver_init
+//
+// Inputs       : mode - TAGLINE_PLACEMENT_TABLE or TAGLINE_PLACEMENT_COMPUTED
+// Outputs      : 0 if successful, 1 if failure
+
+int tagline_set_placement(int mode){
+
+	//The layout of the disks can not change once they have data
+	if (Globtag != NULL || exceptions != NULL || metaFrames != NULL)
+		return (1);
+
+	if (mode != TAGLINE_PLACEMENT_TABLE && mode != TAGLINE_PLACEMENT_COMPUTED)
+		return (1);
+
+	placementMode = mode;
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_locate
+// Description  : finds the disk locations of one block of a tagline, using the
+//				  table or, in computed placement, the exception table and then
+//				  the placement function
+//
+// Inputs       : tag - the tagline
+//				  bnum - the block of the tagline
+// Outputs      : the locations of the block, TAGLINE_NO_LOC if never written
+
+struct tagline tagline_locate(TagLineNumber tag, TagLineBlockNumber bnum){
+
+	struct tagline loc = { TAGLINE_NO_LOC, TAGLINE_NO_LOC };
+	struct tagexception *entry;
+	struct mapreader *reader;
+	struct tagline *slot;
+
+	//Out-of-core table, the page has to be brought in
+	if (placementMode == TAGLINE_PLACEMENT_TABLE && metaFrames != NULL){
+		pthread_mutex_lock(&metaLock);
+		slot = meta_entry(tag, bnum, 0);
+		if (slot != NULL)
+			loc = *slot;
+		pthread_mutex_unlock(&metaLock);
+		return (loc);
+	}
+
+	//A table entry is replaced as a whole, one atomic load sees old or new
+	if (placementMode == TAGLINE_PLACEMENT_TABLE){
+		__atomic_load(&Globtag[tag][bnum], &loc, __ATOMIC_ACQUIRE);
+		return (loc);
+	}
+
+	//Blocks that were never written have no location
+	if (bnum >= tagcounter[tag])
+		return (loc);
+
+	//Relocated blocks win over the placement function, the entries seen while
+	//inside are not freed until we leave
+	reader = map_read_begin();
+	loc = computed_location(tag, bnum);
+
+	entry = __atomic_load_n(&exceptions[((uint32_t)tag * MAX_TAGLINE_BLOCK_NUMBER + bnum) % TAGLINE_EXCEPTION_BUCKETS], __ATOMIC_ACQUIRE);
+	while (entry != NULL){
+		if (entry->tag == tag && entry->bnum == bnum){
+			loc = entry->loc;
+			break;
+		}
+		entry = __atomic_load_n(&entry->next, __ATOMIC_ACQUIRE);
+	}
+
+	map_read_end(reader);
+	return (loc);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : computed_location
+// Description  : placement function of the computed mode. Blocks are grouped in
+//				  placement groups of TAGLINE_PG_BLOCKS, every RAID_DISKS groups
+//				  form a row and a hash of the row rotates which disk gets each
+//				  group and how far away its backup is. Inside a row every disk
+//				  gets exactly one primary group and one backup group, so no two
+//				  blocks ever land on the same disk block.
+//
+// Inputs       : tag - the tagline
+//				  bnum - the block of the tagline
+// Outputs      : the locations of the block
+
+struct tagline computed_location(TagLineNumber tag, TagLineBlockNumber bnum){
+
+	struct tagline loc;
+	uint64_t block, group, row, hash;
+	uint32_t offset;
+	int disk, backupDisk;
+
+	//Position of the block in the whole namespace
+	block = (uint64_t)tag * MAX_TAGLINE_BLOCK_NUMBER + bnum;
+	group = block / TAGLINE_PG_BLOCKS;
+	row = group / RAID_DISKS;
+	offset = row * TAGLINE_PG_BLOCKS + block % TAGLINE_PG_BLOCKS;
+
+	//splitmix64 of the row, any process gets the same answer
+	hash = row + 0x9E3779B97F4A7C15ull;
+	hash = (hash ^ (hash >> 30)) * 0xBF58476D1CE4E5B9ull;
+	hash = (hash ^ (hash >> 27)) * 0x94D049BB133111EBull;
+	hash = hash ^ (hash >> 31);
+
+	disk = (group % RAID_DISKS + hash) % RAID_DISKS;
+	backupDisk = (disk + 1 + (hash >> 32) % (RAID_DISKS - 1)) % RAID_DISKS;
+
+	loc.primary = MAKE_LOC(disk, offset);
+	loc.backup = MAKE_LOC(backupDisk, placementRegion + offset);
+
+	return (loc);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : map_update
+// Description  : records new locations for one block of a tagline, in computed
+//				  placement this adds (or drops) an entry of the exception table
+//
+// Inputs       : tag - the tagline
+//				  bnum - the block of the tagline
+//				  loc - the new locations of the block
+// Outputs      : 0 if successful, 1 if failure
+
+int map_update(TagLineNumber tag, TagLineBlockNumber bnum, struct tagline loc){
+
+	struct tagexception **entry;
+	struct tagexception *old, *replacement = NULL;
+	struct tagline computed, *slot;
+
+	pthread_mutex_lock(&mapLock);
+
+	if (placementMode == TAGLINE_PLACEMENT_TABLE && metaFrames != NULL){
+		pthread_mutex_lock(&metaLock);
+		slot = meta_entry(tag, bnum, 1);
+		if (slot != NULL)
+			*slot = loc;
+		pthread_mutex_unlock(&metaLock);
+		pthread_mutex_unlock(&mapLock);
+		return (slot == NULL);
+	}
+
+	if (placementMode == TAGLINE_PLACEMENT_TABLE){
+		__atomic_store(&Globtag[tag][bnum], &loc, __ATOMIC_RELEASE);
+		pthread_mutex_unlock(&mapLock);
+		return (0);
+	}
+
+	computed = computed_location(tag, bnum);
+
+	entry = &exceptions[((uint32_t)tag * MAX_TAGLINE_BLOCK_NUMBER + bnum) % TAGLINE_EXCEPTION_BUCKETS];
+	while (*entry != NULL && ((*entry)->tag != tag || (*entry)->bnum != bnum))
+		entry = &(*entry)->next;
+	old = *entry;
+
+	//Away from the computed place a new entry takes the place of the old one
+	if (loc.primary != computed.primary || loc.backup != computed.backup){
+		replacement = (struct tagexception*) malloc(sizeof(struct tagexception));
+		if (replacement == NULL){
+			pthread_mutex_unlock(&mapLock);
+			return (1);
+		}
+		replacement->tag = tag;
+		replacement->bnum = bnum;
+		replacement->loc = loc;
+		replacement->next = (old != NULL) ? old->next : NULL;
+	}
+	//Back at the computed place, the exception is not needed anymore
+	else if (old != NULL)
+		replacement = old->next;
+	else{
+		pthread_mutex_unlock(&mapLock);
+		return (0);
+	}
+
+	//Readers see either the old chain or the new one, never a half built entry
+	__atomic_store_n(entry, replacement, __ATOMIC_RELEASE);
+
+	if (old != NULL)
+		map_retire(old);
+
+	pthread_mutex_unlock(&mapLock);
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_set_metadata
+// Description  : keeps the table of the table placement in a file instead of
+//				  memory, with a fixed number of pages cached. Lets the driver
+//				  handle more tagline blocks than fit in memory. Has to be
+//				  called before tagline_driver_init.
+//
+// Inputs       : path - the file (created or truncated), NULL for memory
+//				  pages - pages of TAGLINE_META_PAGE entries kept in memory
+// Outputs      : 0 if successful, 1 if failure
+
+int tagline_set_metadata(const char *path, uint32_t pages){
+
+	if (Globtag != NULL || metaFrames != NULL)
+		return (1);
+
+	if (path != NULL && pages == 0)
+		return (1);
+
+	free(metaPath);
+	metaPath = NULL;
+	if (path != NULL){
+		metaPath = strdup(path);
+		if (metaPath == NULL)
+			return (1);
+	}
+
+	metaPages = pages;
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : meta_init
+// Description  : opens the file of the table and creates the page frames
+//
+// Inputs       : maxlines - the number of taglines
+// Outputs      : 0 if successful, 1 if failure
+
+int meta_init(uint32_t maxlines){
+
+	uint64_t pages;
+	uint32_t i;
+
+	pages = ((uint64_t)maxlines * MAX_TAGLINE_BLOCK_NUMBER + TAGLINE_META_PAGE - 1) / TAGLINE_META_PAGE;
+
+	metaFile = open(metaPath, O_RDWR | O_CREAT | O_TRUNC, 0600);
+	if (metaFile == -1){
+		logMessage(LOG_ERROR_LEVEL, "TAGLINE: unable to open metadata file %s", metaPath);
+		return (1);
+	}
+
+	//Whatever was set up before a failure is undone by meta_close
+	metaWritten = (uint8_t*) calloc((pages + 7) / 8, 1);
+	metaFrames = (struct metaframe*) calloc(metaPages, sizeof(struct metaframe));
+	metaBuckets = (int*) malloc(metaPages * sizeof(int));
+	if (metaWritten == NULL || metaFrames == NULL || metaBuckets == NULL){
+		meta_close();
+		return (1);
+	}
+
+	for (i = 0; i < metaPages; i++){
+		metaBuckets[i] = -1;
+		if (posix_memalign((void **)&metaFrames[i].entries, TAGLINE_LINE_SIZE, TAGLINE_META_PAGE * sizeof(struct tagline))){
+			meta_close();
+			return (1);
+		}
+	}
+
+	metaHand = 0;
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : meta_close
+// Description  : closes the file of the table and frees the page frames
+//
+// Inputs       : none
+// Outputs      : none
+
+void meta_close(void){
+
+	uint32_t i;
+
+	if (metaFrames != NULL){
+		logMessage(LOG_OUTPUT_LEVEL, "Metadata pages: %lu hits, %lu misses",
+				(unsigned long)metaHits, (unsigned long)metaMisses);
+		for (i = 0; i < metaPages; i++)
+			free(metaFrames[i].entries);
+	}
+
+	free(metaFrames);
+	metaFrames = NULL;
+	free(metaBuckets);
+	metaBuckets = NULL;
+	free(metaWritten);
+	metaWritten = NULL;
+
+	if (metaFile != -1){
+		close(metaFile);
+		metaFile = -1;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : meta_entry
+// Description  : finds the entry of a block in the cached pages, bringing its
+//				  page in if needed. The frame picked for it is the first one
+//				  the CLOCK hand finds not referenced since it last went by.
+//				  Called with metaLock held, the entry is valid until released.
+//
+// Inputs       : tag - the tagline
+//				  bnum - the block of the tagline
+//				  modify - 1 if the entry is going to be changed
+// Outputs      : pointer to the entry, NULL if failure
+
+struct tagline *meta_entry(TagLineNumber tag, TagLineBlockNumber bnum, int modify){
+
+	struct metaframe *frame;
+	uint64_t index, page;
+	int i, *link;
+
+	index = (uint64_t)tag * MAX_TAGLINE_BLOCK_NUMBER + bnum;
+	page = index / TAGLINE_META_PAGE;
+
+	for (i = metaBuckets[page % metaPages]; i != -1; i = metaFrames[i].next){
+		if (metaFrames[i].page == page){
+			metaHits++;
+			metaFrames[i].referenced = 1;
+			metaFrames[i].dirty |= modify;
+			return (&metaFrames[i].entries[index % TAGLINE_META_PAGE]);
+		}
+	}
+	metaMisses++;
+
+	//Second chance for every referenced frame
+	while (metaFrames[metaHand].valid && metaFrames[metaHand].referenced){
+		metaFrames[metaHand].referenced = 0;
+		metaHand = (metaHand + 1) % metaPages;
+	}
+	frame = &metaFrames[metaHand];
+	metaHand = (metaHand + 1) % metaPages;
+
+	if (frame->valid){
+		if (meta_evict(frame))
+			return (NULL);
+
+		//Out of the index
+		for (link = &metaBuckets[frame->page % metaPages]; *link != frame - metaFrames; link = &metaFrames[*link].next)
+			;
+		*link = frame->next;
+		frame->valid = 0;
+	}
+
+	//Pages that never went to the file are all unused entries
+	if (metaWritten[page / 8] & (1 << (page % 8))){
+		if (pread(metaFile, frame->entries, TAGLINE_META_PAGE * sizeof(struct tagline),
+				page * TAGLINE_META_PAGE * sizeof(struct tagline)) != TAGLINE_META_PAGE * sizeof(struct tagline)){
+			logMessage(LOG_ERROR_LEVEL, "TAGLINE: unable to read metadata page %lu", (unsigned long)page);
+			return (NULL);
+		}
+	}
+	else
+		memset(frame->entries, 0xFF, TAGLINE_META_PAGE * sizeof(struct tagline));
+
+	frame->page = page;
+	frame->valid = 1;
+	frame->referenced = 1;
+	frame->dirty = modify;
+	frame->next = metaBuckets[page % metaPages];
+	metaBuckets[page % metaPages] = frame - metaFrames;
+
+	return (&frame->entries[index % TAGLINE_META_PAGE]);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : meta_evict
+// Description  : writes a page back to the file if it changed
+//
+// Inputs       : frame - the frame holding the page
+// Outputs      : 0 if successful, 1 if failure
+
+int meta_evict(struct metaframe *frame){
+
+	if (!frame->dirty)
+		return (0);
+
+	if (pwrite(metaFile, frame->entries, TAGLINE_META_PAGE * sizeof(struct tagline),
+			frame->page * TAGLINE_META_PAGE * sizeof(struct tagline)) != TAGLINE_META_PAGE * sizeof(struct tagline)){
+		logMessage(LOG_ERROR_LEVEL, "TAGLINE: unable to write metadata page %lu", (unsigned long)frame->page);
+		return (1);
+	}
+
+	metaWritten[frame->page / 8] |= 1 << (frame->page % 8);
+	frame->dirty = 0;
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : map_read_begin
+// Description  : enters a map read, announcing the current epoch so entries
+//				  unlinked from now on are kept until the read ends. Every
+//				  thread registers itself the first time.
+//
+// Inputs       : none
+// Outputs      : the reader record, NULL if it could not be created (the map
+//				  lock is held instead)
+
+struct mapreader *map_read_begin(void){
+
+	struct mapreader *reader = mapReader;
+
+	if (reader == NULL){
+		reader = (struct mapreader*) calloc(1, sizeof(struct mapreader));
+		if (reader == NULL){
+			pthread_mutex_lock(&mapLock);
+			return (NULL);
+		}
+		reader->next = atomic_load(&mapReaders);
+		while (!atomic_compare_exchange_weak(&mapReaders, &reader->next, reader))
+			;
+		mapReader = reader;
+	}
+
+	atomic_store(&reader->epoch, atomic_load(&mapEpoch));
+	atomic_thread_fence(memory_order_seq_cst);
+
+	return (reader);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : map_read_end
+// Description  : leaves a map read
+//
+// Inputs       : reader - the record returned by map_read_begin
+// Outputs      : none
+
+void map_read_end(struct mapreader *reader){
+
+	if (reader == NULL){
+		pthread_mutex_unlock(&mapLock);
+		return;
+	}
+
+	atomic_store_explicit(&reader->epoch, 0, memory_order_release);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : map_retire
+// Description  : queues an exception entry that is not reachable anymore, it
+//				  is freed once no reader is left from the epoch it was unlinked
+//				  in. Called with mapLock held.
+//
+// Inputs       : entry - the unlinked entry
+// Outputs      : none
+
+void map_retire(struct tagexception *entry){
+
+	entry->retiredEpoch = atomic_fetch_add(&mapEpoch, 1);
+	entry->retired = mapRetired;
+	mapRetired = entry;
+
+	map_reclaim(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : map_reclaim
+// Description  : frees the retired entries no reader can still be looking at.
+//				  Called with mapLock held.
+//
+// Inputs       : all - 1 to free every retired entry (no readers are left)
+// Outputs      : none
+
+void map_reclaim(int all){
+
+	struct mapreader *reader;
+	struct tagexception **entry, *old;
+	uint64_t oldest = UINT64_MAX, epoch;
+
+	//Oldest epoch a reader is still in
+	for (reader = atomic_load(&mapReaders); reader != NULL && !all; reader = reader->next){
+		epoch = atomic_load(&reader->epoch);
+		if (epoch != 0 && epoch < oldest)
+			oldest = epoch;
+	}
+
+	entry = &mapRetired;
+	while (*entry != NULL){
+		if ((*entry)->retiredEpoch < oldest){
+			old = *entry;
+			*entry = old->retired;
+			free(old);
+		}
+		else
+			entry = &(*entry)->retired;
+	}
+}
@@ -0,0 +1,378 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : tagline_mirror.c
+//  Description    : This is the backup copy side of the TAGLINE driver: the
+//                   durability of each tagline, the queue of backup writes of
+//                   relaxed taglines with the thread that writes them, and the
+//                   record of the backups that missed a write.
+//
+//  Author         : agent
+//  Last Modified  : 10/18/2026
+//
+
+// Includes
+#include <string.h>
+
+// Project includes
+#include <cmpsc311_log.h>
+#include "raid_network.h"
+#include "raid_pool.h"
+#include "tagline_internal.h"
+
+
+//Definitions
+
+//Bounded queue of backup writes of relaxed taglines, written in order by the
+//mirror thread on its own connection. mirrorQueued/mirrorDone count requests
+//so anyone can wait for the backups to catch up (recovery, close).
+#define TAGLINE_MIRROR_QUEUE     64
+
+
+//Structures
+
+struct mirrorwrite
+{
+	RAIDOpCode operation;
+	char *data; //pool buffer with the blocks
+	TagLineNumber tag;
+	TagLineBlockNumber bnum;
+};
+
+
+//Global Variables
+
+//Durability of each tagline (TAGLINE_DURABLE_*): BOTH acknowledges a write once
+//both copies are on disk, ONE once the primary is, the backup copy goes through
+//the mirror queue
+uint8_t *tagdurability = NULL;
+
+struct mirrorwrite mirrorQueue[TAGLINE_MIRROR_QUEUE];
+uint64_t mirrorQueued = 0;
+uint64_t mirrorDone = 0;
+int mirrorRunning = 0;
+pthread_t mirrorThread;
+pthread_mutex_t mirrorLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t mirrorWork = PTHREAD_COND_INITIALIZER;
+pthread_cond_t mirrorProgress = PTHREAD_COND_INITIALIZER;
+
+//Blocks whose backup copy missed a write: an asynchronous backup write of
+//them failed. One bit per tagline block, set by the mirror thread and
+//cleared once the backup is written again. Such a backup is never read and
+//can not stand in for a lost primary; mirror_sync and the rebuilds write it
+//again from the primary.
+uint8_t *backupStale = NULL;
+_Atomic uint32_t backupStaleCount = 0;
+
+
+//Functions Prototypes
+int mirror_sync(void);
+void *mirror_worker(void *);
+
+
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_set_durability
+// Description  : selects when tagline_write returns for a tagline: once both
+//				  copies are written (TAGLINE_DURABLE_BOTH) or once the primary
+//				  is (TAGLINE_DURABLE_ONE) with the backup written asynchronously.
+//				  Going back to BOTH fails while backups that missed a write
+//				  can not be written again.
+//
+// Inputs       : tag - the tagline
+//				  mode - TAGLINE_DURABLE_BOTH or TAGLINE_DURABLE_ONE
+// Outputs      : 0 if successful, 1 if failure
+
+int tagline_set_durability(TagLineNumber tag, int mode){
+
+	int failed = 0;
+
+	if (tagdurability == NULL || tag >= maxtaglines)
+		return (1);
+
+	if (mode != TAGLINE_DURABLE_BOTH && mode != TAGLINE_DURABLE_ONE)
+		return (1);
+
+	pthread_mutex_lock(&writeLock);
+
+	//Going back to full durability means the queued backups must land first
+	if (mode == TAGLINE_DURABLE_BOTH && tagdurability[tag] == TAGLINE_DURABLE_ONE)
+		failed = mirror_sync();
+
+	if (!failed)
+		tagdurability[tag] = mode;
+	pthread_mutex_unlock(&writeLock);
+	return (failed);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : write_backup
+// Description  : writes the backup copy of some blocks. For relaxed taglines
+//				  the blocks are copied into a pool buffer and queued for the
+//				  mirror thread, waiting only if the queue is full.
+//
+// Inputs       : tag - the tagline the blocks belong to
+//				  bnum - the first of the blocks
+//				  operation - the RAID_WRITE of the backup copy
+//				  buf - the blocks
+// Outputs      : 0 if successful, 1 if failure
+
+int write_backup(TagLineNumber tag, TagLineBlockNumber bnum, RAIDOpCode operation, char *buf){
+
+	RAIDOpCode response = 0;
+	char *data;
+	int blocks;
+
+	if (tagdurability[tag] == TAGLINE_DURABLE_BOTH){
+		response = client_raid_bus_request(operation, buf);
+		return (extract_raid_response(response, operation, NULL));
+	}
+
+	//The caller's buffer is reused as soon as we return
+	blocks = (operation << 8) >> 56;
+	data = raid_pool_get(blocks);
+	if (data == NULL)
+		return (1);
+	memcpy(data, buf, blocks * RAID_BLOCK_SIZE);
+
+	pthread_mutex_lock(&mirrorLock);
+
+	//Start the mirror thread the first time it has work
+	if (!mirrorRunning){
+		mirrorRunning = 1;
+		if (pthread_create(&mirrorThread, NULL, mirror_worker, NULL)){
+			mirrorRunning = 0;
+			pthread_mutex_unlock(&mirrorLock);
+			raid_pool_put(data);
+			response = client_raid_bus_request(operation, buf);
+			return (extract_raid_response(response, operation, NULL));
+		}
+	}
+
+	//Bounded queue, wait for room
+	while (mirrorQueued - mirrorDone == TAGLINE_MIRROR_QUEUE)
+		pthread_cond_wait(&mirrorProgress, &mirrorLock);
+
+	mirrorQueue[mirrorQueued % TAGLINE_MIRROR_QUEUE].operation = operation;
+	mirrorQueue[mirrorQueued % TAGLINE_MIRROR_QUEUE].data = data;
+	mirrorQueue[mirrorQueued % TAGLINE_MIRROR_QUEUE].tag = tag;
+	mirrorQueue[mirrorQueued % TAGLINE_MIRROR_QUEUE].bnum = bnum;
+	mirrorQueued++;
+
+	pthread_cond_signal(&mirrorWork);
+	pthread_mutex_unlock(&mirrorLock);
+
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : mirror_sync
+// Description  : waits until every queued backup copy has been written and
+//				  writes the backups that missed a write again from their
+//				  primaries
+//
+// Inputs       : none
+// Outputs      : 0 if successful, 1 if some backup is still behind
+
+int mirror_sync(void){
+
+	mirror_drain();
+
+	return (backup_repair(0));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : mirror_drain
+// Description  : waits until the backups queued before the call are written.
+//				  Later ones are not waited for, so a steady stream of relaxed
+//				  writes can not keep the caller waiting.
+//
+// Inputs       : none
+// Outputs      : none
+
+void mirror_drain(void){
+
+	uint64_t ticket;
+
+	pthread_mutex_lock(&mirrorLock);
+
+	ticket = mirrorQueued;
+	while (mirrorDone < ticket)
+		pthread_cond_wait(&mirrorProgress, &mirrorLock);
+
+	pthread_mutex_unlock(&mirrorLock);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : mirror_worker
+// Description  : mirror thread, writes the queued backup copies in order on
+//				  its own connection to the RAID server
+//
+// Inputs       : arg - unused
+// Outputs      : NULL
+
+void *mirror_worker(void *arg){
+
+	struct mirrorwrite work;
+	RAIDOpCode response;
+	int failed;
+
+	pthread_mutex_lock(&mirrorLock);
+
+	while (1){
+
+		while (mirrorRunning && mirrorDone == mirrorQueued)
+			pthread_cond_wait(&mirrorWork, &mirrorLock);
+
+		if (mirrorDone == mirrorQueued)
+			break;
+
+		//The entry stays in the queue (and counted) until it is on disk
+		work = mirrorQueue[mirrorDone % TAGLINE_MIRROR_QUEUE];
+		pthread_mutex_unlock(&mirrorLock);
+
+		response = client_raid_bus_request_channel(TAGLINE_MIRROR_CHANNEL, work.operation, work.data);
+		failed = (response == (RAIDOpCode)-1 || ((response << 31) >> 63));
+		raid_pool_put(work.data);
+
+		//A lost backup write leaves the copies different until the backup is
+		//written again, no one may read it meanwhile
+		backup_mark(work.tag, work.bnum, RAID_OP_BLOCKS(work.operation), failed);
+		if (failed && digestsEnabled)
+			digest_stale(work.tag, work.bnum, RAID_OP_BLOCKS(work.operation), 1);
+		if (failed)
+			logMessage(LOG_ERROR_LEVEL, "TAGLINE : asynchronous backup write to disk %u block %u failed.",
+					(unsigned)((work.operation >> 40) & 0xFF), (unsigned)(work.operation & 0xFFFFFFFF));
+
+		pthread_mutex_lock(&mirrorLock);
+		mirrorDone++;
+		pthread_cond_broadcast(&mirrorProgress);
+	}
+
+	pthread_mutex_unlock(&mirrorLock);
+	return (NULL);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : backup_mark
+// Description  : records whether the backup copies of some blocks missed a
+//				  write (stale) or hold what the primaries hold
+//
+// Inputs       : tag - the tagline
+//				  bnum - the first block
+//				  n - the number of blocks
+//				  stale - 1 if the backups are behind, 0 if they are current
+// Outputs      : none
+
+void backup_mark(TagLineNumber tag, TagLineBlockNumber bnum, uint32_t n, int stale){
+
+	uint64_t bit;
+	uint8_t mask, old;
+	uint32_t i;
+
+	for (i = 0; i < n; i++){
+		bit = (uint64_t)tag * MAX_TAGLINE_BLOCK_NUMBER + bnum + i;
+		mask = (uint8_t)(1 << (bit % 8));
+
+		//Nothing stale is the common case, keep it to a load
+		if (!stale && !(__atomic_load_n(&backupStale[bit / 8], __ATOMIC_RELAXED) & mask))
+			continue;
+
+		if (stale){
+			old = __atomic_fetch_or(&backupStale[bit / 8], mask, __ATOMIC_RELAXED);
+			if (!(old & mask))
+				atomic_fetch_add(&backupStaleCount, 1);
+		}
+		else{
+			old = __atomic_fetch_and(&backupStale[bit / 8], (uint8_t)~mask, __ATOMIC_RELAXED);
+			if (old & mask)
+				atomic_fetch_sub(&backupStaleCount, 1);
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : backup_stale
+// Description  : whether the backup copy of a block missed a write
+//
+// Inputs       : tag - the tagline
+//				  bnum - the block
+// Outputs      : 1 if it is stale, 0 if not
+
+int backup_stale(TagLineNumber tag, TagLineBlockNumber bnum){
+
+	uint64_t bit = (uint64_t)tag * MAX_TAGLINE_BLOCK_NUMBER + bnum;
+
+	return ((__atomic_load_n(&backupStale[bit / 8], __ATOMIC_RELAXED) >> (bit % 8)) & 1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : backup_repair
+// Description  : writes every stale backup copy again from its primary, when
+//				  both disks are ready. Backups only go stale on failures, so
+//				  this copies blocks one at a time.
+//
+// Inputs       : channel - the connection to use
+// Outputs      : 0 if successful, 1 if some backup is still stale
+
+int backup_repair(int channel){
+
+	RAIDOpCode operation = 0;
+	RAIDOpCode response = 0;
+	struct tagline loc;
+	char *data;
+	int tag, j;
+
+	if (backupStale == NULL || atomic_load(&backupStaleCount) == 0)
+		return (0);
+
+	data = raid_pool_get(1);
+	if (data == NULL)
+		return (1);
+
+	for (tag = 0; tag < maxtaglines; tag++){
+		for (j = 0; j < tagcounter[tag]; j++){
+
+			if (!backup_stale(tag, j))
+				continue;
+
+			loc = tagline_locate(tag, j);
+			if (loc.primary == TAGLINE_NO_LOC || loc.backup == TAGLINE_NO_LOC
+					|| array[LOC_DISK(loc.primary)].status != RAID_DISK_READY
+					|| array[LOC_DISK(loc.backup)].status != RAID_DISK_READY)
+				continue;
+
+			operation = create_raid_request(RAID_READ, 1, LOC_DISK(loc.primary), LOC_POSITION(loc.primary));
+			response = client_raid_bus_request_channel(channel, operation, data);
+			if (extract_raid_response(response, operation, NULL))
+				continue;
+
+			operation = create_raid_request(RAID_WRITE, 1, LOC_DISK(loc.backup), LOC_POSITION(loc.backup));
+			response = client_raid_bus_request_channel(channel, operation, data);
+			if (extract_raid_response(response, operation, NULL))
+				continue;
+
+			backup_mark(tag, j, 1, 0);
+			if (digestsEnabled)
+				digest_write(tag, j, 1, data, 0);
+		}
+	}
+
+	raid_pool_put(data);
+
+	if (atomic_load(&backupStaleCount) > 0){
+		logMessage(LOG_ERROR_LEVEL, "TAGLINE : %u backup blocks are behind their primaries.",
+				(unsigned)atomic_load(&backupStaleCount));
+		return (1);
+	}
+
+	return (0);
+}
@@ -0,0 +1,239 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : tagline_monitor.c
+//  Description    : This is the health monitor of the TAGLINE driver, a
+//                   thread that polls the disks and rebuilds the ones that
+//                   fail without the application calling raid_disk_signal.
+//
+//  Author         : agent
+//  Last Modified  : 10/18/2026
+//
+
+// Includes
+#include <time.h>
+
+// Project includes
+#include <cmpsc311_log.h>
+#include "tagline_internal.h"
+
+
+//Definitions
+
+//Health monitor: a thread polls RAID_STATUS of every disk in one pipelined
+//batch on its own channel and starts the rebuild of a disk as soon as it
+//fails. The wait between polls drops to TAGLINE_MONITOR_MIN after a change
+//and doubles back to the configured interval while nothing happens.
+#define TAGLINE_MONITOR_MIN      50    // Shortest wait between polls (ms)
+
+
+//Global Variables
+
+//Health of every disk as published by tagline_disk_health (TAGLINE_DISK_*)
+_Atomic int diskHealth[RAID_DISKS];
+_Atomic uint32_t diskFailures[RAID_DISKS];
+
+uint32_t monitorInterval = 0;
+int monitorRunning = 0;
+pthread_t monitorThread;
+pthread_mutex_t monitorLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t monitorWake;
+uint64_t monitorPolls = 0;
+
+
+//Functions Prototypes
+void *monitor_worker(void *);
+int monitor_poll(void);
+
+
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_set_monitor
+// Description  : watches the health of the disks from a thread of the driver,
+//				  a disk that fails is rebuilt without the application calling
+//				  raid_disk_signal. Has to be called before tagline_driver_init.
+//
+// Inputs       : interval - longest wait between two polls in ms, 0 for none
+// Outputs      : 0 if successful, 1 if failure
+
+int tagline_set_monitor(uint32_t interval){
+
+	if (monitorRunning || (interval > 0 && interval < TAGLINE_MONITOR_MIN))
+		return (1);
+
+	monitorInterval = interval;
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_disk_health
+// Description  : the last known health of a disk
+//
+// Inputs       : disk - the disk
+// Outputs      : TAGLINE_DISK_*, -1 if failure
+
+int tagline_disk_health(uint8_t disk){
+
+	if (disk >= RAID_DISKS)
+		return (-1);
+
+	return (atomic_load(&diskHealth[disk]));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : monitor_start
+// Description  : starts the health monitor
+//
+// Inputs       : none
+// Outputs      : 0 if successful, 1 if failure
+
+int monitor_start(void){
+
+	pthread_condattr_t attr;
+
+	//Waits are measured on the monotonic clock
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&monitorWake, &attr);
+	pthread_condattr_destroy(&attr);
+
+	monitorRunning = 1;
+	if (pthread_create(&monitorThread, NULL, monitor_worker, NULL)){
+		logMessage(LOG_ERROR_LEVEL, "TAGLINE: unable to start the health monitor");
+		monitorRunning = 0;
+		pthread_cond_destroy(&monitorWake);
+		return (1);
+	}
+
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : monitor_stop
+// Description  : stops the health monitor, a rebuild it started is finished
+//				  first
+//
+// Inputs       : none
+// Outputs      : none
+
+void monitor_stop(void){
+
+	if (!monitorRunning)
+		return;
+
+	pthread_mutex_lock(&monitorLock);
+	monitorRunning = 0;
+	pthread_cond_signal(&monitorWake);
+	pthread_mutex_unlock(&monitorLock);
+
+	pthread_join(monitorThread, NULL);
+	pthread_cond_destroy(&monitorWake);
+
+	logMessage(LOG_INFO_LEVEL, "TAGLINE: health monitor stopped after %lu polls", (unsigned long)monitorPolls);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : monitor_worker
+// Description  : the health monitor thread, polls the disks and sleeps for a
+//				  while that grows as long as nothing changes
+//
+// Inputs       : arg - unused
+// Outputs      : NULL
+
+void *monitor_worker(void *arg){
+
+	struct timespec until;
+	uint32_t wait = monitorInterval;
+
+	pthread_mutex_lock(&monitorLock);
+	while (monitorRunning){
+		pthread_mutex_unlock(&monitorLock);
+
+		//Something happened, look again soon
+		if (monitor_poll())
+			wait = TAGLINE_MONITOR_MIN;
+		else if (wait < monitorInterval)
+			wait = (wait * 2 < monitorInterval) ? wait * 2 : monitorInterval;
+
+		clock_gettime(CLOCK_MONOTONIC, &until);
+		until.tv_sec += wait / 1000;
+		until.tv_nsec += (long)(wait % 1000) * 1000000;
+		if (until.tv_nsec >= 1000000000){
+			until.tv_sec++;
+			until.tv_nsec -= 1000000000;
+		}
+
+		pthread_mutex_lock(&monitorLock);
+		while (monitorRunning && pthread_cond_timedwait(&monitorWake, &monitorLock, &until) == 0);
+	}
+	pthread_mutex_unlock(&monitorLock);
+
+	return (NULL);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : monitor_poll
+// Description  : asks every disk for its status in one batch and rebuilds the
+//				  ones that failed
+//
+// Inputs       : none
+// Outputs      : 1 if the health of a disk changed or is unknown, 0 if not
+
+int monitor_poll(void){
+
+	RAIDOpCode ops[RAID_DISKS];
+	RAIDOpCode responses[RAID_DISKS];
+	void *bufs[RAID_DISKS];
+	RAIDOpCode response = 0;
+	int disk, disks, changed = 0;
+
+	//Disks added meanwhile are polled next time
+	disks = __atomic_load_n(&arrayDisks, __ATOMIC_ACQUIRE);
+	for (disk = 0; disk < disks; disk++){
+		ops[disk] = create_raid_request(RAID_STATUS, 0, disk, 0);
+		bufs[disk] = NULL;
+	}
+
+	monitorPolls++;
+	if (client_raid_bus_pipeline(TAGLINE_MONITOR_CHANNEL, disks, ops, bufs, responses)){
+		for (disk = 0; disk < disks; disk++)
+			atomic_store(&diskHealth[disk], TAGLINE_DISK_UNKNOWN);
+		return (1);
+	}
+
+	for (disk = 0; disk < disks; disk++){
+		if (RAID_OP_STATUS(responses[disk])){
+			atomic_store(&diskHealth[disk], TAGLINE_DISK_UNKNOWN);
+			changed = 1;
+			continue;
+		}
+
+		if (RAID_OP_ID(responses[disk]) != RAID_DISK_FAILED){
+			if (atomic_load(&diskHealth[disk]) == TAGLINE_DISK_UNKNOWN && array[disk].status == RAID_DISK_READY)
+				atomic_store(&diskHealth[disk], TAGLINE_DISK_HEALTHY);
+			continue;
+		}
+		changed = 1;
+
+		//The answer may predate a rebuild that just finished, ask again now
+		//that none can be running
+		pthread_mutex_lock(&recoverLock);
+		response = client_raid_bus_request_channel(TAGLINE_MONITOR_CHANNEL, ops[disk], NULL);
+		if (response != (RAIDOpCode)-1 && !RAID_OP_STATUS(response) && RAID_OP_ID(response) == RAID_DISK_FAILED)
+			array[disk].status = RAID_DISK_FAILED;
+
+		if (array[disk].status == RAID_DISK_FAILED){
+			logMessage(LOG_ERROR_LEVEL, "TAGLINE: disk %d failed, rebuilding it", disk);
+			recover_disk(disk);
+		}
+		pthread_mutex_unlock(&recoverLock);
+	}
+
+	return (changed);
+}
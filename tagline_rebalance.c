@@ -0,0 +1,323 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : tagline_rebalance.c
+//  Description    : This is the online growth of the TAGLINE array: disks
+//                   are added and copies move onto them, a few blocks at a
+//                   time, until every disk holds about as many blocks.
+//
+//  Author         : agent
+//  Last Modified  : 10/18/2026
+//
+
+// Includes
+#include <string.h>
+
+// Project includes
+#include <cmpsc311_log.h>
+#include "raid_network.h"
+#include "raid_pool.h"
+#include "tagline_internal.h"
+
+
+//Global Variables
+
+//Rebalancing after disks are added: copies on disks holding more than
+//rebalanceTarget blocks move, a contiguous run at a time, to the disk with
+//the fewest. Like the defragmenter it walks the taglines in steps of at most
+//rebalanceBudget blocks, every TAGLINE_DEFRAG_INTERVAL writes.
+uint32_t rebalanceBudget = 0;
+uint32_t rebalanceWrites = 0;
+uint32_t rebalanceTarget = 0;
+uint32_t rebalanceLive[RAID_DISKS]; //Copies mapped to each disk
+TagLineNumber rebalanceTag = 0;
+TagLineBlockNumber rebalanceBnum = 0;
+int rebalanceIdle = 0; //Taglines looked at since the last move
+uint64_t rebalanceMoved = 0;
+
+
+//Functions Prototypes
+int rebalance_disk(void);
+int rebalance_move(TagLineNumber, TagLineBlockNumber, int, int, int);
+
+
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_set_disks
+// Description  : sets how many disks of the bus the array starts with, the
+//				  others can be added later with tagline_add_disks. Has to be
+//				  called before tagline_driver_init, computed placement always
+//				  uses all of them.
+//
+// Inputs       : disks - the number of disks, 2 to RAID_DISKS
+// Outputs      : 0 if successful, 1 if failure
+
+int tagline_set_disks(uint32_t disks){
+
+	if (disks < 2 || disks > RAID_DISKS || tagcounter != NULL)
+		return (1);
+
+	arrayDisks = disks;
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_add_disks
+// Description  : grows the array, formats the next disks of the bus and starts
+//				  moving copies onto them until every disk holds about as many
+//				  blocks. New writes use the new disks right away.
+//
+// Inputs       : disks - the number of disks to add
+//				  budget - blocks moved per rebalancing step, 0 to leave it to
+//				  tagline_rebalance_step
+// Outputs      : 0 if successful, 1 if failure
+
+int tagline_add_disks(uint32_t disks, uint32_t budget){
+
+	RAIDOpCode operation = 0;
+	RAIDOpCode response = 0;
+	struct tagline loc;
+	uint64_t total = 0;
+	int disk, i, j;
+
+	//No disk is rebuilt while the array grows
+	pthread_mutex_lock(&recoverLock);
+	pthread_mutex_lock(&writeLock);
+
+	if (tagcounter == NULL || placementMode == TAGLINE_PLACEMENT_COMPUTED
+			|| disks == 0 || arrayDisks + disks > RAID_DISKS){
+		pthread_mutex_unlock(&writeLock);
+		pthread_mutex_unlock(&recoverLock);
+		return (1);
+	}
+
+	for (disk = arrayDisks; disk < arrayDisks + disks; disk++){
+		operation = create_raid_request(RAID_FORMAT, 0, disk, 0);
+		response = client_raid_bus_request(operation, NULL);
+		if (extract_raid_response(response, operation, NULL)){
+			pthread_mutex_unlock(&writeLock);
+			pthread_mutex_unlock(&recoverLock);
+			return (1);
+		}
+
+		array[disk].blocks = -1;
+		array[disk].status = RAID_DISK_READY;
+		atomic_store(&diskHealth[disk], TAGLINE_DISK_HEALTHY);
+	}
+	__atomic_store_n(&arrayDisks, arrayDisks + disks, __ATOMIC_RELEASE);
+
+	//Where the copies are now
+	memset(rebalanceLive, 0, sizeof(rebalanceLive));
+	for (i = 0; i < maxtaglines; i++){
+		for (j = 0; j < tagcounter[i]; j++){
+			loc = tagline_locate(i, j);
+			if (loc.primary != TAGLINE_NO_LOC)
+				rebalanceLive[LOC_DISK(loc.primary)]++;
+			if (loc.backup != TAGLINE_NO_LOC)
+				rebalanceLive[LOC_DISK(loc.backup)]++;
+		}
+	}
+	for (disk = 0; disk < arrayDisks; disk++)
+		total += rebalanceLive[disk];
+
+	rebalanceTarget = (total + arrayDisks - 1) / arrayDisks;
+	rebalanceTag = 0;
+	rebalanceBnum = 0;
+	rebalanceIdle = 0;
+	rebalanceBudget = budget;
+
+	logMessage(LOG_INFO_LEVEL, "TAGLINE: array grown to %u disks, rebalancing to %u blocks per disk",
+			arrayDisks, rebalanceTarget);
+	pthread_mutex_unlock(&writeLock);
+	pthread_mutex_unlock(&recoverLock);
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_rebalance_step
+// Description  : one step of the rebalancing. Carries on from where the last
+//				  step stopped and moves runs of copies that sit on a disk over
+//				  the target to the emptiest disk, until budget blocks moved or
+//				  every tagline has been looked at once. Ends the rebalancing
+//				  once no disk is over the target. A step moves nothing while
+//				  a disk is rebuilt, so the disks found ready to read from and
+//				  write to stay ready until the move is done.
+//
+// Inputs       : budget - the number of blocks that may move
+// Outputs      : the number of blocks moved, -1 if failure
+
+int tagline_rebalance_step(uint32_t budget){
+
+	struct tagline loc;
+	uint32_t moved = 0, start;
+	int scanned = 0, copy, dest, from, other, n;
+
+	//Nothing moves while a disk is rebuilt, the rebuild holds recoverLock
+	pthread_mutex_lock(&writeLock);
+	if (tagcounter == NULL || rebalanceTarget == 0 || pthread_mutex_trylock(&recoverLock)){
+		pthread_mutex_unlock(&writeLock);
+		return (0);
+	}
+
+	while (moved < budget && scanned <= maxtaglines){
+
+		//Balanced, no disk left to take blocks or nothing left that can move
+		dest = rebalance_disk();
+		if (dest == -1 || rebalanceIdle > maxtaglines){
+			rebalanceTarget = 0;
+			rebalanceBudget = 0;
+			logMessage(LOG_INFO_LEVEL, "TAGLINE: rebalancing done, %lu blocks moved", (unsigned long)rebalanceMoved);
+			break;
+		}
+
+		//Next tagline
+		if (rebalanceTag >= maxtaglines || rebalanceBnum >= tagcounter[rebalanceTag]){
+			rebalanceTag = (rebalanceTag + 1 < maxtaglines) ? rebalanceTag + 1 : 0;
+			rebalanceBnum = 0;
+			rebalanceIdle++;
+			scanned++;
+			continue;
+		}
+
+		//The copy of this block that is on the fuller disk, if it is over
+		//(a block missing a copy is left where it is)
+		loc = tagline_locate(rebalanceTag, rebalanceBnum);
+		if (loc.primary == TAGLINE_NO_LOC || loc.backup == TAGLINE_NO_LOC){
+			rebalanceBnum++;
+			continue;
+		}
+		copy = (rebalanceLive[LOC_DISK(loc.backup)] > rebalanceLive[LOC_DISK(loc.primary)]);
+		from = LOC_DISK(copy ? loc.backup : loc.primary);
+		other = LOC_DISK(copy ? loc.primary : loc.backup);
+
+		if (rebalanceLive[from] <= rebalanceTarget || other == dest || array[from].status != RAID_DISK_READY){
+			rebalanceBnum++;
+			continue;
+		}
+
+		//As many following blocks as are contiguous with it on the same disk
+		start = copy ? loc.backup : loc.primary;
+		for (n = 1; n < 255 && moved + n < budget && rebalanceBnum + n < tagcounter[rebalanceTag]
+				&& rebalanceLive[from] - n > rebalanceTarget && rebalanceLive[dest] + n < rebalanceTarget; n++){
+			loc = tagline_locate(rebalanceTag, rebalanceBnum + n);
+			if ((copy ? loc.backup : loc.primary) != start + n || (copy ? loc.primary : loc.backup) == TAGLINE_NO_LOC
+					|| LOC_DISK(copy ? loc.primary : loc.backup) == dest)
+				break;
+		}
+
+		//The new disk is full
+		if (array[dest].blocks + n >= RAID_DISKBLOCKS - 1)
+			break;
+
+		if (rebalance_move(rebalanceTag, rebalanceBnum, n, copy, dest)){
+			pthread_mutex_unlock(&recoverLock);
+			pthread_mutex_unlock(&writeLock);
+			return (-1);
+		}
+
+		rebalanceLive[from] -= n;
+		rebalanceLive[dest] += n;
+		rebalanceIdle = 0;
+		rebalanceBnum += n;
+		moved += n;
+	}
+
+	rebalanceMoved += moved;
+	pthread_mutex_unlock(&recoverLock);
+	pthread_mutex_unlock(&writeLock);
+	return (moved);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : rebalance_disk
+// Description  : picks the disk the rebalancing moves blocks to
+//
+// Inputs       : none
+// Outputs      : the ready disk with the fewest blocks, -1 if every disk has
+//				  the target or none is over it
+
+int rebalance_disk(void){
+
+	int disk, dest = -1, over = 0;
+
+	for (disk = 0; disk < arrayDisks; disk++){
+		if (array[disk].status != RAID_DISK_READY)
+			continue;
+		if (rebalanceLive[disk] > rebalanceTarget)
+			over = 1;
+		else if (rebalanceLive[disk] < rebalanceTarget && (dest == -1 || rebalanceLive[disk] < rebalanceLive[dest]))
+			dest = disk;
+	}
+
+	return (over ? dest : -1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : rebalance_move
+// Description  : moves one copy of a run of blocks to the end of another disk.
+//				  The run is read from the copy that moves, written at the new
+//				  place and only then the map switches over; the other copy
+//				  stays where it is.
+//
+// Inputs       : tag - the tagline
+//				  bnum - the first block of the run
+//				  n - the number of blocks, contiguous on the copy that moves
+//				  copy - 0 to move the primary copy, 1 the backup
+//				  dest - the disk it moves to
+// Outputs      : 0 if successful, 1 if failure
+
+int rebalance_move(TagLineNumber tag, TagLineBlockNumber bnum, int n, int copy, int dest){
+
+	RAIDOpCode operation = 0;
+	RAIDOpCode response = 0;
+	struct tagline loc;
+	uint32_t start, to;
+	char *data;
+	int i;
+
+	//Queued backups of the run must not land after it has moved
+	if (tagdurability[tag] == TAGLINE_DURABLE_ONE)
+		mirror_drain();
+
+	data = raid_pool_get(n);
+	if (data == NULL)
+		return (1);
+
+	loc = tagline_locate(tag, bnum);
+	start = copy ? loc.backup : loc.primary;
+	to = MAKE_LOC(dest, array[dest].blocks + 1);
+
+	operation = create_raid_request(RAID_READ, n, LOC_DISK(start), LOC_POSITION(start));
+	response = client_raid_bus_request(operation, data);
+	if (extract_raid_response(response, operation, NULL)){
+		raid_pool_put(data);
+		return (1);
+	}
+
+	operation = create_raid_request(RAID_WRITE, n, dest, LOC_POSITION(to));
+	response = client_raid_bus_request(operation, data);
+	raid_pool_put(data);
+	if (extract_raid_response(response, operation, NULL))
+		return (1);
+	array[dest].blocks += n;
+
+	//Switch the map over, the old places are never read again
+	for (i = 0; i < n; i++){
+		loc = tagline_locate(tag, bnum + i);
+		if (copy)
+			loc.backup = to + i;
+		else{
+			invalidate_raid_cache(LOC_DISK(loc.primary), LOC_POSITION(loc.primary));
+			loc.primary = to + i;
+		}
+		if (map_update(tag, bnum + i, loc))
+			return (1);
+	}
+
+	return (0);
+}
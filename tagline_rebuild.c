@@ -0,0 +1,660 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : tagline_rebuild.c
+//  Description    : This is the rebuild of a failed disk in the TAGLINE
+//                   driver: the blocks to copy back are ranked, cut into
+//                   chunks and copied by work-stealing threads while the
+//                   application goes on. Blocks whose primary is on a failed
+//                   disk are read from their backup and, if the disk is being
+//                   rebuilt, written back to it on the spot.
+//
+//  Author         : agent
+//  Last Modified  : 10/18/2026
+//
+
+// Includes
+#include <stdlib.h>
+
+// Project includes
+#include <cmpsc311_log.h>
+#include <cmpsc311_util.h>
+#include "raid_network.h"
+#include "tagline_internal.h"
+
+
+//Definitions
+
+//Rebuild of a failed disk: the blocks to copy back are gathered in runs,
+//sorted by rank (priority of the tagline, then how much it is read) and by
+//their place on the rebuilt disk, and cut into chunks of at most
+//TAGLINE_REBUILD_RUNS runs and TAGLINE_REBUILD_BLOCKS blocks. The caller and
+//the helper threads (each on its own channel, none of them the one of the
+//application) take chunks from their own queue and steal from the others when
+//it runs dry. The writes of a chunk go out in the same batch as the reads of
+//the next one.
+#define TAGLINE_REBUILD_RUNS     16
+#define TAGLINE_REBUILD_BLOCKS   256
+
+//Blocks of the disk being rebuilt: lost, being copied back by a rebuild
+//thread or a read that needed it, or done (copied or written since). A write
+//of a block being copied waits for the copy, so the data read before the
+//write can not land after it. rebuildLock guards the states.
+#define TAGLINE_BLOCK_LOST       0
+#define TAGLINE_BLOCK_COPYING    1
+#define TAGLINE_BLOCK_DONE       2
+
+
+//Structures
+
+struct rebuildrun
+{
+	uint64_t rank;
+	uint32_t from;
+	uint32_t to;
+	uint32_t blocks;
+};
+
+//Chunks of a thread are self, self + THREADS, ... its own are taken from
+//the front, stolen ones from the back
+struct rebuildqueue
+{
+	pthread_mutex_t lock;
+	uint32_t front, back;
+};
+
+
+//Global Variables
+
+struct rebuildrun *rebuildRuns = NULL;
+uint32_t rebuildCount = 0, rebuildSize = 0;
+uint32_t *rebuildChunks = NULL; //First run of each chunk, and the end
+uint32_t rebuildChunkCount = 0;
+struct rebuildqueue rebuildQueues[TAGLINE_REBUILD_THREADS];
+int rebuildOffload = 0; //RAID_COPY is used, probed before the threads start
+_Atomic int rebuildFailed = 0;
+_Atomic uint64_t rebuildStolen = 0;
+
+_Atomic int rebuildDisk = -1;
+uint8_t *rebuildState = NULL;
+pthread_mutex_t rebuildLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t rebuildCopied = PTHREAD_COND_INITIALIZER;
+
+//Blocks read from each tagline (halved when one would overflow) and the
+//priority given with tagline_set_rebuild_priority, they rank the rebuild
+uint32_t *tagheat = NULL;
+uint8_t *tagpriority = NULL;
+
+
+//Functions Prototypes
+int rebuild_order(const void *, const void *);
+int rebuild_next(int);
+void *rebuild_worker(void *);
+int rebuild_batch(int, int, RAIDOpCode *, void **);
+void rebuild_reset(void);
+int rebuild_claim_run(struct rebuildrun *, char *, RAIDOpCode *, void **, uint64_t *, int);
+void rebuild_settle(RAIDOpCode *, uint64_t *, int, int);
+
+
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : rebuild_add
+// Description  : adds a block to copy to the rebuild, extending the last run
+//				  when it follows it on both disks
+//
+// Inputs       : from - location of the good copy
+//				  to - location of the lost copy
+//				  tag - the tagline the block belongs to
+// Outputs      : 0 if successful, 1 if failure
+
+int rebuild_add(uint32_t from, uint32_t to, TagLineNumber tag){
+
+	struct rebuildrun *last, *grown;
+	uint64_t rank;
+
+	rank = (uint64_t)tagpriority[tag] << 32 | __atomic_load_n(&tagheat[tag], __ATOMIC_RELAXED);
+
+	last = (rebuildCount > 0) ? &rebuildRuns[rebuildCount-1] : NULL;
+	if (last != NULL && last->blocks < 255 && last->rank == rank
+			&& from == last->from + last->blocks && to == last->to + last->blocks){
+		last->blocks++;
+		return (0);
+	}
+
+	if (rebuildCount == rebuildSize){
+		grown = (struct rebuildrun *) realloc(rebuildRuns, (rebuildSize ? 2 * rebuildSize : 1024) * sizeof(struct rebuildrun));
+		if (grown == NULL){
+			rebuild_reset();
+			return (1);
+		}
+		rebuildRuns = grown;
+		rebuildSize = rebuildSize ? 2 * rebuildSize : 1024;
+	}
+
+	rebuildRuns[rebuildCount].rank = rank;
+	rebuildRuns[rebuildCount].from = from;
+	rebuildRuns[rebuildCount].to = to;
+	rebuildRuns[rebuildCount].blocks = 1;
+	rebuildCount++;
+
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : rebuild_run
+// Description  : copies back every run added to the rebuild, sorted by rank
+//				  and place on the rebuilt disk (so runs that meet there are
+//				  merged) and split in chunks dealt out to the rebuild threads,
+//				  which take their chunks in order: the highest ranked first
+//
+// Inputs       : none
+// Outputs      : 0 if successful, 1 if failure
+
+int rebuild_run(void){
+
+	pthread_t helpers[TAGLINE_REBUILD_THREADS];
+	uint32_t i, count, blocks;
+	int t, started;
+
+	qsort(rebuildRuns, rebuildCount, sizeof(struct rebuildrun), rebuild_order);
+
+	for (i = 1, count = (rebuildCount > 0); i < rebuildCount; i++){
+		if (rebuildRuns[count-1].blocks + rebuildRuns[i].blocks <= 255
+				&& rebuildRuns[i].from == rebuildRuns[count-1].from + rebuildRuns[count-1].blocks
+				&& rebuildRuns[i].to == rebuildRuns[count-1].to + rebuildRuns[count-1].blocks)
+			rebuildRuns[count-1].blocks += rebuildRuns[i].blocks;
+		else
+			rebuildRuns[count++] = rebuildRuns[i];
+	}
+	rebuildCount = count;
+
+	//Cut the chunks, a run longer than a chunk is a chunk of its own
+	rebuildChunks = (uint32_t *) malloc((rebuildCount + 1) * sizeof(uint32_t));
+	if (rebuildChunks == NULL){
+		rebuild_reset();
+		return (1);
+	}
+	rebuildChunkCount = 0;
+	for (i = 0; i < rebuildCount; i++){
+		if (i == 0 || i - rebuildChunks[rebuildChunkCount-1] == TAGLINE_REBUILD_RUNS
+				|| blocks + rebuildRuns[i].blocks > TAGLINE_REBUILD_BLOCKS){
+			rebuildChunks[rebuildChunkCount++] = i;
+			blocks = 0;
+		}
+		blocks += rebuildRuns[i].blocks;
+	}
+	rebuildChunks[rebuildChunkCount] = rebuildCount;
+
+	for (t = 0; t < TAGLINE_REBUILD_THREADS; t++){
+		pthread_mutex_init(&rebuildQueues[t].lock, NULL);
+		rebuildQueues[t].front = 0;
+		rebuildQueues[t].back = (rebuildChunkCount + TAGLINE_REBUILD_THREADS - 1 - t) / TAGLINE_REBUILD_THREADS;
+	}
+	atomic_store(&rebuildFailed, 0);
+	atomic_store(&rebuildStolen, 0);
+	rebuildOffload = offload_ready(&copyOffload, RAID_COPY);
+
+	//The caller is thread 0
+	for (started = 1; started < TAGLINE_REBUILD_THREADS; started++){
+		if (pthread_create(&helpers[started], NULL, rebuild_worker, (void *)(intptr_t)started))
+			break;
+	}
+	rebuild_worker((void *)0);
+	for (t = 1; t < started; t++)
+		pthread_join(helpers[t], NULL);
+
+	for (t = 0; t < TAGLINE_REBUILD_THREADS; t++)
+		pthread_mutex_destroy(&rebuildQueues[t].lock);
+
+	logMessage(LOG_INFO_LEVEL, "TAGLINE : rebuild copied %u runs in %u chunks, %lu stolen.",
+			rebuildCount, rebuildChunkCount, (unsigned long)atomic_load(&rebuildStolen));
+
+	rebuild_reset();
+	return (atomic_load(&rebuildFailed));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : rebuild_reset
+// Description  : forgets the runs and chunks of a rebuild
+//
+// Inputs       : none
+// Outputs      : none
+
+void rebuild_reset(void){
+
+	free(rebuildChunks);
+	rebuildChunks = NULL;
+	free(rebuildRuns);
+	rebuildRuns = NULL;
+	rebuildCount = rebuildSize = rebuildChunkCount = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : rebuild_order
+// Description  : order of the rebuild runs, highest rank first and then by
+//				  place on the rebuilt disk
+//
+// Inputs       : a, b - the runs to compare
+// Outputs      : <0, 0 or >0 as qsort expects
+
+int rebuild_order(const void *a, const void *b){
+
+	const struct rebuildrun *x = (const struct rebuildrun *)a;
+	const struct rebuildrun *y = (const struct rebuildrun *)b;
+
+	if (x->rank != y->rank)
+		return (x->rank < y->rank ? 1 : -1);
+
+	return ((x->to > y->to) - (x->to < y->to));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : rebuild_next
+// Description  : takes the next chunk of a rebuild thread, from its own queue
+//				  or else stolen from the back of another one
+//
+// Inputs       : self - the rebuild thread
+// Outputs      : the chunk, -1 if there is nothing left (or the rebuild failed)
+
+int rebuild_next(int self){
+
+	struct rebuildqueue *queue;
+	int t, victim, chunk = -1;
+
+	if (atomic_load(&rebuildFailed))
+		return (-1);
+
+	for (t = 0; t < TAGLINE_REBUILD_THREADS && chunk == -1; t++){
+		victim = (self + t) % TAGLINE_REBUILD_THREADS;
+		queue = &rebuildQueues[victim];
+
+		pthread_mutex_lock(&queue->lock);
+		if (queue->front < queue->back){
+			if (victim == self)
+				chunk = victim + (queue->front++) * TAGLINE_REBUILD_THREADS;
+			else{
+				chunk = victim + (--queue->back) * TAGLINE_REBUILD_THREADS;
+				atomic_fetch_add(&rebuildStolen, 1);
+			}
+		}
+		pthread_mutex_unlock(&queue->lock);
+	}
+
+	return (chunk);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : rebuild_worker
+// Description  : rebuild thread. Without RAID_COPY every batch writes the
+//				  chunk read in the previous one and reads the next chunk into
+//				  the other buffer, so reads and writes are in flight together.
+//				  Only the blocks still lost are written back.
+//
+// Inputs       : arg - the number of the rebuild thread
+// Outputs      : NULL
+
+void *rebuild_worker(void *arg){
+
+	RAIDOpCode ops[TAGLINE_REBUILD_BLOCKS + TAGLINE_REBUILD_RUNS];
+	void *bufs[TAGLINE_REBUILD_BLOCKS + TAGLINE_REBUILD_RUNS];
+	uint64_t targets[TAGLINE_REBUILD_BLOCKS];
+	char *data[2] = { NULL, NULL };
+	struct rebuildrun *run;
+	int self = (intptr_t)arg;
+	int channel = TAGLINE_REBUILD_CHANNEL + self;
+	int chunk, next, count, writes, side = 0, failed;
+	uint32_t i, offset;
+
+	//Only the server moves the data
+	if (rebuildOffload){
+		while ((chunk = rebuild_next(self)) != -1){
+			pthread_mutex_lock(&rebuildLock);
+			for (i = rebuildChunks[chunk], count = 0; i < rebuildChunks[chunk+1]; i++)
+				count = rebuild_claim_run(&rebuildRuns[i], NULL, ops, bufs, targets, count);
+			pthread_mutex_unlock(&rebuildLock);
+
+			failed = rebuild_batch(channel, count, ops, bufs);
+			rebuild_settle(ops, targets, count, failed);
+			if (failed)
+				break;
+		}
+		return (NULL);
+	}
+
+	if (posix_memalign((void **)&data[0], TAGLINE_LINE_SIZE, 2 * (size_t)TAGLINE_REBUILD_BLOCKS * RAID_BLOCK_SIZE)){
+		atomic_store(&rebuildFailed, 1);
+		return (NULL);
+	}
+	data[1] = data[0] + (size_t)TAGLINE_REBUILD_BLOCKS * RAID_BLOCK_SIZE;
+
+	chunk = -1;
+	next = rebuild_next(self);
+	while (chunk != -1 || next != -1){
+		count = 0;
+
+		//Writes of the chunk read last time
+		if (chunk != -1){
+			pthread_mutex_lock(&rebuildLock);
+			for (i = rebuildChunks[chunk], offset = 0; i < rebuildChunks[chunk+1]; offset += rebuildRuns[i++].blocks)
+				count = rebuild_claim_run(&rebuildRuns[i], data[side] + (size_t)offset * RAID_BLOCK_SIZE, ops, bufs, NULL, count);
+			pthread_mutex_unlock(&rebuildLock);
+		}
+		writes = count;
+
+		//Reads of the next one, into the other buffer
+		if (next != -1){
+			for (i = rebuildChunks[next], offset = 0; i < rebuildChunks[next+1]; offset += rebuildRuns[i++].blocks){
+				run = &rebuildRuns[i];
+				ops[count] = create_raid_request(RAID_READ, run->blocks, LOC_DISK(run->from), LOC_POSITION(run->from));
+				bufs[count++] = data[!side] + (size_t)offset * RAID_BLOCK_SIZE;
+			}
+		}
+
+		failed = rebuild_batch(channel, count, ops, bufs);
+		rebuild_settle(ops, NULL, writes, failed);
+		if (failed)
+			break;
+
+		side = !side;
+		chunk = next;
+		next = (chunk != -1) ? rebuild_next(self) : -1;
+	}
+
+	free(data[0]);
+	return (NULL);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : rebuild_begin
+// Description  : marks every block of a disk as lost, from now on reads and
+//				  writes of its blocks go through the rebuild states
+//
+// Inputs       : disk - the disk being rebuilt, already formatted
+// Outputs      : 0 if successful, 1 if failure
+
+int rebuild_begin(uint8_t disk){
+
+	uint8_t *state;
+
+	state = (uint8_t *) calloc(RAID_DISKBLOCKS, sizeof(uint8_t));
+	if (state == NULL)
+		return (1);
+
+	pthread_mutex_lock(&rebuildLock);
+	rebuildState = state;
+	atomic_store(&rebuildDisk, disk);
+	pthread_mutex_unlock(&rebuildLock);
+
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : rebuild_end
+// Description  : forgets the rebuild states, the disk is ready again if the
+//				  rebuild worked. Reads and writes waiting for a block go back
+//				  to the disk, or to the backup copies if it failed.
+//
+// Inputs       : disk - the disk that was rebuilt
+//				  failed - 1 if the rebuild failed
+// Outputs      : none
+
+void rebuild_end(uint8_t disk, int failed){
+
+	pthread_mutex_lock(&rebuildLock);
+	atomic_store(&rebuildDisk, -1);
+	free(rebuildState);
+	rebuildState = NULL;
+	if (!failed)
+		array[disk].status = RAID_DISK_READY;
+	pthread_cond_broadcast(&rebuildCopied);
+	pthread_mutex_unlock(&rebuildLock);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : rebuild_claim_run
+// Description  : adds the writes (or, with no data, the RAID_COPYs) of the
+//				  blocks of a run that are still lost to a batch, marking them
+//				  as being copied. Called with rebuildLock held.
+//
+// Inputs       : run - the run
+//				  data - the blocks of the run, NULL to copy on the server
+//				  ops, bufs - the batch
+//				  targets - the payloads of the RAID_COPYs
+//				  count - the operations already in the batch
+// Outputs      : the operations in the batch now
+
+int rebuild_claim_run(struct rebuildrun *run, char *data, RAIDOpCode *ops, void **bufs, uint64_t *targets, int count){
+
+	uint32_t j, k, position = LOC_POSITION(run->to);
+
+	for (j = 0; j < run->blocks; j = k){
+		if (rebuildState[position + j] != TAGLINE_BLOCK_LOST){
+			k = j + 1;
+			continue;
+		}
+
+		for (k = j; k < run->blocks && rebuildState[position + k] == TAGLINE_BLOCK_LOST; k++)
+			rebuildState[position + k] = TAGLINE_BLOCK_COPYING;
+
+		if (data == NULL){
+			targets[count] = htonll64(RAID_COPY_TARGET(LOC_DISK(run->to), position + j));
+			ops[count] = create_raid_request(RAID_COPY, k - j, LOC_DISK(run->from), LOC_POSITION(run->from) + j);
+			bufs[count] = &targets[count];
+		}
+		else{
+			ops[count] = create_raid_request(RAID_WRITE, k - j, LOC_DISK(run->to), position + j);
+			bufs[count] = data + (size_t)j * RAID_BLOCK_SIZE;
+		}
+		count++;
+	}
+
+	return (count);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : rebuild_settle
+// Description  : marks the blocks written back by a batch as done, or as lost
+//				  again if it failed, and wakes up the writes waiting for them
+//
+// Inputs       : ops - the writes (or RAID_COPYs) of the batch
+//				  targets - the payloads of the RAID_COPYs, NULL for writes
+//				  count - the number of writes
+//				  failed - 1 if the batch failed
+// Outputs      : none
+
+void rebuild_settle(RAIDOpCode *ops, uint64_t *targets, int count, int failed){
+
+	uint32_t position, j;
+	int i;
+
+	pthread_mutex_lock(&rebuildLock);
+	for (i = 0; i < count; i++){
+		position = targets ? (uint32_t)ntohll64(targets[i]) : RAID_OP_ID(ops[i]);
+		for (j = 0; j < RAID_OP_BLOCKS(ops[i]); j++)
+			rebuildState[position + j] = failed ? TAGLINE_BLOCK_LOST : TAGLINE_BLOCK_DONE;
+	}
+	pthread_cond_broadcast(&rebuildCopied);
+	pthread_mutex_unlock(&rebuildLock);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : rebuild_claim
+// Description  : called before a block is written, if it is on the disk being
+//				  rebuilt it is no longer to be copied back. A copy already on
+//				  its way is waited for, it carries the data from before.
+//
+// Inputs       : loc - the location about to be written
+// Outputs      : none
+
+void rebuild_claim(uint32_t loc){
+
+	int disk = LOC_DISK(loc), position = LOC_POSITION(loc);
+
+	if (disk == -1 || atomic_load(&rebuildDisk) != disk)
+		return;
+
+	pthread_mutex_lock(&rebuildLock);
+	while (atomic_load(&rebuildDisk) == disk && rebuildState[position] == TAGLINE_BLOCK_COPYING)
+		pthread_cond_wait(&rebuildCopied, &rebuildLock);
+	if (atomic_load(&rebuildDisk) == disk)
+		rebuildState[position] = TAGLINE_BLOCK_DONE;
+	pthread_mutex_unlock(&rebuildLock);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : read_degraded
+// Description  : reads a block whose primary copy is on a failed disk. If the
+//				  disk is being rebuilt and the block is back it is read from
+//				  there; if it is still lost it is read from the backup copy
+//				  and written back right away, ahead of the rebuild. Reads take
+//				  no lock, a disk formatted by another rebuild while the block
+//				  was in flight fails the read like a failed one.
+//
+// Inputs       : tag - the tagline the block belongs to
+//				  bnum - the block of the tagline
+//				  loc - the locations of the block
+//				  buf - where the block is read
+// Outputs      : 0 if successful, 1 if failure
+
+int read_degraded(TagLineNumber tag, TagLineBlockNumber bnum, struct tagline loc, char *buf){
+
+	RAIDOpCode operation = 0;
+	RAIDOpCode response = 0;
+	int disk = LOC_DISK(loc.primary), position = LOC_POSITION(loc.primary);
+	int backupDisk = LOC_DISK(loc.backup), state = TAGLINE_BLOCK_COPYING, failed;
+	uint32_t formats;
+
+	formats = atomic_load(&diskFormats[disk]);
+	pthread_mutex_lock(&rebuildLock);
+	if (atomic_load(&rebuildDisk) == disk){
+		state = rebuildState[position];
+		if (state == TAGLINE_BLOCK_LOST)
+			rebuildState[position] = TAGLINE_BLOCK_COPYING;
+	}
+	else if (array[disk].status == RAID_DISK_READY)
+		state = TAGLINE_BLOCK_DONE;
+	pthread_mutex_unlock(&rebuildLock);
+
+	if (state == TAGLINE_BLOCK_DONE){
+		operation = create_raid_request(RAID_READ, 1, disk, position);
+		response = client_raid_bus_request(operation, buf);
+		failed = extract_raid_response(response, operation, NULL);
+		return (failed || atomic_load(&diskFormats[disk]) != formats);
+	}
+
+	//The backup of a relaxed tagline may still be in the mirror queue
+	if (tagdurability[tag] != TAGLINE_DURABLE_BOTH)
+		mirror_drain();
+
+	//A backup that missed a write has nothing to give
+	failed = (backupDisk == -1);
+	if (!failed){
+		formats = atomic_load(&diskFormats[backupDisk]);
+		failed = (array[backupDisk].status != RAID_DISK_READY || backup_stale(tag, bnum));
+	}
+	if (!failed){
+		operation = create_raid_request(RAID_READ, 1, backupDisk, LOC_POSITION(loc.backup));
+		response = client_raid_bus_request(operation, buf);
+		failed = (extract_raid_response(response, operation, NULL) || atomic_load(&diskFormats[backupDisk]) != formats);
+	}
+
+	//Repair on demand, the rebuild skips it
+	if (state == TAGLINE_BLOCK_LOST){
+		if (!failed){
+			operation = create_raid_request(RAID_WRITE, 1, disk, position);
+			response = client_raid_bus_request(operation, buf);
+			state = extract_raid_response(response, operation, NULL) ? TAGLINE_BLOCK_LOST : TAGLINE_BLOCK_DONE;
+		}
+
+		pthread_mutex_lock(&rebuildLock);
+		if (atomic_load(&rebuildDisk) == disk)
+			rebuildState[position] = state;
+		pthread_cond_broadcast(&rebuildCopied);
+		pthread_mutex_unlock(&rebuildLock);
+	}
+
+	return (failed);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_set_rebuild_priority
+// Description  : sets the rebuild priority of a tagline, after a disk fails the
+//				  taglines with the highest priority get their copies back
+//				  first, then the ones read the most
+//
+// Inputs       : tag - the tagline
+//				  priority - 0 (default) to 255
+// Outputs      : 0 if successful, 1 if failure
+
+int tagline_set_rebuild_priority(TagLineNumber tag, uint8_t priority){
+
+	if (tagpriority == NULL || tag >= maxtaglines)
+		return (1);
+
+	tagpriority[tag] = priority;
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_heat
+// Description  : counts blocks read from a tagline, every counter is halved
+//				  before one overflows so old reads weigh less
+//
+// Inputs       : tag - the tagline
+//				  blks - the blocks read
+// Outputs      : none
+
+void tagline_heat(TagLineNumber tag, uint32_t blks){
+
+	int i;
+
+	if (__atomic_load_n(&tagheat[tag], __ATOMIC_RELAXED) > UINT32_MAX - blks){
+		for (i = 0; i < maxtaglines; i++)
+			__atomic_store_n(&tagheat[i], __atomic_load_n(&tagheat[i], __ATOMIC_RELAXED) / 2, __ATOMIC_RELAXED);
+	}
+
+	__atomic_fetch_add(&tagheat[tag], blks, __ATOMIC_RELAXED);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : rebuild_batch
+// Description  : sends a batch of a rebuild thread pipelined on its channel,
+//				  a failure stops every rebuild thread
+//
+// Inputs       : channel - the channel of the thread
+//				  count - the number of operations
+//				  ops - the operations
+//				  bufs - the blocks (or copy target) of each operation
+// Outputs      : 0 if successful, 1 if failure
+
+int rebuild_batch(int channel, int count, RAIDOpCode *ops, void **bufs){
+
+	RAIDOpCode responses[TAGLINE_REBUILD_BLOCKS + TAGLINE_REBUILD_RUNS];
+	int i, failed;
+
+	failed = client_raid_bus_pipeline(channel, count, ops, bufs, responses) != 0;
+	for (i = 0; i < count && !failed; i++)
+		failed = (responses[i] << 31) >> 63;
+
+	if (failed){
+		logMessage(LOG_ERROR_LEVEL, "TAGLINE : rebuild batch on channel %d failed.", channel);
+		atomic_store(&rebuildFailed, 1);
+	}
+
+	return (failed);
+}
@@ -0,0 +1,637 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : tagline_replica.c
+//  Description    : This is the asynchronous replication of the TAGLINE
+//                   driver: writes are logged and shipped by a thread to a
+//                   second array, taglines that do not fit in the log are
+//                   sent again whole.
+//
+//  Author         : agent
+//  Last Modified  : 10/18/2026
+//
+
+// Includes
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Project includes
+#include <cmpsc311_log.h>
+#include "raid_pool.h"
+#include "tagline_internal.h"
+
+
+//Definitions
+
+//Asynchronous replication (tagline_set_replica): every tagline write is also
+//put in a bounded log that a replicator thread ships, in pipelined batches,
+//to a second array on a connection of its own. Block b of tagline t has a
+//fixed place there (groups of TAGLINE_REPLICA_GROUP blocks dealt over the
+//disks), so the second array can be read without the map. A write that does
+//not fit in the log marks its tagline to be sent again whole, read back from
+//this array, so a write never waits for the second array.
+#define TAGLINE_REPLICA_LOG      256   // Writes the log holds
+#define TAGLINE_REPLICA_BLOCKS   4096  // Blocks the log holds
+#define TAGLINE_REPLICA_BATCH    32    // Writes shipped at once
+#define TAGLINE_REPLICA_GROUP    64
+#define TAGLINE_REPLICA_RETRY    100   // First wait after a failure (ms), doubles up to 5 s
+
+
+//Structures
+
+struct replicawrite
+{
+	TagLineNumber tag;
+	TagLineBlockNumber bnum;
+	uint32_t blocks;
+	char *data;       //pool buffer with the blocks
+	uint64_t logged;  //raid_now() when it was logged
+};
+
+
+//Global Variables
+
+char *replicaAddress = NULL;
+unsigned short replicaPort = 0;
+int replicaRunning = 0;
+pthread_t replicaThread;
+pthread_mutex_t replicaLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t replicaWork = PTHREAD_COND_INITIALIZER;
+struct replicawrite replicaLog[TAGLINE_REPLICA_LOG];
+uint64_t replicaLogged = 0;    //Writes put in the log
+uint64_t replicaShipped = 0;   //Writes on the second array
+uint32_t replicaBlocks = 0;    //Blocks in the log
+uint8_t *replicaDirty = NULL;  //Taglines to send again whole
+uint32_t replicaResends = 0;
+uint64_t replicaBehind = 0;    //raid_now() of the oldest tagline marked
+int replicaFormat = 0;         //Format the second array at the next connection
+uint64_t replicaBatches = 0, replicaSent = 0, replicaOverflows = 0;
+
+
+//Functions Prototypes
+void replica_mark(TagLineNumber);
+void *replica_worker(void *);
+int replica_connect(int);
+int replica_ship(struct replicawrite *, int);
+int replica_resend(TagLineNumber);
+uint32_t replica_location(TagLineNumber, TagLineBlockNumber);
+uint32_t replica_source(struct tagline);
+
+
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_set_replica
+// Description  : replicates every tagline write to a second array, without
+//				  the writes ever waiting for it. The second array is formatted
+//				  when the replicator first reaches it, after a lost connection
+//				  it only gets what it missed. Has to be called before
+//				  tagline_driver_init.
+//
+// Inputs       : address - the RAID server of the second array, NULL for none
+//				  port - its port
+// Outputs      : 0 if successful, 1 if failure
+
+int tagline_set_replica(const char *address, unsigned short port){
+
+	if (replicaRunning || (address != NULL && port == 0))
+		return (1);
+
+	free(replicaAddress);
+	replicaAddress = NULL;
+	replicaPort = 0;
+
+	if (address != NULL){
+		replicaAddress = strdup(address);
+		if (replicaAddress == NULL)
+			return (1);
+		replicaPort = port;
+	}
+
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_replica_format
+// Description  : has the replicator format the second array again and send it
+//				  every tagline whole, for when it lost what it had
+//
+// Inputs       : none
+// Outputs      : 0 if successful, 1 if failure
+
+int tagline_replica_format(void){
+
+	if (!replicaRunning)
+		return (1);
+
+	pthread_mutex_lock(&replicaLock);
+	replicaFormat = 1;
+	pthread_cond_signal(&replicaWork);
+	pthread_mutex_unlock(&replicaLock);
+
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_replica_lag
+// Description  : how far the second array is behind this one
+//
+// Inputs       : writes - returns the writes in the log, NULL if not needed
+//				  blocks - returns the blocks in the log, NULL if not needed
+//				  taglines - returns the taglines waiting to be sent whole,
+//				  NULL if not needed
+// Outputs      : the age in usec of the oldest change the second array does
+//				  not have, 0 if it is up to date
+
+uint64_t tagline_replica_lag(uint32_t *writes, uint32_t *blocks, uint32_t *taglines){
+
+	uint64_t now = raid_now(), oldest = now;
+
+	pthread_mutex_lock(&replicaLock);
+	if (writes != NULL)
+		*writes = replicaLogged - replicaShipped;
+	if (blocks != NULL)
+		*blocks = replicaBlocks;
+	if (taglines != NULL)
+		*taglines = replicaResends;
+
+	if (replicaLogged != replicaShipped)
+		oldest = replicaLog[replicaShipped % TAGLINE_REPLICA_LOG].logged;
+	if (replicaResends > 0 && replicaBehind < oldest)
+		oldest = replicaBehind;
+	pthread_mutex_unlock(&replicaLock);
+
+	return (now - oldest);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : replica_start
+// Description  : checks the second array can hold every tagline and starts
+//				  the replicator
+//
+// Inputs       : none
+// Outputs      : 0 if successful, 1 if failure
+
+int replica_start(void){
+
+	uint64_t groups;
+
+	groups = ((uint64_t)maxtaglines * MAX_TAGLINE_BLOCK_NUMBER + TAGLINE_REPLICA_GROUP - 1) / TAGLINE_REPLICA_GROUP;
+	if (((groups + RAID_DISKS - 1) / RAID_DISKS) * TAGLINE_REPLICA_GROUP > RAID_DISKBLOCKS){
+		logMessage(LOG_ERROR_LEVEL, "TAGLINE: %u taglines do not fit the second array", maxtaglines);
+		return (1);
+	}
+
+	if (client_raid_channel_endpoint(TAGLINE_REPLICA_CHANNEL, replicaAddress, replicaPort))
+		return (1);
+
+	replicaFormat = 1;
+	replicaRunning = 1;
+	if (pthread_create(&replicaThread, NULL, replica_worker, NULL)){
+		logMessage(LOG_ERROR_LEVEL, "TAGLINE: unable to start the replicator");
+		replicaRunning = 0;
+		return (1);
+	}
+
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : replica_stop
+// Description  : stops the replicator once the second array has everything,
+//				  or right away if it can not be reached
+//
+// Inputs       : none
+// Outputs      : none
+
+void replica_stop(void){
+
+	if (!replicaRunning)
+		return;
+
+	pthread_mutex_lock(&replicaLock);
+	replicaRunning = 0;
+	pthread_cond_signal(&replicaWork);
+	pthread_mutex_unlock(&replicaLock);
+
+	pthread_join(replicaThread, NULL);
+
+	//What could not be shipped is lost for the second array
+	if (replicaLogged != replicaShipped || replicaResends > 0)
+		logMessage(LOG_ERROR_LEVEL, "TAGLINE: second array left %lu writes and %u taglines behind",
+				(unsigned long)(replicaLogged - replicaShipped), replicaResends);
+	while (replicaShipped != replicaLogged)
+		raid_pool_put(replicaLog[replicaShipped++ % TAGLINE_REPLICA_LOG].data);
+	replicaBlocks = 0;
+	replicaResends = 0;
+
+	logMessage(LOG_INFO_LEVEL, "TAGLINE: replicated %lu blocks in %lu batches, %lu writes did not fit the log",
+			(unsigned long)replicaSent, (unsigned long)replicaBatches, (unsigned long)replicaOverflows);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : replica_log
+// Description  : puts a write in the replication log, or if there is no room
+//				  (or it failed) marks its tagline to be sent whole
+//
+// Inputs       : tag - the tagline
+//				  bnum - the first block written
+//				  blks - the number of blocks
+//				  buf - the blocks
+//				  failed - 1 if the write failed
+// Outputs      : none
+
+void replica_log(TagLineNumber tag, TagLineBlockNumber bnum, uint32_t blks, char *buf, int failed){
+
+	struct replicawrite *entry;
+	uint32_t i, piece;
+	char *data;
+
+	//What is on this array after a failed write is not known
+	if (failed){
+		replica_mark(tag);
+		return;
+	}
+
+	for (i = 0; i < blks; i += piece){
+		piece = (blks - i > RAID_POOL_MULTI_BLOCKS) ? RAID_POOL_MULTI_BLOCKS : blks - i;
+
+		data = raid_pool_get(piece);
+		if (data != NULL)
+			memcpy(data, &buf[i*RAID_BLOCK_SIZE], (size_t)piece * RAID_BLOCK_SIZE);
+
+		pthread_mutex_lock(&replicaLock);
+		if (data == NULL || replicaLogged - replicaShipped == TAGLINE_REPLICA_LOG
+				|| replicaBlocks + piece > TAGLINE_REPLICA_BLOCKS){
+			pthread_mutex_unlock(&replicaLock);
+			if (data != NULL)
+				raid_pool_put(data);
+			replica_mark(tag);
+			return;
+		}
+
+		entry = &replicaLog[replicaLogged % TAGLINE_REPLICA_LOG];
+		entry->tag = tag;
+		entry->bnum = bnum + i;
+		entry->blocks = piece;
+		entry->data = data;
+		entry->logged = raid_now();
+		replicaLogged++;
+		replicaBlocks += piece;
+		pthread_cond_signal(&replicaWork);
+		pthread_mutex_unlock(&replicaLock);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : replica_mark
+// Description  : marks a tagline to be sent whole to the second array
+//
+// Inputs       : tag - the tagline
+// Outputs      : none
+
+void replica_mark(TagLineNumber tag){
+
+	pthread_mutex_lock(&replicaLock);
+	replicaOverflows++;
+	if (!replicaDirty[tag]){
+		if (replicaResends++ == 0)
+			replicaBehind = raid_now();
+		replicaDirty[tag] = 1;
+	}
+	pthread_cond_signal(&replicaWork);
+	pthread_mutex_unlock(&replicaLock);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : replica_worker
+// Description  : the replicator thread. Ships the log in batches, and when
+//				  it is empty sends the marked taglines whole. After a failure
+//				  it waits (longer each time), connects again and starts the
+//				  second array over, since what it holds is then not known.
+//
+// Inputs       : arg - unused
+// Outputs      : NULL
+
+void *replica_worker(void *arg){
+
+	struct replicawrite batch[TAGLINE_REPLICA_BATCH];
+	struct timespec until;
+	uint32_t wait = TAGLINE_REPLICA_RETRY, blocks;
+	int connected = 0, failed = 0, format, count, i;
+	TagLineNumber tag = 0;
+
+	pthread_mutex_lock(&replicaLock);
+	while (1){
+
+		while (replicaRunning && connected && !replicaFormat && replicaLogged == replicaShipped && replicaResends == 0)
+			pthread_cond_wait(&replicaWork, &replicaLock);
+
+		//Stopping: leave when everything is shipped, or nothing can be
+		if (!replicaRunning && (failed || (connected && !replicaFormat && replicaLogged == replicaShipped && replicaResends == 0)))
+			break;
+		format = replicaFormat;
+		replicaFormat = 0;
+		pthread_mutex_unlock(&replicaLock);
+
+		if (!connected || format){
+			failed = replica_connect(format);
+			connected = !failed;
+		}
+		//The log first, it is in order
+		else if (replicaLogged != replicaShipped){
+			pthread_mutex_lock(&replicaLock);
+			for (count = 0; count < TAGLINE_REPLICA_BATCH && replicaShipped + count != replicaLogged; count++)
+				batch[count] = replicaLog[(replicaShipped + count) % TAGLINE_REPLICA_LOG];
+			pthread_mutex_unlock(&replicaLock);
+
+			failed = replica_ship(batch, count);
+			if (!failed){
+				pthread_mutex_lock(&replicaLock);
+				for (i = 0, blocks = 0; i < count; i++){
+					raid_pool_put(batch[i].data);
+					blocks += batch[i].blocks;
+				}
+				replicaShipped += count;
+				replicaBlocks -= blocks;
+				replicaSent += blocks;
+				replicaBatches++;
+				pthread_mutex_unlock(&replicaLock);
+			}
+		}
+		else{
+			//Next marked tagline, the mark goes first so a write that
+			//overflows meanwhile marks it again
+			pthread_mutex_lock(&replicaLock);
+			while (!replicaDirty[tag])
+				tag = (tag + 1) % maxtaglines;
+			replicaDirty[tag] = 0;
+			replicaResends--;
+			pthread_mutex_unlock(&replicaLock);
+
+			failed = replica_resend(tag);
+			if (failed){
+				pthread_mutex_lock(&replicaLock);
+				replicaResends++;
+				replicaDirty[tag] = 1;
+				pthread_mutex_unlock(&replicaLock);
+			}
+		}
+
+		if (failed){
+			logMessage(LOG_ERROR_LEVEL, "TAGLINE: second array unreachable, trying again in %u ms", wait);
+			client_raid_channel_reset(TAGLINE_REPLICA_CHANNEL);
+			connected = 0;
+
+			clock_gettime(CLOCK_REALTIME, &until);
+			until.tv_sec += wait / 1000;
+			until.tv_nsec += (long)(wait % 1000) * 1000000;
+			if (until.tv_nsec >= 1000000000){
+				until.tv_sec++;
+				until.tv_nsec -= 1000000000;
+			}
+			wait = (wait * 2 < 5000) ? wait * 2 : 5000;
+
+			pthread_mutex_lock(&replicaLock);
+			while (replicaRunning && pthread_cond_timedwait(&replicaWork, &replicaLock, &until) == 0);
+			continue;
+		}
+
+		wait = TAGLINE_REPLICA_RETRY;
+		pthread_mutex_lock(&replicaLock);
+	}
+	pthread_mutex_unlock(&replicaLock);
+
+	return (NULL);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : replica_connect
+// Description  : initializes the second array. On first contact, or when
+//				  asked with tagline_replica_format, it is formatted and then
+//				  has to get every tagline whole; otherwise it still has what
+//				  it got and the log and the marked taglines bring it up to date.
+//
+// Inputs       : format - 1 to format the second array
+// Outputs      : 0 if successful, 1 if failure
+
+int replica_connect(int format){
+
+	RAIDOpCode operation = 0;
+	RAIDOpCode response = 0;
+	int disk, tag, failed;
+
+	operation = create_raid_request(RAID_INIT, RAID_DISKBLOCKS/RAID_TRACK_BLOCKS+3, RAID_DISKS, 0);
+	response = client_raid_bus_request_channel(TAGLINE_REPLICA_CHANNEL, operation, NULL);
+	failed = (response == (RAIDOpCode)-1 || RAID_OP_STATUS(response));
+
+	for (disk = 0; disk < RAID_DISKS && format && !failed; disk++){
+		operation = create_raid_request(RAID_FORMAT, 0, disk, 0);
+		response = client_raid_bus_request_channel(TAGLINE_REPLICA_CHANNEL, operation, NULL);
+		failed = (response == (RAIDOpCode)-1 || RAID_OP_STATUS(response));
+	}
+
+	//Still to be formatted when it is reached again
+	if (failed){
+		if (format){
+			pthread_mutex_lock(&replicaLock);
+			replicaFormat = 1;
+			pthread_mutex_unlock(&replicaLock);
+		}
+		return (1);
+	}
+
+	//The log only has the latest writes, older blocks come with the taglines
+	if (format){
+		pthread_mutex_lock(&writeLock);
+		for (tag = 0; tag < maxtaglines; tag++)
+			if (tagcounter[tag] > 0)
+				replica_mark(tag);
+		pthread_mutex_unlock(&writeLock);
+	}
+
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : replica_ship
+// Description  : writes logged writes to their places on the second array,
+//				  pipelined on the replica connection
+//
+// Inputs       : batch - the writes
+//				  count - how many
+// Outputs      : 0 if successful, 1 if failure
+
+int replica_ship(struct replicawrite *batch, int count){
+
+	RAIDOpCode ops[TAGLINE_REPLICA_BATCH * (RAID_POOL_MULTI_BLOCKS / TAGLINE_REPLICA_GROUP + 2)];
+	RAIDOpCode responses[TAGLINE_REPLICA_BATCH * (RAID_POOL_MULTI_BLOCKS / TAGLINE_REPLICA_GROUP + 2)];
+	void *bufs[TAGLINE_REPLICA_BATCH * (RAID_POOL_MULTI_BLOCKS / TAGLINE_REPLICA_GROUP + 2)];
+	uint32_t i, run, to;
+	int j, ops_count = 0;
+
+	//A write is cut where its blocks go to the next group
+	for (j = 0; j < count; j++){
+		for (i = 0; i < batch[j].blocks; i += run){
+			to = replica_location(batch[j].tag, batch[j].bnum + i);
+			run = TAGLINE_REPLICA_GROUP - (batch[j].bnum + i) % TAGLINE_REPLICA_GROUP;
+			if (run > batch[j].blocks - i)
+				run = batch[j].blocks - i;
+
+			ops[ops_count] = create_raid_request(RAID_WRITE, run, LOC_DISK(to), LOC_POSITION(to));
+			bufs[ops_count++] = &batch[j].data[i*RAID_BLOCK_SIZE];
+		}
+	}
+
+	if (client_raid_bus_pipeline(TAGLINE_REPLICA_CHANNEL, ops_count, ops, bufs, responses))
+		return (1);
+
+	for (j = 0; j < ops_count; j++)
+		if (RAID_OP_STATUS(responses[j]))
+			return (1);
+
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : replica_resend
+// Description  : sends a whole tagline to the second array, read from this
+//				  one (from the backup copy where the primary disk is down,
+//				  unless that backup missed a write)
+//
+// Inputs       : tag - the tagline
+// Outputs      : 0 if successful, 1 if failure (the second array's)
+
+int replica_resend(TagLineNumber tag){
+
+	RAIDOpCode ops[RAID_POOL_MULTI_BLOCKS];
+	RAIDOpCode responses[RAID_POOL_MULTI_BLOCKS];
+	void *bufs[RAID_POOL_MULTI_BLOCKS];
+	struct replicawrite piece;
+	struct tagline loc;
+	uint32_t blocks, i, run, start, source, skip;
+	int count, j, unread, failed = 0;
+
+	piece.data = raid_pool_get(RAID_POOL_MULTI_BLOCKS);
+	if (piece.data == NULL)
+		return (1);
+	piece.tag = tag;
+
+	//Backups of relaxed taglines may still be queued
+	pthread_mutex_lock(&writeLock);
+	if (tagdurability[tag] == TAGLINE_DURABLE_ONE)
+		mirror_drain();
+	blocks = tagcounter[tag];
+	pthread_mutex_unlock(&writeLock);
+
+	for (start = 0; start < blocks && !failed; start += piece.blocks + skip){
+		piece.bnum = start;
+		piece.blocks = (blocks - start > RAID_POOL_MULTI_BLOCKS) ? RAID_POOL_MULTI_BLOCKS : blocks - start;
+		skip = 0;
+
+		//Read the piece, a request per run that is contiguous where it is
+		//read, with the map and the disks held still until it is in memory
+		pthread_mutex_lock(&writeLock);
+		count = 0;
+		for (i = 0; i < piece.blocks; i += run){
+			loc = tagline_locate(tag, start + i);
+			source = replica_source(loc);
+
+			//A backup that missed a write would ship old data
+			if (source == TAGLINE_NO_LOC || (source != loc.primary && backup_stale(tag, start + i)))
+				break;
+
+			for (run = 1; i + run < piece.blocks; run++){
+				loc = tagline_locate(tag, start + i + run);
+				if (replica_source(loc) != source + run)
+					break;
+				if (loc.primary != source + run && backup_stale(tag, start + i + run))
+					break;
+			}
+			ops[count] = create_raid_request(RAID_READ, run, LOC_DISK(source), LOC_POSITION(source));
+			bufs[count++] = &piece.data[i*RAID_BLOCK_SIZE];
+		}
+
+		//A block with no copy, or with its primary down and its backup stale,
+		//has nothing current to send, the piece ends before it and it is
+		//passed over
+		if (i < piece.blocks){
+			logMessage(LOG_ERROR_LEVEL, "TAGLINE: block %u of tagline %u has no current copy to replicate", start + i, tag);
+			piece.blocks = i;
+			skip = 1;
+			if (count == 0){
+				pthread_mutex_unlock(&writeLock);
+				continue;
+			}
+		}
+
+		//This array failing is not the second array's fault, try it later
+		unread = client_raid_bus_pipeline(TAGLINE_RESEND_CHANNEL, count, ops, bufs, responses);
+		if (unread)
+			client_raid_channel_reset(TAGLINE_RESEND_CHANNEL);
+		for (j = 0; j < count && !unread; j++)
+			unread = RAID_OP_STATUS(responses[j]);
+		pthread_mutex_unlock(&writeLock);
+
+		if (unread){
+			replica_mark(tag);
+			break;
+		}
+
+		failed = replica_ship(&piece, 1);
+		if (!failed){
+			pthread_mutex_lock(&replicaLock);
+			replicaSent += piece.blocks;
+			pthread_mutex_unlock(&replicaLock);
+		}
+	}
+
+	raid_pool_put(piece.data);
+	return (failed);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : replica_location
+// Description  : where a block of a tagline is kept on the second array
+//
+// Inputs       : tag - the tagline
+//				  bnum - the block
+// Outputs      : the location
+
+uint32_t replica_location(TagLineNumber tag, TagLineBlockNumber bnum){
+
+	uint64_t block, group;
+
+	block = (uint64_t)tag * MAX_TAGLINE_BLOCK_NUMBER + bnum;
+	group = block / TAGLINE_REPLICA_GROUP;
+
+	return (MAKE_LOC(group % RAID_DISKS, (group / RAID_DISKS) * TAGLINE_REPLICA_GROUP + block % TAGLINE_REPLICA_GROUP));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : replica_source
+// Description  : the copy of a block to read for the second array, the
+//				  primary one unless it is missing or its disk is down
+//
+// Inputs       : loc - the locations of the block
+// Outputs      : the location, TAGLINE_NO_LOC if the block has none
+
+uint32_t replica_source(struct tagline loc){
+
+	if (loc.backup != TAGLINE_NO_LOC && (loc.primary == TAGLINE_NO_LOC || array[LOC_DISK(loc.primary)].status != RAID_DISK_READY))
+		return (loc.backup);
+	return (loc.primary);
+}
@@ -0,0 +1,273 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : tagline_ring.c
+//  Description    : This is the implementation of the driver side of the
+//                   TAGLINE rings. Submitted entries are taken in batches, in
+//                   order; entries that continue each other both in the
+//                   tagline and in memory become one large read or write,
+//                   which the driver pipelines on the bus.
+//
+//  Author         : agent
+//  Last Modified  : 10/18/2026
+//
+
+// Includes
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+
+// Project includes
+#include <cmpsc311_log.h>
+#include <tagline_ext.h>
+#include <tagline_ring.h>
+
+
+//Definitions
+
+//Largest ring
+#define TAGLINE_RING_MAX         65536
+
+//Empty polls before the poller goes to sleep
+#define TAGLINE_RING_IDLE        1024
+
+
+//Functions Prototypes
+void *ring_poll(void *);
+int ring_execute(struct tagline_sqe *, uint32_t);
+
+
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_ring_create
+// Description  : Creates a submission and a completion queue
+//
+// Inputs       : entries - the size of the queues, rounded up to a power of two
+// Outputs      : the rings, NULL if failure
+
+struct tagline_ring * tagline_ring_create(uint32_t entries) {
+
+	struct tagline_ring *ring;
+	uint32_t size = 1;
+
+	if (entries == 0 || entries > TAGLINE_RING_MAX)
+		return (NULL);
+	while (size < entries)
+		size <<= 1;
+
+	ring = (struct tagline_ring *) calloc(1, sizeof(struct tagline_ring));
+	if (ring == NULL)
+		return (NULL);
+
+	//Each queue in its own cache lines
+	if (posix_memalign((void **)&ring->sqes, 64, size * sizeof(struct tagline_sqe))
+			|| posix_memalign((void **)&ring->cqes, 64, size * sizeof(struct tagline_cqe))){
+		tagline_ring_destroy(ring);
+		return (NULL);
+	}
+
+	ring->entries = size;
+	ring->mask = size - 1;
+	atomic_init(&ring->sqHead, 0);
+	atomic_init(&ring->sqTail, 0);
+	atomic_init(&ring->cqHead, 0);
+	atomic_init(&ring->cqTail, 0);
+	atomic_init(&ring->flags, 0);
+	atomic_init(&ring->polling, 0);
+	pthread_mutex_init(&ring->lock, NULL);
+	pthread_cond_init(&ring->wakeup, NULL);
+
+	return (ring);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_ring_destroy
+// Description  : Stops the poller, if there is one, and frees the rings.
+//                Entries still in the submission queue are not run.
+//
+// Inputs       : ring - the rings
+// Outputs      : none
+
+void tagline_ring_destroy(struct tagline_ring *ring) {
+
+	if (ring == NULL)
+		return;
+
+	if (atomic_load(&ring->polling)){
+		pthread_mutex_lock(&ring->lock);
+		atomic_store(&ring->polling, 0);
+		pthread_cond_signal(&ring->wakeup);
+		pthread_mutex_unlock(&ring->lock);
+		pthread_join(ring->poller, NULL);
+	}
+
+	pthread_mutex_destroy(&ring->lock);
+	pthread_cond_destroy(&ring->wakeup);
+	free(ring->sqes);
+	free(ring->cqes);
+	free(ring);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_ring_enter
+// Description  : Runs the submitted entries, as many as there is room for in
+//                the completion queue. Completions are posted after each run
+//                of merged entries.
+//
+// Inputs       : ring - the rings
+// Outputs      : the number of completions posted, -1 if failure
+
+int tagline_ring_enter(struct tagline_ring *ring) {
+
+	struct tagline_sqe *sqe, *next;
+	struct tagline_cqe *cqe;
+	uint32_t head, tail, cqTail, room, run, blocks, k;
+	int32_t result;
+	int posted = 0;
+
+	if (ring == NULL)
+		return (-1);
+
+	head = atomic_load_explicit(&ring->sqHead, memory_order_relaxed);
+	tail = atomic_load_explicit(&ring->sqTail, memory_order_acquire);
+	cqTail = atomic_load_explicit(&ring->cqTail, memory_order_relaxed);
+	room = ring->entries - (cqTail - atomic_load_explicit(&ring->cqHead, memory_order_acquire));
+
+	while (head != tail && room > 0){
+
+		//Merge the entries that continue this one
+		sqe = &ring->sqes[head & ring->mask];
+		blocks = sqe->blocks;
+		for (run = 1; head + run != tail && run < room; run++){
+			next = &ring->sqes[(head + run) & ring->mask];
+			if (next->opcode != sqe->opcode || next->tag != sqe->tag || next->bnum != sqe->bnum + blocks
+					|| next->buf != sqe->buf + (size_t)blocks * TAGLINE_BLOCK_SIZE
+					|| blocks + next->blocks > MAX_TAGLINE_BLOCK_NUMBER)
+				break;
+			blocks += next->blocks;
+		}
+
+		result = ring_execute(sqe, blocks);
+
+		for (k = 0; k < run; k++){
+			cqe = &ring->cqes[(cqTail + k) & ring->mask];
+			cqe->user_data = ring->sqes[(head + k) & ring->mask].user_data;
+			cqe->result = result;
+		}
+
+		//The entries are no longer needed, the application may reuse them
+		head += run;
+		cqTail += run;
+		room -= run;
+		posted += run;
+		atomic_store_explicit(&ring->sqHead, head, memory_order_release);
+		atomic_store_explicit(&ring->cqTail, cqTail, memory_order_release);
+	}
+
+	return (posted);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : ring_execute
+// Description  : Runs one (merged) entry on the driver
+//
+// Inputs       : sqe - the first entry
+//                blocks - the blocks of all the merged entries
+// Outputs      : 0 if successful, 1 if failure
+
+int ring_execute(struct tagline_sqe *sqe, uint32_t blocks) {
+
+	switch (sqe->opcode){
+
+	case TAGLINE_RING_READ:
+		return (tagline_read_large(sqe->tag, sqe->bnum, blocks, sqe->buf));
+
+	case TAGLINE_RING_WRITE:
+		return (tagline_write_large(sqe->tag, sqe->bnum, blocks, sqe->buf));
+	}
+
+	return (1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_ring_poll_start
+// Description  : Starts a thread that runs submitted entries as they come, so
+//                the application never has to make a call to submit
+//
+// Inputs       : ring - the rings
+// Outputs      : 0 if successful, -1 if failure
+
+int tagline_ring_poll_start(struct tagline_ring *ring) {
+
+	if (ring == NULL || atomic_load(&ring->polling))
+		return (-1);
+
+	atomic_store(&ring->polling, 1);
+	if (pthread_create(&ring->poller, NULL, ring_poll, ring)){
+		atomic_store(&ring->polling, 0);
+		logMessage(LOG_ERROR_LEVEL, "TAGLINE ring: unable to start the poller");
+		return (-1);
+	}
+
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_ring_wake
+// Description  : Wakes up the poller when it went to sleep
+//
+// Inputs       : ring - the rings
+// Outputs      : none
+
+void tagline_ring_wake(struct tagline_ring *ring) {
+
+	pthread_mutex_lock(&ring->lock);
+	pthread_cond_signal(&ring->wakeup);
+	pthread_mutex_unlock(&ring->lock);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : ring_poll
+// Description  : The poller thread. Keeps draining the submission queue and
+//                after a while with nothing to do sleeps until woken up.
+//
+// Inputs       : arg - the rings
+// Outputs      : NULL
+
+void *ring_poll(void *arg) {
+
+	struct tagline_ring *ring = (struct tagline_ring *)arg;
+	int idle = 0;
+
+	while (atomic_load(&ring->polling)){
+
+		if (tagline_ring_enter(ring) > 0){
+			idle = 0;
+			continue;
+		}
+
+		if (++idle < TAGLINE_RING_IDLE){
+			sched_yield();
+			continue;
+		}
+
+		//Ask to be woken up, then look once more so no submission is missed
+		pthread_mutex_lock(&ring->lock);
+		atomic_fetch_or(&ring->flags, TAGLINE_RING_NEED_WAKEUP);
+		while (atomic_load(&ring->polling)
+				&& atomic_load(&ring->sqHead) == atomic_load(&ring->sqTail))
+			pthread_cond_wait(&ring->wakeup, &ring->lock);
+		atomic_fetch_and(&ring->flags, ~TAGLINE_RING_NEED_WAKEUP);
+		pthread_mutex_unlock(&ring->lock);
+		idle = 0;
+	}
+
+	return (NULL);
+}
@@ -0,0 +1,122 @@
+#ifndef TAGLINE_RING_INCLUDED
+#define TAGLINE_RING_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : tagline_ring.h
+//  Description    : This is the interface of the TAGLINE rings, a submission
+//                   queue and a completion queue shared by an application and
+//                   the driver. The application side (getting entries,
+//                   publishing them and reaping completions) is inline, only
+//                   handing a batch to the driver is a call.
+//
+//  Author         : agent
+//  Last Modified  : 10/18/2026
+//
+
+// Include Files
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+// Project Include Files
+#include <tagline_driver.h>
+
+// Defines
+#define TAGLINE_RING_READ        1
+#define TAGLINE_RING_WRITE       2
+
+//Flags of the ring set by the driver
+#define TAGLINE_RING_NEED_WAKEUP 1     // The poller sleeps, tagline_ring_submit wakes it
+
+//Submission entry, one tagline read or write of any size
+struct tagline_sqe
+{
+	uint8_t opcode;
+	TagLineNumber tag;
+	TagLineBlockNumber bnum;
+	uint32_t blocks;
+	char *buf;
+	uint64_t user_data;
+};
+
+//Completion entry, result is 0 if successful, 1 if failure
+struct tagline_cqe
+{
+	uint64_t user_data;
+	int32_t result;
+};
+
+//The rings, entries is a power of two. The application owns sqTail and
+//cqHead, the driver sqHead and cqTail.
+struct tagline_ring
+{
+	uint32_t entries;
+	uint32_t mask;
+	_Atomic uint32_t sqHead;
+	_Atomic uint32_t sqTail;
+	_Atomic uint32_t cqHead;
+	_Atomic uint32_t cqTail;
+	_Atomic uint32_t flags;
+	struct tagline_sqe *sqes;
+	struct tagline_cqe *cqes;
+
+	//Poller thread (tagline_ring_poll_start)
+	_Atomic int polling;
+	pthread_t poller;
+	pthread_mutex_t lock;
+	pthread_cond_t wakeup;
+};
+
+//
+// Interface
+
+struct tagline_ring * tagline_ring_create(uint32_t entries);
+	// Create rings of entries (rounded up to a power of two), NULL if failure
+
+void tagline_ring_destroy(struct tagline_ring *ring);
+	// Stop the poller if any and free the rings
+
+int tagline_ring_enter(struct tagline_ring *ring);
+	// Run the submitted entries in the caller, completions posted or -1 if failure
+
+int tagline_ring_poll_start(struct tagline_ring *ring);
+	// Run submitted entries in a driver thread, the application must then not
+	// call the driver itself, 0 if successful
+
+void tagline_ring_wake(struct tagline_ring *ring);
+	// Wake up a sleeping poller
+
+//Free submission entry n (0 for the first one filled since the last submit),
+//NULL if the queue is full
+static inline struct tagline_sqe *tagline_ring_get_sqe(struct tagline_ring *ring, uint32_t n) {
+	uint32_t tail = atomic_load_explicit(&ring->sqTail, memory_order_relaxed);
+	if (tail + n - atomic_load_explicit(&ring->sqHead, memory_order_acquire) >= ring->entries)
+		return (NULL);
+	return (&ring->sqes[(tail + n) & ring->mask]);
+}
+
+//Publish the n entries filled since the last submit
+static inline void tagline_ring_submit(struct tagline_ring *ring, uint32_t n) {
+	atomic_store_explicit(&ring->sqTail, atomic_load_explicit(&ring->sqTail, memory_order_relaxed) + n,
+			memory_order_release);
+	atomic_thread_fence(memory_order_seq_cst);
+	if (atomic_load_explicit(&ring->flags, memory_order_relaxed) & TAGLINE_RING_NEED_WAKEUP)
+		tagline_ring_wake(ring);
+}
+
+//Oldest completion not seen yet, NULL if there is none
+static inline struct tagline_cqe *tagline_ring_peek_cqe(struct tagline_ring *ring) {
+	uint32_t head = atomic_load_explicit(&ring->cqHead, memory_order_relaxed);
+	if (head == atomic_load_explicit(&ring->cqTail, memory_order_acquire))
+		return (NULL);
+	return (&ring->cqes[head & ring->mask]);
+}
+
+//Give the oldest completion back to the driver
+static inline void tagline_ring_cqe_seen(struct tagline_ring *ring) {
+	atomic_store_explicit(&ring->cqHead, atomic_load_explicit(&ring->cqHead, memory_order_relaxed) + 1,
+			memory_order_release);
+}
+
+#endif
@@ -0,0 +1,418 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : tagline_stream.c
+//  Description    : This is the streaming of taglines to and from files in
+//                   the TAGLINE driver, with the RAID side and the file side
+//                   of a stream running at the same time.
+//
+//  Author         : agent
+//  Last Modified  : 10/18/2026
+//
+
+// Includes
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// Project includes
+#include <cmpsc311_log.h>
+#include "tagline_internal.h"
+
+
+//Definitions
+
+//Streaming (tagline_export, tagline_import): the blocks go through two
+//buffers of TAGLINE_STREAM_BLOCKS, one on the RAID side and one on the file
+//side at any time. The thread doing the RAID side sets cacheBypass, so the
+//blocks streamed do not push the working set out of the cache.
+#define TAGLINE_STREAM_BLOCKS    1024
+
+
+//Structures
+
+struct tagstream
+{
+	char *buf[2];
+	uint32_t blocks[2];  //Blocks in each buffer, 0 if it is free
+	int done;            //No more buffers will be filled
+	int failed;
+	TagLineNumber tag;
+	TagLineBlockNumber bnum;
+	uint32_t total;      //Blocks to export
+	pthread_mutex_t lock;
+	pthread_cond_t changed;
+};
+
+
+//Global Variables
+
+__thread int cacheBypass = 0;
+
+
+//Functions Prototypes
+int stream_open(struct tagstream *, TagLineNumber);
+void stream_close(struct tagstream *);
+void *export_reader(void *);
+void *import_writer(void *);
+int truncate_tagline(TagLineNumber, TagLineBlockNumber);
+
+
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_export
+// Description  : writes every block of a tagline to a file (or pipe, socket),
+//				  in order. A thread reads large coalesced runs from the RAID
+//				  into one buffer while the caller writes the other one out.
+//
+// Inputs       : tag - the tagline
+//				  fd - where the blocks go
+// Outputs      : the number of blocks exported, -1 if failure
+
+int tagline_export(TagLineNumber tag, int fd){
+
+	struct tagstream stream;
+	pthread_t reader;
+	ssize_t written;
+	size_t offset, length;
+	uint32_t exported = 0;
+	int side = 0;
+
+	if (tagcounter == NULL || tag >= maxtaglines || stream_open(&stream, tag))
+		return (-1);
+	stream.total = __atomic_load_n(&tagcounter[tag], __ATOMIC_ACQUIRE);
+
+	//Only a hint, pipes and sockets do not take it
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+	if (pthread_create(&reader, NULL, export_reader, &stream)){
+		stream_close(&stream);
+		return (-1);
+	}
+
+	pthread_mutex_lock(&stream.lock);
+	while (!stream.failed){
+		while (stream.blocks[side] == 0 && !stream.done && !stream.failed)
+			pthread_cond_wait(&stream.changed, &stream.lock);
+		if (stream.blocks[side] == 0 || stream.failed)
+			break;
+		pthread_mutex_unlock(&stream.lock);
+
+		length = (size_t)stream.blocks[side] * RAID_BLOCK_SIZE;
+		for (offset = 0; offset < length; offset += written){
+			written = write(fd, stream.buf[side] + offset, length - offset);
+			if (written < 0 && errno == EINTR)
+				written = 0;
+			else if (written <= 0)
+				break;
+		}
+
+		pthread_mutex_lock(&stream.lock);
+		if (offset < length)
+			stream.failed = 1;
+		exported += stream.blocks[side];
+		stream.blocks[side] = 0;
+		pthread_cond_broadcast(&stream.changed);
+		side = !side;
+	}
+	pthread_mutex_unlock(&stream.lock);
+
+	pthread_join(reader, NULL);
+	if (stream.failed){
+		stream_close(&stream);
+		return (-1);
+	}
+
+	stream_close(&stream);
+	logMessage(LOG_INFO_LEVEL, "TAGLINE : exported %u blocks of tagline %u.", exported, tag);
+	return (exported);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_import
+// Description  : replaces the blocks of a tagline with those of a file, up
+//				  to the end of the file (the last block padded with zeros).
+//				  The caller reads the file into one buffer while a thread
+//				  writes the other one to the RAID. The tagline is then cut
+//				  to the blocks imported.
+//
+// Inputs       : fd - where the blocks come from
+//				  tag - the tagline
+// Outputs      : the number of blocks imported, -1 if failure
+
+int tagline_import(int fd, TagLineNumber tag){
+
+	struct tagstream stream;
+	pthread_t writer;
+	ssize_t got = 1;
+	size_t offset, length;
+	uint32_t imported = 0;
+	int side = 0, failed;
+
+	if (tagcounter == NULL || tag >= maxtaglines || stream_open(&stream, tag))
+		return (-1);
+
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+	if (pthread_create(&writer, NULL, import_writer, &stream)){
+		stream_close(&stream);
+		return (-1);
+	}
+
+	while (got > 0){
+
+		//Wait for the buffer to be written out
+		pthread_mutex_lock(&stream.lock);
+		while (stream.blocks[side] != 0 && !stream.failed)
+			pthread_cond_wait(&stream.changed, &stream.lock);
+		failed = stream.failed;
+		pthread_mutex_unlock(&stream.lock);
+		if (failed)
+			break;
+
+		//A tagline holds at most MAX_TAGLINE_BLOCK_NUMBER blocks
+		length = (size_t)TAGLINE_STREAM_BLOCKS * RAID_BLOCK_SIZE;
+		if (length > (size_t)(MAX_TAGLINE_BLOCK_NUMBER - imported) * RAID_BLOCK_SIZE)
+			length = (size_t)(MAX_TAGLINE_BLOCK_NUMBER - imported) * RAID_BLOCK_SIZE;
+		for (offset = 0; offset < length; offset += got){
+			got = read(fd, stream.buf[side] + offset, length - offset);
+			if (got < 0 && errno == EINTR)
+				got = 0;
+			else if (got <= 0)
+				break;
+		}
+
+		pthread_mutex_lock(&stream.lock);
+		if (got < 0 || (length == 0 && read(fd, stream.buf[side], 1) > 0)){
+			logMessage(LOG_ERROR_LEVEL, "TAGLINE : import to tagline %u failed, the file could not be read or does not fit.", tag);
+			stream.failed = 1;
+		}
+		else if (offset > 0){
+			memset(stream.buf[side] + offset, 0, (RAID_BLOCK_SIZE - offset % RAID_BLOCK_SIZE) % RAID_BLOCK_SIZE);
+			stream.blocks[side] = (offset + RAID_BLOCK_SIZE - 1) / RAID_BLOCK_SIZE;
+			imported += stream.blocks[side];
+			side = !side;
+		}
+		//End of the file, or of the tagline
+		if (offset < length || length == 0)
+			got = 0;
+		pthread_cond_broadcast(&stream.changed);
+		pthread_mutex_unlock(&stream.lock);
+	}
+
+	pthread_mutex_lock(&stream.lock);
+	stream.done = 1;
+	pthread_cond_broadcast(&stream.changed);
+	pthread_mutex_unlock(&stream.lock);
+
+	pthread_join(writer, NULL);
+	if (stream.failed || truncate_tagline(tag, imported)){
+		stream_close(&stream);
+		return (-1);
+	}
+
+	stream_close(&stream);
+	logMessage(LOG_INFO_LEVEL, "TAGLINE : imported %u blocks to tagline %u.", imported, tag);
+	return (imported);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : stream_open
+// Description  : prepares the two buffers of a stream
+//
+// Inputs       : stream - the stream
+//				  tag - the tagline streamed
+// Outputs      : 0 if successful, 1 if failure
+
+int stream_open(struct tagstream *stream, TagLineNumber tag){
+
+	memset(stream, 0, sizeof(*stream));
+	stream->tag = tag;
+
+	if (posix_memalign((void **)&stream->buf[0], TAGLINE_LINE_SIZE, 2 * (size_t)TAGLINE_STREAM_BLOCKS * RAID_BLOCK_SIZE))
+		return (1);
+	stream->buf[1] = stream->buf[0] + (size_t)TAGLINE_STREAM_BLOCKS * RAID_BLOCK_SIZE;
+
+	pthread_mutex_init(&stream->lock, NULL);
+	pthread_cond_init(&stream->changed, NULL);
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : stream_close
+// Description  : frees the buffers of a stream
+//
+// Inputs       : stream - the stream
+// Outputs      : none
+
+void stream_close(struct tagstream *stream){
+
+	pthread_mutex_destroy(&stream->lock);
+	pthread_cond_destroy(&stream->changed);
+	free(stream->buf[0]);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : export_reader
+// Description  : RAID side of an export, fills the buffers in turn with the
+//				  next blocks of the tagline
+//
+// Inputs       : arg - the stream
+// Outputs      : NULL
+
+void *export_reader(void *arg){
+
+	struct tagstream *stream = (struct tagstream *)arg;
+	uint32_t n;
+	int side = 0, failed;
+
+	cacheBypass = 1;
+
+	while (stream->bnum < stream->total){
+		pthread_mutex_lock(&stream->lock);
+		while (stream->blocks[side] != 0 && !stream->failed)
+			pthread_cond_wait(&stream->changed, &stream->lock);
+		failed = stream->failed;
+		pthread_mutex_unlock(&stream->lock);
+		if (failed)
+			return (NULL);
+
+		n = stream->total - stream->bnum;
+		if (n > TAGLINE_STREAM_BLOCKS)
+			n = TAGLINE_STREAM_BLOCKS;
+		failed = tagline_read_large(stream->tag, stream->bnum, n, stream->buf[side]);
+
+		pthread_mutex_lock(&stream->lock);
+		if (failed)
+			stream->failed = 1;
+		else
+			stream->blocks[side] = n;
+		pthread_cond_broadcast(&stream->changed);
+		pthread_mutex_unlock(&stream->lock);
+		if (failed)
+			return (NULL);
+
+		stream->bnum += n;
+		side = !side;
+	}
+
+	pthread_mutex_lock(&stream->lock);
+	stream->done = 1;
+	pthread_cond_broadcast(&stream->changed);
+	pthread_mutex_unlock(&stream->lock);
+	return (NULL);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : import_writer
+// Description  : RAID side of an import, writes the buffers in turn to the
+//				  tagline as they are filled
+//
+// Inputs       : arg - the stream
+// Outputs      : NULL
+
+void *import_writer(void *arg){
+
+	struct tagstream *stream = (struct tagstream *)arg;
+	uint32_t n;
+	int side = 0, failed;
+
+	cacheBypass = 1;
+
+	while (1){
+		pthread_mutex_lock(&stream->lock);
+		while (stream->blocks[side] == 0 && !stream->done && !stream->failed)
+			pthread_cond_wait(&stream->changed, &stream->lock);
+		n = stream->failed ? 0 : stream->blocks[side];
+		pthread_mutex_unlock(&stream->lock);
+		if (n == 0)
+			return (NULL);
+
+		failed = tagline_write_large(stream->tag, stream->bnum, n, stream->buf[side]);
+
+		pthread_mutex_lock(&stream->lock);
+		if (failed)
+			stream->failed = 1;
+		stream->bnum += n;
+		stream->blocks[side] = 0;
+		pthread_cond_broadcast(&stream->changed);
+		pthread_mutex_unlock(&stream->lock);
+		if (failed)
+			return (NULL);
+
+		side = !side;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : truncate_tagline
+// Description  : cuts a tagline to its first blocks, the ones after it have no
+//				  location anymore and are as if never written
+//
+// Inputs       : tag - the tagline
+//				  length - the blocks it keeps
+// Outputs      : 0 if successful, 1 if failure
+
+int truncate_tagline(TagLineNumber tag, TagLineBlockNumber length){
+
+	uint64_t leaves[MAX_TAGLINE_BLOCK_NUMBER];
+	struct tagline loc, none = { TAGLINE_NO_LOC, TAGLINE_NO_LOC };
+	TagLineBlockNumber bnum, end;
+	int failed = 0;
+
+	pthread_mutex_lock(&writeLock);
+
+	end = tagcounter[tag];
+	if (length >= end){
+		pthread_mutex_unlock(&writeLock);
+		return (0);
+	}
+
+	//Backups of the cut blocks must not land after them
+	if (tagdurability[tag] == TAGLINE_DURABLE_ONE)
+		mirror_drain();
+
+	//From the end, a failure leaves the tagline cut as far as it got
+	for (bnum = end; bnum > length; bnum--){
+		loc = tagline_locate(tag, bnum - 1);
+		if (loc.primary != TAGLINE_NO_LOC)
+			invalidate_raid_cache(LOC_DISK(loc.primary), LOC_POSITION(loc.primary));
+
+		//Computed places come back by themselves, only the moved ones are forgotten
+		failed = map_update(tag, bnum - 1, (placementMode == TAGLINE_PLACEMENT_COMPUTED) ? computed_location(tag, bnum - 1) : none);
+		if (failed)
+			break;
+
+		if (rebalanceTarget > 0){
+			if (loc.primary != TAGLINE_NO_LOC)
+				rebalanceLive[LOC_DISK(loc.primary)]--;
+			if (loc.backup != TAGLINE_NO_LOC)
+				rebalanceLive[LOC_DISK(loc.backup)]--;
+		}
+	}
+	tagcounter[tag] = bnum;
+
+	//Nothing is behind or differs where nothing is
+	backup_mark(tag, bnum, end - bnum, 0);
+	if (digestsEnabled){
+		memset(leaves, 0, sizeof(leaves));
+		pthread_mutex_lock(&digestLock);
+		if (digests[tag].nodes[0] != NULL){
+			digest_set(&digests[tag], bnum, end - bnum, 0, leaves);
+			digest_set(&digests[tag], bnum, end - bnum, 1, leaves);
+		}
+		pthread_mutex_unlock(&digestLock);
+	}
+
+	pthread_mutex_unlock(&writeLock);
+	return (failed);
+}
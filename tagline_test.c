@@ -0,0 +1,2214 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : tagline_test.c
+//  Description    : This is the test program of the TAGLINE driver: the
+//                   disk failure handling (rebuild, the health monitor,
+//                   hedged reads, degraded reads and a rebuild while the
+//                   taglines are in use) and the extensions of the driver.
+//                   The driver runs against the local stand-in server, whose
+//                   disks the tests fail and stall, and the tests look into
+//                   the map of the driver. Every test runs in a process of
+//                   its own, on a server of its own. It is linked with the
+//                   driver sources in place of the simulator:
+//
+//                   cc -o tagline_test tagline_test.c tagline_driver.c
+//                      tagline_map.c tagline_mirror.c tagline_workers.c
+//                      tagline_rebuild.c tagline_monitor.c tagline_defrag.c
+//                      tagline_rebalance.c tagline_digest.c tagline_stream.c
+//                      tagline_replica.c tagline_daemon.c tagline_ring.c
+//                      raid_client.c raid_local_server.c raid_pool.c
+//                      raid_cache.c -lpthread
+//
+//  Author         : agent
+//  Last Modified  : 10/18/2026
+//
+
+// Includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sched.h>
+
+// Project includes
+#include <raid_network.h>
+#include <raid_ext.h>
+#include <tagline_ext.h>
+#include <raid_pool.h>
+#include <tagline_daemon.h>
+#include <tagline_ring.h>
+#include "tagline_internal.h"
+
+
+//Definitions
+
+//Taglines written by every test, each of them full
+#define TEST_TAGLINES        8
+#define TEST_BLOCKS          MAX_TAGLINE_BLOCK_NUMBER
+
+//Blocks of one tagline_read or tagline_write
+#define TEST_IO_BLOCKS       8
+
+//Port of the server of the first test, the next ones use the following ones
+#define TEST_PORT            19890
+
+//Longest wait for the health monitor (ms)
+#define TEST_MONITOR_WAIT    5000
+
+//Stalls of the hedging test, one read of disk 0 in TEST_STALL_EVERY answers
+//TEST_STALL_USEC late. They are far enough apart for a hedge connection to
+//be free every time.
+#define TEST_STALL_USEC      50000
+#define TEST_STALL_EVERY     200
+#define TEST_HEDGE_PASSES    4
+
+//Stall of every request during the rebuild in use (usec), so it is still
+//copying while the taglines are written and read
+#define TEST_REBUILD_STALL   2000
+
+//Pages of the table kept in memory by the paged map test, fewer than the
+//taglines fill (two taglines a page)
+#define TEST_META_PAGES      1
+
+//Blocks of a stripe unit of the striped layout test
+#define TEST_STRIPE_UNIT     4
+
+//Blocks the defragmenter makes contiguous at a time
+#define TEST_DEFRAG_EXTENT   64
+
+//Blocks of the rewrites of the overwrite test, across many runs
+#define TEST_OVERWRITE_BLOCKS 60
+
+//Stall of every request of the relaxed durability test (usec), so the backup
+//writes queue up behind the primary ones
+#define TEST_RELAXED_STALL   300
+
+//Threads of the buffer pool test, the buffers each holds at most (more than
+//the cache of a thread) and the times each takes them
+#define TEST_POOL_THREADS    8
+#define TEST_POOL_HELD       40
+#define TEST_POOL_ROUNDS     20000
+
+//Readers of the epoch test, the moves of its writer and the blocks of each
+//tagline it moves. Blocks TEST_TAGLINES/2 taglines apart share a bucket of
+//the exception table.
+#define TEST_EPOCH_READERS   4
+#define TEST_EPOCH_ROUNDS    1000000
+#define TEST_EPOCH_BLOCKS    16
+
+//Entries of the rings of the ring test and the ones submitted at once
+#define TEST_RING_ENTRIES    32
+#define TEST_RING_BATCH      16
+
+//Stall of one request in four of a disk in the workers test (usec)
+#define TEST_WORKERS_STALL   2000
+
+//Stall of every request of the slow disk of the work stealing test (usec)
+#define TEST_STEAL_STALL     5000
+
+//Blocks left in the file imported last by the streaming test
+#define TEST_STREAM_BLOCKS   16
+
+//The second array of the replica test listens TEST_REPLICA_PORT ports past the
+//first one. It is down for TEST_REPLICA_DOWN ms, and has TEST_REPLICA_WAIT ms
+//to catch up.
+#define TEST_REPLICA_PORT    100
+#define TEST_REPLICA_DOWN    300
+#define TEST_REPLICA_WAIT    10000
+
+
+//Structures
+
+//A test and its name
+struct tagtest
+{
+	const char *name;
+	int (*run)(void);
+};
+
+
+//Functions Prototypes
+int test_rebuild(void);
+int test_monitor(void);
+int test_hedge(void);
+int test_degraded(void);
+int test_rebuild_live(void);
+int test_read_ref(void);
+int test_large(void);
+int test_paged_map(void);
+int test_packing(void);
+int test_computed(void);
+int test_pool(void);
+int test_relaxed(void);
+int test_striped(void);
+int test_copy_offload(void);
+int test_mirror_offload(void);
+int test_defrag(void);
+int test_overwrite(void);
+int test_reserve(void);
+int test_epochs(void);
+int test_daemon(void);
+int test_ring(void);
+int test_workers(void);
+int test_stealing(void);
+int test_grow(void);
+int test_digests(void);
+int test_stream(void);
+int test_replica(void);
+int test_start(unsigned short, uint32_t);
+void test_stop(void);
+void test_pattern(TagLineNumber, TagLineBlockNumber, char *);
+int test_fill(void);
+int test_fill_blocks(TagLineNumber, TagLineBlockNumber, uint32_t);
+int test_check(void);
+int test_check_blocks(TagLineNumber, TagLineBlockNumber, uint32_t);
+int test_places(const char *, uint32_t);
+void * test_pool_thread(void *);
+int test_fragments(void);
+void * test_epoch_thread(void *);
+struct tagline test_moved(TagLineNumber, TagLineBlockNumber);
+int test_daemon_client(const char *, TagLineNumber);
+int test_ring_run(struct tagline_ring *, int, TagLineNumber, TagLineNumber, char *, int);
+int test_replica_server(int, int);
+int test_replica_verify(TagLineNumber, TagLineNumber);
+int test_replica_ask(char, TagLineNumber, TagLineNumber);
+int test_replica_wait(void);
+int test_wait_health(uint8_t, int);
+uint64_t test_now(void);
+
+
+//Global Variables
+
+//Changes the contents of the blocks of a tagline, for writes that replace them
+uint8_t testGeneration[TEST_TAGLINES];
+
+//Tells the threads of a test to stop
+_Atomic int testStop = 0;
+
+//Pipes to the process of the second array of the replica test
+int testCommands = -1, testAnswers = -1;
+
+struct tagtest tests[] = {
+	{ "rebuild", test_rebuild },
+	{ "monitor", test_monitor },
+	{ "hedge", test_hedge },
+	{ "degraded read", test_degraded },
+	{ "rebuild in use", test_rebuild_live },
+	{ "read reference", test_read_ref },
+	{ "large I/O", test_large },
+	{ "paged map", test_paged_map },
+	{ "location packing", test_packing },
+	{ "computed places", test_computed },
+	{ "buffer pool", test_pool },
+	{ "relaxed", test_relaxed },
+	{ "striped", test_striped },
+	{ "copy offload", test_copy_offload },
+	{ "mirror offload", test_mirror_offload },
+	{ "defrag", test_defrag },
+	{ "overwrite", test_overwrite },
+	{ "reserve", test_reserve },
+	{ "epochs", test_epochs },
+	{ "daemon", test_daemon },
+	{ "ring", test_ring },
+	{ "workers", test_workers },
+	{ "stealing", test_stealing },
+	{ "grow", test_grow },
+	{ "digests", test_digests },
+	{ "stream", test_stream },
+	{ "replica", test_replica },
+};
+
+
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : main
+// Description  : Runs every test in a child process and reports them
+//
+// Inputs       : none
+// Outputs      : 0 if every test passed, 1 if not
+
+int main(void) {
+
+	int i, status, failed = 0;
+	pid_t pid;
+
+	for (i = 0; i < (int)(sizeof(tests) / sizeof(tests[0])); i++){
+
+		fflush(stdout);
+		pid = fork();
+		if (pid == -1)
+			return (1);
+
+		//The driver and the server start from scratch in every test
+		if (pid == 0){
+			raid_network_port = TEST_PORT + i;
+			status = tests[i].run();
+			fflush(stdout);
+			_exit(status);
+		}
+
+		waitpid(pid, &status, 0);
+		if (!WIFEXITED(status) || WEXITSTATUS(status)){
+			printf("%-16s FAILED\n", tests[i].name);
+			failed = 1;
+		}
+		else
+			printf("%-16s passed\n", tests[i].name);
+	}
+
+	return (failed);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : test_rebuild
+// Description  : Fails every disk in turn and has the driver rebuild it, the
+//                last rebuilds copy blocks that were themselves rebuilt
+//
+// Inputs       : none
+// Outputs      : 0 if successful, 1 if failure
+
+int test_rebuild(void) {
+
+	uint8_t disk;
+
+	if (test_start(raid_network_port, 4) || test_fill())
+		return (1);
+
+	for (disk = 0; disk < 4; disk++){
+		if (raid_local_server_fail(disk, 0) || raid_disk_signal()){
+			printf("rebuild: disk %u was not rebuilt\n", disk);
+			return (1);
+		}
+		if (tagline_disk_health(disk) != TAGLINE_DISK_HEALTHY){
+			printf("rebuild: disk %u is not healthy after its rebuild\n", disk);
+			return (1);
+		}
+	}
+
+	if (test_check())
+		return (1);
+
+	test_stop();
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : test_monitor
+// Description  : Lets the health monitor find a failed disk on its own. The
+//                disk can not be formatted at first, so the monitor reports
+//                it failed; once it is replaced the monitor rebuilds it.
+//
+// Inputs       : none
+// Outputs      : 0 if successful, 1 if failure
+
+int test_monitor(void) {
+
+	if (tagline_set_monitor(50) || test_start(raid_network_port, 4) || test_fill())
+		return (1);
+
+	raid_local_server_fail(2, 1);
+	if (test_wait_health(2, TAGLINE_DISK_FAILED)){
+		printf("monitor: the failed disk was not found\n");
+		return (1);
+	}
+
+	raid_local_server_fail(2, 0);
+	if (test_wait_health(2, TAGLINE_DISK_HEALTHY)){
+		printf("monitor: the replaced disk was not rebuilt\n");
+		return (1);
+	}
+
+	if (test_check())
+		return (1);
+
+	test_stop();
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : test_hedge
+// Description  : Reads every block a few times while disk 0 stalls now and
+//                then, with hedging and without. The reads that stall are
+//                answered by the backup when hedging, the same reads must be
+//                clearly faster with it. The hedged pass goes first so any
+//                cache warmth helps the other one.
+//
+// Inputs       : none
+// Outputs      : 0 if successful, 1 if failure
+
+int test_hedge(void) {
+
+	uint64_t start, hedged, plain;
+	int pass;
+
+	//Every read before the stalls gives the latency history
+	if (test_start(raid_network_port, 4) || test_fill() || test_check())
+		return (1);
+
+	raid_local_server_stall(0, TEST_STALL_USEC, TEST_STALL_EVERY);
+
+	tagline_set_hedging(90);
+	start = test_now();
+	for (pass = 0; pass < TEST_HEDGE_PASSES; pass++)
+		if (test_check())
+			return (1);
+	hedged = test_now() - start;
+
+	tagline_set_hedging(0);
+	start = test_now();
+	for (pass = 0; pass < TEST_HEDGE_PASSES; pass++)
+		if (test_check())
+			return (1);
+	plain = test_now() - start;
+
+	if (hedged * 4 > plain * 3){
+		printf("hedge: %lu usec hedged, %lu usec not\n", (unsigned long)hedged, (unsigned long)plain);
+		return (1);
+	}
+
+	raid_local_server_stall(0, 0, 0);
+	test_stop();
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : test_degraded
+// Description  : Fails one disk of two for good, the rebuild fails and every
+//                block whose primary was on it has to be read from its backup
+//
+// Inputs       : none
+// Outputs      : 0 if successful, 1 if failure
+
+int test_degraded(void) {
+
+	if (test_start(raid_network_port, 2) || test_fill())
+		return (1);
+
+	raid_local_server_fail(1, 1);
+	raid_disk_signal();
+	if (tagline_disk_health(1) != TAGLINE_DISK_FAILED){
+		printf("degraded read: the disk that can not be formatted was rebuilt\n");
+		return (1);
+	}
+
+	if (test_check())
+		return (1);
+
+	test_stop();
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : test_rebuild_live
+// Description  : Has the health monitor rebuild a disk while taglines are
+//                read and written. The first two taglines have the lowest
+//                rebuild priority (and are out of the cache), so they are
+//                still lost when the first one is read (and repaired) while
+//                the second one is written (and must not be overwritten by
+//                the copy). The other disks are
+//                then failed for good in turn, so their blocks can only come
+//                from the rebuilt one.
+//
+// Inputs       : none
+// Outputs      : 0 if successful, 1 if failure
+
+int test_rebuild_live(void) {
+
+	TagLineNumber tag;
+	TagLineBlockNumber bnum;
+	uint8_t disk;
+
+	if (tagline_set_monitor(50) || test_start(raid_network_port, 4) || test_fill())
+		return (1);
+	for (tag = 2; tag < TEST_TAGLINES; tag++)
+		tagline_set_rebuild_priority(tag, 1);
+
+	//Slow enough for the rebuild to still be copying
+	for (disk = 0; disk < 4; disk++)
+		raid_local_server_stall(disk, TEST_REBUILD_STALL, 1);
+
+	raid_local_server_fail(1, 0);
+	if (test_wait_health(1, TAGLINE_DISK_REBUILDING)){
+		printf("rebuild in use: the failed disk was not found\n");
+		return (1);
+	}
+
+	testGeneration[1] = 0x5a;
+	for (bnum = 0; bnum < TEST_BLOCKS; bnum += TEST_IO_BLOCKS)
+		if (test_check_blocks(0, bnum, TEST_IO_BLOCKS) || test_fill_blocks(1, bnum, TEST_IO_BLOCKS))
+			return (1);
+
+	if (test_wait_health(1, TAGLINE_DISK_HEALTHY)){
+		printf("rebuild in use: disk 1 was not rebuilt\n");
+		return (1);
+	}
+	for (disk = 0; disk < 4; disk++)
+		raid_local_server_stall(disk, 0, 0);
+	if (test_check())
+		return (1);
+
+	for (disk = 0; disk < 4; disk++){
+		if (disk == 1)
+			continue;
+
+		raid_local_server_fail(disk, 1);
+		if (test_wait_health(disk, TAGLINE_DISK_FAILED) || test_check()){
+			printf("rebuild in use: blocks of disk 1 are wrong with disk %u failed\n", disk);
+			return (1);
+		}
+
+		raid_local_server_fail(disk, 0);
+		if (test_wait_health(disk, TAGLINE_DISK_HEALTHY)){
+			printf("rebuild in use: disk %u was not rebuilt\n", disk);
+			return (1);
+		}
+	}
+
+	test_stop();
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : test_read_ref
+// Description  : Holds a reference to a cached block while the block is
+//                written again and more blocks than the cache holds are read.
+//                The reference keeps the old data, reads get the new one, and
+//                it can only be given back once.
+//
+// Inputs       : none
+// Outputs      : 0 if successful, 1 if failure
+
+int test_read_ref(void) {
+
+	char block[TAGLINE_BLOCK_SIZE];
+	const char *ref;
+
+	if (test_start(raid_network_port, 4) || test_fill())
+		return (1);
+
+	test_pattern(0, 0, block);
+	if (tagline_read_ref(0, 0, &ref) || memcmp(ref, block, TAGLINE_BLOCK_SIZE)){
+		printf("read reference: block 0 was not referenced\n");
+		return (1);
+	}
+
+	testGeneration[0] = 0x5a;
+	if (test_fill_blocks(0, 0, TEST_BLOCKS) || test_check())
+		return (1);
+
+	if (memcmp(ref, block, TAGLINE_BLOCK_SIZE)){
+		printf("read reference: the referenced block changed\n");
+		return (1);
+	}
+
+	if (tagline_read_release(ref) || !tagline_read_release(ref)){
+		printf("read reference: the reference was not given back once\n");
+		return (1);
+	}
+
+	test_stop();
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : test_large
+// Description  : Writes whole taglines with one call each, longer than the
+//                largest RAID_WRITE: one appended as a single extent, one
+//                striped one block per unit and one with a relaxed backup.
+//                They are read back with one call, and a write past the end
+//                of a tagline is refused.
+//
+// Inputs       : none
+// Outputs      : 0 if successful, 1 if failure
+
+int test_large(void) {
+
+	char *buf, block[TAGLINE_BLOCK_SIZE];
+	TagLineNumber tag;
+	TagLineBlockNumber bnum;
+
+	buf = (char *) malloc(TEST_BLOCKS * TAGLINE_BLOCK_SIZE);
+	if (buf == NULL || test_start(raid_network_port, 4))
+		return (1);
+
+	tagline_set_durability(2, TAGLINE_DURABLE_ONE);
+	for (tag = 0; tag < 3; tag++){
+		tagline_set_stripe_unit(tag == 1);
+		for (bnum = 0; bnum < TEST_BLOCKS; bnum++)
+			test_pattern(tag, bnum, &buf[bnum * TAGLINE_BLOCK_SIZE]);
+
+		if (tagline_write_large(tag, 0, TEST_BLOCKS, buf)){
+			printf("large I/O: tagline %u was not written\n", tag);
+			return (1);
+		}
+	}
+	tagline_set_stripe_unit(0);
+
+	for (tag = 0; tag < 3; tag++){
+		memset(buf, 0, TEST_BLOCKS * TAGLINE_BLOCK_SIZE);
+		if (tagline_read_large(tag, 0, TEST_BLOCKS, buf))
+			return (1);
+
+		for (bnum = 0; bnum < TEST_BLOCKS; bnum++){
+			test_pattern(tag, bnum, block);
+			if (memcmp(&buf[bnum * TAGLINE_BLOCK_SIZE], block, TAGLINE_BLOCK_SIZE)){
+				printf("large I/O: tagline %u block %u read back wrong\n", tag, bnum);
+				return (1);
+			}
+		}
+	}
+
+	if (!tagline_write_large(3, 1, TEST_BLOCKS, buf)){
+		printf("large I/O: a write past the end of a tagline was taken\n");
+		return (1);
+	}
+
+	free(buf);
+	test_stop();
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : test_paged_map
+// Description  : Keeps the table of the placement in a file with room in
+//                memory for fewer pages than the taglines fill, so every
+//                pass over them pages the table out and back in. The
+//                taglines are written, read back across a rebuild of every
+//                disk, and the table has to have reached the file.
+//
+// Inputs       : none
+// Outputs      : 0 if successful, 1 if failure
+
+int test_paged_map(void) {
+
+	char path[64];
+	struct stat info;
+	TagLineBlockNumber bnum;
+	TagLineNumber tag;
+	uint8_t disk;
+
+	snprintf(path, sizeof(path), "/tmp/tagline_test.%d.meta", (int)getpid());
+	if (tagline_set_metadata(path, TEST_META_PAGES) || test_start(raid_network_port, 4) || test_fill())
+		return (1);
+
+	//Tagline by tagline, every read of the other half of the table misses
+	for (bnum = 0; bnum < TEST_BLOCKS; bnum += TEST_IO_BLOCKS){
+		for (tag = 0; tag < TEST_TAGLINES; tag++){
+			if (test_check_blocks(tag, bnum, TEST_IO_BLOCKS))
+				return (1);
+		}
+	}
+
+	for (disk = 0; disk < 4; disk++){
+		if (raid_local_server_fail(disk, 0) || raid_disk_signal()){
+			printf("paged map: disk %u was not rebuilt\n", disk);
+			return (1);
+		}
+	}
+
+	if (test_check())
+		return (1);
+
+	test_stop();
+	if (stat(path, &info) || info.st_size == 0){
+		printf("paged map: the table never went to the file\n");
+		return (1);
+	}
+
+	unlink(path);
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : test_packing
+// Description  : Packs the extremes of a location, then fills the taglines
+//                and has every place of the map unpack to a block of the
+//                array, before and after a rebuild
+//
+// Inputs       : none
+// Outputs      : 0 if successful, 1 if failure
+
+int test_packing(void) {
+
+	uint32_t loc;
+
+	loc = MAKE_LOC(RAID_DISKS - 1, RAID_DISKBLOCKS - 1);
+	if (sizeof(struct tagline) != 8 || loc == TAGLINE_NO_LOC || LOC_DISK(loc) != RAID_DISKS - 1
+			|| LOC_POSITION(loc) != RAID_DISKBLOCKS - 1 || LOC_DISK(MAKE_LOC(0, 0)) != 0
+			|| LOC_DISK(TAGLINE_NO_LOC) != -1 || LOC_POSITION(TAGLINE_NO_LOC) != -1){
+		printf("location packing: a location does not unpack to its disk and block\n");
+		return (1);
+	}
+
+	if (test_start(raid_network_port, 4) || test_fill() || test_places("location packing", 4))
+		return (1);
+
+	if (raid_local_server_fail(1, 0) || raid_disk_signal() || test_places("location packing", 4) || test_check())
+		return (1);
+
+	test_stop();
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : test_computed
+// Description  : Places the taglines by the hash: the appended blocks are
+//                where it says, no two of them collide, and the blocks a
+//                rebuild moves are remembered and still read back
+//
+// Inputs       : none
+// Outputs      : 0 if successful, 1 if failure
+
+int test_computed(void) {
+
+	struct tagline loc, hashed;
+	TagLineNumber tag;
+	TagLineBlockNumber bnum;
+
+	//The hash spreads over every disk of the bus
+	if (tagline_set_placement(TAGLINE_PLACEMENT_COMPUTED) || test_start(raid_network_port, RAID_DISKS)
+			|| test_fill() || test_places("computed placement", RAID_DISKS))
+		return (1);
+
+	for (tag = 0; tag < TEST_TAGLINES; tag++){
+		for (bnum = 0; bnum < TEST_BLOCKS; bnum++){
+			loc = tagline_locate(tag, bnum);
+			hashed = computed_location(tag, bnum);
+			if (loc.primary != hashed.primary || loc.backup != hashed.backup){
+				printf("computed placement: tagline %u block %u is not where the hash puts it\n", tag, bnum);
+				return (1);
+			}
+		}
+	}
+
+	if (raid_local_server_fail(2, 0) || raid_disk_signal() || test_places("computed placement", RAID_DISKS)
+			|| test_check())
+		return (1);
+
+	test_stop();
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : test_pool
+// Description  : Has threads take and give back buffers of both sizes at
+//                once, more than they cache, so the shared free lists are
+//                pushed and popped concurrently (ABA). No buffer may be
+//                handed to two holders. Closing the pool with a buffer out
+//                is refused and frees nothing.
+//
+// Inputs       : none
+// Outputs      : 0 if successful, 1 if failure
+
+int test_pool(void) {
+
+	pthread_t threads[TEST_POOL_THREADS];
+	long i, failed = 0;
+	void *status;
+	char *buf;
+
+	for (i = 0; i < TEST_POOL_THREADS; i++)
+		if (pthread_create(&threads[i], NULL, test_pool_thread, (void *)i))
+			return (1);
+
+	for (i = 0; i < TEST_POOL_THREADS; i++){
+		pthread_join(threads[i], &status);
+		failed |= (long)status;
+	}
+	if (failed){
+		printf("buffer pool: a buffer was handed out twice\n");
+		return (1);
+	}
+
+	buf = (char *) raid_pool_get(1);
+	if (buf == NULL)
+		return (1);
+	memset(buf, 0x5a, RAID_BLOCK_SIZE);
+
+	if (raid_pool_close() != -1 || buf[RAID_BLOCK_SIZE - 1] != 0x5a){
+		printf("buffer pool: the pool was closed with a buffer out\n");
+		return (1);
+	}
+
+	raid_pool_put(buf);
+	if (raid_pool_close()){
+		printf("buffer pool: the pool was not closed with every buffer back\n");
+		return (1);
+	}
+
+	//A closed pool starts again on the next get
+	buf = (char *) raid_pool_get(RAID_POOL_MULTI_BLOCKS);
+	if (buf == NULL)
+		return (1);
+	raid_pool_put(buf);
+
+	return (raid_pool_close() != 0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : test_relaxed
+// Description  : Writes relaxed taglines to slow disks, so the backup copies
+//                are still queued when a disk fails: the rebuild and then
+//                the degraded reads of a disk that stays failed have to see
+//                the last write of every block
+//
+// Inputs       : none
+// Outputs      : 0 if successful, 1 if failure
+
+int test_relaxed(void) {
+
+	TagLineNumber tag;
+	uint8_t disk;
+
+	if (test_start(raid_network_port, 4))
+		return (1);
+
+	for (tag = 0; tag < TEST_TAGLINES; tag++)
+		if (tagline_set_durability(tag, TAGLINE_DURABLE_ONE))
+			return (1);
+
+	for (disk = 0; disk < 4; disk++)
+		raid_local_server_stall(disk, TEST_RELAXED_STALL, 1);
+
+	//The rewrite replaces blocks whose first backup may not be written yet
+	if (test_fill())
+		return (1);
+	for (tag = 0; tag < TEST_TAGLINES; tag++){
+		testGeneration[tag] = 0x5a;
+		if (test_fill_blocks(tag, 0, TEST_BLOCKS))
+			return (1);
+	}
+
+	if (raid_local_server_fail(0, 0) || raid_disk_signal() || test_check())
+		return (1);
+
+	for (tag = 0; tag < TEST_TAGLINES; tag++){
+		testGeneration[tag] = 0xa5;
+		if (test_fill_blocks(tag, 0, TEST_BLOCKS))
+			return (1);
+	}
+
+	raid_local_server_fail(3, 1);
+	raid_disk_signal();
+	if (tagline_disk_health(3) != TAGLINE_DISK_FAILED){
+		printf("relaxed durability: disk 3 was rebuilt after failing for good\n");
+		return (1);
+	}
+
+	if (test_check())
+		return (1);
+
+	test_stop();
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : test_striped
+// Description  : Appends the taglines in stripe units: unit s of tagline t
+//                is contiguous on disk (t+s) % 4 with its mirror on the next
+//                disk. Once a disk fails for good the rest of the taglines
+//                is striped over the other disks, and everything reads back.
+//
+// Inputs       : none
+// Outputs      : 0 if successful, 1 if failure
+
+int test_striped(void) {
+
+	struct tagline loc, last = { TAGLINE_NO_LOC, TAGLINE_NO_LOC };
+	TagLineNumber tag;
+	TagLineBlockNumber bnum;
+	int disk;
+
+	if (tagline_set_stripe_unit(TEST_STRIPE_UNIT) || test_start(raid_network_port, 4))
+		return (1);
+
+	for (tag = 0; tag < TEST_TAGLINES; tag++)
+		if (test_fill_blocks(tag, 0, TEST_BLOCKS / 2))
+			return (1);
+
+	for (tag = 0; tag < TEST_TAGLINES; tag++){
+		for (bnum = 0; bnum < TEST_BLOCKS / 2; bnum++){
+			loc = tagline_locate(tag, bnum);
+			disk = (tag + bnum / TEST_STRIPE_UNIT) % 4;
+			if (LOC_DISK(loc.primary) != disk || LOC_DISK(loc.backup) != (disk + 1) % 4
+					|| (bnum % TEST_STRIPE_UNIT && (loc.primary != last.primary + 1 || loc.backup != last.backup + 1))){
+				printf("striped: tagline %u block %u is out of its stripe unit\n", tag, bnum);
+				return (1);
+			}
+			last = loc;
+		}
+	}
+
+	raid_local_server_fail(2, 1);
+	raid_disk_signal();
+	for (tag = 0; tag < TEST_TAGLINES; tag++)
+		if (test_fill_blocks(tag, TEST_BLOCKS / 2, TEST_BLOCKS / 2))
+			return (1);
+
+	for (tag = 0; tag < TEST_TAGLINES; tag++){
+		for (bnum = TEST_BLOCKS / 2; bnum < TEST_BLOCKS; bnum++){
+			loc = tagline_locate(tag, bnum);
+			if (LOC_DISK(loc.primary) == 2 || LOC_DISK(loc.backup) == 2){
+				printf("striped: tagline %u block %u was put on the failed disk\n", tag, bnum);
+				return (1);
+			}
+		}
+	}
+
+	if (test_check())
+		return (1);
+
+	test_stop();
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : test_copy_offload
+// Description  : Rebuilds every disk in turn with the copies made by the
+//                server (RAID_COPY), which the local server has
+//
+// Inputs       : none
+// Outputs      : 0 if successful, 1 if failure
+
+int test_copy_offload(void) {
+
+	uint8_t disk;
+
+	if (tagline_set_copy_offload(1) || test_start(raid_network_port, 4) || test_fill())
+		return (1);
+
+	for (disk = 0; disk < 4; disk++){
+		if (raid_local_server_fail(disk, 0) || raid_disk_signal()
+				|| tagline_disk_health(disk) != TAGLINE_DISK_HEALTHY){
+			printf("copy offload: disk %u was not rebuilt\n", disk);
+			return (1);
+		}
+	}
+
+	if (!offload_ready(&copyOffload, RAID_COPY)){
+		printf("copy offload: the server copies were not used\n");
+		return (1);
+	}
+
+	if (test_check())
+		return (1);
+
+	test_stop();
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : test_mirror_offload
+// Description  : Writes and rewrites the taglines with both copies in one
+//                frame (RAID_MIRROR_WRITE), then fails a disk for good: the
+//                backups the server wrote have to hold every last write
+//
+// Inputs       : none
+// Outputs      : 0 if successful, 1 if failure
+
+int test_mirror_offload(void) {
+
+	TagLineNumber tag;
+
+	if (tagline_set_mirror_offload(1) || test_start(raid_network_port, 4) || test_fill())
+		return (1);
+
+	for (tag = 0; tag < TEST_TAGLINES; tag += 2){
+		testGeneration[tag] = 0x5a;
+		if (test_fill_blocks(tag, 0, TEST_BLOCKS))
+			return (1);
+	}
+
+	if (!offload_ready(&mirrorOffload, RAID_MIRROR_WRITE)){
+		printf("mirror offload: the mirrored writes were not used\n");
+		return (1);
+	}
+
+	raid_local_server_fail(0, 1);
+	raid_disk_signal();
+	if (tagline_disk_health(0) != TAGLINE_DISK_FAILED || test_check())
+		return (1);
+
+	test_stop();
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : test_defrag
+// Description  : Fills the taglines a few blocks at a time on random disk
+//                pairs, then steps the defragmenter until it has nothing left
+//                to move: every extent is contiguous on both copies and the
+//                blocks read back, also after a rebuild
+//
+// Inputs       : none
+// Outputs      : 0 if successful, 1 if failure
+
+int test_defrag(void) {
+
+	int moved, steps = 0;
+
+	if (test_start(raid_network_port, 4) || test_fill())
+		return (1);
+
+	if (test_fragments() == 0){
+		printf("defrag: the taglines were written contiguous\n");
+		return (1);
+	}
+
+	do {
+		moved = tagline_defrag_step(TEST_BLOCKS);
+		if (moved < 0)
+			return (1);
+	} while (moved > 0 && ++steps < TEST_TAGLINES * TEST_BLOCKS);
+
+	if (test_fragments()){
+		printf("defrag: %d extents are still fragmented\n", test_fragments());
+		return (1);
+	}
+
+	if (test_places("defrag", 4) || test_check())
+		return (1);
+
+	if (raid_local_server_fail(3, 0) || raid_disk_signal() || test_check())
+		return (1);
+
+	test_stop();
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : test_overwrite
+// Description  : Rewrites the taglines with long writes that start in the
+//                middle of a run and cross the runs of several disk pairs.
+//                Every block stays in its places and the new contents read
+//                back from the primaries and, with a disk failed, from the
+//                backups.
+//
+// Inputs       : none
+// Outputs      : 0 if successful, 1 if failure
+
+int test_overwrite(void) {
+
+	char buf[TEST_OVERWRITE_BLOCKS * TAGLINE_BLOCK_SIZE];
+	struct tagline before[TEST_BLOCKS], loc;
+	TagLineNumber tag;
+	TagLineBlockNumber bnum, first;
+	int i;
+
+	if (test_start(raid_network_port, 2) || test_fill())
+		return (1);
+
+	for (tag = 0; tag < TEST_TAGLINES; tag++){
+
+		for (bnum = 0; bnum < TEST_BLOCKS; bnum++)
+			before[bnum] = tagline_locate(tag, bnum);
+
+		testGeneration[tag] = 0x5a;
+		for (first = 0; first < TEST_BLOCKS; first += i){
+			i = TEST_BLOCKS - first;
+			if (first == 0)
+				i = TEST_IO_BLOCKS / 2;
+			else if (i > TEST_OVERWRITE_BLOCKS)
+				i = TEST_OVERWRITE_BLOCKS;
+
+			for (bnum = 0; bnum < i; bnum++)
+				test_pattern(tag, first + bnum, &buf[bnum * TAGLINE_BLOCK_SIZE]);
+			if (tagline_write(tag, first, i, buf))
+				return (1);
+		}
+
+		for (bnum = 0; bnum < TEST_BLOCKS; bnum++){
+			loc = tagline_locate(tag, bnum);
+			if (loc.primary != before[bnum].primary || loc.backup != before[bnum].backup){
+				printf("overwrite: tagline %u block %u moved\n", tag, bnum);
+				return (1);
+			}
+		}
+	}
+
+	//The reads go to the primaries, then with disk 1 gone to the backups on disk 0
+	if (test_check())
+		return (1);
+
+	raid_local_server_fail(1, 1);
+	raid_disk_signal();
+	if (test_check())
+		return (1);
+
+	test_stop();
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : test_reserve
+// Description  : Reserves room for whole taglines and appends to all of them
+//                in turns, a few blocks each: every tagline still ends up in
+//                one extent per copy. More than a tagline holds can not be
+//                reserved.
+//
+// Inputs       : none
+// Outputs      : 0 if successful, 1 if failure
+
+int test_reserve(void) {
+
+	struct tagline first, loc;
+	TagLineNumber tag;
+	TagLineBlockNumber bnum;
+
+	if (test_start(raid_network_port, 4))
+		return (1);
+
+	for (tag = 0; tag < TEST_TAGLINES; tag++)
+		if (tagline_reserve(tag, TEST_BLOCKS))
+			return (1);
+
+	for (bnum = 0; bnum < TEST_BLOCKS; bnum += TEST_IO_BLOCKS)
+		for (tag = 0; tag < TEST_TAGLINES; tag++)
+			if (test_fill_blocks(tag, bnum, TEST_IO_BLOCKS))
+				return (1);
+
+	for (tag = 0; tag < TEST_TAGLINES; tag++){
+		first = tagline_locate(tag, 0);
+		for (bnum = 1; bnum < TEST_BLOCKS; bnum++){
+			loc = tagline_locate(tag, bnum);
+			if (loc.primary != first.primary + bnum || loc.backup != first.backup + bnum){
+				printf("reserve: tagline %u is not contiguous at block %u\n", tag, bnum);
+				return (1);
+			}
+		}
+	}
+
+	if (!tagline_reserve(0, 1)){
+		printf("reserve: a full tagline took a reservation\n");
+		return (1);
+	}
+
+	if (test_places("reserve", 4) || test_check())
+		return (1);
+
+	test_stop();
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : test_epochs
+// Description  : Moves blocks of computed placement back and forth between
+//                their hashed places and exception entries while threads
+//                look them up without a lock. Blocks that share a bucket of
+//                the exception table are picked so the chains are replaced
+//                under the readers; every lookup has to give one of the two
+//                places. An entry freed while a reader still looks at it is
+//                found for sure when built with -fsanitize=address.
+//
+// Inputs       : none
+// Outputs      : 0 if successful, 1 if failure
+
+int test_epochs(void) {
+
+	pthread_t threads[TEST_EPOCH_READERS];
+	struct tagline loc;
+	TagLineNumber tag;
+	TagLineBlockNumber bnum;
+	long i, failed = 0;
+	void *status;
+	int round;
+
+	if (tagline_set_placement(TAGLINE_PLACEMENT_COMPUTED) || test_start(raid_network_port, RAID_DISKS))
+		return (1);
+
+	for (tag = 0; tag < TEST_TAGLINES; tag++)
+		if (test_fill_blocks(tag, 0, TEST_EPOCH_BLOCKS))
+			return (1);
+
+	for (i = 0; i < TEST_EPOCH_READERS; i++)
+		if (pthread_create(&threads[i], NULL, test_epoch_thread, NULL))
+			return (1);
+
+	for (round = 0; round < TEST_EPOCH_ROUNDS && !failed; round++){
+		tag = round % TEST_TAGLINES;
+		bnum = (round / TEST_TAGLINES) % TEST_EPOCH_BLOCKS;
+		loc = (round / (TEST_TAGLINES * TEST_EPOCH_BLOCKS)) % 2 ? test_moved(tag, bnum) : computed_location(tag, bnum);
+		failed = map_update(tag, bnum, loc);
+	}
+
+	atomic_store(&testStop, 1);
+	for (i = 0; i < TEST_EPOCH_READERS; i++){
+		pthread_join(threads[i], &status);
+		failed |= (long)status;
+	}
+
+	if (failed){
+		printf("epochs: a lookup gave a place the block never had\n");
+		return (1);
+	}
+
+	test_stop();
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : test_daemon
+// Description  : Serves the driver to a process per tagline, each writing
+//                and reading back its tagline through the daemon at the same
+//                time as the others. The daemon then holds every block.
+//
+// Inputs       : none
+// Outputs      : 0 if successful, 1 if failure
+
+int test_daemon(void) {
+
+	char path[64];
+	pid_t pids[TEST_TAGLINES];
+	TagLineNumber tag;
+	int status, failed = 0;
+
+	snprintf(path, sizeof(path), "/tmp/tagline_test.%d.sock", (int)getpid());
+	if (raid_local_server_start(raid_network_port) || tagline_set_disks(4)
+			|| tagline_daemon_start(path, TEST_TAGLINES))
+		return (1);
+
+	for (tag = 0; tag < TEST_TAGLINES; tag++){
+		pids[tag] = fork();
+		if (pids[tag] == -1)
+			return (1);
+		if (pids[tag] == 0)
+			_exit(test_daemon_client(path, tag));
+	}
+
+	for (tag = 0; tag < TEST_TAGLINES; tag++){
+		waitpid(pids[tag], &status, 0);
+		if (!WIFEXITED(status) || WEXITSTATUS(status)){
+			printf("daemon: the client of tagline %u failed\n", tag);
+			failed = 1;
+		}
+	}
+
+	if (failed || test_check())
+		return (1);
+
+	if (tagline_daemon_stop() || raid_local_server_stop())
+		return (1);
+
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : test_ring
+// Description  : Writes half of the taglines through a ring entered by the
+//                test and the other half through a ring poller, then reads
+//                all of them back through the poller. The entries of a
+//                tagline continue each other and are merged; an entry of a
+//                tagline that does not exist fails on its own.
+//
+// Inputs       : none
+// Outputs      : 0 if successful, 1 if failure
+
+int test_ring(void) {
+
+	struct tagline_ring *ring;
+	struct tagline_sqe *sqe;
+	struct tagline_cqe *cqe;
+	char *buf, block[TAGLINE_BLOCK_SIZE];
+	TagLineNumber tag;
+	TagLineBlockNumber bnum;
+
+	buf = (char *) malloc((size_t)TEST_TAGLINES * TEST_BLOCKS * TAGLINE_BLOCK_SIZE);
+	ring = tagline_ring_create(TEST_RING_ENTRIES);
+	if (buf == NULL || ring == NULL || test_start(raid_network_port, 4))
+		return (1);
+
+	for (tag = 0; tag < TEST_TAGLINES; tag++)
+		for (bnum = 0; bnum < TEST_BLOCKS; bnum++)
+			test_pattern(tag, bnum, &buf[((size_t)tag * TEST_BLOCKS + bnum) * TAGLINE_BLOCK_SIZE]);
+
+	if (test_ring_run(ring, TAGLINE_RING_WRITE, 0, TEST_TAGLINES / 2, buf, 0))
+		return (1);
+
+	if (tagline_ring_poll_start(ring)
+			|| test_ring_run(ring, TAGLINE_RING_WRITE, TEST_TAGLINES / 2, TEST_TAGLINES, buf, 1))
+		return (1);
+
+	memset(buf, 0, (size_t)TEST_TAGLINES * TEST_BLOCKS * TAGLINE_BLOCK_SIZE);
+	if (test_ring_run(ring, TAGLINE_RING_READ, 0, TEST_TAGLINES, buf, 1))
+		return (1);
+
+	for (tag = 0; tag < TEST_TAGLINES; tag++){
+		for (bnum = 0; bnum < TEST_BLOCKS; bnum++){
+			test_pattern(tag, bnum, block);
+			if (memcmp(&buf[((size_t)tag * TEST_BLOCKS + bnum) * TAGLINE_BLOCK_SIZE], block, TAGLINE_BLOCK_SIZE)){
+				printf("ring: tagline %u block %u read back wrong\n", tag, bnum);
+				return (1);
+			}
+		}
+	}
+
+	//Alone in its batch, the poller has nothing to merge it with
+	sqe = tagline_ring_get_sqe(ring, 0);
+	sqe->opcode = TAGLINE_RING_READ;
+	sqe->tag = TEST_TAGLINES;
+	sqe->bnum = 0;
+	sqe->blocks = 1;
+	sqe->buf = block;
+	sqe->user_data = TEST_TAGLINES;
+	tagline_ring_submit(ring, 1);
+	while ((cqe = tagline_ring_peek_cqe(ring)) == NULL)
+		sched_yield();
+	if (cqe->user_data != TEST_TAGLINES || cqe->result == 0){
+		printf("ring: a read of a tagline that does not exist succeeded\n");
+		return (1);
+	}
+	tagline_ring_cqe_seen(ring);
+
+	tagline_ring_destroy(ring);
+	free(buf);
+	if (test_check())
+		return (1);
+
+	test_stop();
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : test_workers
+// Description  : Runs the pipelined I/O on the disk workers: whole striped
+//                taglines are written and read with one call while one disk
+//                answers late, so the workers of the other disks finish
+//                first, and read again after a disk is rebuilt under them
+//
+// Inputs       : none
+// Outputs      : 0 if successful, 1 if failure
+
+int test_workers(void) {
+
+	char *buf, block[TAGLINE_BLOCK_SIZE];
+	TagLineNumber tag;
+	TagLineBlockNumber bnum;
+	int pass;
+
+	buf = (char *) malloc(TEST_BLOCKS * TAGLINE_BLOCK_SIZE);
+	if (buf == NULL || tagline_set_workers(1) || test_start(raid_network_port, 4))
+		return (1);
+
+	//Striped, every call keeps all the disks busy
+	tagline_set_stripe_unit(TEST_STRIPE_UNIT);
+	raid_local_server_stall(1, TEST_WORKERS_STALL, 4);
+	for (tag = 0; tag < TEST_TAGLINES; tag++){
+		for (bnum = 0; bnum < TEST_BLOCKS; bnum++)
+			test_pattern(tag, bnum, &buf[bnum * TAGLINE_BLOCK_SIZE]);
+		if (tagline_write_large(tag, 0, TEST_BLOCKS, buf))
+			return (1);
+	}
+
+	for (pass = 0; pass < 2; pass++){
+		if (pass == 1 && (raid_local_server_fail(2, 0) || raid_disk_signal()))
+			return (1);
+
+		for (tag = 0; tag < TEST_TAGLINES; tag++){
+			if (tagline_read_large(tag, 0, TEST_BLOCKS, buf))
+				return (1);
+			for (bnum = 0; bnum < TEST_BLOCKS; bnum++){
+				test_pattern(tag, bnum, block);
+				if (memcmp(&buf[bnum * TAGLINE_BLOCK_SIZE], block, TAGLINE_BLOCK_SIZE)){
+					printf("workers: tagline %u block %u read back wrong\n", tag, bnum);
+					return (1);
+				}
+			}
+		}
+	}
+
+	free(buf);
+	test_stop();
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : test_stealing
+// Description  : Rebuilds a disk while one of the disks it copies from
+//                answers late: the rebuild threads with chunks on the fast
+//                disks run out of work and take chunks of the slow one
+//
+// Inputs       : none
+// Outputs      : 0 if successful, 1 if failure
+
+int test_stealing(void) {
+
+	if (test_start(raid_network_port, 4) || test_fill())
+		return (1);
+
+	raid_local_server_stall(1, TEST_STEAL_STALL, 1);
+	if (raid_local_server_fail(0, 0) || raid_disk_signal() || tagline_disk_health(0) != TAGLINE_DISK_HEALTHY){
+		printf("stealing: disk 0 was not rebuilt\n");
+		return (1);
+	}
+
+	if (atomic_load(&rebuildStolen) == 0){
+		printf("stealing: no rebuild thread took work from another\n");
+		return (1);
+	}
+
+	raid_local_server_stall(1, 0, 1);
+	if (test_check())
+		return (1);
+
+	test_stop();
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : test_grow
+// Description  : Fills an array of two disks, grows it to four and steps the
+//                rebalancing until it is done: the new disks hold a fair
+//                share of the copies, the two copies of a block are still on
+//                different disks, and everything reads back, also after one
+//                of the new disks is rebuilt
+//
+// Inputs       : none
+// Outputs      : 0 if successful, 1 if failure
+
+int test_grow(void) {
+
+	uint32_t copies[4] = { 0, 0, 0, 0 };
+	struct tagline loc;
+	TagLineNumber tag;
+	TagLineBlockNumber bnum;
+	int moved, steps = 0, disk;
+
+	if (test_start(raid_network_port, 2) || test_fill() || tagline_add_disks(2, 0))
+		return (1);
+
+	do {
+		moved = tagline_rebalance_step(TEST_BLOCKS);
+		if (moved < 0)
+			return (1);
+	} while (moved > 0 && ++steps < TEST_TAGLINES * TEST_BLOCKS);
+
+	if (test_places("grow", 4))
+		return (1);
+
+	for (tag = 0; tag < TEST_TAGLINES; tag++){
+		for (bnum = 0; bnum < TEST_BLOCKS; bnum++){
+			loc = tagline_locate(tag, bnum);
+			copies[LOC_DISK(loc.primary)]++;
+			copies[LOC_DISK(loc.backup)]++;
+		}
+	}
+
+	//Every disk holds at least half of its share
+	for (disk = 0; disk < 4; disk++){
+		if (copies[disk] < TEST_TAGLINES * TEST_BLOCKS / 4){
+			printf("grow: disk %d holds %u copies after the rebalancing\n", disk, copies[disk]);
+			return (1);
+		}
+	}
+
+	if (test_check() || raid_local_server_fail(3, 0) || raid_disk_signal() || test_check())
+		return (1);
+
+	test_stop();
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : test_digests
+// Description  : Keeps the digests of both copies: full taglines agree. With
+//                a disk failed under the driver, blocks of a relaxed tagline
+//                with their backup on it are written again, and exactly
+//                those are found to differ; the copies can not be resynced
+//                while the disk is missing. The rebuild makes them agree.
+//
+// Inputs       : none
+// Outputs      : 0 if successful, 1 if failure
+
+int test_digests(void) {
+
+	char block[TAGLINE_BLOCK_SIZE];
+	struct tagline loc;
+	TagLineNumber tag;
+	TagLineBlockNumber bnum;
+	int disk, rewritten = 0;
+
+	if (tagline_set_digests(1) || test_start(raid_network_port, 4) || test_fill())
+		return (1);
+
+	for (tag = 0; tag < TEST_TAGLINES; tag++){
+		if (tagline_mirror_verify(tag) != 0 || tagline_mirror_resync(tag) != 0){
+			printf("digests: the copies of tagline %u differ after they were written\n", tag);
+			return (1);
+		}
+	}
+
+	tagline_set_durability(0, TAGLINE_DURABLE_ONE);
+	disk = LOC_DISK(tagline_locate(0, 0).backup);
+	raid_local_server_fail(disk, 0);
+	for (bnum = 0; bnum < TEST_BLOCKS; bnum++){
+		loc = tagline_locate(0, bnum);
+		if (LOC_DISK(loc.backup) != disk || LOC_DISK(loc.primary) == disk)
+			continue;
+
+		test_pattern(0, bnum, block);
+		if (tagline_write(0, bnum, 1, block))
+			return (1);
+		rewritten++;
+	}
+
+	if (tagline_mirror_verify(0) != rewritten || tagline_mirror_resync(0) != -1){
+		printf("digests: %d blocks differ, %d backups missed their write\n", tagline_mirror_verify(0), rewritten);
+		return (1);
+	}
+
+	if (raid_disk_signal() || tagline_mirror_verify(0) != 0){
+		printf("digests: the copies still differ after the rebuild\n");
+		return (1);
+	}
+
+	if (test_check())
+		return (1);
+
+	test_stop();
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : test_stream
+// Description  : Exports a tagline to a file and imports it over another
+//                full one, then imports a shorter file: the tagline is cut
+//                to the blocks imported, the rest can not be read, and it
+//                grows again from there
+//
+// Inputs       : none
+// Outputs      : 0 if successful, 1 if failure
+
+int test_stream(void) {
+
+	char path[64], buf[TAGLINE_BLOCK_SIZE], block[TAGLINE_BLOCK_SIZE];
+	TagLineBlockNumber bnum;
+	int fd;
+
+	snprintf(path, sizeof(path), "/tmp/tagline_test.%d.export", (int)getpid());
+	fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+	if (fd == -1 || test_start(raid_network_port, 4) || test_fill())
+		return (1);
+
+	if (tagline_export(0, fd) != TEST_BLOCKS || lseek(fd, 0, SEEK_SET) != 0
+			|| tagline_import(fd, 1) != TEST_BLOCKS){
+		printf("stream: tagline 0 was not copied whole to tagline 1\n");
+		return (1);
+	}
+
+	if (ftruncate(fd, TEST_STREAM_BLOCKS * TAGLINE_BLOCK_SIZE) || lseek(fd, 0, SEEK_SET) != 0
+			|| tagline_import(fd, 2) != TEST_STREAM_BLOCKS){
+		printf("stream: the short file was not imported\n");
+		return (1);
+	}
+	close(fd);
+	unlink(path);
+
+	for (bnum = 0; bnum < TEST_BLOCKS; bnum++){
+		test_pattern(0, bnum, block);
+		if (tagline_read(1, bnum, 1, buf) || memcmp(buf, block, TAGLINE_BLOCK_SIZE)
+				|| (bnum < TEST_STREAM_BLOCKS && (tagline_read(2, bnum, 1, buf) || memcmp(buf, block, TAGLINE_BLOCK_SIZE)))){
+			printf("stream: block %u was not imported\n", bnum);
+			return (1);
+		}
+	}
+
+	if (!tagline_read(2, TEST_STREAM_BLOCKS, 1, buf)){
+		printf("stream: a block past the imported ones can still be read\n");
+		return (1);
+	}
+
+	//Tagline 2 is cut where the next append goes
+	if (test_fill_blocks(2, TEST_STREAM_BLOCKS, TEST_IO_BLOCKS) || test_check_blocks(2, TEST_STREAM_BLOCKS, TEST_IO_BLOCKS))
+		return (1);
+
+	test_stop();
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : test_replica
+// Description  : Replicates the taglines to a second array, the local server
+//                of a child process. Once the replica caught up it holds
+//                every block. The second server is then restarted empty, a
+//                tagline is written again meanwhile, and the replicator has
+//                to reconnect and ship it once the server is back.
+//
+// Inputs       : none
+// Outputs      : 0 if successful, 1 if failure
+
+int test_replica(void) {
+
+	int commands[2], answers[2], status;
+	unsigned short port = raid_network_port + TEST_REPLICA_PORT;
+	pid_t pid;
+
+	if (pipe(commands) || pipe(answers))
+		return (1);
+
+	pid = fork();
+	if (pid == -1)
+		return (1);
+	//The child leaves as soon as the test does, it gets no more commands
+	if (pid == 0){
+		close(commands[1]);
+		close(answers[0]);
+		raid_network_port = port;
+		_exit(test_replica_server(commands[0], answers[1]));
+	}
+	close(commands[0]);
+	close(answers[1]);
+	testCommands = commands[1];
+	testAnswers = answers[0];
+
+	if (test_replica_ask('s', 0, 0) || tagline_set_replica("127.0.0.1", port)
+			|| test_start(raid_network_port, 4) || test_fill())
+		return (1);
+
+	if (test_replica_wait() || test_replica_ask('v', 0, TEST_TAGLINES)){
+		printf("replica: the second array does not have the taglines\n");
+		return (1);
+	}
+
+	//The writes while it is down wait in the log
+	if (test_replica_ask('k', 0, 0))
+		return (1);
+	testGeneration[0] = 0x5a;
+	if (test_fill_blocks(0, 0, TEST_BLOCKS))
+		return (1);
+	usleep(TEST_REPLICA_DOWN * 1000);
+
+	if (tagline_replica_lag(NULL, NULL, NULL) == 0 || test_replica_ask('s', 0, 0)
+			|| test_replica_wait() || test_replica_ask('v', 0, 1)){
+		printf("replica: the second array did not get the writes made while it was down\n");
+		return (1);
+	}
+
+	test_stop();
+	test_replica_ask('q', 0, 0);
+	waitpid(pid, &status, 0);
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : test_start
+// Description  : Starts the server and a driver using some of its disks
+//
+// Inputs       : port - the port of the server
+//                disks - the disks of the array
+// Outputs      : 0 if successful, 1 if failure
+
+int test_start(unsigned short port, uint32_t disks) {
+
+	if (raid_local_server_start(port)){
+		printf("unable to start the server on port %u\n", port);
+		return (1);
+	}
+
+	if (tagline_set_disks(disks) || tagline_driver_init(TEST_TAGLINES)){
+		printf("unable to start the driver\n");
+		return (1);
+	}
+
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : test_stop
+// Description  : Stops the driver and the server
+//
+// Inputs       : none
+// Outputs      : none
+
+void test_stop(void) {
+
+	tagline_close();
+	raid_local_server_stop();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : test_pattern
+// Description  : The contents of a block, different for every block
+//
+// Inputs       : tag - the tagline
+//                bnum - the block
+//                buf - where the block is made
+// Outputs      : none
+
+void test_pattern(TagLineNumber tag, TagLineBlockNumber bnum, char *buf) {
+
+	int i;
+
+	for (i = 0; i < TAGLINE_BLOCK_SIZE; i++)
+		buf[i] = (char)(tag * 131 + bnum * 17 + i * 7 + i / 256) ^ testGeneration[tag];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : test_fill
+// Description  : Writes every block of every tagline
+//
+// Inputs       : none
+// Outputs      : 0 if successful, 1 if failure
+
+int test_fill(void) {
+
+	TagLineNumber tag;
+
+	for (tag = 0; tag < TEST_TAGLINES; tag++)
+		if (test_fill_blocks(tag, 0, TEST_BLOCKS))
+			return (1);
+
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : test_fill_blocks
+// Description  : Writes blocks of a tagline, a few at a time so their copies
+//                end up on different disks
+//
+// Inputs       : tag - the tagline
+//                first - the first block, a multiple of TEST_IO_BLOCKS
+//                blocks - the number of blocks, a multiple of it too
+// Outputs      : 0 if successful, 1 if failure
+
+int test_fill_blocks(TagLineNumber tag, TagLineBlockNumber first, uint32_t blocks) {
+
+	char buf[TEST_IO_BLOCKS * TAGLINE_BLOCK_SIZE];
+	TagLineBlockNumber bnum;
+	int i;
+
+	for (bnum = first; bnum < first + blocks; bnum += TEST_IO_BLOCKS){
+		for (i = 0; i < TEST_IO_BLOCKS; i++)
+			test_pattern(tag, bnum + i, &buf[i * TAGLINE_BLOCK_SIZE]);
+
+		if (tagline_write(tag, bnum, TEST_IO_BLOCKS, buf)){
+			printf("write of tagline %u block %u failed\n", tag, bnum);
+			return (1);
+		}
+	}
+
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : test_check
+// Description  : Reads every block of every tagline back and compares it,
+//                more blocks than the cache holds
+//
+// Inputs       : none
+// Outputs      : 0 if successful, 1 if failure
+
+int test_check(void) {
+
+	TagLineNumber tag;
+
+	for (tag = 0; tag < TEST_TAGLINES; tag++)
+		if (test_check_blocks(tag, 0, TEST_BLOCKS))
+			return (1);
+
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : test_check_blocks
+// Description  : Reads blocks of a tagline back and compares them
+//
+// Inputs       : tag - the tagline
+//                first - the first block, a multiple of TEST_IO_BLOCKS
+//                blocks - the number of blocks, a multiple of it too
+// Outputs      : 0 if successful, 1 if failure
+
+int test_check_blocks(TagLineNumber tag, TagLineBlockNumber first, uint32_t blocks) {
+
+	char buf[TEST_IO_BLOCKS * TAGLINE_BLOCK_SIZE], block[TAGLINE_BLOCK_SIZE];
+	TagLineBlockNumber bnum;
+	int i;
+
+	for (bnum = first; bnum < first + blocks; bnum += TEST_IO_BLOCKS){
+
+		if (tagline_read(tag, bnum, TEST_IO_BLOCKS, buf)){
+			printf("read of tagline %u block %u failed\n", tag, bnum);
+			return (1);
+		}
+
+		for (i = 0; i < TEST_IO_BLOCKS; i++){
+			test_pattern(tag, bnum + i, block);
+			if (memcmp(&buf[i * TAGLINE_BLOCK_SIZE], block, TAGLINE_BLOCK_SIZE)){
+				printf("tagline %u block %u read back wrong\n", tag, bnum + i);
+				return (1);
+			}
+		}
+	}
+
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : test_places
+// Description  : Looks at the map of every block of the taglines: both of
+//                its copies have a place, on different disks of the array,
+//                and no two copies share one
+//
+// Inputs       : name - the test, for the messages
+//                disks - the disks of the array
+// Outputs      : 0 if successful, 1 if failure
+
+int test_places(const char *name, uint32_t disks) {
+
+	uint8_t *taken;
+	struct tagline loc;
+	TagLineNumber tag;
+	TagLineBlockNumber bnum;
+	uint32_t place[2];
+	int i;
+
+	taken = (uint8_t *) calloc(disks * RAID_DISKBLOCKS, 1);
+	if (taken == NULL)
+		return (1);
+
+	for (tag = 0; tag < TEST_TAGLINES; tag++){
+		for (bnum = 0; bnum < TEST_BLOCKS; bnum++){
+
+			loc = tagline_locate(tag, bnum);
+			place[0] = loc.primary;
+			place[1] = loc.backup;
+			if (LOC_DISK(place[0]) == LOC_DISK(place[1])){
+				printf("%s: tagline %u block %u has both copies on disk %d\n", name, tag, bnum, LOC_DISK(place[0]));
+				free(taken);
+				return (1);
+			}
+
+			for (i = 0; i < 2; i++){
+				if (LOC_DISK(place[i]) < 0 || LOC_DISK(place[i]) >= (int)disks
+						|| LOC_POSITION(place[i]) >= RAID_DISKBLOCKS
+						|| taken[LOC_DISK(place[i]) * RAID_DISKBLOCKS + LOC_POSITION(place[i])]++){
+					printf("%s: tagline %u block %u has a bad or shared place\n", name, tag, bnum);
+					free(taken);
+					return (1);
+				}
+			}
+		}
+	}
+
+	free(taken);
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : test_pool_thread
+// Description  : Takes a handful of buffers, stamps every one with its
+//                thread and round, checks the stamps before giving them back
+//
+// Inputs       : arg - the number of the thread
+// Outputs      : 0 if every stamp was intact, 1 if not
+
+void * test_pool_thread(void *arg) {
+
+	uint64_t *held[TEST_POOL_HELD];
+	uint64_t stamp;
+	int round, i, count;
+
+	for (round = 0; round < TEST_POOL_ROUNDS; round++){
+
+		stamp = ((uint64_t)(long)arg << 32) | round;
+		count = 1 + (round * 7 + (long)arg) % TEST_POOL_HELD;
+		for (i = 0; i < count; i++){
+			held[i] = (uint64_t *) raid_pool_get(i % 4 ? 1 : RAID_POOL_MULTI_BLOCKS);
+			if (held[i] == NULL)
+				return ((void *)1);
+			held[i][0] = stamp;
+		}
+
+		for (i = 0; i < count; i++){
+			if (held[i][0] != stamp)
+				return ((void *)1);
+			raid_pool_put(held[i]);
+		}
+	}
+
+	return (NULL);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : test_fragments
+// Description  : Counts the extents of TEST_DEFRAG_EXTENT blocks of the
+//                taglines that are not contiguous on both copies
+//
+// Inputs       : none
+// Outputs      : the number of fragmented extents
+
+int test_fragments(void) {
+
+	struct tagline loc, last = { TAGLINE_NO_LOC, TAGLINE_NO_LOC };
+	TagLineNumber tag;
+	TagLineBlockNumber bnum;
+	int fragments = 0, fragmented = 0;
+
+	for (tag = 0; tag < TEST_TAGLINES; tag++){
+		for (bnum = 0; bnum < TEST_BLOCKS; bnum++){
+			loc = tagline_locate(tag, bnum);
+			if (bnum % TEST_DEFRAG_EXTENT == 0){
+				fragments += fragmented;
+				fragmented = 0;
+			}
+			else if (loc.primary != last.primary + 1 || loc.backup != last.backup + 1)
+				fragmented = 1;
+			last = loc;
+		}
+	}
+
+	return (fragments + fragmented);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : test_epoch_thread
+// Description  : Looks up the blocks the epoch test moves until it stops
+//
+// Inputs       : arg - unused
+// Outputs      : 0 if every lookup was right, 1 if not
+
+void * test_epoch_thread(void *arg) {
+
+	struct tagline loc, hashed, moved;
+	TagLineNumber tag;
+	TagLineBlockNumber bnum;
+	uint32_t i;
+
+	for (i = 0; !atomic_load(&testStop); i++){
+		tag = i % TEST_TAGLINES;
+		bnum = (i / TEST_TAGLINES) % TEST_EPOCH_BLOCKS;
+		loc = tagline_locate(tag, bnum);
+		hashed = computed_location(tag, bnum);
+		moved = test_moved(tag, bnum);
+		if ((loc.primary != hashed.primary || loc.backup != hashed.backup)
+				&& (loc.primary != moved.primary || loc.backup != moved.backup))
+			return ((void *)1);
+	}
+
+	return (NULL);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : test_moved
+// Description  : The place the epoch test moves a block to, past the regions
+//                of the hash and different for every block
+//
+// Inputs       : tag - the tagline
+//                bnum - the block
+// Outputs      : the place
+
+struct tagline test_moved(TagLineNumber tag, TagLineBlockNumber bnum) {
+
+	struct tagline loc;
+
+	loc.primary = MAKE_LOC(tag % RAID_DISKS, RAID_DISKBLOCKS - 1 - bnum);
+	loc.backup = MAKE_LOC((tag + 1) % RAID_DISKS, RAID_DISKBLOCKS - 1 - bnum);
+	return (loc);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : test_daemon_client
+// Description  : A client process of the daemon test. Writes its tagline a
+//                few blocks at a time, half from the shared buffer and half
+//                from a buffer of its own, then reads it back.
+//
+// Inputs       : path - the socket of the daemon
+//                tag - the tagline of the client
+// Outputs      : 0 if successful, 1 if failure
+
+int test_daemon_client(const char *path, TagLineNumber tag) {
+
+	char own[TEST_IO_BLOCKS * TAGLINE_BLOCK_SIZE], block[TAGLINE_BLOCK_SIZE];
+	TagLineBlockNumber bnum;
+	char *buf;
+	int i;
+
+	if (tagline_daemon_connect(path))
+		return (1);
+
+	for (bnum = 0; bnum < TEST_BLOCKS; bnum += TEST_IO_BLOCKS){
+		buf = (bnum / TEST_IO_BLOCKS) % 2 ? own : tagline_daemon_buffer();
+		for (i = 0; i < TEST_IO_BLOCKS; i++)
+			test_pattern(tag, bnum + i, &buf[i * TAGLINE_BLOCK_SIZE]);
+		if (tagline_daemon_write(tag, bnum, TEST_IO_BLOCKS, buf))
+			return (1);
+	}
+
+	for (bnum = 0; bnum < TEST_BLOCKS; bnum += TEST_IO_BLOCKS){
+		buf = (bnum / TEST_IO_BLOCKS) % 2 ? tagline_daemon_buffer() : own;
+		if (tagline_daemon_read(tag, bnum, TEST_IO_BLOCKS, buf))
+			return (1);
+		for (i = 0; i < TEST_IO_BLOCKS; i++){
+			test_pattern(tag, bnum + i, block);
+			if (memcmp(&buf[i * TAGLINE_BLOCK_SIZE], block, TAGLINE_BLOCK_SIZE))
+				return (1);
+		}
+	}
+
+	return (tagline_daemon_disconnect() != 0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : test_ring_run
+// Description  : Reads or writes taglines through a ring, TEST_IO_BLOCKS
+//                blocks an entry and TEST_RING_BATCH entries a submit. Every
+//                batch has to complete in order and without failure.
+//
+// Inputs       : ring - the rings
+//                opcode - TAGLINE_RING_READ or TAGLINE_RING_WRITE
+//                first - the first tagline
+//                last - the tagline after the last one
+//                buf - the blocks of all the taglines, one after the other
+//                polling - 1 if a poller runs the entries, 0 to enter the ring
+// Outputs      : 0 if successful, 1 if failure
+
+int test_ring_run(struct tagline_ring *ring, int opcode, TagLineNumber first, TagLineNumber last,
+		char *buf, int polling) {
+
+	struct tagline_sqe *sqe;
+	struct tagline_cqe *cqe;
+	uint64_t entry, done, entries;
+
+	entries = (uint64_t)(last - first) * TEST_BLOCKS / TEST_IO_BLOCKS;
+	for (entry = done = 0; done < entries; ){
+
+		//Fill a batch
+		for (; entry < entries && (sqe = tagline_ring_get_sqe(ring, entry % TEST_RING_BATCH)) != NULL; entry++){
+			sqe->opcode = opcode;
+			sqe->tag = first + entry * TEST_IO_BLOCKS / TEST_BLOCKS;
+			sqe->bnum = entry * TEST_IO_BLOCKS % TEST_BLOCKS;
+			sqe->blocks = TEST_IO_BLOCKS;
+			sqe->buf = &buf[((size_t)first * TEST_BLOCKS + entry * TEST_IO_BLOCKS) * TAGLINE_BLOCK_SIZE];
+			sqe->user_data = entry;
+			if ((entry + 1) % TEST_RING_BATCH == 0){
+				entry++;
+				break;
+			}
+		}
+		tagline_ring_submit(ring, entry - done);
+		if (!polling && tagline_ring_enter(ring) < 0)
+			return (1);
+
+		//Reap it
+		for (; done < entry; done++){
+			while ((cqe = tagline_ring_peek_cqe(ring)) == NULL)
+				sched_yield();
+			if (cqe->user_data != done || cqe->result){
+				printf("ring: entry %lu completed wrong\n", (unsigned long)done);
+				return (1);
+			}
+			tagline_ring_cqe_seen(ring);
+		}
+	}
+
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : test_replica_server
+// Description  : The child process of the replica test, runs the second
+//                array. Starts ('s') and stops ('k') its server, checks the
+//                blocks of a range of taglines on it ('v') and leaves ('q').
+//
+// Inputs       : commands - where the commands come from
+//                answers - where their results go, one byte, 0 if successful
+// Outputs      : 0 if successful, 1 if failure
+
+int test_replica_server(int commands, int answers) {
+
+	uint8_t command[4], answer;
+
+	while (read(commands, command, sizeof(command)) == sizeof(command)){
+
+		switch (command[0]){
+		case 's':
+			answer = (raid_local_server_start(raid_network_port) != 0);
+			break;
+		case 'k':
+			answer = (raid_local_server_stop() != 0);
+			break;
+		case 'v':
+			testGeneration[command[1]] = command[3];
+			answer = test_replica_verify(command[1], command[2]);
+			break;
+		default:
+			return (0);
+		}
+
+		if (write(answers, &answer, 1) != 1)
+			return (1);
+	}
+
+	return (1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : test_replica_verify
+// Description  : Reads the blocks of a range of taglines from their places on
+//                the second array, from the child process that runs it
+//
+// Inputs       : first - the first tagline
+//                last - the tagline after the last one
+// Outputs      : 0 if successful, 1 if failure
+
+int test_replica_verify(TagLineNumber first, TagLineNumber last) {
+
+	char buf[TAGLINE_BLOCK_SIZE], block[TAGLINE_BLOCK_SIZE];
+	RAIDOpCode operation, response;
+	TagLineNumber tag;
+	TagLineBlockNumber bnum;
+	uint32_t loc;
+	int failed = 0;
+
+	operation = create_raid_request(RAID_INIT, RAID_DISKBLOCKS/RAID_TRACK_BLOCKS+3, RAID_DISKS, 0);
+	response = client_raid_bus_request(operation, NULL);
+	if (extract_raid_response(response, operation, NULL))
+		return (1);
+
+	for (tag = first; tag < last && !failed; tag++){
+		for (bnum = 0; bnum < TEST_BLOCKS && !failed; bnum++){
+			loc = replica_location(tag, bnum);
+			operation = create_raid_request(RAID_READ, 1, LOC_DISK(loc), LOC_POSITION(loc));
+			response = client_raid_bus_request(operation, buf);
+			test_pattern(tag, bnum, block);
+			failed = (extract_raid_response(response, operation, NULL) || memcmp(buf, block, TAGLINE_BLOCK_SIZE));
+		}
+	}
+
+	client_raid_bus_request(create_raid_request(RAID_CLOSE, 0, 0, 0), NULL);
+	return (failed);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : test_replica_ask
+// Description  : Has the child process of the replica test run a command
+//
+// Inputs       : command - the command
+//                first - the first tagline it checks
+//                last - the tagline after the last one
+// Outputs      : 0 if successful, 1 if failure
+
+int test_replica_ask(char command, TagLineNumber first, TagLineNumber last) {
+
+	uint8_t message[4], answer;
+
+	message[0] = command;
+	message[1] = first;
+	message[2] = last;
+	message[3] = testGeneration[first];
+
+	if (write(testCommands, message, sizeof(message)) != sizeof(message))
+		return (1);
+	if (command == 'q')
+		return (0);
+
+	return (read(testAnswers, &answer, 1) != 1 || answer);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : test_replica_wait
+// Description  : Waits for the second array to have every write
+//
+// Inputs       : none
+// Outputs      : 0 if successful, 1 if it did not catch up in time
+
+int test_replica_wait(void) {
+
+	uint64_t start = test_now();
+
+	while (tagline_replica_lag(NULL, NULL, NULL) != 0){
+		if (test_now() - start > TEST_REPLICA_WAIT * 1000)
+			return (1);
+		usleep(10000);
+	}
+
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : test_wait_health
+// Description  : Waits for the monitor to report a health for a disk
+//
+// Inputs       : disk - the disk
+//                health - the TAGLINE_DISK_* health waited for
+// Outputs      : 0 if it was reported, 1 if not in time
+
+int test_wait_health(uint8_t disk, int health) {
+
+	int waited;
+
+	for (waited = 0; waited < TEST_MONITOR_WAIT; waited += 10){
+		if (tagline_disk_health(disk) == health)
+			return (0);
+		usleep(10000);
+	}
+
+	return (1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : test_now
+// Description  : The monotonic clock in microseconds
+//
+// Inputs       : none
+// Outputs      : the time
+
+uint64_t test_now(void) {
+
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return ((uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000);
+}
@@ -0,0 +1,259 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : tagline_workers.c
+//  Description    : These are the disk workers of the TAGLINE driver, threads
+//                   that each serve some of the disks on a connection of
+//                   their own so the disks of a batch are busy at once.
+//
+//  Author         : agent
+//  Last Modified  : 10/18/2026
+//
+
+// Includes
+
+// Project includes
+#include <cmpsc311_log.h>
+#include "tagline_internal.h"
+
+
+//Definitions
+
+//Disk workers (tagline_set_workers): disk d is served by worker
+//d % TAGLINE_WORKERS, a thread with a connection (channel) and a queue of its
+//own. Pipelined batches are split by disk and every worker sorts and pipelines
+//its part, so the disks of a batch are busy at the same time.
+#define TAGLINE_WORKER_QUEUE     64
+
+
+//Structures
+
+//A batch handed to the workers, done when every operation is
+struct workerbatch
+{
+	int remaining;
+	int failed;
+};
+
+struct workerjob
+{
+	RAIDOpCode operation;
+	void *buf;
+	struct workerbatch *batch;
+};
+
+struct diskworker
+{
+	struct workerjob queue[TAGLINE_WORKER_QUEUE];
+	uint32_t head, tail;
+	pthread_t thread;
+	pthread_cond_t work;
+};
+
+
+//Global Variables
+
+struct diskworker workers[TAGLINE_WORKERS];
+
+int workersEnabled = 0;
+int workersRunning = 0;
+pthread_mutex_t workerLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t workerProgress = PTHREAD_COND_INITIALIZER;
+
+
+//Functions Prototypes
+void *disk_worker(void *);
+
+
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_set_workers
+// Description  : gives every disk (or group of disks) a worker thread with its
+//				  own connection. Reads and pipelined writes are then split by
+//				  disk and run by the workers in parallel. Has to be called
+//				  before tagline_driver_init.
+//
+// Inputs       : enable - 1 to use the workers, 0 to do all I/O in the caller
+// Outputs      : 0 if successful, 1 if failure
+
+int tagline_set_workers(int enable){
+
+	if ((enable != 0 && enable != 1) || workersRunning)
+		return (1);
+
+	workersEnabled = enable;
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : workers_start
+// Description  : starts the disk workers
+//
+// Inputs       : none
+// Outputs      : 0 if successful, 1 if failure
+
+int workers_start(void){
+
+	int i;
+
+	pthread_mutex_lock(&workerLock);
+	workersRunning = 1;
+
+	for (i = 0; i < TAGLINE_WORKERS; i++){
+		workers[i].head = workers[i].tail = 0;
+		pthread_cond_init(&workers[i].work, NULL);
+		if (pthread_create(&workers[i].thread, NULL, disk_worker, (void *)(intptr_t)i)){
+			logMessage(LOG_ERROR_LEVEL, "TAGLINE: unable to start disk worker %d", i);
+			pthread_cond_destroy(&workers[i].work);
+			pthread_mutex_unlock(&workerLock);
+
+			//Stop the ones already running
+			while (i-- > 0){
+				pthread_mutex_lock(&workerLock);
+				workersRunning = 0;
+				pthread_cond_signal(&workers[i].work);
+				pthread_mutex_unlock(&workerLock);
+				pthread_join(workers[i].thread, NULL);
+				pthread_cond_destroy(&workers[i].work);
+			}
+			return (1);
+		}
+	}
+
+	pthread_mutex_unlock(&workerLock);
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : workers_stop
+// Description  : stops the disk workers, nothing is queued at this point since
+//				  every batch is waited for
+//
+// Inputs       : none
+// Outputs      : none
+
+void workers_stop(void){
+
+	int i;
+
+	if (!workersRunning)
+		return;
+
+	pthread_mutex_lock(&workerLock);
+	workersRunning = 0;
+	for (i = 0; i < TAGLINE_WORKERS; i++)
+		pthread_cond_signal(&workers[i].work);
+	pthread_mutex_unlock(&workerLock);
+
+	for (i = 0; i < TAGLINE_WORKERS; i++){
+		pthread_join(workers[i].thread, NULL);
+		pthread_cond_destroy(&workers[i].work);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : workers_flush
+// Description  : splits a batch of RAID operations by disk, queues each part
+//				  to its worker and waits until all of them are done
+//
+// Inputs       : count - the number of operations
+//				  ops - the operations
+//				  bufs - the blocks of each operation
+// Outputs      : 0 if successful, 1 if failure
+
+int workers_flush(int count, RAIDOpCode *ops, void **bufs){
+
+	struct workerbatch batch = { count, 0 };
+	struct diskworker *worker;
+	int i;
+
+	pthread_mutex_lock(&workerLock);
+
+	for (i = 0; i < count; i++){
+		worker = &workers[((ops[i] >> 40) & 0xFF) % TAGLINE_WORKERS];
+
+		while (worker->tail - worker->head == TAGLINE_WORKER_QUEUE)
+			pthread_cond_wait(&workerProgress, &workerLock);
+
+		worker->queue[worker->tail % TAGLINE_WORKER_QUEUE].operation = ops[i];
+		worker->queue[worker->tail % TAGLINE_WORKER_QUEUE].buf = bufs[i];
+		worker->queue[worker->tail % TAGLINE_WORKER_QUEUE].batch = &batch;
+		worker->tail++;
+		pthread_cond_signal(&worker->work);
+	}
+
+	while (batch.remaining > 0)
+		pthread_cond_wait(&workerProgress, &workerLock);
+
+	pthread_mutex_unlock(&workerLock);
+
+	return (batch.failed ? 1 : 0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : disk_worker
+// Description  : disk worker thread, takes everything queued for its disks,
+//				  sorts it by disk and block and sends it pipelined on its own
+//				  connection
+//
+// Inputs       : arg - the number of the worker
+// Outputs      : NULL
+
+void *disk_worker(void *arg){
+
+	struct diskworker *worker = &workers[(intptr_t)arg];
+	struct workerjob jobs[TAGLINE_PIPELINE_BATCH], job;
+	RAIDOpCode ops[TAGLINE_PIPELINE_BATCH], responses[TAGLINE_PIPELINE_BATCH];
+	void *bufs[TAGLINE_PIPELINE_BATCH];
+	int channel = TAGLINE_WORKER_CHANNEL + (intptr_t)arg;
+	int i, j, count, failed;
+
+	pthread_mutex_lock(&workerLock);
+
+	while (1){
+
+		while (workersRunning && worker->tail == worker->head)
+			pthread_cond_wait(&worker->work, &workerLock);
+
+		if (worker->tail == worker->head)
+			break;
+
+		for (count = 0; count < TAGLINE_PIPELINE_BATCH && worker->head != worker->tail; count++)
+			jobs[count] = worker->queue[worker->head++ % TAGLINE_WORKER_QUEUE];
+		pthread_cond_broadcast(&workerProgress);
+		pthread_mutex_unlock(&workerLock);
+
+		//Disk and block are the upper bits and the id of the opcode, an
+		//insertion sort keeps operations on the same block in order
+		for (i = 1; i < count; i++){
+			job = jobs[i];
+			for (j = i; j > 0 && ((jobs[j-1].operation >> 40) & 0xFF) * 0x100000000ull + (uint32_t)jobs[j-1].operation
+					> ((job.operation >> 40) & 0xFF) * 0x100000000ull + (uint32_t)job.operation; j--)
+				jobs[j] = jobs[j-1];
+			jobs[j] = job;
+		}
+
+		for (i = 0; i < count; i++){
+			ops[i] = jobs[i].operation;
+			bufs[i] = jobs[i].buf;
+		}
+
+		failed = client_raid_bus_pipeline(channel, count, ops, bufs, responses) != 0;
+
+		pthread_mutex_lock(&workerLock);
+		for (i = 0; i < count; i++){
+			if (failed || ((responses[i] << 31) >> 63))
+				jobs[i].batch->failed = 1;
+			jobs[i].batch->remaining--;
+		}
+		pthread_cond_broadcast(&workerProgress);
+	}
+
+	pthread_mutex_unlock(&workerLock);
+	return (NULL);
+}